@@ -5,7 +5,6 @@ Summary: OBS Studio plugin as video filters to track face for mainly a speaking
 License: GPLv3+
 
 Source0: %{name}-%{version}.tar.bz2
-Source1: %{name}-%{version}-libvisca.tar.bz2
 Source2: %{name}-%{version}-dlib-models.tar.bz2
 Requires: obs-studio >= @OBS_VERSION@
 BuildRequires: cmake, gcc, gcc-c++
@@ -44,7 +43,6 @@ The model file came from https://github.com/davisking/dlib-models/.
 
 %prep
 %autosetup -p1
-%setup -T -D -a 1
 %setup -T -D -a 2
 
 %build
@@ -4,6 +4,7 @@
 #include <util/bmem.h>
 #include "plugin-macros.generated.h"
 #include "face-detector-base.h"
+#include "face-tracker-base.h"
 #ifndef _WIN32
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -17,6 +18,8 @@ face_detector_base::face_detector_base()
 	pthread_cond_init(&cond, NULL);
 	request_stop = 0;
 	running = 0;
+	tracker = NULL;
+	tracker_primed = false;
 	leak_test = bmalloc(1);
 }
 
@@ -46,12 +49,38 @@ void *face_detector_base::thread_routine(void *p)
 		} catch (...) {
 			blog(LOG_ERROR, "detect_main: unknown exception");
 		}
+		base->prime_tracker();
 		pthread_cond_wait(&base->cond, &base->mutex);
 	}
 	base->unlock();
 	return NULL;
 }
 
+void face_detector_base::set_tracker(class face_tracker_base *tracker_, std::shared_ptr<class texture_object> &tex,
+				     const rectf_s &upsize)
+{
+	tracker = tracker_;
+	tracker_tex = tex;
+	tracker_upsize = upsize;
+	tracker_primed = false;
+}
+
+void face_detector_base::prime_tracker()
+{
+	if (!tracker)
+		return;
+
+	std::vector<rect_s> rects;
+	get_faces(rects);
+	if (rects.size() > 0) {
+		rect_s r = upsize_rect(rects[0], tracker_upsize);
+		tracker_primed = tracker->prime(tracker_tex, r, tracker_upsize);
+	}
+
+	tracker = NULL;
+	tracker_tex.reset();
+}
+
 void face_detector_base::start()
 {
 	blog(LOG_INFO, "face_detector_base: starting the thread.");
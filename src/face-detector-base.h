@@ -14,8 +14,15 @@ class face_detector_base {
 	volatile bool request_stop;
 	void *leak_test;
 
+	// tracker to be started on the detector thread as soon as faces are found
+	class face_tracker_base *tracker;
+	std::shared_ptr<class texture_object> tracker_tex;
+	rectf_s tracker_upsize;
+	bool tracker_primed;
+
 	static void *thread_routine(void *);
 	virtual void detect_main() = 0;
+	void prime_tracker();
 
 public:
 	face_detector_base();
@@ -30,6 +37,10 @@ public:
 				 int crop_b) = 0;
 	virtual void get_faces(std::vector<struct rect_s> &) = 0;
 
+	void set_tracker(class face_tracker_base *tracker, std::shared_ptr<class texture_object> &tex,
+			 const rectf_s &upsize);
+	bool is_tracker_primed() const { return tracker_primed; }
+
 	void start();
 	void stop();
 };
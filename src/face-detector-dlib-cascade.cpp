@@ -0,0 +1,429 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <string>
+#include <algorithm>
+#include "plugin-macros.generated.h"
+#include "face-detector-dlib-cascade.h"
+#include "face-detector-dlib-mmod.h"
+#include "texture-object.h"
+
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/image_transforms.h>
+
+#define MAX_ERROR 2
+
+#define PROPOSAL_TH -0.5     // adjust_threshold of the HOG detector, negative to propose weaker candidates too
+#define PROPOSAL_MAX 16
+#define PROPOSAL_NMS_TH 0.5f // overlap relative to the smaller one to merge two candidates
+#define VERIFY_ENLARGE 2.0f  // size of the region to verify relative to the candidate
+#define VERIFY_SIZE 160      // the regions are resized to the same size to be batched
+#define VERIFY_SIZE_MIN 20   // a smaller region has too few pixels for the CNN
+#define VERIFY_BATCH 8
+#define VERIFY_NMS_TH 0.5f
+#define REPORT_INTERVAL 100  // detections between the reports to the log
+
+typedef dlib::matrix<dlib::rgb_pixel> image_t;
+
+// region cropped for the CNN detector
+struct crop_s
+{
+	float x0, y0; // top-left in the source pixels
+	float k;      // source pixels for one pixel of the crop
+};
+
+struct cascade_stats_s
+{
+	int n_detect = 0;
+	int n_proposal = 0; // proposed by the HOG detector
+	int n_hog = 0;      // proposals over the default threshold, which the HOG engine would return
+	int n_hint = 0;
+	int n_verify = 0;   // regions sent to the CNN detector
+	int n_face = 0;
+	uint64_t hog_ns = 0, cnn_ns = 0;
+
+	// comparison with the CNN detector on the whole frame
+	int n_audit = 0;
+	int n_ref = 0;         // faces found by the CNN detector on the whole frame
+	int n_ref_hog = 0;     // of `n_ref`, found by the HOG detector with the default threshold
+	int n_ref_cascade = 0; // of `n_ref`, found by the cascade
+	uint64_t ref_ns = 0;
+};
+
+struct face_detector_dlib_cascade_private_s
+{
+	std::shared_ptr<texture_object> tex;
+	std::shared_ptr<texture_object> tex_verify;
+	std::vector<rect_s> hints;
+	std::vector<rect_s> rects;
+	dlib::frontal_face_detector hog;
+	dlib_mmod::net_type net;
+	std::string hog_filename, cnn_filename;
+	bool hog_loaded = false, cnn_loaded = false;
+	bool hog_error = false, cnn_error = false;
+	int crop_l = 0, crop_r = 0, crop_t = 0, crop_b = 0;
+	int n_error = 0;
+	int audit_interval = 0; // detections between the CNN runs on the whole frame, 0 to disable
+
+	// work buffers, the rectangles are in the source pixels
+	rect_s region; // searched by the HOG detector
+	std::vector<rect_s> proposals;
+	std::vector<rect_s> candidates;
+	std::vector<const texture_object *> verify_texs;
+	std::vector<image_t> verify_imgs; // RGB image of each of `verify_texs`
+	std::vector<image_t> crops;
+	std::vector<crop_s> crop_info;
+	std::vector<rect_s> found;
+
+	cascade_stats_s stats;
+};
+
+face_detector_dlib_cascade::face_detector_dlib_cascade()
+{
+	p = new face_detector_dlib_cascade_private_s;
+}
+
+face_detector_dlib_cascade::~face_detector_dlib_cascade()
+{
+	delete p;
+}
+
+void face_detector_dlib_cascade::set_texture(std::shared_ptr<texture_object> &tex, int crop_l, int crop_r,
+					     int crop_t, int crop_b)
+{
+	p->tex = tex;
+	p->crop_l = crop_l;
+	p->crop_r = crop_r;
+	p->crop_t = crop_t;
+	p->crop_b = crop_b;
+}
+
+template<typename T> static void load_model(const std::string &filename, T &model, bool &loaded, bool &has_error)
+{
+	if (loaded)
+		return;
+	loaded = true;
+	try {
+		blog(LOG_INFO, "loading file '%s'", filename.c_str());
+		dlib::deserialize(filename.c_str()) >> model;
+		has_error = false;
+	} catch (...) {
+		blog(LOG_ERROR, "failed to load file '%s'", filename.c_str());
+		has_error = true;
+	}
+}
+
+static inline bool overlaps(const rect_s &a, const rect_s &b, float th)
+{
+	const int area = std::min(get_width(a) * get_height(a), get_width(b) * get_height(b));
+	return common_area(a, b) > area * th;
+}
+
+// Greedy non-maximum suppression keeping the order of `rects`.
+static void suppress(std::vector<rect_s> &rects, float th, size_t n_max)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < rects.size() && n < n_max; i++) {
+		bool merged = false;
+		for (size_t j = 0; j < n && !merged; j++)
+			merged = overlaps(rects[i], rects[j], th);
+		if (!merged)
+			rects[n++] = rects[i];
+	}
+	rects.resize(n);
+}
+
+// Runs the HOG detector with the low threshold and returns the proposals in `p->proposals`.
+template<typename pixel_type>
+static bool propose(face_detector_dlib_cascade_private_s *p, dlib::matrix<pixel_type> &img)
+{
+	const float scale = p->tex->scale;
+	int x0 = 0, y0 = 0;
+	p->region = rect_s{0, 0, (int)(img.nc() * scale), (int)(img.nr() * scale), 0.0f};
+	if (p->crop_l > 0 || p->crop_r > 0 || p->crop_t > 0 || p->crop_b > 0) {
+		dlib::matrix<pixel_type> img_crop;
+		x0 = (int)(p->crop_l / scale);
+		int x1 = img.nc() - (int)(p->crop_r / scale);
+		y0 = (int)(p->crop_t / scale);
+		int y1 = img.nr() - (int)(p->crop_b / scale);
+		if (x1 - x0 < 80 || y1 - y0 < 80) {
+			if (p->n_error++ < MAX_ERROR)
+				blog(LOG_ERROR, "too small image: %dx%d cropped left=%d right=%d top=%d bottom=%d",
+				     (int)img.nc(), (int)img.nr(), p->crop_l, p->crop_r, p->crop_t, p->crop_b);
+			return false;
+		} else if (p->n_error) {
+			p->n_error--;
+		}
+		img_crop.set_size(y1 - y0, x1 - x0);
+		for (int y = y0; y < y1; y++) {
+			for (int x = x0; x < x1; x++) {
+				img_crop(y - y0, x - x0) = img(y, x);
+			}
+		}
+		img = img_crop;
+		p->region = rect_s{(int)(x0 * scale), (int)(y0 * scale), (int)(x1 * scale), (int)(y1 * scale), 0.0f};
+	}
+	if (img.nc() < 80 || img.nr() < 80) {
+		if (p->n_error++ < MAX_ERROR)
+			blog(LOG_ERROR, "too small image: %dx%d", (int)img.nc(), (int)img.nr());
+		return false;
+	} else if (p->n_error) {
+		p->n_error--;
+	}
+
+	std::vector<dlib::rect_detection> dets;
+	p->hog(img, dets, PROPOSAL_TH);
+	std::sort(dets.begin(), dets.end(), [](const dlib::rect_detection &a, const dlib::rect_detection &b) {
+		return a.detection_confidence > b.detection_confidence;
+	});
+	p->proposals.resize(dets.size());
+	for (size_t i = 0; i < dets.size(); i++) {
+		const dlib::rectangle &d = dets[i].rect;
+		rect_s &r = p->proposals[i];
+		r.x0 = (int)((d.left() + x0) * scale);
+		r.y0 = (int)((d.top() + y0) * scale);
+		r.x1 = (int)((d.right() + x0) * scale);
+		r.y1 = (int)((d.bottom() + y0) * scale);
+		r.score = (float)dets[i].detection_confidence;
+	}
+	return true;
+}
+
+static const image_t *verify_image(face_detector_dlib_cascade_private_s *p, const texture_object &tex)
+{
+	for (size_t i = 0; i < p->verify_texs.size(); i++) {
+		if (p->verify_texs[i] == &tex)
+			return &p->verify_imgs[i];
+	}
+	const size_t i = p->verify_texs.size();
+	if (p->verify_imgs.size() <= i)
+		p->verify_imgs.resize(i + 1);
+	if (!tex.get_dlib_rgb_image(p->verify_imgs[i]))
+		return nullptr;
+	p->verify_texs.push_back(&tex);
+	return &p->verify_imgs[i];
+}
+
+/* Crops the square region enlarged around each candidate from the finest level covering it.
+ * The crops are resized to the same size so that the CNN detector processes them in batches.
+ */
+static void crop_candidates(face_detector_dlib_cascade_private_s *p)
+{
+	const texture_object &base = p->tex_verify ? *p->tex_verify : *p->tex;
+	p->verify_texs.clear();
+	p->crop_info.clear();
+	size_t n = 0;
+	for (const rect_s &c : p->candidates) {
+		const float s = std::max(get_width(c), get_height(c)) * VERIFY_ENLARGE * 0.5f;
+		const float cx = (c.x0 + c.x1) * 0.5f, cy = (c.y0 + c.y1) * 0.5f;
+		const float k = 1.0f / base.scale;
+		dlib::rectangle r((long)((cx - s - base.origin.x) * k), (long)((cy - s - base.origin.y) * k),
+				  (long)((cx + s - base.origin.x) * k), (long)((cy + s - base.origin.y) * k));
+		const texture_object &tex = base.finest(r);
+		const image_t *img = verify_image(p, tex);
+		if (!img)
+			continue;
+
+		// Keep the region square and inside the image.
+		const long size = std::min({(long)r.width(), (long)img->nc(), (long)img->nr()});
+		if (size < VERIFY_SIZE_MIN)
+			continue;
+		const long left = std::clamp(r.left() + ((long)r.width() - size) / 2, 0L, (long)img->nc() - size);
+		const long top = std::clamp(r.top() + ((long)r.height() - size) / 2, 0L, (long)img->nr() - size);
+
+		if (p->crops.size() <= n)
+			p->crops.resize(n + 1);
+		p->crops[n].set_size(VERIFY_SIZE, VERIFY_SIZE);
+		dlib::resize_image(dlib::sub_image(*img, dlib::rectangle(left, top, left + size - 1, top + size - 1)),
+				   p->crops[n]);
+		p->crop_info.push_back(crop_s{left * tex.scale + tex.origin.x, top * tex.scale + tex.origin.y,
+					      size * tex.scale / VERIFY_SIZE});
+		n++;
+	}
+	p->crops.resize(n);
+}
+
+static void verify(face_detector_dlib_cascade_private_s *p)
+{
+	p->found.clear();
+	if (p->crops.empty())
+		return;
+
+	std::vector<std::vector<dlib::mmod_rect>> dets = p->net(p->crops, VERIFY_BATCH);
+	for (size_t i = 0; i < dets.size() && i < p->crop_info.size(); i++) {
+		const crop_s &c = p->crop_info[i];
+		for (const dlib::mmod_rect &d : dets[i]) {
+			rect_s r;
+			r.x0 = (int)(c.x0 + d.rect.left() * c.k);
+			r.y0 = (int)(c.y0 + d.rect.top() * c.k);
+			r.x1 = (int)(c.x0 + d.rect.right() * c.k);
+			r.y1 = (int)(c.y0 + d.rect.bottom() * c.k);
+			r.score = (float)d.detection_confidence;
+			p->found.push_back(r);
+		}
+	}
+
+	// A face is found more than once if the regions overlap.
+	std::sort(p->found.begin(), p->found.end(), [](const rect_s &a, const rect_s &b) { return a.score > b.score; });
+	suppress(p->found, VERIFY_NMS_TH, p->found.size());
+}
+
+static int count_matched(const std::vector<rect_s> &ref, const std::vector<rect_s> &rects, float score_th)
+{
+	int n = 0;
+	for (const rect_s &a : ref) {
+		for (const rect_s &b : rects) {
+			if (b.score >= score_th && overlaps(a, b, VERIFY_NMS_TH)) {
+				n++;
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+// Runs the CNN detector on the whole frame as the CNN engine does and counts the faces each engine would find.
+static void audit(face_detector_dlib_cascade_private_s *p)
+{
+	const texture_object &tex = *p->tex;
+	image_t img;
+	if (!tex.get_dlib_rgb_image(img))
+		return;
+
+	const uint64_t ns = os_gettime_ns();
+	auto dets = p->net(img);
+	p->stats.ref_ns += os_gettime_ns() - ns;
+
+	std::vector<rect_s> ref;
+	for (const dlib::mmod_rect &d : dets) {
+		rect_s r;
+		r.x0 = (int)(d.rect.left() * tex.scale);
+		r.y0 = (int)(d.rect.top() * tex.scale);
+		r.x1 = (int)(d.rect.right() * tex.scale);
+		r.y1 = (int)(d.rect.bottom() * tex.scale);
+		r.score = (float)d.detection_confidence;
+		if (common_area(r, p->region) * 2 > get_width(r) * get_height(r))
+			ref.push_back(r);
+	}
+
+	p->stats.n_audit++;
+	p->stats.n_ref += (int)ref.size();
+	p->stats.n_ref_hog += count_matched(ref, p->proposals, 0.0f);
+	p->stats.n_ref_cascade += count_matched(ref, p->found, 0.0f);
+}
+
+static void report(face_detector_dlib_cascade_private_s *p)
+{
+	cascade_stats_s &s = p->stats;
+	if (s.n_detect < REPORT_INTERVAL)
+		return;
+
+	const float k = 1.0f / s.n_detect;
+	blog(LOG_DEBUG,
+	     "face_detector_dlib_cascade: %d detections, %.1f proposals (%.1f over the default threshold), "
+	     "%.1f hints, %.1f regions verified, %.1f faces, HOG %.1f ms, CNN %.1f ms per detection",
+	     s.n_detect, s.n_proposal * k, s.n_hog * k, s.n_hint * k, s.n_verify * k, s.n_face * k, s.hog_ns * 1e-6 * k,
+	     s.cnn_ns * 1e-6 * k);
+	if (s.n_audit > 0 && s.n_ref > 0) {
+		blog(LOG_DEBUG,
+		     "face_detector_dlib_cascade: recall relative to CNN on the whole frame: "
+		     "cascade %.0f%%, HOG %.0f%%, %d faces in %d frames, CNN on the whole frame %.1f ms",
+		     s.n_ref_cascade * 100.0f / s.n_ref, s.n_ref_hog * 100.0f / s.n_ref, s.n_ref, s.n_audit,
+		     s.ref_ns * 1e-6 / s.n_audit);
+	}
+	s = cascade_stats_s();
+}
+
+void face_detector_dlib_cascade::detect_main()
+{
+	if (!p->tex)
+		return;
+
+	load_model(p->hog_filename, p->hog, p->hog_loaded, p->hog_error);
+	load_model(p->cnn_filename, p->net, p->cnn_loaded, p->cnn_error);
+	if (p->hog_error || p->cnn_error) {
+		p->tex.reset();
+		p->tex_verify.reset();
+		return;
+	}
+
+	uint64_t ns = os_gettime_ns();
+	dlib::matrix<dlib::rgb_pixel> rgb;
+	dlib::matrix<unsigned char> gray;
+	bool proposed = false;
+	with_dlib_image(*p->tex, rgb, gray, [&](auto &img) { proposed = propose(p, img); });
+	if (!proposed) {
+		p->tex.reset();
+		p->tex_verify.reset();
+		return;
+	}
+	const uint64_t hog_ns = os_gettime_ns() - ns;
+
+	// The hints come first so that they are verified even if there are many proposals.
+	p->candidates.clear();
+	int n_hint = 0;
+	for (const rect_s &h : p->hints) {
+		const int cx = (h.x0 + h.x1) / 2, cy = (h.y0 + h.y1) / 2;
+		if (p->region.x0 <= cx && cx < p->region.x1 && p->region.y0 <= cy && cy < p->region.y1) {
+			p->candidates.push_back(h);
+			n_hint++;
+		}
+	}
+	p->candidates.insert(p->candidates.end(), p->proposals.begin(), p->proposals.end());
+	suppress(p->candidates, PROPOSAL_NMS_TH, PROPOSAL_MAX);
+
+	ns = os_gettime_ns();
+	crop_candidates(p);
+	verify(p);
+	const uint64_t cnn_ns = os_gettime_ns() - ns;
+	p->rects = p->found;
+
+	cascade_stats_s &s = p->stats;
+	s.n_detect++;
+	s.n_proposal += (int)p->proposals.size();
+	s.n_hog += (int)std::count_if(p->proposals.begin(), p->proposals.end(),
+				      [](const rect_s &r) { return r.score >= 0.0f; });
+	s.n_hint += n_hint;
+	s.n_verify += (int)p->crops.size();
+	s.n_face += (int)p->rects.size();
+	s.hog_ns += hog_ns;
+	s.cnn_ns += cnn_ns;
+	if (p->audit_interval > 0 && s.n_detect % p->audit_interval == 0)
+		audit(p);
+	report(p);
+
+	p->tex.reset();
+	p->tex_verify.reset();
+}
+
+void face_detector_dlib_cascade::get_faces(std::vector<struct rect_s> &rects)
+{
+	rects = p->rects;
+}
+
+void face_detector_dlib_cascade::set_model(const char *hog_filename, const char *cnn_filename)
+{
+	if (p->hog_filename != hog_filename) {
+		p->hog_filename = hog_filename;
+		p->hog_loaded = false;
+	}
+	if (p->cnn_filename != cnn_filename) {
+		p->cnn_filename = cnn_filename;
+		p->cnn_loaded = false;
+	}
+}
+
+void face_detector_dlib_cascade::set_audit_interval(int interval)
+{
+	p->audit_interval = interval;
+}
+
+void face_detector_dlib_cascade::set_texture_verify(const std::shared_ptr<texture_object> &tex)
+{
+	p->tex_verify = tex;
+}
+
+void face_detector_dlib_cascade::set_hints(const std::vector<struct rect_s> &hints)
+{
+	p->hints = hints;
+}
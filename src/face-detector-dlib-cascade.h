@@ -0,0 +1,36 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "plugin-macros.generated.h"
+#include "face-detector-base.h"
+
+/* HOG detector with a low threshold proposes the candidates, and the CNN detector verifies only the regions around
+ * them. The regions given by `set_hints`, usually where the trackers expect the faces, are also verified.
+ */
+class face_detector_dlib_cascade : public face_detector_base {
+	struct face_detector_dlib_cascade_private_s *p;
+
+	void detect_main() override;
+
+public:
+	face_detector_dlib_cascade();
+	virtual ~face_detector_dlib_cascade();
+	void set_texture(std::shared_ptr<texture_object> &, int crop_l, int crop_r, int crop_t, int crop_b) override;
+	void get_faces(std::vector<struct rect_s> &) override;
+
+	void set_model(const char *hog_filename, const char *cnn_filename);
+
+	/* Runs the CNN detector also on the whole frame every `interval` detections and reports the recall of the
+	 * cascade and the HOG detector relative to it. 0 disables.
+	 */
+	void set_audit_interval(int interval);
+
+	/* Sets the frame to crop the regions for the CNN detector.
+	 * The regions are cropped from the finest level of the pyramid covering each of them.
+	 * Null verifies on the texture given by `set_texture`.
+	 */
+	void set_texture_verify(const std::shared_ptr<texture_object> &);
+
+	// Sets the regions to be verified in addition to the proposals, in the source pixels.
+	void set_hints(const std::vector<struct rect_s> &);
+};
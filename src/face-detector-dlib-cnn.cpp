@@ -6,7 +6,7 @@
 #include "face-detector-dlib-cnn.h"
 #include "texture-object.h"
 
-#include <dlib/dnn.h>
+#include "face-detector-dlib-mmod.h"
 #include <dlib/data_io.h>
 #include <dlib/image_processing.h>
 #include <dlib/array2d/array2d_kernel.h>
@@ -14,13 +14,7 @@
 #define MAX_ERROR 2
 
 using namespace dlib;
-template<long num_filters, typename SUBNET> using con5d = con<num_filters, 5, 5, 2, 2, SUBNET>;
-template<long num_filters, typename SUBNET> using con5 = con<num_filters, 5, 5, 1, 1, SUBNET>;
-template<typename SUBNET>
-using downsampler = relu<affine<con5d<32, relu<affine<con5d<32, relu<affine<con5d<16, SUBNET>>>>>>>>>;
-template<typename SUBNET> using rcon5 = relu<affine<con5<45, SUBNET>>>;
-using net_type =
-	loss_mmod<con<1, 9, 9, 1, 1, rcon5<rcon5<rcon5<downsampler<input_rgb_image_pyramid<pyramid_down<6>>>>>>>>;
+using dlib_mmod::net_type;
 typedef dlib::matrix<dlib::rgb_pixel> image_t;
 
 struct private_s
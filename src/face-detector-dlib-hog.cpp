@@ -4,14 +4,85 @@
 #include "plugin-macros.generated.h"
 #include "face-detector-dlib-hog.h"
 #include "texture-object.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <sys/resource.h>
+#else // _WIN32
+#include <windows.h>
+#endif // _WIN32
 
 #include <dlib/image_processing/frontal_face_detector.h>
 
 #define MAX_ERROR 2
 
+// tiled detection
+#define TILE_FACE_MIN 80     // the detector does not find smaller faces
+#define TILE_OVERLAP 1.25f   // relative to the smallest face found without the tiles
+#define TILE_SIZE_MIN 320
+#define TILE_FLAT_TH 8       // standard deviation of the luma, a flatter tile cannot contain a face
+#define TILE_WORKERS_MAX 4
+#define TILE_NMS_TH 0.5f     // overlap relative to the smaller one to merge two detections
+
+struct tile_s
+{
+	int x0, y0, x1, y1;
+};
+
+/* Threads to run the detector on the tiles in parallel with the detector thread.
+ * Each thread has its own copy of the detector since the detector has work buffers inside.
+ */
+struct tile_pool_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_job;
+	pthread_cond_t cond_done;
+	std::vector<pthread_t> threads;
+	bool stopping = false;
+	int generation = 0;       // incremented for each job
+	int generation_start = 0; // `generation` when the threads were created
+	int n_started = 0;
+	int n_active = 0;
+
+	// job, protected by `mutex`
+	std::vector<dlib::frontal_face_detector> detectors; // one for each thread and the last one for the caller
+	const dlib::matrix<unsigned char> *img = nullptr;
+	const std::vector<tile_s> *tiles = nullptr;
+	size_t next_tile = 0;
+	std::vector<dlib::rect_detection> results; // in the pixels of `img`
+
+	tile_pool_s()
+	{
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond_job, NULL);
+		pthread_cond_init(&cond_done, NULL);
+	}
+
+	~tile_pool_s()
+	{
+		pthread_mutex_lock(&mutex);
+		stopping = true;
+		pthread_cond_broadcast(&cond_job);
+		pthread_mutex_unlock(&mutex);
+		for (pthread_t &t : threads)
+			pthread_join(t, NULL);
+		pthread_cond_destroy(&cond_done);
+		pthread_cond_destroy(&cond_job);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	void start(int n, const dlib::frontal_face_detector &detector);
+	void run(const dlib::matrix<unsigned char> &img, const std::vector<tile_s> &tiles);
+
+private:
+	static void *thread_routine(void *);
+	void work(dlib::frontal_face_detector &detector);
+};
+
 struct face_detector_dlib_private_s
 {
 	std::shared_ptr<texture_object> tex;
+	std::shared_ptr<texture_object> tex_native;
 	std::vector<rect_s> rects;
 	dlib::frontal_face_detector detector;
 	bool detector_loaded = false;
@@ -19,8 +90,16 @@ struct face_detector_dlib_private_s
 	std::string model_filename;
 	int crop_l = 0, crop_r = 0, crop_t = 0, crop_b = 0;
 	int n_error = 0;
+	bool detected = false; // `rects` is updated by the latest `detect_image`
+
+	// tiled detection
+	tile_pool_s *pool = nullptr;
+	bool pool_loaded = false; // `pool` has the copies of the current `detector`
+	dlib::matrix<unsigned char> img_native;
+	std::vector<tile_s> tiles;
+
 	face_detector_dlib_private_s() {}
-	~face_detector_dlib_private_s() {}
+	~face_detector_dlib_private_s() { delete pool; }
 };
 
 face_detector_dlib_hog::face_detector_dlib_hog()
@@ -43,18 +122,11 @@ void face_detector_dlib_hog::set_texture(std::shared_ptr<texture_object> &tex, i
 	p->crop_b = crop_b;
 }
 
-void face_detector_dlib_hog::detect_main()
+template<typename pixel_type> static void detect_image(face_detector_dlib_private_s *p, dlib::matrix<pixel_type> &img)
 {
-	if (!p->tex)
-		return;
-
-	dlib::matrix<dlib::rgb_pixel> img;
-	if (!p->tex->get_dlib_rgb_image(img))
-		return;
-
 	int x0 = 0, y0 = 0;
 	if (p->crop_l > 0 || p->crop_r > 0 || p->crop_t > 0 || p->crop_b > 0) {
-		dlib::matrix<dlib::rgb_pixel> img_crop;
+		dlib::matrix<pixel_type> img_crop;
 		x0 = (int)(p->crop_l / p->tex->scale);
 		int x1 = img.nc() - (int)(p->crop_r / p->tex->scale);
 		y0 = (int)(p->crop_t / p->tex->scale);
@@ -106,9 +178,250 @@ void face_detector_dlib_hog::detect_main()
 			r.y1 = (dets[i].bottom() + y0) * p->tex->scale;
 			r.score = 1.0; // TODO: implement me
 		}
+		p->detected = true;
+	}
+}
+
+void *tile_pool_s::thread_routine(void *data)
+{
+	auto *pool = (tile_pool_s *)data;
+#ifndef _WIN32
+	setpriority(PRIO_PROCESS, 0, 19);
+#else  // _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif // _WIN32
+	os_set_thread_name("face-det-tile");
+
+	pthread_mutex_lock(&pool->mutex);
+	const int ix = pool->n_started++;
+	int generation = pool->generation_start;
+	while (!pool->stopping) {
+		if (pool->generation == generation) {
+			pthread_cond_wait(&pool->cond_job, &pool->mutex);
+			continue;
+		}
+		generation = pool->generation;
+		pool->work(pool->detectors[ix]);
+		if (--pool->n_active == 0)
+			pthread_cond_signal(&pool->cond_done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+void tile_pool_s::start(int n, const dlib::frontal_face_detector &detector)
+{
+	pthread_mutex_lock(&mutex);
+	detectors.assign(std::max(n, (int)threads.size()) + 1, detector);
+	generation_start = generation;
+	while ((int)threads.size() < n) {
+		threads.emplace_back();
+		if (pthread_create(&threads.back(), NULL, thread_routine, this)) {
+			threads.pop_back();
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+// Called with `mutex` locked. Takes the tiles one by one until all of them are taken.
+void tile_pool_s::work(dlib::frontal_face_detector &detector)
+{
+	dlib::matrix<unsigned char> tile_img;
+	std::vector<dlib::rect_detection> dets;
+	while (next_tile < tiles->size()) {
+		const tile_s t = (*tiles)[next_tile++];
+		pthread_mutex_unlock(&mutex);
+
+		tile_img.set_size(t.y1 - t.y0, t.x1 - t.x0);
+		for (int y = t.y0; y < t.y1; y++) {
+			for (int x = t.x0; x < t.x1; x++)
+				tile_img(y - t.y0, x - t.x0) = (*img)(y, x);
+		}
+		dets.clear();
+		detector(tile_img, dets);
+
+		pthread_mutex_lock(&mutex);
+		for (auto &d : dets) {
+			d.rect = dlib::rectangle(d.rect.left() + t.x0, d.rect.top() + t.y0, d.rect.right() + t.x0,
+						 d.rect.bottom() + t.y0);
+			results.push_back(d);
+		}
+	}
+}
+
+void tile_pool_s::run(const dlib::matrix<unsigned char> &img_, const std::vector<tile_s> &tiles_)
+{
+	pthread_mutex_lock(&mutex);
+	img = &img_;
+	tiles = &tiles_;
+	next_tile = 0;
+	results.clear();
+	n_active = (int)threads.size();
+	generation++;
+	pthread_cond_broadcast(&cond_job);
+
+	work(detectors.back());
+
+	while (n_active > 0)
+		pthread_cond_wait(&cond_done, &mutex);
+	img = nullptr;
+	tiles = nullptr;
+	pthread_mutex_unlock(&mutex);
+}
+
+static inline bool is_flat(const dlib::matrix<unsigned char> &img, const tile_s &t)
+{
+	// Every 4 pixels are enough to tell a flat area such as a wall.
+	int64_t sum = 0, sum2 = 0;
+	int n = 0;
+	for (int y = t.y0; y < t.y1; y += 4) {
+		for (int x = t.x0; x < t.x1; x += 4) {
+			const int v = img(y, x);
+			sum += v;
+			sum2 += v * v;
+			n++;
+		}
+	}
+	if (n == 0)
+		return true;
+	const double mean = (double)sum / n;
+	return (double)sum2 / n - mean * mean < TILE_FLAT_TH * TILE_FLAT_TH;
+}
+
+static inline void make_tiles(std::vector<tile_s> &tiles, int x0, int y0, int x1, int y1, int size, int step)
+{
+	auto starts = [size, step](int a0, int a1, std::vector<int> &v) {
+		v.clear();
+		for (int a = a0;; a += step) {
+			if (a + size >= a1) {
+				v.push_back(std::max(a1 - size, a0));
+				break;
+			}
+			v.push_back(a);
+		}
+	};
+	std::vector<int> xs, ys;
+	starts(x0, x1, xs);
+	starts(y0, y1, ys);
+	tiles.clear();
+	for (int y : ys) {
+		for (int x : xs)
+			tiles.push_back(tile_s{x, y, std::min(x + size, x1), std::min(y + size, y1)});
+	}
+}
+
+static inline int overlap_area(const dlib::rectangle &a, const dlib::rectangle &b)
+{
+	return (int)a.intersect(b).area();
+}
+
+/* Searches the faces smaller than `detect_image` can find in the tiles of the native resolution.
+ * The tiles overlap by the largest of such faces so that each face is entirely in one of the tiles.
+ * The tiles covered by a face already found and the flat tiles are skipped.
+ * The results are merged with the faces already found by non-maximum suppression across the tiles.
+ */
+static void detect_tiles(face_detector_dlib_private_s *p)
+{
+	const texture_object &tex = *p->tex_native;
+	const float coarse_scale = p->tex->scale / tex.scale; // pixels of the native texture for one detector pixel
+	if (coarse_scale <= 1.0f)
+		return;
+
+	if (!tex.get_dlib_gray_image(p->img_native))
+		return;
+	const int nc = (int)p->img_native.nc(), nr = (int)p->img_native.nr();
+
+	const int overlap = (int)(TILE_FACE_MIN * coarse_scale * TILE_OVERLAP);
+	const int size = std::max(overlap * 2, TILE_SIZE_MIN);
+	const int x0 = std::max((int)((p->crop_l - tex.origin.x) / tex.scale), 0);
+	const int y0 = std::max((int)((p->crop_t - tex.origin.y) / tex.scale), 0);
+	const int x1 = std::min(nc - (int)(p->crop_r / tex.scale), nc);
+	const int y1 = std::min(nr - (int)(p->crop_b / tex.scale), nr);
+	if (x1 - x0 < TILE_FACE_MIN || y1 - y0 < TILE_FACE_MIN)
+		return;
+	make_tiles(p->tiles, x0, y0, x1, y1, size, size - overlap);
+
+	// faces found by `detect_image` in the pixels of the native texture
+	std::vector<dlib::rectangle> found;
+	for (const rect_s &r : p->rects) {
+		found.push_back(dlib::rectangle((long)((r.x0 - tex.origin.x) / tex.scale),
+						(long)((r.y0 - tex.origin.y) / tex.scale),
+						(long)((r.x1 - tex.origin.x) / tex.scale),
+						(long)((r.y1 - tex.origin.y) / tex.scale)));
+	}
+
+	const size_t n_tiles = p->tiles.size();
+	p->tiles.erase(std::remove_if(p->tiles.begin(), p->tiles.end(),
+				      [&](const tile_s &t) {
+					      const dlib::rectangle rt(t.x0, t.y0, t.x1 - 1, t.y1 - 1);
+					      for (const auto &f : found) {
+						      if (overlap_area(rt, f) * 2 > (int)rt.area())
+							      return true;
+					      }
+					      return is_flat(p->img_native, t);
+				      }),
+		       p->tiles.end());
+	if (p->tiles.empty())
+		return;
+
+	if (!p->pool)
+		p->pool = new tile_pool_s;
+	if (!p->pool_loaded) {
+		const int n_threads = std::clamp(os_get_logical_cores() / 2 - 1, 0, TILE_WORKERS_MAX);
+		p->pool->start(n_threads, p->detector);
+		p->pool_loaded = true;
+	}
+
+	const uint64_t ns = os_gettime_ns();
+	p->pool->run(p->img_native, p->tiles);
+
+	auto &dets = p->pool->results;
+	std::sort(dets.begin(), dets.end(), [](const dlib::rect_detection &a, const dlib::rect_detection &b) {
+		return a.detection_confidence > b.detection_confidence;
+	});
+	const size_t n_found = found.size();
+	for (const auto &d : dets) {
+		bool merged = false;
+		for (const auto &f : found) {
+			const int a = (int)std::min(d.rect.area(), f.area());
+			if (overlap_area(d.rect, f) > a * TILE_NMS_TH) {
+				merged = true;
+				break;
+			}
+		}
+		if (merged)
+			continue;
+		found.push_back(d.rect);
+
+		rect_s r;
+		r.x0 = (int)(d.rect.left() * tex.scale + tex.origin.x);
+		r.y0 = (int)(d.rect.top() * tex.scale + tex.origin.y);
+		r.x1 = (int)(d.rect.right() * tex.scale + tex.origin.x);
+		r.y1 = (int)(d.rect.bottom() * tex.scale + tex.origin.y);
+		r.score = 1.0; // same as `detect_image`
+		p->rects.push_back(r);
 	}
 
+	blog(LOG_DEBUG, "face_detector_dlib_hog: %d of %d tiles searched, %d face(s) added, %.1f ms",
+	     (int)p->tiles.size(), (int)n_tiles, (int)(found.size() - n_found), (os_gettime_ns() - ns) * 1e-6);
+}
+
+void face_detector_dlib_hog::detect_main()
+{
+	if (!p->tex)
+		return;
+
+	dlib::matrix<dlib::rgb_pixel> rgb;
+	dlib::matrix<unsigned char> gray;
+	p->detected = false;
+	with_dlib_image(*p->tex, rgb, gray, [&](auto &img) { detect_image(p, img); });
+
+	if (p->tex_native && p->detected)
+		detect_tiles(p);
+
 	p->tex.reset();
+	p->tex_native.reset();
 }
 
 void face_detector_dlib_hog::get_faces(std::vector<struct rect_s> &rects)
@@ -121,5 +434,11 @@ void face_detector_dlib_hog::set_model(const char *filename)
 	if (p->model_filename != filename) {
 		p->model_filename = filename;
 		p->detector_loaded = false;
+		p->pool_loaded = false;
 	}
 }
+
+void face_detector_dlib_hog::set_texture_native(const std::shared_ptr<texture_object> &tex)
+{
+	p->tex_native = tex;
+}
@@ -16,4 +16,9 @@ public:
 	void get_faces(std::vector<struct rect_s> &) override;
 
 	void set_model(const char *filename);
+
+	/* Sets the native resolution of the frame given by `set_texture` to search the small faces in tiles.
+	 * Null disables the tiled detection.
+	 */
+	void set_texture_native(const std::shared_ptr<texture_object> &);
 };
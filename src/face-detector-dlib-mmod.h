@@ -0,0 +1,14 @@
+#pragma once
+#include <dlib/dnn.h>
+
+// Network of the MMOD face detector of dlib, shared by the CNN detector and the cascade detector.
+namespace dlib_mmod {
+template<long num_filters, typename SUBNET> using con5d = dlib::con<num_filters, 5, 5, 2, 2, SUBNET>;
+template<long num_filters, typename SUBNET> using con5 = dlib::con<num_filters, 5, 5, 1, 1, SUBNET>;
+template<typename SUBNET>
+using downsampler = dlib::relu<dlib::affine<
+	con5d<32, dlib::relu<dlib::affine<con5d<32, dlib::relu<dlib::affine<con5d<16, SUBNET>>>>>>>>>;
+template<typename SUBNET> using rcon5 = dlib::relu<dlib::affine<con5<45, SUBNET>>>;
+using net_type = dlib::loss_mmod<dlib::con<
+	1, 9, 9, 1, 1, rcon5<rcon5<rcon5<downsampler<dlib::input_rgb_image_pyramid<dlib::pyramid_down<6>>>>>>>>;
+}
@@ -17,6 +17,11 @@ face_tracker_base::face_tracker_base()
 	pthread_cond_init(&cond, NULL);
 	stop_requested = 0;
 	running = 0;
+	tick_tracked = -1;
+	motion_tracked = pointf_s{0.0f, 0.0f};
+	update_ns_sum = 0;
+	update_cnt = 0;
+	update_targets = 0;
 	leak_test = bmalloc(1);
 }
 
@@ -55,6 +60,31 @@ void *face_tracker_base::thread_routine(void *p)
 	return NULL;
 }
 
+/* Construct the tracker and run the first tracking on the caller thread.
+ * This is called from the detector thread so that the tracker is available
+ * without waiting for the handshakes through the tracker thread. */
+bool face_tracker_base::prime(std::shared_ptr<texture_object> &tex, const rect_s &rect, const rectf_s &upsize)
+{
+	bool ret = false;
+	lock();
+	try {
+		set_texture(tex);
+		set_position(rect);
+		set_upsize_info(upsize);
+		track_main();
+		set_texture(tex);
+		track_main();
+		rect_s r;
+		ret = get_face(r);
+	} catch (std::exception &e) {
+		blog(LOG_ERROR, "prime: exception %s", e.what());
+	} catch (...) {
+		blog(LOG_ERROR, "prime: unknown exception");
+	}
+	unlock();
+	return ret;
+}
+
 void face_tracker_base::start()
 {
 	stop_requested = 0;
@@ -106,6 +136,23 @@ bool face_tracker_base::is_stopped()
 		return 0;
 }
 
+#define UPDATE_TIME_REPORT_CNT 600
+
+void face_tracker_base::add_update_time(const char *name, uint64_t ns, int n_targets)
+{
+	update_ns_sum += ns;
+	update_targets += n_targets;
+	if (++update_cnt < UPDATE_TIME_REPORT_CNT)
+		return;
+
+	blog(LOG_DEBUG, "%s %p: %.3f ms per update, %.3f ms per target in average of %d updates", name, this,
+	     update_ns_sum * 1e-6 / update_cnt, update_targets > 0 ? update_ns_sum * 1e-6 / update_targets : 0.0,
+	     update_cnt);
+	update_ns_sum = 0;
+	update_cnt = 0;
+	update_targets = 0;
+}
+
 void face_tracker_base::request_suspend()
 {
 	suspend_requested = true;
@@ -18,6 +18,15 @@ class face_tracker_base {
 	static void *thread_routine(void *);
 	virtual void track_main() = 0;
 
+	uint64_t update_ns_sum;
+	int update_cnt;
+	int update_targets;
+
+protected:
+	int tick_tracked;       // tick of the texture that produced the latest result
+	pointf_s motion_tracked; // `motion` of the texture that produced the latest result
+	void add_update_time(const char *name, uint64_t ns, int n_targets = 1);
+
 public:
 	face_tracker_base();
 	virtual ~face_tracker_base();
@@ -34,6 +43,11 @@ public:
 	virtual bool get_face(struct rect_s &) = 0;
 	virtual bool get_landmark(std::vector<pointf_s> &) = 0;
 
+	int get_tick_tracked() const { return tick_tracked; }
+	pointf_s get_motion_tracked() const { return motion_tracked; }
+
+	bool prime(std::shared_ptr<texture_object> &tex, const rect_s &rect, const rectf_s &upsize);
+
 	void start();
 	void stop();
 	void request_stop();
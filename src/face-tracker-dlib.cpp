@@ -18,6 +18,9 @@ struct face_tracker_dlib_private_s
 	dlib::shape_predictor sp;
 	dlib::full_object_detection shape;
 	float last_scale;
+	pointf_s last_origin;
+	dlib::matrix<dlib::rgb_pixel> roi_rgb;
+	dlib::matrix<unsigned char> roi_gray;
 	float score0;
 	float pslr_max, pslr_min;
 	bool need_restart;
@@ -105,41 +108,60 @@ void face_tracker_dlib::track_main()
 		return;
 
 	uint64_t ns = os_gettime_ns();
+
+	// The correlation tracker and the shape predictor take a grayscale frame as is.
+	const bool is_gray = p->tex->is_gray();
+	dlib::matrix<dlib::rgb_pixel> rgb;
+	dlib::matrix<unsigned char> gray;
+	auto load_image = [&]() {
+		return is_gray ? p->tex->get_dlib_gray_image(gray) : p->tex->get_dlib_rgb_image(rgb);
+	};
+
 	if (p->need_restart) {
 		if (!p->tracker)
 			p->tracker = new dlib::correlation_tracker();
 
-		dlib::matrix<dlib::rgb_pixel> img;
-		if (!p->tex->get_dlib_rgb_image(img))
+		if (!load_image())
 			return;
 
 		dlib::rectangle r(p->rect.x0, p->rect.y0, p->rect.x1, p->rect.y1);
-		p->tracker->start_track(img, r);
-		p->tracker_nc = img.nc();
-		p->tracker_nr = img.nr();
+		if (is_gray)
+			p->tracker->start_track(gray, r);
+		else
+			p->tracker->start_track(rgb, r);
+		p->tracker_nc = is_gray ? gray.nc() : rgb.nc();
+		p->tracker_nr = is_gray ? gray.nr() : rgb.nr();
 		p->score0 = p->rect.score;
 		p->need_restart = false;
 		p->pslr_max = 0.0f;
 		p->pslr_min = 1e9f;
 		p->scale_orig = p->tex->scale;
 		p->shape = dlib::full_object_detection();
+		tick_tracked = p->tex->tick;
+		motion_tracked = p->tex->motion;
 	} else if (p->tex->scale != p->scale_orig) {
 		p->rect.score = 0.0f;
 	} else {
-		dlib::matrix<dlib::rgb_pixel> img;
-		if (!p->tex->get_dlib_rgb_image(img))
+		if (!load_image())
 			return;
 
-		if (img.nc() != p->tracker_nc || img.nr() != p->tracker_nr) {
+		const int nc = (int)(is_gray ? gray.nc() : rgb.nc());
+		const int nr = (int)(is_gray ? gray.nr() : rgb.nr());
+		if (nc != p->tracker_nc || nr != p->tracker_nr) {
 			blog(LOG_ERROR,
 			     "face_tracker_dlib::track_main: cannot run correlation-tracker with different image size %dx%d, expected %dx%d",
-			     (int)img.nc(), (int)img.nr(), p->tracker_nc, p->tracker_nr);
+			     nc, nr, p->tracker_nc, p->tracker_nr);
 			p->rect.score = 0;
 			p->n_track += 1; // to return score=0
 			return;
 		}
 
-		float s = p->tracker->update(img);
+		// Start searching from where the camera motion has moved the face.
+		const float scale = p->tex->scale;
+		const dlib::dpoint shift((p->tex->motion.x - motion_tracked.x) / scale,
+					 (p->tex->motion.y - motion_tracked.y) / scale);
+		const dlib::drectangle guess = dlib::translate_rect(p->tracker->get_position(), shift);
+		float s = is_gray ? p->tracker->update(gray, guess) : p->tracker->update(rgb, guess);
 		if (s > p->pslr_max)
 			p->pslr_max = s;
 		if (s < p->pslr_min)
@@ -152,6 +174,8 @@ void face_tracker_dlib::track_main()
 		s = p->pslr_max / p->pslr_min * ((ns - p->last_ns) * 1e-9f);
 		p->rect.score = (p->rect.score /*+ 0.0f*s */) / (1.0f + s);
 		p->n_track += 1;
+		tick_tracked = p->tex->tick;
+		motion_tracked = p->tex->motion;
 
 		if (p->landmark_detection_data) {
 			if (p->landmark_detection_data_updated) {
@@ -172,10 +196,18 @@ void face_tracker_dlib::track_main()
 				internal_division(r.left(), r.right(), p->upsize.x0 + 1.0f, p->upsize.x1),
 				internal_division(r.top(), r.bottom(), p->upsize.y0 + 1.0f, p->upsize.y1));
 
-			if (p->sp_available)
-				p->shape = p->sp(img, r_face);
-			p->last_scale = p->tex->scale;
+			// The region of interest read back at the native resolution gives the finer landmarks.
+			const texture_object &tex = p->tex->finest(r_face);
+			if (p->sp_available && &tex == p->tex.get())
+				p->shape = is_gray ? p->sp(gray, r_face) : p->sp(rgb, r_face);
+			else if (p->sp_available)
+				with_dlib_image(tex, p->roi_rgb, p->roi_gray,
+						[&](auto &img) { p->shape = p->sp(img, r_face); });
+			p->last_scale = tex.scale;
+			p->last_origin = tex.origin;
 		}
+
+		add_update_time("face_tracker_dlib", os_gettime_ns() - ns);
 	}
 	p->last_ns = ns;
 
@@ -199,8 +231,8 @@ bool face_tracker_dlib::get_landmark(std::vector<pointf_s> &results)
 
 		for (unsigned long i = 0; i < shape.num_parts(); i++) {
 			const dlib::point pnt = shape.part(i);
-			results[i].x = (float)pnt.x() * p->last_scale;
-			results[i].y = (float)pnt.y() * p->last_scale;
+			results[i].x = (float)pnt.x() * p->last_scale + p->last_origin.x;
+			results[i].y = (float)pnt.y() * p->last_scale + p->last_origin.y;
 		}
 
 		return true;
@@ -0,0 +1,225 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "plugin-macros.generated.h"
+#include "texture-object.h"
+#include "face-tracker-kcf.h"
+
+#include <dlib/image_processing.h>
+
+struct face_tracker_kcf_private_s
+{
+	std::shared_ptr<texture_object> tex;
+	rect_s rect;
+	kcf_core core;
+	kcf_model_s *model;
+	kcf_box_s box;
+	std::vector<uint8_t> gray;
+	int tracker_nc, tracker_nr;
+	dlib::matrix<dlib::rgb_pixel> img;
+	dlib::matrix<unsigned char> img_gray;
+	dlib::shape_predictor sp;
+	dlib::full_object_detection shape;
+	float last_scale;
+	pointf_s last_origin;
+	float pslr_max, pslr_min;
+	bool need_restart;
+	uint64_t last_ns;
+	float scale_orig;
+	int n_track;
+	rectf_s upsize;
+	char *landmark_detection_data;
+	bool landmark_detection_data_updated;
+	bool sp_available = false;
+
+	face_tracker_kcf_private_s(enum kcf_feature_e feature) : core(feature)
+	{
+		model = new kcf_model_s;
+		need_restart = false;
+		tex = NULL;
+		rect.score = 0.0f;
+		n_track = 0;
+		landmark_detection_data = NULL;
+		landmark_detection_data_updated = false;
+	}
+
+	~face_tracker_kcf_private_s() { delete model; }
+};
+
+face_tracker_kcf::face_tracker_kcf(enum kcf_feature_e feature)
+{
+	p = new face_tracker_kcf_private_s(feature);
+}
+
+face_tracker_kcf::~face_tracker_kcf()
+{
+	bfree(p->landmark_detection_data);
+	delete p;
+}
+
+enum kcf_feature_e face_tracker_kcf::get_feature() const
+{
+	return p->core.get_feature();
+}
+
+void face_tracker_kcf::set_texture(std::shared_ptr<texture_object> &tex)
+{
+	p->tex = tex;
+	p->n_track = 0;
+}
+
+void face_tracker_kcf::set_position(const rect_s &rect)
+{
+	if (!p->tex) {
+		blog(LOG_ERROR, "face_tracker_kcf::set_position: texture was not set. rect=(%d %d %d %d %f)", rect.x0,
+		     rect.y0, rect.x1, rect.y1, rect.score);
+		return;
+	}
+
+	p->rect.x0 = rect.x0 / p->tex->scale;
+	p->rect.y0 = rect.y0 / p->tex->scale;
+	p->rect.x1 = rect.x1 / p->tex->scale;
+	p->rect.y1 = rect.y1 / p->tex->scale;
+	p->rect.score = 1.0f;
+	p->need_restart = true;
+	p->n_track = 0;
+}
+
+void face_tracker_kcf::set_upsize_info(const rectf_s &upsize)
+{
+	p->upsize = upsize;
+}
+
+void face_tracker_kcf::set_landmark_detection(const char *data_file_path)
+{
+	if (p->landmark_detection_data && data_file_path && strcmp(p->landmark_detection_data, data_file_path) == 0)
+		return;
+
+	bfree(p->landmark_detection_data);
+	p->landmark_detection_data = NULL;
+	if (data_file_path) {
+		p->landmark_detection_data = bstrdup(data_file_path);
+		p->landmark_detection_data_updated = true;
+	}
+}
+
+template<typename Tx, typename Ta> inline Tx internal_division(Tx x0, Tx x1, Ta a0, Ta a1)
+{
+	return (x0 * a1 + x1 * a0) / (a0 + a1);
+}
+
+void face_tracker_kcf::track_main()
+{
+	if (!p->tex)
+		return;
+
+	uint64_t ns = os_gettime_ns();
+	int nc, nr;
+	if (!p->tex->get_gray_image(p->gray, nc, nr) || nc < 2 || nr < 2)
+		return;
+	const kcf_image_s img = {p->gray.data(), nc, nr, nc};
+
+	if (p->need_restart) {
+		p->core.init(*p->model, p->box, img, p->rect.x0, p->rect.y0, p->rect.x1, p->rect.y1);
+		p->tracker_nc = nc;
+		p->tracker_nr = nr;
+		p->need_restart = false;
+		p->pslr_max = 0.0f;
+		p->pslr_min = 1e9f;
+		p->scale_orig = p->tex->scale;
+		p->shape = dlib::full_object_detection();
+		tick_tracked = p->tex->tick;
+		motion_tracked = p->tex->motion;
+	} else if (p->tex->scale != p->scale_orig) {
+		p->rect.score = 0.0f;
+	} else {
+		if (nc != p->tracker_nc || nr != p->tracker_nr) {
+			blog(LOG_ERROR,
+			     "face_tracker_kcf::track_main: cannot run tracker with different image size %dx%d, expected %dx%d",
+			     nc, nr, p->tracker_nc, p->tracker_nr);
+			p->rect.score = 0;
+			p->n_track += 1; // to return score=0
+			return;
+		}
+
+		// Start searching from where the camera motion has moved the face.
+		p->box.cx += (p->tex->motion.x - motion_tracked.x) / p->tex->scale;
+		p->box.cy += (p->tex->motion.y - motion_tracked.y) / p->tex->scale;
+		float s = p->core.update(*p->model, p->box, img);
+		if (s > p->pslr_max)
+			p->pslr_max = s;
+		if (s < p->pslr_min)
+			p->pslr_min = s;
+		const kcf_box_s &t = p->box;
+		const float scale = p->tex->scale;
+		p->rect.x0 = (t.cx - t.w * 0.5f) * scale;
+		p->rect.y0 = (t.cy - t.h * 0.5f) * scale;
+		p->rect.x1 = (t.cx + t.w * 0.5f) * scale;
+		p->rect.y1 = (t.cy + t.h * 0.5f) * scale;
+		s = p->pslr_max / p->pslr_min * ((ns - p->last_ns) * 1e-9f);
+		p->rect.score = p->rect.score / (1.0f + s);
+		p->n_track += 1;
+		tick_tracked = p->tex->tick;
+		motion_tracked = p->tex->motion;
+
+		if (p->landmark_detection_data) {
+			if (p->landmark_detection_data_updated) {
+				p->landmark_detection_data_updated = false;
+				blog(LOG_INFO, "loading file %s", p->landmark_detection_data);
+				try {
+					p->sp_available = false;
+					dlib::deserialize(p->landmark_detection_data) >> p->sp;
+					p->sp_available = true;
+				} catch (...) {
+					blog(LOG_ERROR, "Failed to load file %s", p->landmark_detection_data);
+				}
+			}
+
+			const float l = t.cx - t.w * 0.5f, r = t.cx + t.w * 0.5f;
+			const float u = t.cy - t.h * 0.5f, b = t.cy + t.h * 0.5f;
+			dlib::rectangle r_face(internal_division(l, r, p->upsize.x0, p->upsize.x1 + 1.0f),
+					       internal_division(u, b, p->upsize.y0, p->upsize.y1 + 1.0f),
+					       internal_division(l, r, p->upsize.x0 + 1.0f, p->upsize.x1),
+					       internal_division(u, b, p->upsize.y0 + 1.0f, p->upsize.y1));
+
+			// The region of interest read back at the native resolution gives the finer landmarks.
+			const texture_object &tex = p->tex->finest(r_face);
+			if (p->sp_available)
+				with_dlib_image(tex, p->img, p->img_gray,
+						[&](auto &img) { p->shape = p->sp(img, r_face); });
+			p->last_scale = tex.scale;
+			p->last_origin = tex.origin;
+		}
+
+		add_update_time("face_tracker_kcf", os_gettime_ns() - ns);
+	}
+	p->last_ns = ns;
+
+	p->tex.reset();
+}
+
+bool face_tracker_kcf::get_face(struct rect_s &rect)
+{
+	if (p->n_track > 0) {
+		rect = p->rect;
+		return true;
+	} else
+		return false;
+}
+
+bool face_tracker_kcf::get_landmark(std::vector<pointf_s> &results)
+{
+	if (p->shape.num_parts() > 0) {
+		const auto &shape = p->shape;
+		results.resize(shape.num_parts());
+
+		for (unsigned long i = 0; i < shape.num_parts(); i++) {
+			const dlib::point pnt = shape.part(i);
+			results[i].x = (float)pnt.x() * p->last_scale + p->last_origin.x;
+			results[i].y = (float)pnt.y() * p->last_scale + p->last_origin.y;
+		}
+
+		return true;
+	} else
+		return false;
+}
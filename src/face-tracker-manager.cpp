@@ -3,9 +3,14 @@
 #include "face-tracker-manager.hpp"
 #include "face-detector-dlib-hog.h"
 #include "face-detector-dlib-cnn.h"
+#include "face-detector-dlib-cascade.h"
 #include "face-tracker-dlib.h"
+#include "face-tracker-kcf.h"
+#include "face-tracker-multi.h"
 #include "texture-object.h"
+#include "scene-change.hpp"
 #include "helper.hpp"
+#include <algorithm>
 
 // #define debug_track(fmt, ...) blog(LOG_INFO, fmt, __VA_ARGS__)
 // #define debug_detect(fmt, ...) blog(LOG_INFO, fmt, __VA_ARGS__)
@@ -17,20 +22,57 @@
 #define DIR_DLIB_CNN "dlib_cnn_model"
 #define DIR_DLIB_LANDMARK "dlib_face_landmark_model"
 
+#define SCENE_STEP 8.0f           // the change detector takes every 8 pixels of the source
+#define SCENE_FULL_DETECT_CNT 5   // the whole frame is searched at least once in this number of detections
+#define SCENE_DETECT_MIN 96       // minimum size of the partial detection in the pixels of the detector
+#define SCENE_REPORT_CNT 600
+#define SCENE_MASK_ALL (~(uint64_t)0)
+#define SCENE_REF_TRACK 0  // reference of `scene_change` set when the trackers take the texture
+#define SCENE_REF_DETECT 1 // reference of `scene_change` set when the detector takes the texture
+
 face_tracker_manager::face_tracker_manager()
 {
 	upsize_l = upsize_r = upsize_t = upsize_b = 0.0f;
 	scale = 0.0f;
 	tracking_threshold = 1e-2f;
+	motion_prediction = false;
+	tracker_engine = tracker_dlib_correlation;
+	tracker_batch = false;
+	detector_cascade_audit = 0;
+	crowd_mode = false;
+	crowd_max_updates = 0;
 	landmark_detection_data = NULL;
 	crop_cur.x0 = crop_cur.x1 = crop_cur.y0 = crop_cur.y1 = 0.0f;
-	tick_cnt = detect_tick = next_tick_stage_to_detector = 0;
+	reset_requested = false;
+	tick_cnt = 0;
+	tick_post = detect_tick = next_tick_stage_to_detector = 0;
+	detect_interval = 0;
+	tick_detected_reported = -1;
+	detect_to_crop_frames = -1;
 	detector_in_progress = false;
+	detector_levels_pending = false;
+	detector_levels_tick = 0;
 	detect = NULL;
+	multi = NULL;
+	scene_gate = false;
+	detect_partial = false;
+	scene = new scene_change();
+	scene_tick = scene_cut_tick = 0;
+	scene_static = false;
+	scene_mask = SCENE_MASK_ALL;
+	scene_width = scene_height = 0;
+	scene_partial_cnt = 0;
+	scene_report_cnt = scene_detect_cnt = scene_detect_skipped = scene_track_cnt = scene_track_skipped = 0;
+	scene_cut_cnt = 0;
 }
 
 face_tracker_manager::~face_tracker_manager()
 {
+	// The detector thread might be constructing one of the trackers.
+	if (detect) {
+		detect->stop();
+		delete detect;
+	}
 	for (auto &t : trackers_idlepool) {
 		if (t.tracker) {
 			t.tracker->stop();
@@ -45,16 +87,23 @@ face_tracker_manager::~face_tracker_manager()
 			t.tracker = NULL;
 		}
 	}
-	if (detect) {
-		detect->stop();
-		delete detect;
+	if (multi) {
+		multi->stop();
+		delete multi;
 	}
+	delete scene;
 	bfree(landmark_detection_data);
 }
 
 inline void face_tracker_manager::retire_tracker(int ix)
 {
 	debug_track_thread("%p retire_tracker(%d %p)", this, ix, trackers[ix].tracker);
+	if (!trackers[ix].tracker) {
+		if (trackers[ix].target_id >= 0)
+			multi_removed.push_back(trackers[ix].target_id);
+		trackers.erase(trackers.begin() + ix);
+		return;
+	}
 	trackers_idlepool.push_back(trackers[ix]);
 	trackers[ix].tracker->request_suspend();
 	trackers.erase(trackers.begin() + ix);
@@ -71,46 +120,88 @@ inline bool face_tracker_manager::is_low_confident(const tracker_inst_s &t, floa
 	return false;
 }
 
+static inline int rect_size_max(const rect_s &r)
+{
+	return std::max(r.x1 - r.x0, r.y1 - r.y0);
+}
+
 void face_tracker_manager::remove_duplicated_tracker()
 {
+	int size_max = 1;
+	for (const auto &t : trackers) {
+		if (t.state == tracker_inst_s::tracker_state_available)
+			size_max = std::max(size_max, rect_size_max(t.rect));
+	}
+	grid.reset(size_max);
+	for (size_t i = 0; i < trackers.size(); i++) {
+		if (trackers[i].state == tracker_inst_s::tracker_state_available)
+			grid.insert((int)i, trackers[i].rect);
+	}
+
+	// A tracker is removed if it is mostly covered by the trackers that follow it.
+	to_remove.assign(trackers.size(), 0);
 	for (size_t i = 0; i < trackers.size(); i++) {
 		if (trackers[i].state != tracker_inst_s::tracker_state_available)
 			continue;
 
 		rect_s r = trackers[i].rect;
+		grid_candidates.clear();
+		grid.query(r, [&](int j) {
+			if ((size_t)j > i)
+				grid_candidates.push_back(j);
+		});
+		std::sort(grid_candidates.begin(), grid_candidates.end());
+
 		int a0 = (r.x1 - r.x0) * (r.y1 - r.y0);
 		int a_overlap_sum = 0;
-		bool to_remove = false;
-		for (size_t j = i + 1; j < trackers.size() && !to_remove; j++) {
-			if (trackers[j].state != tracker_inst_s::tracker_state_available)
-				continue;
+		for (int j : grid_candidates) {
 			int a = common_area(r, trackers[j].rect);
 			a_overlap_sum += a;
-			if (a * 10 > a0 && a_overlap_sum * 2 > a0)
-				to_remove = true;
+			if (a * 10 > a0 && a_overlap_sum * 2 > a0) {
+				to_remove[i] = 1;
+				break;
+			}
 		}
+	}
 
-		if (to_remove) {
+	for (int i = (int)trackers.size() - 1; i >= 0; i--) {
+		if (to_remove[i])
 			retire_tracker(i);
-			i--;
-		}
 	}
 }
 
 inline void face_tracker_manager::attenuate_tracker()
 {
+	// The cells are as large as both the detections and the trackers to be queried.
+	int size_max = 1;
+	for (const auto &r : detect_results)
+		size_max = std::max(size_max, rect_size_max(r));
+	for (const auto &t : trackers) {
+		if (t.state == tracker_inst_s::tracker_state_available)
+			size_max = std::max(size_max, rect_size_max(t.rect));
+	}
+	grid.reset(size_max);
+	for (size_t j = 0; j < detect_results.size(); j++)
+		grid.insert((int)j, detect_results[j]);
+
 	for (size_t i = 0; i < trackers.size(); i++) {
 		if (trackers[i].state != tracker_inst_s::tracker_state_available)
 			continue;
 		struct tracker_inst_s &t = trackers[i];
 
+		// The partial detection does not tell anything about the faces outside of the region.
+		if (detect_partial && (t.rect.x0 < detect_region.x0 || t.rect.y0 < detect_region.y0 ||
+				       t.rect.x1 > detect_region.x1 || t.rect.y1 > detect_region.y1))
+			continue;
+
 		int a1 = (t.rect.x1 - t.rect.x0) * (t.rect.y1 - t.rect.y0);
 		float amax = (float)a1 * 0.1f;
-		for (size_t j = 0; j < detect_rects.size(); j++) {
-			rect_s r = detect_rects[j];
-			float a = (float)common_area(r, t.rect);
-			if (a > amax)
-				amax = a;
+		if (!detect_results.empty()) {
+			grid.query(t.rect, [&](int j) {
+				float a = (float)common_area(detect_results[j], t.rect);
+				if (a > amax)
+					amax = a;
+			});
 		}
 
 		t.att *= powf(amax / a1, 0.1f); // if no faces, remove the tracker
@@ -136,6 +227,110 @@ inline void face_tracker_manager::attenuate_tracker()
 	}
 }
 
+// Noise parameters for the motion prediction, relative to the face size.
+#define KF_R_RATIO 3e-2f   // measurement
+#define KF_RV_RATIO 5e-2f  // initial velocity
+#define KF_Q_RATIO 1.5e-2f // acceleration
+
+inline int face_tracker_manager::get_tick_tracked(const tracker_inst_s &t)
+{
+	if (t.tracker)
+		return t.tracker->get_tick_tracked();
+	return multi ? multi->get_target_tick(t.target_id) : -1;
+}
+
+inline pointf_s face_tracker_manager::get_motion_tracked(const tracker_inst_s &t)
+{
+	if (t.tracker)
+		return t.tracker->get_motion_tracked();
+	return multi ? multi->get_target_motion(t.target_id) : pointf_s{0.0f, 0.0f};
+}
+
+// Location of the face excluding the camera motion so that the prediction does not follow the camera.
+static inline f3 world_location(const rect_s &rect, const pointf_s &motion)
+{
+	f3 z(rect);
+	z.v[0] -= motion.x;
+	z.v[1] -= motion.y;
+	return z;
+}
+
+inline void face_tracker_manager::reset_prediction(tracker_inst_s &t)
+{
+	const f3 z = world_location(t.rect, t.motion);
+	const float r = sqf(z.v[2] * KF_R_RATIO);
+	const float r_v = sqf(z.v[2] * KF_RV_RATIO);
+	for (int i = 0; i < 3; i++)
+		t.kf[i].reset(z.v[i], r, r_v);
+	t.tick_measured = t.kf_tick = get_tick_tracked(t);
+}
+
+inline void face_tracker_manager::correct_prediction(tracker_inst_s &t)
+{
+	const int tick = get_tick_tracked(t);
+	if (tick == t.tick_measured)
+		return;
+
+	const f3 z = world_location(t.rect, t.motion);
+	const float r = sqf(z.v[2] * KF_R_RATIO);
+	const float q = sqf(z.v[2] * KF_Q_RATIO);
+	if (tick > t.kf_tick) {
+		for (int i = 0; i < 3; i++)
+			t.kf[i].predict(tick - t.kf_tick, q);
+		t.kf_tick = tick;
+	}
+	for (int i = 0; i < 3; i++)
+		t.kf[i].correct(z.v[i], t.kf_tick - tick, r);
+	t.tick_measured = tick;
+}
+
+// Adds a target for each detected face that is not tracked yet.
+// `trackers[ix]` is the placeholder for the detection and is replaced by the new targets.
+void face_tracker_manager::add_crowd_targets(size_t ix)
+{
+	const tracker_inst_s t0 = trackers[ix];
+	trackers.erase(trackers.begin() + ix);
+
+	if (detect_results.empty())
+		return;
+
+	const rectf_s upsize = {upsize_l, upsize_t, upsize_r, upsize_b};
+	auto is_tracking = [](const tracker_inst_s &t) {
+		return t.state >= tracker_inst_s::tracker_state_constructing &&
+		       t.state <= tracker_inst_s::tracker_state_available;
+	};
+	int size_max = 1;
+	for (const auto &r : detect_results)
+		size_max = std::max(size_max, rect_size_max(upsize_rect(r, upsize)));
+	for (const auto &t : trackers) {
+		if (is_tracking(t))
+			size_max = std::max(size_max, rect_size_max(t.rect));
+	}
+	grid.reset(size_max);
+	for (size_t i = 0; i < trackers.size(); i++) {
+		if (is_tracking(trackers[i]))
+			grid.insert((int)i, trackers[i].rect);
+	}
+
+	for (const auto &d : detect_results) {
+		const rect_s r = upsize_rect(d, upsize);
+		const int a0 = (r.x1 - r.x0) * (r.y1 - r.y0);
+		bool tracked = false;
+		grid.query(r, [&](int j) {
+			if (common_area(r, trackers[j].rect) * 10 > a0 * 3)
+				tracked = true;
+		});
+		if (tracked)
+			continue;
+
+		tracker_inst_s t = t0;
+		t.rect = r;
+		t.state = tracker_inst_s::tracker_state_constructing;
+		trackers.push_back(t);
+		grid.insert((int)trackers.size() - 1, r);
+	}
+}
+
 inline void face_tracker_manager::copy_detector_to_tracker()
 {
 	size_t i_tracker;
@@ -146,26 +341,170 @@ inline void face_tracker_manager::copy_detector_to_tracker()
 	if (i_tracker >= trackers.size())
 		return;
 
-	if (detect_rects.size() <= 0) {
+	if (detect_results.size() <= 0) {
 		retire_tracker(i_tracker);
 		return;
 	}
 
 	struct tracker_inst_s &t = trackers[i_tracker];
+	t.tick_detected = tick_post;
+
+	if (!t.tracker && crowd_mode) {
+		add_crowd_targets(i_tracker);
+		return;
+	}
+
+	if (!t.tracker) {
+		// The target will be added to the batched tracker at the next lock.
+		t.rect = upsize_rect(detect_results[0], rectf_s{upsize_l, upsize_t, upsize_r, upsize_b});
+		t.state = tracker_inst_s::tracker_state_constructing;
+		return;
+	}
 
-	struct rect_s r = detect_rects[0];
-	int w = r.x1 - r.x0;
-	int h = r.y1 - r.y0;
-	r.x0 -= w * upsize_l;
-	r.x1 += w * upsize_r;
-	r.y0 -= h * upsize_t;
-	r.y1 += h * upsize_b;
+	if (detect->is_tracker_primed()) {
+		// The detector thread has already constructed the tracker and run the 1st tracking.
+		bool ret = t.tracker->get_face(t.rect);
+		t.motion = get_motion_tracked(t);
+		t.crop_rect = t.crop_tracker;
+		t.att = 1.0f;
+		t.score_first = t.rect.score;
+		if (!ret || !landmark_detection_data || !t.tracker->get_landmark(t.landmark))
+			t.landmark.resize(0);
+		debug_track("copy_detector_to_tracker: primed %p %d %d %d %d %f", t.tracker, t.rect.x0, t.rect.y0,
+			    t.rect.x1, t.rect.y1, t.rect.score);
+		reset_prediction(t);
+		t.tracker->start();
+		t.state = tracker_inst_s::tracker_state_available;
+		remove_duplicated_tracker();
+		return;
+	}
+
+	struct rect_s r = upsize_rect(detect_results[0], rectf_s{upsize_l, upsize_t, upsize_r, upsize_b});
 	t.tracker->set_position(r); // TODO: consider how to track two or more faces.
 	t.tracker->set_upsize_info(rectf_s{upsize_l, upsize_t, upsize_r, upsize_b});
 	t.tracker->start();
 	t.state = tracker_inst_s::tracker_state_constructing;
 }
 
+/* Compares the latest texture with the one analyzed last to find a scene cut, and with the textures the trackers and
+ * the detector took last to find what changed since then.
+ * The texture is taken only when the trackers or the detector need it anyway.
+ */
+inline void face_tracker_manager::update_scene()
+{
+	if (!scene_gate) {
+		scene->reset();
+		scene_static = false;
+		scene_mask = SCENE_MASK_ALL;
+		return;
+	}
+
+	if (trackers.empty() && (next_tick_stage_to_detector - tick_post) > 0)
+		return;
+
+	auto cvtex = get_cvtex();
+	if (!cvtex || cvtex->tick == scene_tick)
+		return;
+	scene_tick = cvtex->tick;
+
+	const int step = std::max((int)(SCENE_STEP / cvtex->scale), 1);
+	int width, height;
+	if (!cvtex->get_gray_image(scene_gray, width, height, step))
+		return;
+	scene_width = (int)(width * step * cvtex->scale);
+	scene_height = (int)(height * step * cvtex->scale);
+
+	uint64_t mask[SCENE_CHANGE_REFS];
+	const auto result = scene->update(scene_gray.data(), width, height, mask);
+	scene_static = result != scene_change::result_cut && !mask[SCENE_REF_TRACK];
+	scene_mask = mask[SCENE_REF_DETECT];
+
+	if (result == scene_change::result_cut) {
+		// The trackers are following the previous scene. Hide them now and detect the faces in the new scene.
+		debug_detect("update_scene: scene cut at tick %d", tick_post);
+		for (auto &t : trackers)
+			t.att = 0.0f;
+		detect_results.clear();
+		next_tick_stage_to_detector = tick_post;
+		scene_cut_tick = tick_post;
+		scene_mask = SCENE_MASK_ALL;
+		scene_cut_cnt++;
+	}
+}
+
+// Returns the region around the tiles changed since the last detection, or false to search the whole frame.
+inline bool face_tracker_manager::get_scene_region(rect_s &region, float detect_scale) const
+{
+	if (!scene_gate || scene_mask == SCENE_MASK_ALL || scene_partial_cnt >= SCENE_FULL_DETECT_CNT)
+		return false;
+	if (scene_width <= 0 || scene_height <= 0)
+		return false;
+
+	const int n = SCENE_CHANGE_TILES;
+	int tx0 = n, ty0 = n, tx1 = -1, ty1 = -1;
+	for (int ty = 0; ty < n; ty++) {
+		for (int tx = 0; tx < n; tx++) {
+			if (!(scene_mask & ((uint64_t)1 << (ty * n + tx))))
+				continue;
+			tx0 = std::min(tx0, tx);
+			ty0 = std::min(ty0, ty);
+			tx1 = std::max(tx1, tx);
+			ty1 = std::max(ty1, ty);
+		}
+	}
+	if (tx1 < 0)
+		return false;
+
+	// One more tile on each side for the faces straddling the boundary.
+	tx0 = std::max(tx0 - 1, 0);
+	ty0 = std::max(ty0 - 1, 0);
+	tx1 = std::min(tx1 + 2, n);
+	ty1 = std::min(ty1 + 2, n);
+	region.x0 = tx0 * scene_width / n;
+	region.y0 = ty0 * scene_height / n;
+	region.x1 = tx1 * scene_width / n;
+	region.y1 = ty1 * scene_height / n;
+
+	// The detector cannot find a face in a too small region.
+	const int size_min = (int)(SCENE_DETECT_MIN * detect_scale);
+	auto expand = [](int &a0, int &a1, int size, int size_max) {
+		if (a1 - a0 >= size)
+			return;
+		a0 = std::clamp((a0 + a1 - size) / 2, 0, std::max(size_max - size, 0));
+		a1 = std::min(a0 + size, size_max);
+	};
+	expand(region.x0, region.x1, size_min, scene_width);
+	expand(region.y0, region.y1, size_min, scene_height);
+
+	return region.x0 > 0 || region.y0 > 0 || region.x1 < scene_width || region.y1 < scene_height;
+}
+
+inline void face_tracker_manager::report_scene()
+{
+	if (++scene_report_cnt < SCENE_REPORT_CNT)
+		return;
+
+	if (scene_gate) {
+		blog(LOG_DEBUG, "scene gate: skipped %d of %d detections, %d of %d tracker updates, %d scene cut(s)",
+		     scene_detect_skipped, scene_detect_cnt, scene_track_skipped, scene_track_cnt, scene_cut_cnt);
+	}
+	scene_report_cnt = scene_detect_cnt = scene_detect_skipped = scene_track_cnt = scene_track_skipped = 0;
+	scene_cut_cnt = 0;
+}
+
+// Regions where the trackers expect the faces, shifted by the camera motion since the measurement.
+std::vector<rect_s> face_tracker_manager::cascade_hints(const pointf_s &motion) const
+{
+	std::vector<rect_s> hints;
+	for (const tracker_inst_s &t : trackers) {
+		if (t.state != tracker_inst_s::tracker_state_available || t.att <= 0.0f)
+			continue;
+		const int dx = (int)(motion.x - t.motion.x), dy = (int)(motion.y - t.motion.y);
+		hints.push_back(rect_s{t.rect.x0 + dx, t.rect.y0 + dy, t.rect.x1 + dx, t.rect.y1 + dy, t.rect.score});
+	}
+	return hints;
+}
+
 inline void face_tracker_manager::stage_to_detector()
 {
 	if (!detect || detect->trylock())
@@ -173,65 +512,182 @@ inline void face_tracker_manager::stage_to_detector()
 
 	// get previous results
 	if (detector_in_progress) {
-		detect->get_faces(detect_rects);
-		for (size_t i = 0; i < detect_rects.size(); i++)
-			debug_detect("stage_to_detector: detect_rects %d %d %d %d %d %f", i, detect_rects[i].x0,
-				     detect_rects[i].y0, detect_rects[i].x1, detect_rects[i].y1, detect_rects[i].score);
+		detect->get_faces(detect_results);
+		if ((scene_cut_tick - detect_tick) > 0) {
+			// The results are from the scene before the cut.
+			detect_results.clear();
+		}
+		for (size_t i = 0; i < detect_results.size(); i++)
+			debug_detect("stage_to_detector: detect_results %d %d %d %d %d %f", i, detect_results[i].x0,
+				     detect_results[i].y0, detect_results[i].x1, detect_results[i].y1,
+				     detect_results[i].score);
 		attenuate_tracker();
 		copy_detector_to_tracker();
 		detector_in_progress = false;
 	}
 
-	if ((next_tick_stage_to_detector - tick_cnt) > 0) {
+	if ((next_tick_stage_to_detector - tick_post) > 0) {
 		detect->unlock();
 		return;
 	}
 
-	if (auto cvtex = get_cvtex()) {
-		detect->set_texture(cvtex, detector_crop_l, detector_crop_r, detector_crop_t, detector_crop_b);
+	scene_detect_cnt++;
+	if (scene_gate && !scene_mask && scene_partial_cnt < SCENE_FULL_DETECT_CNT) {
+		// Nothing moved since the last detection.
+		scene_detect_skipped++;
+		scene_partial_cnt++;
+		next_tick_stage_to_detector = tick_post + detect_interval.load(std::memory_order_relaxed);
+		detector_levels_pending = false;
+		detect->unlock();
+		return;
+	}
+
+	auto cvtex = get_cvtex();
+	if (cvtex && detector_levels_pending && cvtex->tick - detector_levels_tick < 0) {
+		// The texture with the levels for the detector is not mapped yet.
+		detect->unlock();
+		return;
+	}
+
+	if (cvtex) {
+		detector_levels_pending = false;
+		// The detector takes the coarse level if available. The trackers keep the level of `cvtex`.
+		std::shared_ptr<texture_object> detect_tex = cvtex->coarse ? cvtex->coarse : cvtex;
+		int crop_l = detector_crop_l, crop_r = detector_crop_r;
+		int crop_t = detector_crop_t, crop_b = detector_crop_b;
+		detect_partial = get_scene_region(detect_region, detect_tex->scale);
+		if (detect_partial) {
+			crop_l = std::max(crop_l, detect_region.x0);
+			crop_r = std::max(crop_r, scene_width - detect_region.x1);
+			crop_t = std::max(crop_t, detect_region.y0);
+			crop_b = std::max(crop_b, scene_height - detect_region.y1);
+			scene_partial_cnt++;
+		} else {
+			scene_partial_cnt = 0;
+		}
+		scene_mask = 0;
+		scene->set_reference(SCENE_REF_DETECT);
+		detect->set_texture(detect_tex, crop_l, crop_r, crop_t, crop_b);
 		if (detector_engine == engine_dlib_hog) {
-			if (auto *d = dynamic_cast<face_detector_dlib_hog *>(detect))
+			if (auto *d = dynamic_cast<face_detector_dlib_hog *>(detect)) {
 				d->set_model(detector_dlib_hog_model.c_str());
+				d->set_texture_native(cvtex->native);
+			}
 		} else if (detector_engine == engine_dlib_cnn) {
 			if (auto *d = dynamic_cast<face_detector_dlib_cnn *>(detect))
 				d->set_model(detector_dlib_cnn_model.c_str());
+		} else if (detector_engine == engine_dlib_cascade) {
+			if (auto *d = dynamic_cast<face_detector_dlib_cascade *>(detect)) {
+				d->set_model(detector_dlib_hog_model.c_str(), detector_dlib_cnn_model.c_str());
+				d->set_audit_interval(detector_cascade_audit);
+				d->set_texture_verify(cvtex);
+				d->set_hints(cascade_hints(cvtex->motion));
+			}
 		}
 		detect->signal();
 		detector_in_progress = true;
-		detect_tick = tick_cnt;
+		detect_tick = tick_post;
+		next_tick_stage_to_detector = tick_post + detect_interval.load(std::memory_order_relaxed);
 
 		struct tracker_inst_s t;
 		t.rect = rect_s{0, 0, 0, 0, 0.0f};
 		t.crop_rect = rectf_s{0.0f, 0.0f, 0.0f, 0.0f};
+		t.motion = cvtex->motion;
 		t.att = 0.0f;
 		t.score_first = 0.0f;
-		if (trackers_idlepool.size() > 0) {
-			t.tracker = trackers_idlepool[0].tracker;
-			trackers_idlepool[0].tracker = NULL;
-			trackers_idlepool.pop_front();
-		} else {
-			debug_track_thread(
-				"%p No available idle tracker, creating new tracker thread. There are %d existing thread.",
-				this, trackers.size());
-			t.tracker = new face_tracker_dlib();
-			for (size_t i = 0; i < trackers.size(); i++) {
-				debug_track_thread("%p existing tracker[%d]: state=%d", this, i,
-						   (int)trackers[i].state);
+		update_multi();
+		t.engine = tracker_engine;
+		t.target_id = -1;
+		t.tracker = NULL;
+		if (!multi) {
+			while (trackers_idlepool.size() > 0 && trackers_idlepool[0].engine != tracker_engine) {
+				// The tracker engine has been changed.
+				trackers_idlepool[0].tracker->stop();
+				delete trackers_idlepool[0].tracker;
+				trackers_idlepool.pop_front();
+			}
+			if (trackers_idlepool.size() > 0) {
+				t.tracker = trackers_idlepool[0].tracker;
+				trackers_idlepool[0].tracker = NULL;
+				trackers_idlepool.pop_front();
+			} else {
+				debug_track_thread(
+					"%p No available idle tracker, creating new tracker thread. There are %d existing thread.",
+					this, trackers.size());
+				t.tracker = new_tracker();
+				for (size_t i = 0; i < trackers.size(); i++) {
+					debug_track_thread("%p existing tracker[%d]: state=%d", this, i,
+							   (int)trackers[i].state);
+				}
 			}
 		}
 		t.crop_tracker = crop_cur;
 		t.state = tracker_inst_s::tracker_state_e::tracker_state_reset_texture;
-		t.tick_cnt = tick_cnt;
-		t.tracker->set_texture(cvtex);
-		t.tracker->set_landmark_detection(landmark_detection_data);
+		t.tick_cnt = tick_post;
+		t.tick_detected = -1;
 		if (!landmark_detection_data)
 			t.landmark.clear();
+		if (t.tracker) {
+			t.tracker->set_texture(cvtex);
+			t.tracker->set_landmark_detection(landmark_detection_data);
+			detect->set_tracker(t.tracker, cvtex, rectf_s{upsize_l, upsize_t, upsize_r, upsize_b});
+		} else {
+			t.tex_detected = cvtex;
+		}
 		trackers.push_back(t);
 	}
 
 	detect->unlock();
 }
 
+face_tracker_base *face_tracker_manager::new_tracker()
+{
+	switch (tracker_engine) {
+	case tracker_kcf_gray:
+		return new face_tracker_kcf(kcf_feature_gray);
+	case tracker_kcf_hog:
+		return new face_tracker_kcf(kcf_feature_hog);
+	case tracker_dlib_correlation:
+		break;
+	default:
+		blog(LOG_ERROR, "unknown tracker_engine %d", (int)tracker_engine);
+	}
+	return new face_tracker_dlib();
+}
+
+void face_tracker_manager::update_multi()
+{
+	const bool use_multi = crowd_mode || (tracker_batch && tracker_engine != tracker_dlib_correlation);
+	const enum kcf_feature_e feature = tracker_engine == tracker_kcf_hog ? kcf_feature_hog : kcf_feature_gray;
+	if (multi && use_multi && multi->get_feature() == feature)
+		return;
+	if (!multi && !use_multi)
+		return;
+
+	if (multi) {
+		// The targets cannot be moved to another tracker.
+		for (int i = trackers.size() - 1; i >= 0; i--) {
+			if (!trackers[i].tracker)
+				trackers.erase(trackers.begin() + i);
+		}
+		multi_removed.clear();
+		multi->stop();
+		delete multi;
+		multi = NULL;
+	}
+
+	if (use_multi) {
+		for (auto &t : trackers_idlepool) {
+			t.tracker->stop();
+			delete t.tracker;
+		}
+		trackers_idlepool.clear();
+
+		multi = new face_tracker_multi(feature);
+		multi->start();
+	}
+}
+
 inline int face_tracker_manager::stage_surface_to_tracker(struct tracker_inst_s &t)
 {
 	if (auto cvtex = get_cvtex()) {
@@ -248,6 +704,8 @@ inline void face_tracker_manager::stage_to_trackers()
 	bool have_new_tracker = false;
 	for (size_t i = 0; i < trackers.size(); i++) {
 		struct tracker_inst_s &t = trackers[i];
+		if (!t.tracker)
+			continue;
 		if (t.state == tracker_inst_s::tracker_state_constructing) {
 			if (!t.tracker->trylock()) {
 				if (!stage_surface_to_tracker(t)) {
@@ -260,6 +718,7 @@ inline void face_tracker_manager::stage_to_trackers()
 		} else if (t.state == tracker_inst_s::tracker_state_first_track) {
 			if (!t.tracker->trylock()) {
 				bool ret = t.tracker->get_face(t.rect);
+				t.motion = get_motion_tracked(t);
 				t.crop_rect = t.crop_tracker;
 				debug_track("tracker_state_first_track %p %d %d %d %d %f", t.tracker, t.rect.x0,
 					    t.rect.y0, t.rect.x1, t.rect.y1, t.rect.score);
@@ -267,6 +726,8 @@ inline void face_tracker_manager::stage_to_trackers()
 				t.score_first = t.rect.score;
 				if (!ret || !landmark_detection_data || !t.tracker->get_landmark(t.landmark))
 					t.landmark.resize(0);
+				if (ret)
+					reset_prediction(t);
 				stage_surface_to_tracker(t);
 				t.tracker->signal();
 				t.tracker->unlock();
@@ -278,12 +739,15 @@ inline void face_tracker_manager::stage_to_trackers()
 		} else if (t.state == tracker_inst_s::tracker_state_available) {
 			if (!t.tracker->trylock()) {
 				bool ret = t.tracker->get_face(t.rect);
+				t.motion = get_motion_tracked(t);
 				t.crop_rect = t.crop_tracker;
 				debug_track("tracker_state_available %p %d %d %d %d %f landmark=%d", t.tracker,
 					    t.rect.x0, t.rect.y0, t.rect.x1, t.rect.y1, t.rect.score,
 					    t.landmark.size());
 				if (!ret || !landmark_detection_data || !t.tracker->get_landmark(t.landmark))
 					t.landmark.resize(0);
+				if (ret)
+					correct_prediction(t);
 				stage_surface_to_tracker(t);
 				t.tracker->signal();
 				t.tracker->unlock();
@@ -295,15 +759,68 @@ inline void face_tracker_manager::stage_to_trackers()
 		remove_duplicated_tracker();
 }
 
-static inline void make_tracker_rects(std::vector<face_tracker_manager::tracker_rect_s> &tracker_rects,
-				      const std::deque<face_tracker_manager::tracker_inst_s> &trackers)
+inline void face_tracker_manager::stage_to_multi()
 {
-	size_t n = 0;
-	for (size_t i = 0; i < trackers.size(); i++) {
-		if (trackers[i].state != face_tracker_manager::tracker_inst_s::tracker_state_available)
+	if (!multi || multi->trylock())
+		return;
+
+	for (int id : multi_removed)
+		multi->remove_target(id);
+	multi_removed.clear();
+
+	bool have_new_tracker = false;
+	for (auto &t : trackers) {
+		if (t.tracker)
 			continue;
+		if (t.state == tracker_inst_s::tracker_state_constructing) {
+			t.target_id = multi->add_target(t.tex_detected, t.rect,
+							rectf_s{upsize_l, upsize_t, upsize_r, upsize_b});
+			t.tex_detected.reset();
+			t.state = tracker_inst_s::tracker_state_first_track;
+		} else if (t.state == tracker_inst_s::tracker_state_first_track ||
+			   t.state == tracker_inst_s::tracker_state_available) {
+			if (!multi->get_target_face(t.target_id, t.rect))
+				continue;
+			t.motion = multi->get_target_motion(t.target_id);
+			t.crop_rect = t.crop_tracker;
+			debug_track("stage_to_multi %d state=%d %d %d %d %d %f", t.target_id, (int)t.state, t.rect.x0,
+				    t.rect.y0, t.rect.x1, t.rect.y1, t.rect.score);
+			if (!landmark_detection_data || !multi->get_target_landmark(t.target_id, t.landmark))
+				t.landmark.resize(0);
+			if (t.state == tracker_inst_s::tracker_state_first_track) {
+				t.att = 1.0f;
+				t.score_first = t.rect.score;
+				reset_prediction(t);
+				t.state = tracker_inst_s::tracker_state_available;
+				have_new_tracker = true;
+			} else {
+				correct_prediction(t);
+			}
+		}
+	}
+
+	if (auto cvtex = get_cvtex()) {
+		for (auto &t : trackers) {
+			if (!t.tracker)
+				t.crop_tracker = crop_cur;
+		}
+		multi->set_texture(cvtex);
+		multi->set_landmark_detection(landmark_detection_data);
+		multi->set_update_limit(crowd_mode ? crowd_max_updates : 0);
+		multi->signal();
+	}
+	multi->unlock();
+
+	if (have_new_tracker)
+		remove_duplicated_tracker();
+}
 
-		float score = trackers[i].rect.score * trackers[i].att;
+static inline void make_tracker_rects(std::vector<face_tracker_manager::tracker_rect_s> &tracker_rects,
+				      const face_tracker_manager::snapshot_s &snapshot, bool motion_prediction)
+{
+	size_t n = 0;
+	for (const auto &t : snapshot.trackers) {
+		const float score = t.rect.score;
 
 		if (score <= 0.0f || isnan(score))
 			continue;
@@ -312,10 +829,30 @@ static inline void make_tracker_rects(std::vector<face_tracker_manager::tracker_
 			tracker_rects.resize(n + 1);
 		auto &r = tracker_rects[n++];
 
-		r.rect = trackers[i].rect;
-		r.rect.score = score;
-		r.crop_rect = trackers[i].crop_rect;
-		r.landmark = trackers[i].landmark;
+		r.rect = t.rect;
+		r.crop_rect = t.crop_rect;
+		r.landmark = t.landmark;
+		r.motion = t.motion;
+
+		if (motion_prediction) {
+			// Move the rectangle and the landmark to the predicted location at the current tick.
+			// The prediction excludes the camera motion, which is added back up to the latest texture.
+			const auto &kf = t.kf;
+			const f3 m(t.rect);
+			const float k = m.v[2] > 0.0f && kf[2].x > 0.0f ? kf[2].x / m.v[2] : 1.0f;
+			const float cx = kf[0].x + snapshot.motion.x;
+			const float cy = kf[1].x + snapshot.motion.y;
+			r.rect.x0 = (int)roundf(cx + (t.rect.x0 - m.v[0]) * k);
+			r.rect.x1 = (int)roundf(cx + (t.rect.x1 - m.v[0]) * k);
+			r.rect.y0 = (int)roundf(cy + (t.rect.y0 - m.v[1]) * k);
+			r.rect.y1 = (int)roundf(cy + (t.rect.y1 - m.v[1]) * k);
+			for (auto &p : r.landmark) {
+				p.x = cx + (p.x - m.v[0]) * k;
+				p.y = cy + (p.y - m.v[1]) * k;
+			}
+			r.crop_rect = snapshot.crop_cur;
+			r.motion = snapshot.motion;
+		}
 	}
 
 	if (tracker_rects.size() > n)
@@ -324,25 +861,108 @@ static inline void make_tracker_rects(std::vector<face_tracker_manager::tracker_
 
 void face_tracker_manager::tick(float second)
 {
+	detect_interval.store((int)(2.0f / second), std::memory_order_relaxed); // detect for each _ second(s).
+
+	const int tick = tick_cnt.load(std::memory_order_relaxed) + 1;
+	tick_cnt.store(tick, std::memory_order_relaxed);
+
+	snapshots.acquire();
+	snapshot_s &snapshot = snapshots.front();
+
 	if (reset_requested) {
-		for (int i = trackers.size() - 1; i >= 0; i--)
-			trackers[i].att = 0.0f;
-		detect_rects.clear();
-		reset_requested = false;
+		// `post_render` will clear the trackers. Until then, old snapshot should not be shown.
+		snapshot.trackers.clear();
+		snapshot.detect_rects.clear();
 	}
 
-	if (detect_tick == tick_cnt)
-		next_tick_stage_to_detector = tick_cnt + (int)(2.0f / second); // detect for each _ second(s).
+	for (auto &t : snapshot.trackers) {
+		const float q = sqf(t.kf[2].x * KF_Q_RATIO);
+		for (int i = 0; i < 3; i++)
+			t.kf[i].predict(tick - t.kf_tick, q);
+		t.kf_tick = tick;
+	}
 
-	tick_cnt += 1;
+	make_tracker_rects(tracker_rects, snapshot, motion_prediction);
+	detect_rects = snapshot.detect_rects;
 
-	make_tracker_rects(tracker_rects, trackers);
+	int tick_detected_max = tick_detected_reported;
+	for (const auto &t : snapshot.trackers) {
+		if (t.tick_detected <= tick_detected_reported)
+			continue;
+		detect_to_crop_frames = tick - t.tick_detected;
+		blog(LOG_DEBUG, "new tracker %p: %d frame(s) from detection request, %d frame(s) from detection results",
+		     t.tracker, tick - t.tick_cnt, detect_to_crop_frames);
+		tick_detected_max = std::max(tick_detected_max, t.tick_detected);
+	}
+	tick_detected_reported = tick_detected_max;
+}
+
+inline void face_tracker_manager::publish_snapshot()
+{
+	snapshot_s &snapshot = snapshots.back();
+	size_t n = 0;
+	for (const auto &t : trackers) {
+		if (t.state != tracker_inst_s::tracker_state_available)
+			continue;
+
+		// Reuse the elements so that the landmark buffers are not reallocated.
+		if (snapshot.trackers.size() <= n)
+			snapshot.trackers.resize(n + 1);
+		auto &r = snapshot.trackers[n++];
+		r.tracker = t.tracker;
+		r.rect = t.rect;
+		r.rect.score = t.rect.score * t.att;
+		r.crop_rect = t.crop_rect;
+		r.landmark = t.landmark;
+		r.motion = t.motion;
+		for (int i = 0; i < 3; i++)
+			r.kf[i] = t.kf[i];
+		r.kf_tick = t.kf_tick;
+		r.tick_cnt = t.tick_cnt;
+		r.tick_detected = t.tick_detected;
+	}
+	if (snapshot.trackers.size() > n)
+		snapshot.trackers.resize(n);
+	snapshot.detect_rects = detect_results;
+	snapshot.crop_cur = crop_cur;
+	if (auto cvtex = get_cvtex())
+		snapshot.motion = cvtex->motion;
+	snapshots.publish();
 }
 
 void face_tracker_manager::post_render()
 {
+	tick_post = tick_cnt.load(std::memory_order_relaxed);
+
+	if (reset_requested.exchange(false)) {
+		for (auto &t : trackers)
+			t.att = 0.0f;
+		detect_results.clear();
+	}
+
+	update_scene();
 	stage_to_detector();
-	stage_to_trackers();
+
+	// Skip the trackers while nothing moves unless a new tracker is waiting for its first update.
+	bool pending = !multi_removed.empty();
+	for (const auto &t : trackers) {
+		if (t.state == tracker_inst_s::tracker_state_constructing ||
+		    t.state == tracker_inst_s::tracker_state_first_track)
+			pending = true;
+	}
+	if (!trackers.empty())
+		scene_track_cnt++;
+	if (scene_static && !pending) {
+		if (!trackers.empty())
+			scene_track_skipped++;
+	} else {
+		stage_to_trackers();
+		stage_to_multi();
+		scene->set_reference(SCENE_REF_TRACK);
+	}
+
+	publish_snapshot();
+	report_scene();
 }
 
 static void update_detector(face_tracker_manager *ftm, enum face_tracker_manager::detector_engine_e detector_engine)
@@ -360,6 +980,9 @@ static void update_detector(face_tracker_manager *ftm, enum face_tracker_manager
 	case face_tracker_manager::engine_dlib_cnn:
 		ftm->detect = new face_detector_dlib_cnn();
 		break;
+	case face_tracker_manager::engine_dlib_cascade:
+		ftm->detect = new face_detector_dlib_cascade();
+		break;
 	default:
 		blog(LOG_ERROR, "unknown detector_engine %d", (int)detector_engine);
 	}
@@ -382,6 +1005,11 @@ void face_tracker_manager::update(obs_data_t *settings)
 		update_detector(this, _detector_engine);
 	detector_dlib_hog_model = obs_data_get_string(settings, "detector_dlib_hog_model");
 	detector_dlib_cnn_model = obs_data_get_string(settings, "detector_dlib_cnn_model");
+	detector_cascade_audit = (int)obs_data_get_int(settings, "debug_cascade_audit");
+	tracker_engine = (enum tracker_engine_e)obs_data_get_int(settings, "tracker_engine");
+	tracker_batch = obs_data_get_bool(settings, "tracker_batch");
+	crowd_mode = obs_data_get_bool(settings, "crowd_mode");
+	crowd_max_updates = obs_data_get_int(settings, "crowd_max_updates");
 	detector_crop_l = obs_data_get_int(settings, "detector_crop_l");
 	detector_crop_r = obs_data_get_int(settings, "detector_crop_r");
 	detector_crop_t = obs_data_get_int(settings, "detector_crop_t");
@@ -391,6 +1019,8 @@ void face_tracker_manager::update(obs_data_t *settings)
 	landmark_detection_data = NULL;
 	if (landmark_detection)
 		landmark_detection_data = bstrdup(obs_data_get_string(settings, "landmark_detection_data"));
+	motion_prediction = obs_data_get_bool(settings, "motion_prediction");
+	scene_gate = obs_data_get_bool(settings, "scene_gate");
 	if (obs_data_get_bool(settings, "tracking_th_en"))
 		tracking_threshold = from_dB(obs_data_get_double(settings, "tracking_th_dB"));
 	else
@@ -405,6 +1035,22 @@ static bool tracking_th_en_modified(obs_properties_t *props, obs_property_t *, o
 	return true;
 }
 
+static bool tracker_engine_modified(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	auto tracker_engine = (enum face_tracker_manager::tracker_engine_e)obs_data_get_int(settings, "tracker_engine");
+	obs_property_t *tracker_batch = obs_properties_get(props, "tracker_batch");
+	obs_property_set_visible(tracker_batch, tracker_engine != face_tracker_manager::tracker_dlib_correlation);
+	return true;
+}
+
+static bool crowd_mode_modified(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	bool crowd_mode = obs_data_get_bool(settings, "crowd_mode");
+	obs_property_t *crowd_max_updates = obs_properties_get(props, "crowd_max_updates");
+	obs_property_set_visible(crowd_max_updates, crowd_mode);
+	return true;
+}
+
 void face_tracker_manager::get_properties(obs_properties_t *pp)
 {
 	obs_property_t *p;
@@ -419,6 +1065,7 @@ void face_tracker_manager::get_properties(obs_properties_t *pp)
 				    OBS_COMBO_FORMAT_INT);
 	obs_property_list_add_int(p, obs_module_text("Detector.dlib.hog"), (int)engine_dlib_hog);
 	obs_property_list_add_int(p, obs_module_text("Detector.dlib.cnn"), (int)engine_dlib_cnn);
+	obs_property_list_add_int(p, obs_module_text("Detector.dlib.cascade"), (int)engine_dlib_cascade);
 	obs_properties_add_path(pp, "detector_dlib_hog_model", obs_module_text("Dlib HOG model"), OBS_PATH_FILE,
 				"Data Files (*.dat);;"
 				"All Files (*.*)",
@@ -427,6 +1074,16 @@ void face_tracker_manager::get_properties(obs_properties_t *pp)
 				"Data Files (*.dat);;"
 				"All Files (*.*)",
 				(data_path + "/" DIR_DLIB_CNN).c_str());
+	p = obs_properties_add_list(pp, "tracker_engine", obs_module_text("Tracker"), OBS_COMBO_TYPE_LIST,
+				    OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p, obs_module_text("Tracker.dlib.correlation"), (int)tracker_dlib_correlation);
+	obs_property_list_add_int(p, obs_module_text("Tracker.kcf.gray"), (int)tracker_kcf_gray);
+	obs_property_list_add_int(p, obs_module_text("Tracker.kcf.hog"), (int)tracker_kcf_hog);
+	obs_property_set_modified_callback(p, tracker_engine_modified);
+	obs_properties_add_bool(pp, "tracker_batch", obs_module_text("Track all faces in one thread"));
+	p = obs_properties_add_bool(pp, "crowd_mode", obs_module_text("Crowd mode"));
+	obs_property_set_modified_callback(p, crowd_mode_modified);
+	obs_properties_add_int(pp, "crowd_max_updates", obs_module_text("Faces to track in each frame"), 1, 100, 1);
 	obs_properties_add_int(pp, "detector_crop_l", obs_module_text("Crop left for detector"), 0, 1920, 1);
 	obs_properties_add_int(pp, "detector_crop_r", obs_module_text("Crop right for detector"), 0, 1920, 1);
 	obs_properties_add_int(pp, "detector_crop_t", obs_module_text("Crop top for detector"), 0, 1080, 1);
@@ -444,6 +1101,8 @@ void face_tracker_manager::get_properties(obs_properties_t *pp)
 	obs_property_set_modified_callback(p, tracking_th_en_modified);
 	p = obs_properties_add_float(pp, "tracking_th_dB", obs_module_text("Tracking threshold"), -120.0, -20.0, 5.0);
 	obs_property_float_set_suffix(p, " dB");
+	obs_properties_add_bool(pp, "motion_prediction", obs_module_text("Predict face motion"));
+	obs_properties_add_bool(pp, "scene_gate", obs_module_text("Skip unchanged frames and reset on scene cuts"));
 }
 
 void face_tracker_manager::get_defaults(obs_data_t *settings)
@@ -455,6 +1114,9 @@ void face_tracker_manager::get_defaults(obs_data_t *settings)
 	obs_data_set_default_double(settings, "scale", 2.0);
 	obs_data_set_default_bool(settings, "tracking_th_en", true);
 	obs_data_set_default_double(settings, "tracking_th_dB", -80.0);
+	obs_data_set_default_bool(settings, "motion_prediction", true);
+	obs_data_set_default_bool(settings, "scene_gate", false);
+	obs_data_set_default_int(settings, "crowd_max_updates", 8);
 
 	if (char *f = obs_module_file(DIR_DLIB_HOG "/frontal_face_detector.dat")) {
 		obs_data_set_default_string(settings, "detector_dlib_hog_model", f);
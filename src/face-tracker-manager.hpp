@@ -1,31 +1,55 @@
 #pragma once
 
+#include <atomic>
 #include <deque>
 #include <string>
 #include "face-tracker-base.h"
+#include "kalman-filter.hpp"
+#include "spatial-grid.hpp"
+#include "triple-buffer.hpp"
+
+/* Threading model
+ * `post_render` is the producer. It owns `trackers`, talks to the detector and the trackers, and publishes a
+ * snapshot of the available trackers at the end of each call.
+ * `tick` is the consumer. It takes the latest snapshot, predicts the motion, and makes `tracker_rects`.
+ * The two can run on different threads without a lock. The results `detect_rects` and `tracker_rects` belong to the
+ * consumer thread.
+ */
 
 class face_tracker_manager {
 public:
 	enum detector_engine_e {
 		engine_dlib_hog = 0,
 		engine_dlib_cnn = 1,
+		engine_dlib_cascade = 2,
 		engine_uninitialized = -1,
 	};
 
+	enum tracker_engine_e {
+		tracker_dlib_correlation = 0,
+		tracker_kcf_gray = 1,
+		tracker_kcf_hog = 2,
+	};
+
 	struct tracker_rect_s
 	{
 		rect_s rect;
 		rectf_s crop_rect;
 		std::vector<pointf_s> landmark;
+		pointf_s motion; // `motion` of the texture where `rect` is located
 	};
 
 	struct tracker_inst_s
 	{
-		class face_tracker_base *tracker;
+		class face_tracker_base *tracker; // NULL if the face is tracked by the batched tracker
+		enum tracker_engine_e engine;
+		int target_id;                            // target in the batched tracker, -1 if not added yet
+		std::shared_ptr<texture_object> tex_detected; // texture to add the target to the batched tracker
 		rect_s rect;
 		rectf_s crop_tracker; // crop corresponding to current processing image
 		rectf_s crop_rect;    // crop corresponding to rect
 		std::vector<pointf_s> landmark;
+		pointf_s motion; // `motion` of the texture corresponding to rect
 		float att;
 		float score_first;
 		enum tracker_state_e {
@@ -37,24 +61,58 @@ public:
 			tracker_state_ending,
 		} state;
 		int tick_cnt;
+		int tick_detected; // tick when the detection results were received, -1 if not yet
+		kalman_cv_s kf[3];  // motion prediction for center x, center y, and size, excluding the camera motion
+		int kf_tick;        // tick of the predicted state
+		int tick_measured;  // tick of the texture of the latest measurement
+	};
+
+	// Copy of an available tracker passed from `post_render` to `tick`.
+	struct tracker_snapshot_s
+	{
+		const void *tracker; // only for logging
+		rect_s rect;         // `score` is attenuated
+		rectf_s crop_rect;
+		std::vector<pointf_s> landmark;
+		pointf_s motion;
+		kalman_cv_s kf[3];
+		int kf_tick;
+		int tick_cnt;
+		int tick_detected;
+	};
+
+	struct snapshot_s
+	{
+		std::vector<tracker_snapshot_s> trackers;
+		std::vector<rect_s> detect_rects;
+		rectf_s crop_cur;
+		pointf_s motion = {0.0f, 0.0f}; // `motion` of the latest texture
 	};
 
 public: // properties
 	float upsize_l, upsize_r, upsize_t, upsize_b;
 	volatile float scale;
-	volatile bool reset_requested;
+	std::atomic<bool> reset_requested;
 	float tracking_threshold;
+	bool motion_prediction;
 	enum detector_engine_e detector_engine = engine_uninitialized;
+	enum tracker_engine_e tracker_engine;
+	bool tracker_batch;
+	bool crowd_mode;
+	int crowd_max_updates;
 	std::string detector_dlib_hog_model;
 	std::string detector_dlib_cnn_model;
+	int detector_cascade_audit;
 	int detector_crop_l, detector_crop_r, detector_crop_t, detector_crop_b;
 	char *landmark_detection_data;
+	bool scene_gate;
 
 public: // realtime status
-	rectf_s crop_cur;
-	int tick_cnt;
+	rectf_s crop_cur; // written by the thread calling `post_render`
+	std::atomic<int> tick_cnt;
+	int detect_to_crop_frames; // frames from detection results to the 1st crop update of the new tracker
 
-public: // results
+public: // results, updated by `tick`
 	std::vector<rect_s> detect_rects;
 	std::vector<tracker_rect_s> tracker_rects;
 
@@ -66,9 +124,39 @@ public: /* not sure they are necessary to be public */
 	std::deque<struct tracker_inst_s> trackers;
 	std::deque<struct tracker_inst_s> trackers_idlepool;
 
-private:
+private: // producer
+	int tick_post; // `tick_cnt` at the beginning of `post_render`
 	int next_tick_stage_to_detector;
 	bool detector_in_progress;
+	bool detector_levels_pending; // the levels for the next detection were staged at `detector_levels_tick`
+	int detector_levels_tick;
+	std::vector<rect_s> detect_results;
+	class face_tracker_multi *multi;
+	std::vector<int> multi_removed; // targets to be removed from `multi` at the next lock
+	spatial_grid grid;
+	std::vector<int> grid_candidates;
+	std::vector<char> to_remove;
+	bool detect_partial;  // the detection in progress searches only `detect_region`
+	rect_s detect_region; // in the source pixels
+
+	// scene change gating
+	class scene_change *scene;
+	std::vector<uint8_t> scene_gray;
+	int scene_tick;                // `tick` of the texture analyzed last
+	int scene_cut_tick;            // `tick_post` at the last scene cut
+	bool scene_static;             // nothing changed since the trackers took the texture last
+	uint64_t scene_mask;           // tiles changed since the detector took the texture last
+	int scene_width, scene_height; // size of the texture analyzed last in the source pixels
+	int scene_partial_cnt;         // skipped or partial detections since the last full detection
+	int scene_report_cnt, scene_detect_cnt, scene_detect_skipped, scene_track_cnt, scene_track_skipped;
+	int scene_cut_cnt;
+
+private: // shared
+	triple_buffer<snapshot_s> snapshots;
+	std::atomic<int> detect_interval; // ticks between detections
+
+private: // consumer
+	int tick_detected_reported;
 
 public:
 	face_tracker_manager();
@@ -79,16 +167,46 @@ public:
 	static void get_properties(obs_properties_t *);
 	static void get_defaults(obs_data_t *settings);
 
+	/* Returns true if the detector is idle and will take a texture within `ticks` ticks, and the levels for the
+	 * detector have not been staged for it yet.
+	 */
+	bool detector_levels_due(int ticks) const
+	{
+		return detect && !detector_in_progress && !detector_levels_pending &&
+		       next_tick_stage_to_detector - tick_post <= ticks;
+	}
+
+	// Tells that the levels for the next detection were staged at `tick`. The detector waits for the texture of
+	// the tick.
+	void detector_levels_staged(int tick)
+	{
+		detector_levels_pending = true;
+		detector_levels_tick = tick;
+	}
+
 protected:
 	virtual std::shared_ptr<texture_object> get_cvtex() = 0;
 
 private:
 	inline void retire_tracker(int ix);
+	face_tracker_base *new_tracker();
+	void update_multi();
+	inline int get_tick_tracked(const tracker_inst_s &t);
+	inline pointf_s get_motion_tracked(const tracker_inst_s &t);
 	inline bool is_low_confident(const tracker_inst_s &t, float th1);
 	void remove_duplicated_tracker();
 	void attenuate_tracker();
+	void reset_prediction(tracker_inst_s &t);
+	void correct_prediction(tracker_inst_s &t);
+	void add_crowd_targets(size_t ix);
 	void copy_detector_to_tracker();
+	void update_scene();
+	bool get_scene_region(rect_s &region, float detect_scale) const;
+	void report_scene();
+	std::vector<rect_s> cascade_hints(const pointf_s &motion) const;
 	void stage_to_detector();
 	int stage_surface_to_tracker(struct tracker_inst_s &t);
 	void stage_to_trackers();
+	void stage_to_multi();
+	void publish_snapshot();
 };
@@ -0,0 +1,421 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "plugin-macros.generated.h"
+#include "texture-object.h"
+#include "face-tracker-multi.h"
+
+#include <algorithm>
+#include <dlib/image_processing.h>
+
+template<typename T> static inline void swap_remove(std::vector<T> &v, size_t i)
+{
+	if (i + 1 < v.size())
+		v[i] = std::move(v.back());
+	v.pop_back();
+}
+
+struct face_tracker_multi_private_s
+{
+	kcf_core core;
+	std::shared_ptr<texture_object> tex;
+	std::vector<uint8_t> gray;
+	std::vector<uint8_t> gray_init;
+	dlib::matrix<dlib::rgb_pixel> img;
+	dlib::matrix<unsigned char> img_gray;
+	dlib::matrix<dlib::rgb_pixel> roi_rgb;
+	dlib::matrix<unsigned char> roi_gray;
+	dlib::shape_predictor sp;
+	char *landmark_detection_data;
+	bool landmark_detection_data_updated;
+	bool sp_available = false;
+	rectf_s upsize_default;
+	int next_id;
+	int last_id;
+	int update_limit;
+	std::vector<kcf_model_s *> model_pool;
+
+	// landmarks, `landmark_parts` points are reserved for each slot
+	int landmark_parts;
+	std::vector<pointf_s> landmark;
+	std::vector<int> landmark_free;
+
+	// work buffers to select the targets to update
+	std::vector<float> priority;
+	std::vector<int> order;
+
+	// targets, structure of arrays
+	std::vector<int> id;
+	std::vector<kcf_model_s *> model;
+	std::vector<kcf_box_s> box;
+	std::vector<rect_s> rect;
+	std::vector<rectf_s> upsize;
+	std::vector<float> pslr_max, pslr_min;
+	std::vector<float> scale_orig;
+	std::vector<int> n_track;
+	std::vector<int> tick;
+	std::vector<pointf_s> motion; // `motion` of the texture for `rect`
+	std::vector<uint64_t> last_ns;
+	std::vector<std::shared_ptr<texture_object>> tex_init; // texture to construct the model, reset once constructed
+	std::vector<int> landmark_slot;
+	std::vector<int> landmark_n;
+
+	face_tracker_multi_private_s(enum kcf_feature_e feature) : core(feature)
+	{
+		landmark_detection_data = NULL;
+		landmark_detection_data_updated = false;
+		upsize_default = rectf_s{0.0f, 0.0f, 0.0f, 0.0f};
+		next_id = 0;
+		last_id = -1;
+		update_limit = 0;
+		landmark_parts = 0;
+	}
+
+	~face_tracker_multi_private_s()
+	{
+		for (auto *m : model_pool)
+			delete m;
+		for (auto *m : model)
+			delete m;
+	}
+
+	int find(int target_id) const
+	{
+		for (size_t i = 0; i < id.size(); i++)
+			if (id[i] == target_id)
+				return (int)i;
+		return -1;
+	}
+
+	void set_landmark_parts(int parts)
+	{
+		if (parts == landmark_parts)
+			return;
+		const int n_slots = (int)(landmark_slot.size() + landmark_free.size());
+		landmark_parts = parts;
+		landmark.assign((size_t)n_slots * parts, pointf_s{0.0f, 0.0f});
+		std::fill(landmark_n.begin(), landmark_n.end(), 0);
+	}
+
+	int alloc_landmark_slot()
+	{
+		if (landmark_free.size()) {
+			int slot = landmark_free.back();
+			landmark_free.pop_back();
+			return slot;
+		}
+		const int slot = (int)landmark_slot.size();
+		landmark.resize((size_t)(slot + 1) * landmark_parts);
+		return slot;
+	}
+
+	void erase(size_t i)
+	{
+		model_pool.push_back(model[i]);
+		landmark_free.push_back(landmark_slot[i]);
+		swap_remove(id, i);
+		swap_remove(model, i);
+		swap_remove(box, i);
+		swap_remove(rect, i);
+		swap_remove(upsize, i);
+		swap_remove(pslr_max, i);
+		swap_remove(pslr_min, i);
+		swap_remove(scale_orig, i);
+		swap_remove(n_track, i);
+		swap_remove(tick, i);
+		swap_remove(motion, i);
+		swap_remove(last_ns, i);
+		swap_remove(tex_init, i);
+		swap_remove(landmark_slot, i);
+		swap_remove(landmark_n, i);
+	}
+};
+
+face_tracker_multi::face_tracker_multi(enum kcf_feature_e feature)
+{
+	p = new face_tracker_multi_private_s(feature);
+}
+
+face_tracker_multi::~face_tracker_multi()
+{
+	bfree(p->landmark_detection_data);
+	delete p;
+}
+
+enum kcf_feature_e face_tracker_multi::get_feature() const
+{
+	return p->core.get_feature();
+}
+
+int face_tracker_multi::add_target(std::shared_ptr<texture_object> &tex, const rect_s &rect, const rectf_s &upsize)
+{
+	kcf_model_s *m;
+	if (p->model_pool.size()) {
+		m = p->model_pool.back();
+		p->model_pool.pop_back();
+	} else
+		m = new kcf_model_s;
+
+	const int id = p->next_id++;
+	p->id.push_back(id);
+	p->model.push_back(m);
+	p->box.push_back(kcf_box_s{0.0f, 0.0f, 0.0f, 0.0f});
+	p->rect.push_back(rect_s{(int)(rect.x0 / tex->scale), (int)(rect.y0 / tex->scale),
+				 (int)(rect.x1 / tex->scale), (int)(rect.y1 / tex->scale), 1.0f});
+	p->upsize.push_back(upsize);
+	p->pslr_max.push_back(0.0f);
+	p->pslr_min.push_back(1e9f);
+	p->scale_orig.push_back(tex->scale);
+	p->n_track.push_back(0);
+	p->tick.push_back(-1);
+	p->motion.push_back(tex->motion);
+	p->last_ns.push_back(0);
+	p->tex_init.push_back(tex);
+	p->landmark_slot.push_back(p->alloc_landmark_slot());
+	p->landmark_n.push_back(0);
+
+	p->last_id = id;
+	return id;
+}
+
+void face_tracker_multi::remove_target(int id)
+{
+	int i = p->find(id);
+	if (i >= 0)
+		p->erase(i);
+}
+
+bool face_tracker_multi::get_target_face(int id, struct rect_s &rect)
+{
+	int i = p->find(id);
+	if (i < 0 || p->n_track[i] <= 0)
+		return false;
+	rect = p->rect[i];
+	return true;
+}
+
+bool face_tracker_multi::get_target_landmark(int id, std::vector<pointf_s> &results)
+{
+	int i = p->find(id);
+	if (i < 0 || p->landmark_n[i] <= 0)
+		return false;
+
+	const pointf_s *lm = p->landmark.data() + (size_t)p->landmark_slot[i] * p->landmark_parts;
+	results.assign(lm, lm + p->landmark_n[i]);
+	return true;
+}
+
+int face_tracker_multi::get_target_tick(int id) const
+{
+	int i = p->find(id);
+	return i >= 0 ? p->tick[i] : -1;
+}
+
+pointf_s face_tracker_multi::get_target_motion(int id) const
+{
+	int i = p->find(id);
+	return i >= 0 ? p->motion[i] : pointf_s{0.0f, 0.0f};
+}
+
+void face_tracker_multi::set_update_limit(int n)
+{
+	p->update_limit = n;
+}
+
+void face_tracker_multi::set_texture(std::shared_ptr<texture_object> &tex)
+{
+	p->tex = tex;
+}
+
+void face_tracker_multi::set_position(const rect_s &rect)
+{
+	if (!p->tex) {
+		blog(LOG_ERROR, "face_tracker_multi::set_position: texture was not set. rect=(%d %d %d %d %f)", rect.x0,
+		     rect.y0, rect.x1, rect.y1, rect.score);
+		return;
+	}
+
+	add_target(p->tex, rect, p->upsize_default);
+}
+
+void face_tracker_multi::set_upsize_info(const rectf_s &upsize)
+{
+	p->upsize_default = upsize;
+}
+
+void face_tracker_multi::set_landmark_detection(const char *data_file_path)
+{
+	if (p->landmark_detection_data && data_file_path && strcmp(p->landmark_detection_data, data_file_path) == 0)
+		return;
+
+	bfree(p->landmark_detection_data);
+	p->landmark_detection_data = NULL;
+	if (data_file_path) {
+		p->landmark_detection_data = bstrdup(data_file_path);
+		p->landmark_detection_data_updated = true;
+	}
+}
+
+bool face_tracker_multi::get_face(struct rect_s &rect)
+{
+	return get_target_face(p->last_id, rect);
+}
+
+bool face_tracker_multi::get_landmark(std::vector<pointf_s> &results)
+{
+	return get_target_landmark(p->last_id, results);
+}
+
+template<typename Tx, typename Ta> inline Tx internal_division(Tx x0, Tx x1, Ta a0, Ta a1)
+{
+	return (x0 * a1 + x1 * a0) / (a0 + a1);
+}
+
+// Selects the targets to update for this frame into `p->order`.
+// Targets waiting for the construction are always selected. The others are selected by the number of frames since
+// the last update weighted by the size so that small faces are updated less often but not starved.
+static void select_targets(struct face_tracker_multi_private_s *p, int tick)
+{
+	const int n = (int)p->id.size();
+	p->order.resize(n);
+	for (int i = 0; i < n; i++)
+		p->order[i] = i;
+	if (p->update_limit <= 0 || n <= p->update_limit)
+		return;
+
+	p->priority.resize(n);
+	for (int i = 0; i < n; i++) {
+		if (p->tex_init[i])
+			p->priority[i] = 1e30f;
+		else
+			p->priority[i] = (tick - p->tick[i]) * sqrtf(p->box[i].w * p->box[i].h);
+	}
+
+	const auto &priority = p->priority;
+	std::nth_element(p->order.begin(), p->order.begin() + p->update_limit, p->order.end(),
+			 [&priority](int a, int b) { return priority[a] > priority[b]; });
+	p->order.resize(p->update_limit);
+	std::sort(p->order.begin(), p->order.end());
+}
+
+void face_tracker_multi::track_main()
+{
+	if (!p->tex)
+		return;
+
+	uint64_t ns = os_gettime_ns();
+	int nc, nr;
+	if (!p->tex->get_gray_image(p->gray, nc, nr) || nc < 2 || nr < 2)
+		return;
+	const kcf_image_s img = {p->gray.data(), nc, nr, nc};
+	const float scale = p->tex->scale;
+
+	if (p->landmark_detection_data && p->landmark_detection_data_updated) {
+		p->landmark_detection_data_updated = false;
+		blog(LOG_INFO, "loading file %s", p->landmark_detection_data);
+		try {
+			p->sp_available = false;
+			dlib::deserialize(p->landmark_detection_data) >> p->sp;
+			p->sp_available = true;
+			p->set_landmark_parts((int)p->sp.num_parts());
+		} catch (...) {
+			blog(LOG_ERROR, "Failed to load file %s", p->landmark_detection_data);
+		}
+	}
+	// The whole image is converted only when a face is not covered by a region of interest.
+	const bool landmark = p->landmark_detection_data && p->sp_available;
+	bool img_loaded = false, img_ok = false;
+
+	select_targets(p, p->tex->tick);
+
+	int n_updated = 0;
+	const texture_object *tex_init_last = NULL;
+	bool tex_init_ok = false;
+	int nc0 = 0, nr0 = 0;
+	for (int i : p->order) {
+		if (p->tex_init[i]) {
+			const rect_s &r = p->rect[i];
+			// Targets from one detection share the texture.
+			if (p->tex_init[i].get() != tex_init_last) {
+				tex_init_last = p->tex_init[i].get();
+				tex_init_ok = p->tex_init[i]->get_gray_image(p->gray_init, nc0, nr0);
+			}
+			if (tex_init_ok && nc0 == nc && nr0 == nr) {
+				const kcf_image_s img0 = {p->gray_init.data(), nc0, nr0, nc0};
+				p->core.init(*p->model[i], p->box[i], img0, r.x0, r.y0, r.x1, r.y1);
+			} else {
+				p->scale_orig[i] = 0.0f;
+			}
+			p->tex_init[i].reset();
+			p->last_ns[i] = ns;
+		}
+
+		if (scale != p->scale_orig[i]) {
+			p->rect[i].score = 0.0f;
+			p->n_track[i] += 1; // to return score=0
+			continue;
+		}
+
+		// Start searching from where the camera motion has moved the face.
+		p->box[i].cx += (p->tex->motion.x - p->motion[i].x) / scale;
+		p->box[i].cy += (p->tex->motion.y - p->motion[i].y) / scale;
+		float s = p->core.update(*p->model[i], p->box[i], img);
+		if (s > p->pslr_max[i])
+			p->pslr_max[i] = s;
+		if (s < p->pslr_min[i])
+			p->pslr_min[i] = s;
+		const kcf_box_s &b = p->box[i];
+		rect_s &r = p->rect[i];
+		r.x0 = (b.cx - b.w * 0.5f) * scale;
+		r.y0 = (b.cy - b.h * 0.5f) * scale;
+		r.x1 = (b.cx + b.w * 0.5f) * scale;
+		r.y1 = (b.cy + b.h * 0.5f) * scale;
+		s = p->pslr_max[i] / p->pslr_min[i] * ((ns - p->last_ns[i]) * 1e-9f);
+		r.score = r.score / (1.0f + s);
+		p->n_track[i] += 1;
+		p->tick[i] = p->tex->tick;
+		p->motion[i] = p->tex->motion;
+		p->last_ns[i] = ns;
+
+		if (landmark) {
+			const rectf_s &u = p->upsize[i];
+			const float l = b.cx - b.w * 0.5f, rr = b.cx + b.w * 0.5f;
+			const float t = b.cy - b.h * 0.5f, bb = b.cy + b.h * 0.5f;
+			dlib::rectangle r_face(internal_division(l, rr, u.x0, u.x1 + 1.0f),
+					       internal_division(t, bb, u.y0, u.y1 + 1.0f),
+					       internal_division(l, rr, u.x0 + 1.0f, u.x1),
+					       internal_division(t, bb, u.y0 + 1.0f, u.y1));
+			const texture_object &tex = p->tex->finest(r_face);
+			dlib::full_object_detection shape;
+			if (&tex != p->tex.get()) {
+				with_dlib_image(tex, p->roi_rgb, p->roi_gray,
+						[&](auto &img) { shape = p->sp(img, r_face); });
+			} else {
+				if (!img_loaded) {
+					img_ok = with_dlib_image(*p->tex, p->img, p->img_gray, [](auto &) {});
+					img_loaded = true;
+				}
+				if (img_ok)
+					shape = p->tex->is_gray() ? p->sp(p->img_gray, r_face) : p->sp(p->img, r_face);
+			}
+			const int n = std::min((int)shape.num_parts(), p->landmark_parts);
+			pointf_s *lm = p->landmark.data() + (size_t)p->landmark_slot[i] * p->landmark_parts;
+			for (int j = 0; j < n; j++) {
+				lm[j].x = (float)shape.part(j).x() * tex.scale + tex.origin.x;
+				lm[j].y = (float)shape.part(j).y() * tex.scale + tex.origin.y;
+			}
+			p->landmark_n[i] = n;
+		} else {
+			p->landmark_n[i] = 0;
+		}
+
+		n_updated++;
+	}
+
+	if (n_updated) {
+		tick_tracked = p->tex->tick;
+		add_update_time("face_tracker_multi", os_gettime_ns() - ns, n_updated);
+	}
+
+	p->tex.reset();
+}
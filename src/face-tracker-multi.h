@@ -0,0 +1,40 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "plugin-macros.generated.h"
+#include "face-tracker-base.h"
+#include "kcf-core.hpp"
+
+/* Tracks all faces in one thread.
+ * The grayscale image, the FFT plans, and the work buffers are shared by all targets.
+ * Methods to add, remove, and get targets have to be called while the tracker is locked.
+ */
+class face_tracker_multi : public face_tracker_base {
+	struct face_tracker_multi_private_s *p;
+
+	void track_main() override;
+
+public:
+	face_tracker_multi(enum kcf_feature_e feature);
+	virtual ~face_tracker_multi();
+
+	enum kcf_feature_e get_feature() const;
+
+	int add_target(std::shared_ptr<texture_object> &tex, const rect_s &rect, const rectf_s &upsize);
+	void remove_target(int id);
+	bool get_target_face(int id, struct rect_s &);
+	bool get_target_landmark(int id, std::vector<pointf_s> &);
+	int get_target_tick(int id) const;
+	pointf_s get_target_motion(int id) const;
+
+	// Limits the number of targets updated for each frame. 0 updates all targets.
+	void set_update_limit(int n);
+
+	// Single target interface operates on the most recently added target.
+	void set_texture(std::shared_ptr<texture_object> &) override;
+	void set_position(const rect_s &rect) override;
+	void set_upsize_info(const rectf_s &upsize) override;
+	void set_landmark_detection(const char *data_file_path) override;
+	bool get_face(struct rect_s &) override;
+	bool get_landmark(std::vector<pointf_s> &) override;
+};
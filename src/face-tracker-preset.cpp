@@ -10,6 +10,13 @@ static void copy_data_double(obs_data_t *dst, obs_data_t *src, const char *name)
 	obs_data_set_double(dst, name, v);
 }
 
+static void copy_data_int(obs_data_t *dst, obs_data_t *src, const char *name)
+{
+	blog(LOG_INFO, "copying %s as int", name);
+	long long v = obs_data_get_int(src, name);
+	obs_data_set_int(dst, name, v);
+}
+
 #define preset_mask_track 1
 #define preset_mask_control 2
 static const struct
@@ -54,6 +61,7 @@ static const struct
 			    {"e_nonlineaeer_y", copy_data_double, preset_mask_control},
 			    {"e_nonlineaeer_z", copy_data_double, preset_mask_control},
 			    // specific to face_tracker_ptz
+			    {"control", copy_data_int, preset_mask_control},
 			    {"Kp_x_db", copy_data_double, preset_mask_control},
 			    {"Kp_y_db", copy_data_double, preset_mask_control},
 			    {"Kp_z_db", copy_data_double, preset_mask_control},
@@ -1,7 +1,6 @@
 #include <obs-module.h>
 #include <util/platform.h>
 #include <util/threading.h>
-#include <graphics/vec2.h>
 #include <graphics/graphics.h>
 #include "plugin-macros.generated.h"
 #include "texture-object.h"
@@ -16,24 +15,24 @@
 #include "obsptz-backend.hpp"
 #ifdef WITH_PTZ_TCP
 #include "libvisca-thread.hpp"
+#include "viscaip-backend.hpp"
 #endif
 #include "dummy-backend.hpp"
+#include "sim-backend.hpp"
+#include "global-shift.hpp"
+#include "ptz-calibration.hpp"
+#include "ptz-speed-table.hpp"
+#include "ptz-mpc.hpp"
 
 #define PTZ_MAX_X 0x18
 #define PTZ_MAX_Y 0x14
 #define PTZ_MAX_Z 0x07
-
-enum ptz_cmd_state_e {
-	ptz_cmd_state_none = 0,
-	ptz_cmd_state_pantilt,
-	ptz_cmd_state_zoom,
-};
+#define PTZ_GAIN_FPS 30.0f // frame rate at which the default gains were tuned
 
 class ft_manager_for_ftptz : public face_tracker_manager {
 public:
 	struct face_tracker_ptz *ctx;
 	std::shared_ptr<texture_object> cvtex_cache;
-	enum ptz_cmd_state_e ptz_last_cmd;
 	class ptz_backend *dev;
 
 public:
@@ -101,7 +100,9 @@ static const struct ptz_backend_type_s backends[] = {
 	BACKEND("obsptz", obsptz_backend),
 #ifdef WITH_PTZ_TCP
 	BACKEND("visca-over-tcp", libvisca_thread),
+	BACKEND("visca-over-ip", viscaip_backend),
 #endif // WITH_PTZ_TCP
+	BACKEND("simulator", sim_backend),
 	BACKEND("dummy", dummy_backend),
 	{NULL, NULL, NULL}
 #undef BACKEND
@@ -182,8 +183,13 @@ static void ftptz_update(void *data, obs_data_t *settings)
 {
 	auto *s = (struct face_tracker_ptz *)data;
 
+	// The analysis thread might be using the detector, the trackers, and the settings of the manager.
+	pthread_mutex_lock(&s->ftm_mutex);
 	s->ftm->update(settings);
 	s->ftm->scale = roundf(s->ftm->scale);
+	const int scale = std::max((int)s->ftm->scale, 1);
+	pthread_mutex_unlock(&s->ftm_mutex);
+
 	s->track_z = obs_data_get_double(settings, "track_z");
 	s->track_x = obs_data_get_double(settings, "track_x");
 	s->track_y = obs_data_get_double(settings, "track_y");
@@ -210,11 +216,31 @@ static void ftptz_update(void *data, obs_data_t *settings)
 	s->e_nonlinear.v[2] = (float)obs_data_get_double(settings, "e_nonlinear_z") * 1e-2;
 	float Tatt_int = (float)obs_data_get_double(settings, "Tatt_int");
 	s->f_att_int = Tatt_int > 0.0f ? 1.0f / Tatt_int : 1e3;
+	const auto control = (enum ftptz_control_e)obs_data_get_int(settings, "control");
+	if (control == ftptz_control_mpc && s->control != control) {
+		// Don't reuse the history and the model from the last time MPC was used.
+		os_atomic_set_bool(&s->mpc_reset_requested, true);
+	}
+	s->control = control;
 
 	s->face_lost_preset_timeout_ms = (int)(obs_data_get_double(settings, "face_lost_preset_timeout") * 1e3);
 	s->face_lost_ptz_preset = (int)obs_data_get_int(settings, "face_lost_ptz_preset");
 	s->face_lost_zoomout_timeout_ms = (int)(obs_data_get_double(settings, "face_lost_zoomout_timeout") * 1e3);
 
+	pthread_mutex_lock(&s->analysis_mutex);
+	s->analysis_rate = std::max((float)obs_data_get_double(settings, "analysis_rate"), 1.0f);
+	s->analysis_scale = scale;
+	pthread_mutex_unlock(&s->analysis_mutex);
+	os_atomic_set_bool(&s->ego_motion_enabled, obs_data_get_bool(settings, "ego_motion"));
+	s->hybrid = obs_data_get_bool(settings, "hybrid");
+	s->hybrid_zoom = std::max((float)obs_data_get_double(settings, "hybrid_zoom"), 1.0f);
+	s->hybrid_tc = std::max((float)obs_data_get_double(settings, "hybrid_tc"), 0.01f);
+
+	if (!s->speed_table[0]->parse(obs_data_get_string(settings, "pan_speed_table")))
+		s->speed_table[0]->set(pan_thresholds_default, sizeof(pan_thresholds_default) / sizeof(float));
+	if (!s->speed_table[1]->parse(obs_data_get_string(settings, "tilt_speed_table")))
+		s->speed_table[1]->set(tilt_thresholds_default, sizeof(tilt_thresholds_default) / sizeof(float));
+
 	s->debug_faces = obs_data_get_bool(settings, "debug_faces");
 	s->debug_notrack = obs_data_get_bool(settings, "debug_notrack");
 	s->debug_always_show = obs_data_get_bool(settings, "debug_always_show");
@@ -268,6 +294,8 @@ static void cb_get_state(void *data, calldata_t *cd);
 static void cb_set_state(void *data, calldata_t *cd);
 static const char *ftptz_signals[] = {"void state_changed()", NULL};
 static void emit_state_changed(struct face_tracker_ptz *);
+static void ftptz_analysis_start(struct face_tracker_ptz *s);
+static void ftptz_analysis_stop(struct face_tracker_ptz *s);
 
 static void *ftptz_create(obs_data_t *settings, obs_source_t *context)
 {
@@ -278,7 +306,13 @@ static void *ftptz_create(obs_data_t *settings, obs_source_t *context)
 	s->ftm->scale = 2.0f;
 	s->hotkey_pause = OBS_INVALID_HOTKEY_PAIR_ID;
 	s->hotkey_reset = OBS_INVALID_HOTKEY_ID;
+	s->shift_estimator = new global_shift();
+	s->speed_table[0] = new ptz_speed_table();
+	s->speed_table[1] = new ptz_speed_table();
+	s->mpc[0] = new ptz_mpc("pan");
+	s->mpc[1] = new ptz_mpc("tilt");
 
+	ftptz_analysis_start(s);
 	obs_source_update(context, settings);
 
 	proc_handler_t *ph = obs_source_get_proc_handler(context);
@@ -301,7 +335,14 @@ static void ftptz_destroy(void *data)
 	if (s->hotkey_reset != OBS_INVALID_HOTKEY_ID)
 		obs_hotkey_unregister(s->hotkey_reset);
 
+	ftptz_analysis_stop(s);
 	delete s->ftm;
+	delete s->shift_estimator;
+	delete s->calib;
+	delete s->speed_table[0];
+	delete s->speed_table[1];
+	delete s->mpc[0];
+	delete s->mpc[1];
 	bfree(s->ptz_type);
 	if (s->debug_data_tracker)
 		fclose(s->debug_data_tracker);
@@ -316,6 +357,12 @@ static void ftptz_destroy(void *data)
 	video_scaler_destroy(s->scaler);
 	bfree(s->scaler_buffer);
 
+	if (s->texrender) {
+		obs_enter_graphics();
+		gs_texrender_destroy(s->texrender);
+		obs_leave_graphics();
+	}
+
 	bfree(s);
 }
 
@@ -327,10 +374,20 @@ static bool ftptz_reset_tracking(obs_properties_t *, obs_property_t *, void *dat
 	s->filter_int = f3(0, 0, 0);
 	s->filter_lpf = f3(0, 0, 0);
 	s->ftm->reset_requested = true;
+	os_atomic_set_bool(&s->mpc_reset_requested, true);
 
 	return true;
 }
 
+static bool ftptz_calibrate_speed(obs_properties_t *, obs_property_t *, void *data)
+{
+	auto *s = (struct face_tracker_ptz *)data;
+
+	os_atomic_set_bool(&s->calib_requested, true);
+
+	return false;
+}
+
 static bool ptz_type_modified(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
 {
 	const char *ptz_type = obs_data_get_string(settings, "ptz-type");
@@ -387,6 +444,11 @@ static obs_properties_t *ftptz_properties(void *data)
 	{
 		obs_properties_t *pp = obs_properties_create();
 		face_tracker_manager::get_properties(pp);
+		obs_property_t *p;
+		p = obs_properties_add_float(pp, "analysis_rate", obs_module_text("Analysis frame rate"), 1.0, 120.0,
+					     1.0);
+		obs_property_float_set_suffix(p, " fps");
+		obs_properties_add_bool(pp, "ego_motion", obs_module_text("Compensate camera motion"));
 		obs_properties_add_group(props, "ftm", obs_module_text("Face detection options"), OBS_GROUP_NORMAL, pp);
 	}
 
@@ -402,6 +464,10 @@ static obs_properties_t *ftptz_properties(void *data)
 	{
 		obs_properties_t *pp = obs_properties_create();
 		obs_property_t *p;
+		p = obs_properties_add_list(pp, "control", obs_module_text("Control method"), OBS_COMBO_TYPE_LIST,
+					    OBS_COMBO_FORMAT_INT);
+		obs_property_list_add_int(p, obs_module_text("Control.PID"), (int)ftptz_control_pid);
+		obs_property_list_add_int(p, obs_module_text("Control.MPC"), (int)ftptz_control_mpc);
 		p = obs_properties_add_float(pp, "Kp_x_db", "Track Kp (X)", -40.0, +80.0, 1.0);
 		obs_property_float_set_suffix(p, " dB");
 		p = obs_properties_add_float(pp, "Kp_y_db", "Track Kp (Y)", -40.0, +80.0, 1.0);
@@ -447,12 +513,24 @@ static obs_properties_t *ftptz_properties(void *data)
 		obs_property_list_add_string(p, obs_module_text("through PTZ Controls"), "obsptz");
 #ifdef WITH_PTZ_TCP
 		obs_property_list_add_string(p, obs_module_text("VISCA over TCP"), "visca-over-tcp");
+		obs_property_list_add_string(p, obs_module_text("VISCA over IP (UDP)"), "visca-over-ip");
 #endif // WITH_PTZ_TCP
+		obs_property_list_add_string(p, obs_module_text("Simulator"), "simulator");
 		obs_property_set_modified_callback(p, ptz_type_modified);
 
 		obs_properties_add_bool(pp, "invert_x", obs_module_text("Invert control (Pan)"));
 		obs_properties_add_bool(pp, "invert_y", obs_module_text("Invert control (Tilt)"));
 		obs_properties_add_bool(pp, "invert_z", obs_module_text("Invert control (Zoom)"));
+		obs_properties_add_text(pp, "pan_speed_table", obs_module_text("Speed table (Pan)"), OBS_TEXT_DEFAULT);
+		obs_properties_add_text(pp, "tilt_speed_table", obs_module_text("Speed table (Tilt)"),
+					OBS_TEXT_DEFAULT);
+		obs_properties_add_button(pp, "calibrate_speed", obs_module_text("Calibrate speed"),
+					  ftptz_calibrate_speed);
+		obs_properties_add_bool(pp, "hybrid", obs_module_text("Digital crop"));
+		obs_properties_add_float(pp, "hybrid_zoom", obs_module_text("Digital crop zoom"), 1.0, 4.0, 0.05);
+		p = obs_properties_add_float(pp, "hybrid_tc", obs_module_text("Time for camera to follow"), 0.1, 10.0,
+					     0.1);
+		obs_property_float_set_suffix(p, " s");
 		obs_properties_add_group(props, "output", obs_module_text("Output"), OBS_GROUP_NORMAL, pp);
 	}
 
@@ -460,6 +538,8 @@ static obs_properties_t *ftptz_properties(void *data)
 		obs_properties_t *pp = obs_properties_create();
 		obs_properties_add_bool(pp, "debug_faces", "Show face detection results");
 		obs_properties_add_bool(pp, "debug_always_show", "Always show information (useful for demo)");
+		obs_properties_add_int(pp, "debug_cascade_audit", "Compare HOG + CNN with CNN every N detections", 0,
+				       1000, 1);
 #ifdef ENABLE_DEBUG_DATA
 		obs_properties_add_path(pp, "debug_data_tracker", "Save correlation tracker data to file",
 					OBS_PATH_FILE_SAVE, DEBUG_DATA_PATH_FILTER, NULL);
@@ -479,11 +559,13 @@ static void ftptz_get_defaults(obs_data_t *settings)
 	obs_data_set_default_bool(settings, "preset_mask_track", true);
 	obs_data_set_default_bool(settings, "preset_mask_control", true);
 	face_tracker_manager::get_defaults(settings);
+	obs_data_set_default_double(settings, "analysis_rate", 30.0);
 	obs_data_set_default_double(settings, "tracking_th_dB",
 				    -40.0);                      // overwrite the default from face_tracker_manager
 	obs_data_set_default_double(settings, "track_z", 0.25);  // Smaller is preferable for PTZ not to lose the face.
 	obs_data_set_default_double(settings, "track_y", +0.00); // +0.00 +0.10 +0.30
 
+	obs_data_set_default_int(settings, "control", (int)ftptz_control_pid);
 	obs_data_set_default_double(settings, "Kp_x_db", 50.0);
 	obs_data_set_default_double(settings, "Kp_y_db", 50.0);
 	obs_data_set_default_double(settings, "Kp_z_db", 40.0);
@@ -496,6 +578,8 @@ static void ftptz_get_defaults(obs_data_t *settings)
 	obs_data_set_default_double(settings, "Tdlpf", 2.0);
 	obs_data_set_default_double(settings, "Tdlpf_z", 6.0);
 	obs_data_set_default_double(settings, "Tatt_int", 2.0);
+	obs_data_set_default_double(settings, "hybrid_zoom", 2.0);
+	obs_data_set_default_double(settings, "hybrid_tc", 1.0);
 
 	obs_data_set_default_double(settings, "face_lost_preset_timeout", 5.0);
 	obs_data_set_default_int(settings, "face_lost_ptz_preset", -1);
@@ -507,113 +591,15 @@ static void ftptz_get_defaults(obs_data_t *settings)
 
 	obs_data_set_default_string(settings, "ptz-type", "obsptz");
 	obs_data_set_default_int(settings, "ptz.visca-over-tcp.port", 1259);
+	obs_data_set_default_int(settings, "ptz.visca-over-tcp.camera_address", 1);
+	obs_data_set_default_double(settings, "ptz.visca-over-tcp.query_rate", 10.0);
+	obs_data_set_default_int(settings, "ptz.visca-over-ip.port", 52381);
+	obs_data_set_default_double(settings, "ptz.visca-over-ip.query_rate", 10.0);
+	obs_data_set_default_string(settings, "ptz.simulator.name", "ptz-sim");
 	obs_data_set_default_int(settings, "ptz.obsptz.max_x", PTZ_MAX_X);
 	obs_data_set_default_int(settings, "ptz.obsptz.max_y", PTZ_MAX_Y);
 	obs_data_set_default_int(settings, "ptz.obsptz.max_z", PTZ_MAX_Z);
-}
-
-static inline int pan_flt2raw(float x)
-{
-	// TODO: configurable
-	// TODO: send zero with plus or minus sign, which makes small move.
-	if (x < 0.0f)
-		return -pan_flt2raw(-x);
-	if (x < 0.50f)
-		return 0;
-	if (x < 1.25f)
-		return 1;
-	if (x < 1.85f)
-		return 2;
-	if (x < 2.30f)
-		return 3;
-	if (x < 2.50f)
-		return 4;
-	if (x < 2.70f)
-		return 5;
-	if (x < 2.90f)
-		return 6;
-	if (x < 3.10f)
-		return 7;
-	if (x < 3.30f)
-		return 8;
-	if (x < 3.60f)
-		return 9;
-	if (x < 4.15f)
-		return 10;
-	if (x < 5.25f)
-		return 11;
-	if (x < 7.50f)
-		return 12;
-	if (x < 12.0f)
-		return 13;
-	if (x < 17.0f)
-		return 14;
-	if (x < 22.0f)
-		return 15;
-	if (x < 28.5f)
-		return 16;
-	if (x < 35.0f)
-		return 17;
-	if (x < 41.5f)
-		return 18;
-	if (x < 51.5f)
-		return 19;
-	if (x < 66.5f)
-		return 20;
-	if (x < 81.5f)
-		return 21;
-	if (x < 96.5f)
-		return 22;
-	if (x < 112.5f)
-		return 23;
-	else
-		return 24;
-}
-
-static inline int tilt_flt2raw(float x)
-{
-	// TODO: configurable
-	// TODO: send zero with plus or minus sign, which makes small move.
-	if (x < 0.0f)
-		return -tilt_flt2raw(-x);
-	if (x < 0.50f)
-		return 0;
-	if (x < 1.25f)
-		return 1;
-	if (x < 1.85f)
-		return 2;
-	if (x < 2.30f)
-		return 3;
-	if (x < 4.15f)
-		return 4;
-	if (x < 5.35f)
-		return 5;
-	if (x < 7.00f)
-		return 6;
-	if (x < 9.00f)
-		return 7;
-	if (x < 11.0f)
-		return 8;
-	if (x < 13.5f)
-		return 9;
-	if (x < 16.5f)
-		return 10;
-	if (x < 20.5f)
-		return 11;
-	if (x < 26.5f)
-		return 12;
-	if (x < 34.5f)
-		return 13;
-	if (x < 43.5f)
-		return 14;
-	if (x < 53.5f)
-		return 15;
-	if (x < 64.0f)
-		return 16;
-	if (x < 74.5f)
-		return 17;
-	else
-		return 18;
+	obs_data_set_default_double(settings, "ptz.obsptz.rate", 20.0);
 }
 
 static inline int zoom_flt2raw(float x, int u)
@@ -731,16 +717,22 @@ static void tick_filter(struct face_tracker_ptz *s, float second)
 	s->face_found_last = s->face_found;
 	const float kp_zoom = std::max(s->ptz_query[2], 1.0f);
 	const float kp[3] = {s->kp_x / srwh / kp_zoom, s->kp_y / srwh / kp_zoom, s->kp_z / srwh};
+	/* `uf` is the control integrated over this tick. For pan and tilt, it is divided by the tick to be a velocity
+	 * in PTZ_SPEED_UNIT, which the speed table takes. The result is scaled so that the gains tuned at PTZ_GAIN_FPS
+	 * give the same speed codes as before and the response no longer depends on the frame rate.
+	 */
+	const float to_velocity = second > 0.0f ? 1.0f / (second * PTZ_GAIN_FPS) : 0.0f;
 	for (int i = 0; i < 3; i++) {
 		float x = uf.v[i] * kp[i];
+		if (i < 2)
+			x *= to_velocity;
 		s->u_linear[i] = x;
 		int n = s->u[i];
 		switch (i) {
 		case 0:
-			n = pan_flt2raw(x);
-			break;
 		case 1:
-			n = tilt_flt2raw(x);
+			// TODO: send zero with plus or minus sign, which makes small move.
+			n = s->speed_table[i]->lookup(x);
 			break;
 		default:
 			n = zoom_flt2raw(x, n);
@@ -749,6 +741,25 @@ static void tick_filter(struct face_tracker_ptz *s, float second)
 		s->u[i] = n;
 	}
 
+	if (s->control == ftptz_control_mpc) {
+		if (os_atomic_exchange_bool(&s->mpc_reset_requested, false)) {
+			s->mpc[0]->reset();
+			s->mpc[1]->reset();
+		}
+
+		// Replace pan and tilt. The inversion is taken from the sign of Kp.
+		const uint64_t ns = os_gettime_ns();
+		const uint64_t send_ns = s->ftm->dev ? s->ftm->dev->get_send_ns() : 0;
+		for (int i = 0; i < 2; i++) {
+			const float sign = kp[i] < 0.0f ? -1.0f : 1.0f;
+			const float err = s->detect_err.v[i] / srwh * sign;
+			const int n = s->mpc[i]->control(ns, err, s->face_found, s->ptz_query[2], s->e_deadband.v[i],
+							 *s->speed_table[i], send_ns);
+			s->u[i] = (int)sign * n;
+			s->u_linear[i] = sign * s->speed_table[i]->velocity(n);
+		}
+	}
+
 	if (s->debug_data_control) {
 		fprintf(s->debug_data_control, "%f\t%f\t%f\t%f\t%d\t%d\t%d\n", os_gettime_ns() * 1e-9, uf.v[0], uf.v[1],
 			uf.v[2], s->u[0], s->u[1], s->u[2]);
@@ -817,43 +828,192 @@ static inline void send_ptz_cmd_immediate(struct face_tracker_ptz *s)
 	if (!s->ftm->dev)
 		return;
 
-	s->ftm->dev->set_pantiltzoom_speed(s->u_linear[0], s->u_linear[1], s->u_linear[2]);
+	struct ptz_state_s state;
+	state.pan = s->u[0];
+	state.tilt = s->u[1];
+	state.zoom = s->u[2];
+	state.pan_linear = s->u_linear[0];
+	state.tilt_linear = s->u_linear[1];
+	state.zoom_linear = s->u_linear[2];
+	s->ftm->dev->set_ptz_state(state);
+}
 
-	for (int i = 0; i < 2 && s->ftm->can_send_ptz_cmd(); i++) {
-		if (s->ftm->ptz_last_cmd != ptz_cmd_state_pantilt) {
-			s->ftm->dev->set_pantilt_speed(s->u[0], s->u[1]);
-			s->ftm->ptz_last_cmd = ptz_cmd_state_pantilt;
+static inline void calculate_error(struct face_tracker_ptz *s);
+
+/* Splits the error of pan and tilt into the digital crop and the head.
+ * The crop follows the face in the same frame except the dead band. The head is given the low-pass filtered error
+ * so that it slowly brings the face, and then the crop, back to the center.
+ */
+static void tick_hybrid(struct face_tracker_ptz *s, float second)
+{
+	const float srwh = sqrtf((float)s->known_width * s->known_height);
+	const float size[2] = {(float)s->known_width, (float)s->known_height};
+	const float k_lpf = std::min(second / s->hybrid_tc, 1.0f);
+
+	for (int i = 0; i < 2; i++) {
+		const float e = s->detect_err.v[i];
+		const float d = srwh * s->e_deadband.v[i];
+		const float margin = size[i] * (1.0f - 1.0f / s->hybrid_zoom) * 0.5f;
+		float &c = s->crop_offset[i];
+		if (s->face_found) {
+			if (e > c + d)
+				c = e - d;
+			else if (e < c - d)
+				c = e + d;
+			s->hybrid_lpf[i] += (e - s->hybrid_lpf[i]) * k_lpf;
 		} else {
-			s->ftm->dev->set_zoom_speed(s->u[2]);
-			s->ftm->ptz_last_cmd = ptz_cmd_state_zoom;
+			c -= c * std::min(second * s->f_att_int, 1.0f);
+			s->hybrid_lpf[i] = 0.0f;
 		}
+		c = std::clamp(c, -margin, margin);
+		s->detect_err.v[i] = s->hybrid_lpf[i];
 	}
 }
 
-static inline void calculate_error(struct face_tracker_ptz *s);
+// Sets the motion of the image expected from the speed commands, used if the motion cannot be estimated from the image.
+static void update_ego_velocity(struct face_tracker_ptz *s)
+{
+	if (!os_atomic_load_bool(&s->ego_motion_enabled))
+		return;
+
+	// A positive speed decreases the error unless inverted, that is, the image moves to the negative direction.
+	// The gain identified by MPC is not updated in the other control methods.
+	const float k = -1.0f / (PTZ_SPEED_UNIT * std::max(s->ptz_query[2], 1.0f));
+	const bool mpc = s->control == ftptz_control_mpc;
+	const float v0 = k * (s->kp_x < 0.0f ? -1.0f : 1.0f) * s->speed_table[0]->velocity(s->u[0]) *
+			 (mpc ? s->mpc[0]->gain_ratio() : 1.0f);
+	const float v1 = k * (s->kp_y < 0.0f ? -1.0f : 1.0f) * s->speed_table[1]->velocity(s->u[1]) *
+			 (mpc ? s->mpc[1]->gain_ratio() : 1.0f);
+	pthread_mutex_lock(&s->analysis_mutex);
+	s->ego_velocity[0] = v0;
+	s->ego_velocity[1] = v1;
+	pthread_mutex_unlock(&s->analysis_mutex);
+}
+
+static void finish_calibration(struct face_tracker_ptz *s)
+{
+	const char *names[2] = {"pan_speed_table", "tilt_speed_table"};
+	const char *axes[2] = {"pan", "tilt"};
+	const std::vector<float> *v[2] = {&s->calib->pan_velocities(), &s->calib->tilt_velocities()};
+	bool valid = s->calib->progress() >= 100;
+	if (!valid)
+		blog(LOG_WARNING, "Speed calibration was aborted");
+	for (int i = 0; i < 2 && valid; i++) {
+		if (!ptz_speed_table::is_increasing(*v[i])) {
+			// A flat scene gives no motion and the speed code would move the camera at the control value 0.
+			blog(LOG_WARNING,
+			     "Speed calibration measured %s velocities that are not positive and increasing: %s. "
+			     "The speed tables are kept.",
+			     axes[i], ptz_speed_table::to_string(*v[i]).c_str());
+			valid = false;
+		}
+	}
+
+	if (valid) {
+		obs_data_t *settings = obs_source_get_settings(s->context);
+		for (int i = 0; i < 2; i++) {
+			s->speed_table[i]->set_velocities(*v[i]);
+			std::string str = s->speed_table[i]->to_string();
+			blog(LOG_INFO, "Calibrated %s: %s", names[i], str.c_str());
+			obs_data_set_string(settings, names[i], str.c_str());
+		}
+		obs_data_release(settings);
+		// Show the new tables if the properties are open.
+		obs_source_update_properties(s->context);
+	}
+
+	delete s->calib;
+	s->calib = NULL;
+	os_atomic_set_bool(&s->shift_requested, false);
+	s->filter_int = f3(0, 0, 0);
+	s->filter_lpf = f3(0, 0, 0);
+}
+
+// Returns true while calibrating the speed, during which the tracking does not control the camera.
+static bool tick_calibration(struct face_tracker_ptz *s)
+{
+	if (os_atomic_load_bool(&s->calib_requested)) {
+		os_atomic_set_bool(&s->calib_requested, false);
+		if (!s->calib && s->ftm->dev) {
+			blog(LOG_INFO, "Starting speed calibration");
+			s->calib = new ptz_calibration(s->speed_table[0]->max_code(), s->speed_table[1]->max_code());
+			pthread_mutex_lock(&s->analysis_mutex);
+			s->shift_x_sum = s->shift_y_sum = 0.0f;
+			pthread_mutex_unlock(&s->analysis_mutex);
+			os_atomic_set_bool(&s->shift_requested, true);
+			s->ftm->dev->set_zoom_speed(0);
+		}
+	}
+
+	if (!s->calib)
+		return false;
+
+	pthread_mutex_lock(&s->analysis_mutex);
+	const float dx = s->shift_x_sum;
+	const float dy = s->shift_y_sum;
+	s->shift_x_sum = s->shift_y_sum = 0.0f;
+	pthread_mutex_unlock(&s->analysis_mutex);
+
+	int pan = 0, tilt = 0;
+	if (s->ftm->dev && s->calib->tick(os_gettime_ns(), dx, dy, s->ptz_query[2], pan, tilt)) {
+		if (s->ftm->can_send_ptz_cmd())
+			s->ftm->dev->set_pantilt_speed(pan, tilt);
+		return true;
+	}
+
+	if (s->ftm->dev)
+		s->ftm->dev->set_pantilt_speed(0, 0);
+	finish_calibration(s);
+	return false;
+}
+
+// Gives MPC the speeds that reached the camera, which can differ from the chosen ones if the backend held them.
+static void record_mpc_sent(struct face_tracker_ptz *s)
+{
+	int sent[2];
+	uint64_t ns;
+	if (!s->ftm->dev->get_pantilt_sent(sent[0], sent[1], ns)) {
+		// Assume the requested speeds were sent.
+		sent[0] = s->u[0];
+		sent[1] = s->u[1];
+		ns = os_gettime_ns();
+	}
+	const float kp[2] = {s->kp_x, s->kp_y};
+	for (int i = 0; i < 2; i++) {
+		const int sign = kp[i] < 0.0f ? -1 : 1;
+		s->mpc[i]->sent(ns, sent[i] * sign, *s->speed_table[i]);
+	}
+}
 
 static void ftptz_tick(void *data, float second)
 {
 	auto *s = (struct face_tracker_ptz *)data;
-	const bool was_rendered = s->rendered;
+	const bool was_rendered = os_atomic_exchange_bool(&s->rendered, false);
 	s->ftm->tick(second);
 
 	obs_source_t *target = obs_filter_get_target(s->context);
 	if (!target)
 		return;
 
-	s->rendered = false;
-
 	if (s->hotkey_pause == OBS_INVALID_HOTKEY_PAIR_ID || s->hotkey_reset == OBS_INVALID_HOTKEY_ID)
 		register_hotkeys(s, obs_filter_get_parent(s->context));
 
-	s->known_width = obs_source_get_base_width(target);
-	s->known_height = obs_source_get_base_height(target);
+	// The faces are located in the frame analyzed last.
+	pthread_mutex_lock(&s->analysis_mutex);
+	s->known_width = s->analysis_width;
+	s->known_height = s->analysis_height;
+	pthread_mutex_unlock(&s->analysis_mutex);
+	if (!s->known_width || !s->known_height) {
+		s->known_width = obs_source_get_base_width(target);
+		s->known_height = obs_source_get_base_height(target);
+	}
 
 	if (s->known_width <= 0 || s->known_height <= 0)
 		return;
 
-	if (was_rendered) {
+	const bool calibrating = tick_calibration(s);
+
+	if (was_rendered && !calibrating) {
 		if (!s->is_paused)
 			calculate_error(s);
 		else {
@@ -861,13 +1021,26 @@ static void ftptz_tick(void *data, float second)
 			s->detect_err = f3(0, 0, 0);
 		}
 
+		if (s->hybrid)
+			tick_hybrid(s, second);
+		else
+			s->crop_offset[0] = s->crop_offset[1] = 0.0f;
+
 		tick_filter(s, second);
 		send_ptz_cmd_immediate(s);
+		update_ego_velocity(s);
 	}
 
 	if (s->ftm && s->ftm->dev) {
 		s->ftm->dev->tick();
-		s->ptz_query[2] = s->ftm->dev->get_zoom();
+		if (s->control == ftptz_control_mpc)
+			record_mpc_sent(s);
+		// Only the zoom factor is used, to scale the gains; the controller does not use pan and tilt.
+		struct ptz_position_s pos;
+		if (s->ftm->dev->get_position(pos) && pos.zoom_ns)
+			s->ptz_query[2] = pos.zoom;
+		else
+			s->ptz_query[2] = s->ftm->dev->get_zoom();
 	}
 }
 
@@ -877,6 +1050,18 @@ static inline void calculate_error(struct face_tracker_ptz *s)
 	float sc_tot = 0.0f;
 	bool found = false;
 	auto &tracker_rects = s->ftm->tracker_rects;
+
+	// The target location and size are relative to the digital crop.
+	const float crop_ratio = s->hybrid ? 1.0f / s->hybrid_zoom : 1.0f;
+
+	pointf_s ego_motion = {0.0f, 0.0f};
+	const bool ego_motion_enabled = os_atomic_load_bool(&s->ego_motion_enabled);
+	if (ego_motion_enabled) {
+		pthread_mutex_lock(&s->analysis_mutex);
+		ego_motion = s->ego_motion;
+		pthread_mutex_unlock(&s->analysis_mutex);
+	}
+
 	for (size_t i = 0; i < tracker_rects.size(); i++) {
 		f3 r(tracker_rects[i].rect);
 		float score = tracker_rects[i].rect.score;
@@ -897,9 +1082,15 @@ static inline void calculate_error(struct face_tracker_ptz *s)
 				r.v[2], score);
 		}
 
-		r.v[0] -= get_width(tracker_rects[i].crop_rect) * s->track_x;
-		r.v[1] += get_height(tracker_rects[i].crop_rect) * s->track_y;
-		r.v[2] /= s->track_z;
+		if (ego_motion_enabled) {
+			// The camera has moved since the frame where the face was located.
+			r.v[0] += ego_motion.x - tracker_rects[i].motion.x;
+			r.v[1] += ego_motion.y - tracker_rects[i].motion.y;
+		}
+
+		r.v[0] -= get_width(tracker_rects[i].crop_rect) * s->track_x * crop_ratio;
+		r.v[1] += get_height(tracker_rects[i].crop_rect) * s->track_y * crop_ratio;
+		r.v[2] /= s->track_z * crop_ratio;
 		f3 w(tracker_rects[i].crop_rect);
 
 		f3 e = (r - w) * score;
@@ -949,7 +1140,8 @@ static inline bool operator!=(const struct video_scale_info &a, const struct vid
 	return false;
 }
 
-static bool scale_set_texture(struct face_tracker_ptz *s, texture_object *cvtex, struct obs_source_frame *frame)
+static bool scale_set_texture(struct face_tracker_ptz *s, texture_object *cvtex, struct obs_source_frame *frame,
+			      float scale)
 {
 	const struct video_scale_info scaler_src_info = {
 		frame->format,    frame->width,
@@ -958,8 +1150,8 @@ static bool scale_set_texture(struct face_tracker_ptz *s, texture_object *cvtex,
 	};
 	const struct video_scale_info scaler_dst_info = {
 		VIDEO_FORMAT_BGRX,
-		(uint32_t)(frame->width / s->ftm->scale),
-		(uint32_t)(frame->height / s->ftm->scale),
+		(uint32_t)(frame->width / scale),
+		(uint32_t)(frame->height / scale),
 		scaler_src_info.range,
 		VIDEO_CS_DEFAULT,
 	};
@@ -967,7 +1159,7 @@ static bool scale_set_texture(struct face_tracker_ptz *s, texture_object *cvtex,
 
 	if (!s->scaler || scaler_src_info != s->scaler_src_info || scaler_dst_info != s->scaler_dst_info) {
 		blog(LOG_DEBUG, "creating video-scaler: width=%u height=%u scale=%f -> %ux%u", frame->width,
-		     frame->height, s->ftm->scale, scaler_dst_info.width, scaler_dst_info.height);
+		     frame->height, scale, scaler_dst_info.width, scaler_dst_info.height);
 
 		video_scaler_destroy(s->scaler);
 		s->scaler = NULL;
@@ -1005,35 +1197,293 @@ static bool scale_set_texture(struct face_tracker_ptz *s, texture_object *cvtex,
 	return true;
 }
 
-static struct obs_source_frame *ftptz_filter_video(void *data, struct obs_source_frame *frame)
+static void estimate_shift(struct face_tracker_ptz *s, texture_object *cvtex, const struct ftptz_analysis_frame_s *af)
 {
-	if (!frame)
-		return NULL;
-
-	auto *s = (struct face_tracker_ptz *)data;
+	static thread_local std::vector<uint8_t> gray;
+	int width, height;
+	float dx = 0.0f, dy = 0.0f;
+	const bool valid = cvtex->get_gray_image(gray, width, height) &&
+			   s->shift_estimator->estimate(gray.data(), width, height, dx, dy);
+	const uint64_t ts = af->frame->timestamp;
+	const float dt = s->ego_last_ts && ts > s->ego_last_ts ? (ts - s->ego_last_ts) * 1e-9f : 0.0f;
+	s->ego_last_ts = ts;
+
+	pthread_mutex_lock(&s->analysis_mutex);
+	if (valid && os_atomic_load_bool(&s->shift_requested)) {
+		// The shift is accumulated in the unit of the square root of the area, same as the error of the face.
+		const float srwh = sqrtf((float)width * height);
+		s->shift_x_sum += dx * width / srwh;
+		s->shift_y_sum += dy * height / srwh;
+	}
+	if (os_atomic_load_bool(&s->ego_motion_enabled)) {
+		if (valid) {
+			s->ego_motion.x += dx * af->width;
+			s->ego_motion.y += dy * af->height;
+		} else {
+			// Fall back to the speed commands if the image is too flat to correlate.
+			const float srwh = sqrtf((float)af->width * af->height);
+			s->ego_motion.x += s->ego_velocity[0] * srwh * dt;
+			s->ego_motion.y += s->ego_velocity[1] * srwh * dt;
+		}
+	}
+	pthread_mutex_unlock(&s->analysis_mutex);
+}
 
+static void ftptz_analyze_frame_locked(struct face_tracker_ptz *s, const struct ftptz_analysis_frame_s *af)
+{
 	std::shared_ptr<texture_object> cvtex(new texture_object());
-	cvtex->scale = s->ftm->scale;
-	cvtex->tick = s->ftm->tick_cnt;
+	cvtex->tick = af->tick;
 
-	if (is_rgb_format(frame->format)) {
-		cvtex->set_texture_obsframe(frame, s->ftm->scale);
+	if (is_rgb_format(af->frame->format)) {
+		cvtex->scale = af->scale;
+		cvtex->set_texture_obsframe(af->frame, 1);
 	} else {
-		if (!scale_set_texture(s, cvtex.get(), frame))
-			return frame;
+		// The frame might have been decimated by the video path. The rest of the scale is done by the scaler.
+		const float scale = std::max(s->ftm->scale / af->scale, 1.0f);
+		cvtex->scale = af->scale * scale;
+		if (!scale_set_texture(s, cvtex.get(), af->frame, scale))
+			return;
 	}
 
-	s->known_width = frame->width;
-	s->known_height = frame->height;
+	if (os_atomic_load_bool(&s->shift_requested) || os_atomic_load_bool(&s->ego_motion_enabled)) {
+		estimate_shift(s, cvtex.get(), af);
+	} else {
+		s->shift_estimator->reset();
+		s->ego_last_ts = 0;
+	}
+	cvtex->motion = s->ego_motion;
+
 	s->ftm->cvtex_cache.swap(cvtex);
 	s->ftm->crop_cur.x0 = 0;
 	s->ftm->crop_cur.y0 = 0;
-	s->ftm->crop_cur.x1 = frame->width;
-	s->ftm->crop_cur.y1 = frame->height;
-
-	s->rendered = true;
+	s->ftm->crop_cur.x1 = af->width;
+	s->ftm->crop_cur.y1 = af->height;
 
 	s->ftm->post_render();
+
+	pthread_mutex_lock(&s->analysis_mutex);
+	s->analysis_width = af->width;
+	s->analysis_height = af->height;
+	pthread_mutex_unlock(&s->analysis_mutex);
+	os_atomic_set_bool(&s->rendered, true);
+}
+
+static void ftptz_analyze_frame(struct face_tracker_ptz *s, const struct ftptz_analysis_frame_s *af)
+{
+	pthread_mutex_lock(&s->ftm_mutex);
+	ftptz_analyze_frame_locked(s, af);
+	pthread_mutex_unlock(&s->ftm_mutex);
+}
+
+static void *ftptz_analysis_thread(void *data)
+{
+	auto *s = (struct face_tracker_ptz *)data;
+	os_set_thread_name("ftptz-analysis");
+
+	pthread_mutex_lock(&s->analysis_mutex);
+	while (!s->analysis_stop) {
+		struct ftptz_analysis_frame_s *af = s->analysis_pending;
+		if (!af) {
+			pthread_cond_wait(&s->analysis_cond, &s->analysis_mutex);
+			continue;
+		}
+		s->analysis_pending = NULL;
+		pthread_mutex_unlock(&s->analysis_mutex);
+
+		ftptz_analyze_frame(s, af);
+
+		pthread_mutex_lock(&s->analysis_mutex);
+		s->analysis_free[s->analysis_n_free++] = af;
+	}
+	pthread_mutex_unlock(&s->analysis_mutex);
+	return NULL;
+}
+
+static void ftptz_analysis_start(struct face_tracker_ptz *s)
+{
+	pthread_mutex_init(&s->analysis_mutex, NULL);
+	pthread_mutex_init(&s->ftm_mutex, NULL);
+	pthread_cond_init(&s->analysis_cond, NULL);
+	s->analysis_rate = 1.0f; // until the settings are given
+	s->analysis_scale = 1;
+	for (int i = 0; i < FTPTZ_ANALYSIS_POOL; i++)
+		s->analysis_free[i] = &s->analysis_pool[i];
+	s->analysis_n_free = FTPTZ_ANALYSIS_POOL;
+	s->analysis_stop = false;
+	s->analysis_thread_running = pthread_create(&s->analysis_thread, NULL, ftptz_analysis_thread, s) == 0;
+	if (!s->analysis_thread_running)
+		blog(LOG_ERROR, "failed to create the analysis thread");
+}
+
+static void ftptz_analysis_stop(struct face_tracker_ptz *s)
+{
+	if (s->analysis_thread_running) {
+		pthread_mutex_lock(&s->analysis_mutex);
+		s->analysis_stop = true;
+		pthread_cond_signal(&s->analysis_cond);
+		pthread_mutex_unlock(&s->analysis_mutex);
+		pthread_join(s->analysis_thread, NULL);
+		s->analysis_thread_running = false;
+	}
+
+	for (int i = 0; i < FTPTZ_ANALYSIS_POOL; i++) {
+		obs_source_frame_destroy(s->analysis_pool[i].frame);
+		s->analysis_pool[i].frame = NULL;
+	}
+	pthread_cond_destroy(&s->analysis_cond);
+	pthread_mutex_destroy(&s->ftm_mutex);
+	pthread_mutex_destroy(&s->analysis_mutex);
+}
+
+struct decimate_plane_s
+{
+	int size;             // bytes per pixel
+	int shift_x, shift_y; // chroma subsampling
+};
+
+// Returns the number of the planes of the formats that can be decimated on the video path, 0 for the others.
+static int get_decimate_planes(enum video_format format, struct decimate_plane_s planes[MAX_AV_PLANES])
+{
+	switch (format) {
+	case VIDEO_FORMAT_BGRX:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_RGBA:
+		planes[0] = {4, 0, 0};
+		return 1;
+	case VIDEO_FORMAT_BGR3:
+		planes[0] = {3, 0, 0};
+		return 1;
+	case VIDEO_FORMAT_Y800:
+		planes[0] = {1, 0, 0};
+		return 1;
+	case VIDEO_FORMAT_I444:
+		planes[0] = planes[1] = planes[2] = {1, 0, 0};
+		return 3;
+	case VIDEO_FORMAT_I422:
+		planes[0] = {1, 0, 0};
+		planes[1] = planes[2] = {1, 1, 0};
+		return 3;
+	case VIDEO_FORMAT_I420:
+		planes[0] = {1, 0, 0};
+		planes[1] = planes[2] = {1, 1, 1};
+		return 3;
+	case VIDEO_FORMAT_NV12:
+		planes[0] = {1, 0, 0};
+		planes[1] = {2, 1, 1};
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/* Copies every `scale`-th pixel of each plane.
+ * A chroma sample of the destination is taken from the source at `scale` times its position, which is the chroma of
+ * the luma taken to the destination.
+ */
+static void copy_decimated(struct obs_source_frame *dst, const struct obs_source_frame *src,
+			   const struct decimate_plane_s *planes, int n_planes, int scale)
+{
+	for (int p = 0; p < n_planes; p++) {
+		const int size = planes[p].size;
+		const uint32_t width = (dst->width + (1 << planes[p].shift_x) - 1) >> planes[p].shift_x;
+		const uint32_t height = (dst->height + (1 << planes[p].shift_y) - 1) >> planes[p].shift_y;
+		for (uint32_t i = 0; i < height; i++) {
+			const uint8_t *s_line = src->data[p] + (size_t)src->linesize[p] * scale * i;
+			uint8_t *d_line = dst->data[p] + (size_t)dst->linesize[p] * i;
+			if (scale == 1) {
+				memcpy(d_line, s_line, (size_t)width * size);
+				continue;
+			}
+			for (uint32_t j = 0, js = 0; j < width; j++, js += size * scale)
+				memcpy(d_line + j * size, s_line + js, size);
+		}
+	}
+	dst->timestamp = src->timestamp;
+	dst->full_range = src->full_range;
+	memcpy(dst->color_matrix, src->color_matrix, sizeof(dst->color_matrix));
+	memcpy(dst->color_range_min, src->color_range_min, sizeof(dst->color_range_min));
+	memcpy(dst->color_range_max, src->color_range_max, sizeof(dst->color_range_max));
+}
+
+static inline bool need_allocate_analysis_frame(const struct obs_source_frame *dst, enum video_format format,
+						uint32_t width, uint32_t height)
+{
+	return !dst || dst->format != format || dst->width != width || dst->height != height;
+}
+
+#define HANDOFF_REPORT_CNT 600
+
+static struct obs_source_frame *ftptz_filter_video(void *data, struct obs_source_frame *frame)
+{
+	if (!frame)
+		return NULL;
+
+	auto *s = (struct face_tracker_ptz *)data;
+	if (!s->analysis_thread_running)
+		return frame;
+
+	const uint64_t ns = os_gettime_ns();
+	pthread_mutex_lock(&s->analysis_mutex);
+	const uint64_t interval = (uint64_t)(1e9f / s->analysis_rate);
+	const int analysis_scale = s->analysis_scale;
+	struct ftptz_analysis_frame_s *af = NULL;
+	if (ns + interval / 4 >= s->analysis_next_ns && s->analysis_n_free)
+		af = s->analysis_free[--s->analysis_n_free];
+	pthread_mutex_unlock(&s->analysis_mutex);
+	if (!af)
+		return frame;
+	s->analysis_next_ns = s->analysis_next_ns + interval > ns ? s->analysis_next_ns + interval : ns + interval;
+
+	/* Only a copy is made on the video path, decimated if the format is known. Conversion and staging are done by
+	 * the analysis thread.
+	 */
+	struct decimate_plane_s planes[MAX_AV_PLANES];
+	const int n_planes = get_decimate_planes(frame->format, planes);
+	const int scale = n_planes ? analysis_scale : 1;
+	uint32_t width = frame->width / scale;
+	uint32_t height = frame->height / scale;
+	if (scale > 1 && n_planes > 1) {
+		// Keep the chroma planes aligned to the luma.
+		width &= ~1u;
+		height &= ~1u;
+	}
+	if (need_allocate_analysis_frame(af->frame, frame->format, width, height)) {
+		obs_source_frame_destroy(af->frame);
+		af->frame = obs_source_frame_create(frame->format, width, height);
+	}
+	if (n_planes)
+		copy_decimated(af->frame, frame, planes, n_planes, scale);
+	else
+		obs_source_frame_copy(af->frame, frame);
+	af->tick = s->ftm->tick_cnt;
+	af->width = frame->width;
+	af->height = frame->height;
+	af->scale = scale;
+
+	pthread_mutex_lock(&s->analysis_mutex);
+	if (s->analysis_pending) {
+		// The analysis thread is still busy, the older frame is dropped.
+		s->analysis_free[s->analysis_n_free++] = s->analysis_pending;
+		s->handoff_dropped++;
+	}
+	s->analysis_pending = af;
+	pthread_cond_signal(&s->analysis_cond);
+	pthread_mutex_unlock(&s->analysis_mutex);
+
+	const uint64_t dt = os_gettime_ns() - ns;
+	s->handoff_ns_sum += dt;
+	if (dt > s->handoff_ns_max)
+		s->handoff_ns_max = dt;
+	if (++s->handoff_cnt >= HANDOFF_REPORT_CNT) {
+		blog(LOG_DEBUG, "ftptz_filter_video: %.3f ms in average, %.3f ms at max, %d of %d frame(s) dropped",
+		     s->handoff_ns_sum * 1e-6 / s->handoff_cnt, s->handoff_ns_max * 1e-6, s->handoff_dropped,
+		     s->handoff_cnt);
+		s->handoff_ns_sum = 0;
+		s->handoff_ns_max = 0;
+		s->handoff_cnt = 0;
+		s->handoff_dropped = 0;
+	}
+
 	return frame;
 }
 
@@ -1084,13 +1534,110 @@ static void draw_frame_info(struct face_tracker_ptz *s, bool landmark_only = fal
 	}
 }
 
+static inline uint32_t crop_size(uint32_t size, float zoom)
+{
+	return (uint32_t)(size / zoom);
+}
+
+// Top-left corner of the digital crop in the input
+static inline void get_crop_origin(const struct face_tracker_ptz *s, float &x0, float &y0)
+{
+	x0 = (s->known_width - crop_size(s->known_width, s->hybrid_zoom)) * 0.5f + s->crop_offset[0];
+	y0 = (s->known_height - crop_size(s->known_height, s->hybrid_zoom)) * 0.5f + s->crop_offset[1];
+}
+
+static bool render_target(struct face_tracker_ptz *s)
+{
+	obs_source_t *target = obs_filter_get_target(s->context);
+	obs_source_t *parent = obs_filter_get_parent(s->context);
+	const uint32_t cx = s->known_width, cy = s->known_height;
+	if (!target || !parent || !cx || !cy)
+		return false;
+
+	if (!s->texrender)
+		s->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+	gs_texrender_reset(s->texrender);
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+
+	if (gs_texrender_begin(s->texrender, cx, cy)) {
+		uint32_t parent_flags = obs_source_get_output_flags(target);
+		bool custom_draw = (parent_flags & OBS_SOURCE_CUSTOM_DRAW) != 0;
+		bool async = (parent_flags & OBS_SOURCE_ASYNC) != 0;
+		struct vec4 clear_color;
+
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		if (target == parent && !custom_draw && !async)
+			obs_source_default_render(target);
+		else
+			obs_source_video_render(target);
+
+		gs_texrender_end(s->texrender);
+	}
+
+	gs_blend_state_pop();
+	return true;
+}
+
+static void draw_crop(struct face_tracker_ptz *s)
+{
+	gs_texture_t *tex = gs_texrender_get_texture(s->texrender);
+	if (!tex)
+		return;
+
+	const float w = (float)s->known_width, h = (float)s->known_height;
+	const float cw = (float)crop_size(s->known_width, s->hybrid_zoom);
+	const float ch = (float)crop_size(s->known_height, s->hybrid_zoom);
+	float x0, y0;
+	get_crop_origin(s, x0, y0);
+
+	gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), tex);
+	while (gs_effect_loop(effect, "Draw"))
+		draw_sprite_crop(cw, ch, x0 / w, y0 / h, (x0 + cw) / w, (y0 + ch) / h);
+}
+
 static void ftptz_video_render(void *data, gs_effect_t *)
 {
 	auto *s = (struct face_tracker_ptz *)data;
-	obs_source_skip_video_filter(s->context);
+	const bool show_info = s->debug_faces && (!s->is_active || s->debug_always_show);
 
-	if (s->debug_faces && (!s->is_active || s->debug_always_show))
+	if (!s->hybrid || !render_target(s)) {
+		obs_source_skip_video_filter(s->context);
+		if (show_info)
+			draw_frame_info(s);
+		return;
+	}
+
+	draw_crop(s);
+
+	if (show_info) {
+		float x0, y0;
+		get_crop_origin(s, x0, y0);
+		gs_matrix_push();
+		gs_matrix_translate3f(-x0, -y0, 0.0f);
 		draw_frame_info(s);
+		gs_matrix_pop();
+	}
+}
+
+static uint32_t ftptz_get_width(void *data)
+{
+	auto *s = (struct face_tracker_ptz *)data;
+	obs_source_t *target = obs_filter_get_target(s->context);
+	const uint32_t width = target ? obs_source_get_base_width(target) : 0;
+	return s->hybrid ? crop_size(width, s->hybrid_zoom) : width;
+}
+
+static uint32_t ftptz_get_height(void *data)
+{
+	auto *s = (struct face_tracker_ptz *)data;
+	obs_source_t *target = obs_filter_get_target(s->context);
+	const uint32_t height = target ? obs_source_get_base_height(target) : 0;
+	return s->hybrid ? crop_size(height, s->hybrid_zoom) : height;
 }
 
 static void cb_render_info(void *data, calldata_t *cd)
@@ -1154,5 +1701,7 @@ extern "C" void register_face_tracker_ptz(bool hide_ptz)
 	info.activate = ftf_activate, info.deactivate = ftf_deactivate, info.video_tick = ftptz_tick;
 	info.filter_video = ftptz_filter_video;
 	info.video_render = ftptz_video_render;
+	info.get_width = ftptz_get_width;
+	info.get_height = ftptz_get_height;
 	obs_register_source(&info);
 }
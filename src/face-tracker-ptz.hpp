@@ -3,13 +3,29 @@
 #include <vector>
 #include <deque>
 #include "helper.hpp"
+#include "ptz-backend.hpp"
+
+#define FTPTZ_ANALYSIS_POOL 3
+
+struct ftptz_analysis_frame_s
+{
+	struct obs_source_frame *frame;
+	int tick;
+	uint32_t width, height; // size of the original frame
+	int scale;              // decimation that has been applied to `frame`
+};
+
+enum ftptz_control_e {
+	ftptz_control_pid = 0,
+	ftptz_control_mpc = 1, // model predictive control for pan and tilt, PID for zoom
+};
 
 struct face_tracker_ptz
 {
 	obs_source_t *context;
-	uint32_t known_width;
+	uint32_t known_width; // accessed only by the graphics thread
 	uint32_t known_height;
-	bool rendered;
+	volatile bool rendered; // set by the analysis thread and consumed by `ftptz_tick`
 	bool is_active;
 
 	video_scaler_t *scaler;
@@ -17,6 +33,47 @@ struct face_tracker_ptz
 	struct video_scale_info scaler_src_info;
 	struct video_scale_info scaler_dst_info;
 
+	// The video path hands off frames to the analysis thread.
+	pthread_t analysis_thread;
+	pthread_mutex_t analysis_mutex;
+	pthread_cond_t analysis_cond;
+	bool analysis_thread_running;
+	volatile bool analysis_stop;
+	struct ftptz_analysis_frame_s analysis_pool[FTPTZ_ANALYSIS_POOL];
+	struct ftptz_analysis_frame_s *analysis_free[FTPTZ_ANALYSIS_POOL];
+	int analysis_n_free;
+	struct ftptz_analysis_frame_s *analysis_pending;
+	uint32_t analysis_width, analysis_height; // size of the frame analyzed last, protected by `analysis_mutex`
+	float analysis_rate;                      // protected by `analysis_mutex`
+	int analysis_scale;                       // decimation on the video path, protected by `analysis_mutex`
+	uint64_t analysis_next_ns;                // accessed only by the video thread
+	pthread_mutex_t ftm_mutex;                // held while `ftm` is updated or analyzes a frame
+	uint64_t handoff_ns_sum, handoff_ns_max;
+	int handoff_cnt, handoff_dropped;
+
+	// Speed calibration. The analysis thread estimates the motion of the image while `shift_requested`.
+	class global_shift *shift_estimator; // accessed only by the analysis thread
+	volatile bool shift_requested;
+	float shift_x_sum, shift_y_sum; // protected by `analysis_mutex`
+	volatile bool calib_requested;
+	class ptz_calibration *calib;
+	class ptz_speed_table *speed_table[2]; // pan and tilt
+
+	// Camera motion compensation. The analysis thread estimates the motion of the image for each frame.
+	volatile bool ego_motion_enabled;
+	pointf_s ego_motion;   // accumulated motion in the source pixels, written with `analysis_mutex`
+	float ego_velocity[2]; // motion expected from the commands, protected by `analysis_mutex`
+	uint64_t ego_last_ts;  // accessed only by the analysis thread
+
+	// Hybrid control. The digital crop follows the face immediately.
+	// The head slowly moves the crop back to the center.
+	bool hybrid;
+	float hybrid_zoom;     // ratio of the input size to the crop size
+	float hybrid_tc;       // time constant for the head to follow
+	float crop_offset[2];  // center of the crop from the center of the input in pixels
+	float hybrid_lpf[2];   // error given to the head
+	gs_texrender_t *texrender;
+
 	f3 detect_err;
 	bool face_found, face_found_last;
 
@@ -32,6 +89,9 @@ struct face_tracker_ptz
 	f3 filter_int;
 	f3 filter_lpf;
 	float f_att_int;
+	enum ftptz_control_e control;
+	class ptz_mpc *mpc[2]; // pan and tilt
+	volatile bool mpc_reset_requested;
 	int u[3];
 	float u_linear[3];
 	float ptz_query[3];
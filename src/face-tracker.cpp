@@ -1,7 +1,6 @@
 #include <obs-module.h>
 #include <util/platform.h>
 #include <util/threading.h>
-#include <graphics/vec2.h>
 #include <graphics/graphics.h>
 #include "plugin-macros.generated.h"
 #include "texture-object.h"
@@ -13,29 +12,70 @@
 #include "face-tracker-manager.hpp"
 #include "source_list.h"
 
-static inline void scale_texture(struct face_tracker_filter *s, float scale);
-static inline int stage_to_surface(struct face_tracker_filter *s, float scale);
-static inline std::shared_ptr<texture_object> surface_to_cvtex(struct face_tracker_filter *s, float scale);
+static inline int select_rois(struct face_tracker_filter *s, rectf_s *rois);
+static inline void scale_texture(struct face_tracker_filter *s, const struct ftf_levels_s &lv);
+static inline int stage_to_surface(struct face_tracker_filter *s, const struct ftf_levels_s &lv);
+static inline bool staged_in_tick(const struct face_tracker_filter *s, int tick);
+static inline std::shared_ptr<texture_object> surface_to_cvtex(struct face_tracker_filter *s);
+
+#define RENDER_REPORT_CNT 300
+#define ROI_MARGIN 0.25f    // margin added to each side of the tracked rectangle, relative to its size
+#define ROI_AREA_MAX 0.25f  // larger regions are not read back, relative to the frame
+#define ROI_ALIGN 16
 
 class ft_manager_for_ftf : public face_tracker_manager {
 public:
 	struct face_tracker_filter *ctx;
 
+	// The texture is staged once in each frame and shared by the detector and the trackers.
+	std::shared_ptr<texture_object> cvtex_cache;
+	bool cvtex_staged = false;
+
 public:
 	ft_manager_for_ftf(struct face_tracker_filter *ctx_) { ctx = ctx_; }
 
 	~ft_manager_for_ftf() { release_cvtex(); }
 
-	inline void release_cvtex() {}
+	inline void release_cvtex()
+	{
+		cvtex_cache.reset();
+		cvtex_staged = false;
+	}
 
 	std::shared_ptr<texture_object> get_cvtex() override
 	{
+		if (cvtex_staged)
+			return cvtex_cache;
+		cvtex_staged = true;
+
 		if (scale < 1.0f)
 			scale = 1.0f;
-		scale_texture(ctx, scale);
-		if (stage_to_surface(ctx, scale))
+
+		// Stage once in a tick even if the source is rendered more than once, such as in a projector.
+		if (staged_in_tick(ctx, tick_cnt.load(std::memory_order_relaxed)))
+			return NULL;
+
+		/* Only the levels needed are read back.
+		 * The levels for the detector are staged once for each detection while the detector is idle. They are
+		 * mapped `FTF_STAGE_RING - 1` ticks later, when the detector takes them.
+		 */
+		const bool detect = detector_levels_due(FTF_STAGE_RING - 1);
+		struct ftf_levels_s lv;
+		lv.scale = scale;
+		lv.coarse_level = detect ? ctx->detector_level : 0;
+		lv.native = detect && ctx->detector_tiled && scale > 1.0f;
+		lv.n_roi = 0;
+		if (landmark_detection_data && ctx->landmark_roi && scale > 1.0f)
+			lv.n_roi = select_rois(ctx, lv.roi);
+
+		scale_texture(ctx, lv);
+		if (stage_to_surface(ctx, lv))
 			return NULL;
-		return surface_to_cvtex(ctx, scale);
+		const struct ftf_stage_s &st = ctx->stage_ring[(ctx->stage_next + FTF_STAGE_RING - 1) % FTF_STAGE_RING];
+		if (st.staged_coarse || st.staged_native)
+			detector_levels_staged(st.tick);
+		cvtex_cache = surface_to_cvtex(ctx);
+		return cvtex_cache;
 	};
 };
 
@@ -64,6 +104,10 @@ static void ftf_update(void *data, obs_data_t *settings)
 	s->track_x = obs_data_get_double(settings, "track_x");
 	s->track_y = obs_data_get_double(settings, "track_y");
 	s->scale_max = obs_data_get_double(settings, "scale_max");
+	s->gray_readback = obs_data_get_bool(settings, "gray_readback");
+	s->detector_level = (int)obs_data_get_int(settings, "detector_level");
+	s->landmark_roi = obs_data_get_bool(settings, "landmark_roi");
+	s->detector_tiled = obs_data_get_bool(settings, "detector_tiled");
 
 	double kp = obs_data_get_double(settings, "Kp");
 	float ki = (float)obs_data_get_double(settings, "Ki");
@@ -165,8 +209,28 @@ static void ftf_destroy(void *data)
 	s->texrender = NULL;
 	gs_texrender_destroy(s->texrender_scaled);
 	s->texrender_scaled = NULL;
-	gs_stagesurface_destroy(s->stagesurface);
-	s->stagesurface = NULL;
+	gs_texrender_destroy(s->texrender_coarse);
+	s->texrender_coarse = NULL;
+	gs_texrender_destroy(s->texrender_native);
+	s->texrender_native = NULL;
+	for (auto &tr : s->texrender_roi) {
+		gs_texrender_destroy(tr);
+		tr = NULL;
+	}
+	gs_effect_destroy(s->effect_luma);
+	s->effect_luma = NULL;
+	for (auto &st : s->stage_ring) {
+		gs_stagesurface_destroy(st.surface);
+		st.surface = NULL;
+		gs_stagesurface_destroy(st.surface_coarse);
+		st.surface_coarse = NULL;
+		gs_stagesurface_destroy(st.surface_native);
+		st.surface_native = NULL;
+		for (auto &sr : st.surface_roi) {
+			gs_stagesurface_destroy(sr);
+			sr = NULL;
+		}
+	}
 	obs_leave_graphics();
 
 	delete s->ftm;
@@ -230,6 +294,10 @@ static obs_properties_t *ftf_properties(void *data)
 	{
 		obs_properties_t *pp = obs_properties_create();
 		face_tracker_manager::get_properties(pp);
+		obs_properties_add_bool(pp, "gray_readback", obs_module_text("Read back grayscale image"));
+		obs_properties_add_int(pp, "detector_level", obs_module_text("Reduce image for detector"), 0, 2, 1);
+		obs_properties_add_bool(pp, "landmark_roi", obs_module_text("Read back faces at native resolution"));
+		obs_properties_add_bool(pp, "detector_tiled", obs_module_text("Detect small faces in tiles"));
 		obs_properties_add_group(props, "ftm", obs_module_text("Face detection options"), OBS_GROUP_NORMAL, pp);
 	}
 
@@ -282,6 +350,8 @@ static obs_properties_t *ftf_properties(void *data)
 		obs_properties_add_bool(pp, "debug_faces", "Show face detection results");
 		obs_properties_add_bool(pp, "debug_notrack", "Stop tracking faces");
 		obs_properties_add_bool(pp, "debug_always_show", "Always show information (useful for demo)");
+		obs_properties_add_int(pp, "debug_cascade_audit", "Compare HOG + CNN with CNN every N detections", 0,
+				       1000, 1);
 #ifdef ENABLE_DEBUG_DATA
 		obs_properties_add_path(pp, "debug_data_tracker", "Save correlation tracker data to file",
 					OBS_PATH_FILE_SAVE, DEBUG_DATA_PATH_FILTER, NULL);
@@ -320,6 +390,7 @@ static void ftf_get_defaults(obs_data_t *settings)
 	obs_data_set_default_double(settings, "track_z", 0.70);  //  1.00  0.50  0.35
 	obs_data_set_default_double(settings, "track_y", +0.00); // +0.00 +0.10 +0.30
 	obs_data_set_default_double(settings, "scale_max", 10.0);
+	obs_data_set_default_bool(settings, "landmark_roi", true);
 
 	obs_data_set_default_double(settings, "Kp", 0.95);
 	obs_data_set_default_double(settings, "Ki", 0.3);
@@ -678,98 +749,261 @@ static inline void calculate_error(struct face_tracker_filter *s)
 	}
 }
 
-static inline void draw_sprite_crop(float width, float height, float x0, float y0, float x1, float y1);
+static gs_effect_t *get_effect_luma(struct face_tracker_filter *s)
+{
+	if (s->effect_luma || s->effect_luma_failed)
+		return s->effect_luma;
+
+	char *f = obs_module_file("luma.effect");
+	char *errors = NULL;
+	s->effect_luma = f ? gs_effect_create_from_file(f, &errors) : NULL;
+	if (!s->effect_luma) {
+		blog(LOG_ERROR, "failed to load luma.effect: %s", errors ? errors : "file not found");
+		s->effect_luma_failed = true;
+	}
+	bfree(errors);
+	bfree(f);
+	return s->effect_luma;
+}
 
-static inline void scale_texture(struct face_tracker_filter *s, float scale)
+/* Selects the regions around the tracked faces to be read back at the native resolution.
+ * The margin covers the motion until the landmark detection runs on the staged frame.
+ */
+static inline int select_rois(struct face_tracker_filter *s, rectf_s *rois)
 {
-	if (!s->texrender_scaled)
-		s->texrender_scaled = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
-	const uint32_t cx = s->known_width / scale, cy = s->known_height / scale;
-	gs_texrender_reset(s->texrender_scaled);
-	gs_blend_state_push();
-	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
-	if (gs_texrender_begin(s->texrender_scaled, cx, cy)) {
+	const float w = (float)s->known_width, h = (float)s->known_height;
+	int n = 0;
+	for (const auto &tr : s->ftm->tracker_rects) {
+		if (n >= FTF_ROI_MAX)
+			break;
+		const rect_s &r = tr.rect;
+		const float mx = (r.x1 - r.x0) * ROI_MARGIN, my = (r.y1 - r.y0) * ROI_MARGIN;
+		rectf_s roi;
+		roi.x0 = floorf(std::max(r.x0 - mx, 0.0f) / ROI_ALIGN) * ROI_ALIGN;
+		roi.y0 = floorf(std::max(r.y0 - my, 0.0f) / ROI_ALIGN) * ROI_ALIGN;
+		roi.x1 = std::min(ceilf((r.x1 + mx) / ROI_ALIGN) * ROI_ALIGN, w);
+		roi.y1 = std::min(ceilf((r.y1 + my) / ROI_ALIGN) * ROI_ALIGN, h);
+		if (roi.x1 - roi.x0 < ROI_ALIGN || roi.y1 - roi.y0 < ROI_ALIGN)
+			continue;
+		if ((roi.x1 - roi.x0) * (roi.y1 - roi.y0) > w * h * ROI_AREA_MAX)
+			continue;
+		rois[n++] = roi;
+	}
+	return n;
+}
+
+// Renders the region `x0`, `y0`, `x1`, `y1` in the texture coordinates of `tex` to `cx` x `cy` pixels.
+static inline void render_level(gs_texrender_t **dst, gs_texture_t *tex, gs_effect_t *effect_luma, uint32_t cx,
+				uint32_t cy, float x0, float y0, float x1, float y1)
+{
+	if (!*dst)
+		*dst = gs_texrender_create(effect_luma ? GS_R8 : GS_BGRA, GS_ZS_NONE);
+	gs_texrender_reset(*dst);
+	if (gs_texrender_begin(*dst, cx, cy)) {
 		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
-		gs_texture_t *tex = gs_texrender_get_texture(s->texrender);
-		auto effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+		auto effect = effect_luma ? effect_luma : obs_get_base_effect(OBS_EFFECT_DEFAULT);
 		if (tex && effect) {
 			gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
 			gs_effect_set_texture(image, tex);
 			while (gs_effect_loop(effect, "Draw"))
-				draw_sprite_crop(cx, cy, 0, 0, 1, 1);
+				draw_sprite_crop(cx, cy, x0, y0, x1, y1);
 		}
-		gs_texrender_end(s->texrender_scaled);
+		gs_texrender_end(*dst);
+	}
+}
+
+/* Builds the pyramid from the rendered frame.
+ * The scaled level is for the trackers, the coarse level is made from the scaled level for the detector,
+ * the native level is for the tiled detection,
+ * and the regions of interest are cut from the native resolution for the landmark detection.
+ */
+static inline void scale_texture(struct face_tracker_filter *s, const struct ftf_levels_s &lv)
+{
+	gs_effect_t *effect_luma = s->gray_readback ? get_effect_luma(s) : NULL;
+	const bool gray = effect_luma != NULL;
+	if (s->texrender_scaled_gray != gray) {
+		gs_texrender_destroy(s->texrender_scaled);
+		s->texrender_scaled = NULL;
+		gs_texrender_destroy(s->texrender_coarse);
+		s->texrender_coarse = NULL;
+		gs_texrender_destroy(s->texrender_native);
+		s->texrender_native = NULL;
+		for (auto &tr : s->texrender_roi) {
+			gs_texrender_destroy(tr);
+			tr = NULL;
+		}
+		s->texrender_scaled_gray = gray;
+	}
+
+	gs_texture_t *tex = gs_texrender_get_texture(s->texrender);
+	const uint32_t cx = s->known_width / lv.scale, cy = s->known_height / lv.scale;
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+
+	render_level(&s->texrender_scaled, tex, effect_luma, cx, cy, 0.0f, 0.0f, 1.0f, 1.0f);
+
+	if (lv.coarse_level > 0) {
+		// The luma is already calculated in the scaled level.
+		render_level(&s->texrender_coarse, gs_texrender_get_texture(s->texrender_scaled), NULL,
+			     cx >> lv.coarse_level, cy >> lv.coarse_level, 0.0f, 0.0f, 1.0f, 1.0f);
+	}
+
+	if (lv.native) {
+		render_level(&s->texrender_native, tex, effect_luma, s->known_width, s->known_height, 0.0f, 0.0f, 1.0f,
+			     1.0f);
+	}
+
+	const float w = (float)s->known_width, h = (float)s->known_height;
+	for (int i = 0; i < lv.n_roi; i++) {
+		const rectf_s &r = lv.roi[i];
+		render_level(&s->texrender_roi[i], tex, effect_luma, (uint32_t)(r.x1 - r.x0), (uint32_t)(r.y1 - r.y0),
+			     r.x0 / w, r.y0 / h, r.x1 / w, r.y1 / h);
 	}
+
 	gs_blend_state_pop();
 }
 
-static inline int stage_to_surface(struct face_tracker_filter *s, float scale)
+static inline bool stage_level(gs_stagesurf_t **surface, gs_texrender_t *texrender, uint32_t width, uint32_t height,
+			       bool gray)
+{
+	gs_texture_t *tex = gs_texrender_get_texture(texrender);
+	if (!tex || width <= 0 || height <= 0)
+		return false;
+
+	if (!*surface || width != gs_stagesurface_get_width(*surface) ||
+	    height != gs_stagesurface_get_height(*surface)) {
+		gs_stagesurface_destroy(*surface);
+		*surface = gs_stagesurface_create(width, height, gray ? GS_R8 : GS_BGRA);
+	}
+
+	gs_stage_texture(*surface, tex);
+	return true;
+}
+
+static inline int stage_to_surface(struct face_tracker_filter *s, const struct ftf_levels_s &lv)
 {
-	uint32_t width = s->known_width / scale;
-	uint32_t height = s->known_height / scale;
+	uint32_t width = s->known_width / lv.scale;
+	uint32_t height = s->known_height / lv.scale;
 	if (width <= 0 || height <= 0)
 		return 1;
 
-	gs_texture_t *tex = gs_texrender_get_texture(s->texrender_scaled);
-	if (!tex)
+	if (!gs_texrender_get_texture(s->texrender_scaled))
 		return 2;
 
-	if (!s->stagesurface || width != gs_stagesurface_get_width(s->stagesurface) ||
-	    height != gs_stagesurface_get_height(s->stagesurface)) {
-		gs_stagesurface_destroy(s->stagesurface);
-		s->stagesurface = gs_stagesurface_create(width, height, GS_BGRA);
+	const bool gray = s->texrender_scaled_gray;
+	struct ftf_stage_s &st = s->stage_ring[s->stage_next];
+	if (gray != st.gray) {
+		gs_stagesurface_destroy(st.surface);
+		st.surface = NULL;
+		gs_stagesurface_destroy(st.surface_coarse);
+		st.surface_coarse = NULL;
+		gs_stagesurface_destroy(st.surface_native);
+		st.surface_native = NULL;
+		for (auto &sr : st.surface_roi) {
+			gs_stagesurface_destroy(sr);
+			sr = NULL;
+		}
+		st.gray = gray;
 	}
 
-	gs_stage_texture(s->stagesurface, tex);
+	stage_level(&st.surface, s->texrender_scaled, width, height, gray);
+	st.staged = true;
+	st.tick = s->ftm->tick_cnt;
+	st.scale = lv.scale;
+
+	const int cl = lv.coarse_level;
+	st.staged_coarse =
+		cl > 0 && stage_level(&st.surface_coarse, s->texrender_coarse, width >> cl, height >> cl, gray);
+	st.staged_native = lv.native && stage_level(&st.surface_native, s->texrender_native, s->known_width,
+						    s->known_height, gray);
+
+	st.n_roi = 0;
+	for (int i = 0; i < lv.n_roi; i++) {
+		const rectf_s &r = lv.roi[i];
+		if (stage_level(&st.surface_roi[st.n_roi], s->texrender_roi[i], (uint32_t)(r.x1 - r.x0),
+				(uint32_t)(r.y1 - r.y0), gray))
+			st.roi[st.n_roi++] = r;
+	}
+
+	s->stage_next = (s->stage_next + 1) % FTF_STAGE_RING;
 
 	return 0;
 }
 
-static inline std::shared_ptr<texture_object> surface_to_cvtex(struct face_tracker_filter *s, float scale)
+static inline bool staged_in_tick(const struct face_tracker_filter *s, int tick)
+{
+	const struct ftf_stage_s &st = s->stage_ring[(s->stage_next + FTF_STAGE_RING - 1) % FTF_STAGE_RING];
+	return st.staged && st.tick == tick;
+}
+
+static inline std::shared_ptr<texture_object> map_surface(gs_stagesurf_t *surface, bool gray, int tick, float scale)
 {
 	uint8_t *video_data = NULL;
 	uint32_t video_linesize;
-	if (!gs_stagesurface_map(s->stagesurface, &video_data, &video_linesize))
+	if (!gs_stagesurface_map(surface, &video_data, &video_linesize))
 		return NULL;
 
-	uint32_t width = gs_stagesurface_get_width(s->stagesurface);
-	uint32_t height = gs_stagesurface_get_height(s->stagesurface);
-
 	std::shared_ptr<texture_object> cvtex(new texture_object);
 	cvtex->scale = scale;
-	cvtex->tick = s->ftm->tick_cnt;
+	cvtex->tick = tick;
 
 	struct obs_source_frame frame;
 	memset(&frame, 0, sizeof(frame));
 	frame.data[0] = video_data;
 	frame.linesize[0] = video_linesize;
-	frame.width = width;
-	frame.height = height;
-	frame.format = VIDEO_FORMAT_BGRA;
+	frame.width = gs_stagesurface_get_width(surface);
+	frame.height = gs_stagesurface_get_height(surface);
+	frame.format = gray ? VIDEO_FORMAT_Y800 : VIDEO_FORMAT_BGRA;
 	cvtex->set_texture_obsframe(&frame, 1);
 
-	gs_stagesurface_unmap(s->stagesurface);
+	gs_stagesurface_unmap(surface);
 
 	return cvtex;
 }
 
-static inline void draw_sprite_crop(float width, float height, float x0, float y0, float x1, float y1)
+/* Maps the oldest stage surface, which was staged `FTF_STAGE_RING - 1` ticks before.
+ * Mapping the surface staged in the same frame would wait for the GPU and stall the render thread.
+ * Returns NULL for the first `FTF_STAGE_RING - 1` frames, when no surface has been staged long enough, and after the
+ * rendering has been skipped for some ticks, when the oldest surface is too old to track. The manager takes NULL as
+ * a frame without any image and tries again at the next tick.
+ */
+static inline std::shared_ptr<texture_object> surface_to_cvtex(struct face_tracker_filter *s)
 {
-	gs_render_start(false);
-	gs_vertex2f(0.0f, 0.0f);
-	gs_vertex2f(width, 0.0f);
-	gs_vertex2f(0.0f, height);
-	gs_vertex2f(width, height);
-	struct vec2 tv;
-	vec2_set(&tv, x0, y0);
-	gs_texcoord2v(&tv, 0);
-	vec2_set(&tv, x1, y0);
-	gs_texcoord2v(&tv, 0);
-	vec2_set(&tv, x0, y1);
-	gs_texcoord2v(&tv, 0);
-	vec2_set(&tv, x1, y1);
-	gs_texcoord2v(&tv, 0);
-	gs_render_stop(GS_TRISTRIP);
+	struct ftf_stage_s &st = s->stage_ring[s->stage_next];
+	if (!st.staged)
+		return NULL;
+	st.staged = false;
+	if (s->ftm->tick_cnt.load(std::memory_order_relaxed) - st.tick > FTF_STAGE_RING - 1) {
+		st.staged_coarse = st.staged_native = false;
+		st.n_roi = 0;
+		return NULL;
+	}
+
+	std::shared_ptr<texture_object> cvtex = map_surface(st.surface, st.gray, st.tick, st.scale);
+	if (!cvtex)
+		return NULL;
+
+	if (st.staged_coarse) {
+		const float scale = st.scale * gs_stagesurface_get_width(st.surface) /
+				    gs_stagesurface_get_width(st.surface_coarse);
+		cvtex->coarse = map_surface(st.surface_coarse, st.gray, st.tick, scale);
+		st.staged_coarse = false;
+	}
+
+	if (st.staged_native) {
+		cvtex->native = map_surface(st.surface_native, st.gray, st.tick, 1.0f);
+		st.staged_native = false;
+	}
+
+	for (int i = 0; i < st.n_roi; i++) {
+		if (auto roi = map_surface(st.surface_roi[i], st.gray, st.tick, 1.0f)) {
+			roi->origin = pointf_s{st.roi[i].x0, st.roi[i].y0};
+			cvtex->rois.push_back(roi);
+		}
+	}
+	st.n_roi = 0;
+
+	return cvtex;
 }
 
 static inline void draw_frame_texture(struct face_tracker_filter *s, bool debug_notrack)
@@ -885,6 +1119,23 @@ static inline void draw_frame(struct face_tracker_filter *s)
 		draw_frame_info(s, debug_notrack);
 }
 
+static void post_render(struct face_tracker_filter *s)
+{
+	const uint64_t start_ns = os_gettime_ns();
+	s->ftm->post_render();
+	const uint64_t dt = os_gettime_ns() - start_ns;
+
+	s->render_ns_sum += dt;
+	if (dt > s->render_ns_max)
+		s->render_ns_max = dt;
+	if (++s->render_cnt >= RENDER_REPORT_CNT) {
+		blog(LOG_DEBUG, "%s: %.3f ms in average, %.3f ms at max in the render thread",
+		     obs_source_get_name(s->context), s->render_ns_sum * 1e-6 / s->render_cnt, s->render_ns_max * 1e-6);
+		s->render_ns_sum = s->render_ns_max = 0;
+		s->render_cnt = 0;
+	}
+}
+
 static void ftf_render(void *data, gs_effect_t *)
 {
 	auto *s = (struct face_tracker_filter *)data;
@@ -903,7 +1154,7 @@ static void ftf_render(void *data, gs_effect_t *)
 	if (!s->rendered) {
 		render_target(s, target, parent);
 		if (is_running(s))
-			s->ftm->post_render();
+			post_render(s);
 		s->rendered = true;
 	}
 
@@ -925,7 +1176,7 @@ static void fts_render(void *data, gs_effect_t *)
 		s->rendered = true;
 		render_target(s, target, NULL);
 		if (is_running(s))
-			s->ftm->post_render();
+			post_render(s);
 	}
 
 	draw_frame(s);
@@ -4,12 +4,57 @@
 #include <deque>
 #include "helper.hpp"
 
+// Number of stage surfaces. The frame staged at a tick is mapped `FTF_STAGE_RING - 1` ticks later.
+#define FTF_STAGE_RING 3
+
+// Maximum number of the regions of interest read back at the native resolution for the landmark detection.
+#define FTF_ROI_MAX 4
+
+// Levels of the pyramid rendered and staged in a tick
+struct ftf_levels_s
+{
+	float scale;
+	int coarse_level; // reduced by `1 << coarse_level` from the scaled level, 0 if not needed
+	bool native;      // whole frame at the native resolution for the tiled detection
+	rectf_s roi[FTF_ROI_MAX];
+	int n_roi;
+};
+
+struct ftf_stage_s
+{
+	gs_stagesurf_t *surface;
+	bool staged;
+	int tick; // `tick_cnt` when staged
+	float scale;
+	bool gray; // staged in GS_R8
+
+	// other levels of the pyramid staged at the same tick
+	gs_stagesurf_t *surface_coarse;
+	bool staged_coarse;
+	gs_stagesurf_t *surface_native;
+	bool staged_native;
+	gs_stagesurf_t *surface_roi[FTF_ROI_MAX];
+	rectf_s roi[FTF_ROI_MAX]; // in the source pixels
+	int n_roi;
+};
+
 struct face_tracker_filter
 {
 	obs_source_t *context;
 	gs_texrender_t *texrender;
 	gs_texrender_t *texrender_scaled;
-	gs_stagesurf_t *stagesurface;
+	bool texrender_scaled_gray; // also applies to `texrender_coarse`, `texrender_native`, and `texrender_roi`
+	gs_texrender_t *texrender_coarse;
+	gs_texrender_t *texrender_native;
+	gs_texrender_t *texrender_roi[FTF_ROI_MAX];
+	gs_effect_t *effect_luma;
+	bool effect_luma_failed;
+	bool gray_readback; // read back only luma, 1/4 of the bandwidth of BGRA
+	int detector_level; // the detector takes the image reduced by `1 << detector_level` from the tracker's one
+	bool landmark_roi;  // read back the faces at the native resolution for the landmark detection
+	bool detector_tiled; // read back the native resolution for the detector to find small faces in tiles
+	struct ftf_stage_s stage_ring[FTF_STAGE_RING];
+	int stage_next;
 	uint32_t known_width;
 	uint32_t known_height;
 	uint32_t width_with_aspect;
@@ -52,6 +97,10 @@ struct face_tracker_filter
 	char *debug_data_error_last;
 	char *debug_data_control_last;
 
+	// time spent in `post_render` on the render thread
+	uint64_t render_ns_sum, render_ns_max;
+	int render_cnt;
+
 	bool is_paused;
 	obs_hotkey_pair_id hotkey_pause;
 	obs_hotkey_id hotkey_reset;
@@ -0,0 +1,92 @@
+#include <cmath>
+#include <algorithm>
+#include "global-shift.hpp"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define N GLOBAL_SHIFT_N
+#define PEAK_MIN 0.08f
+
+global_shift::global_shift() : prev_f(N * N), cur_f(N * N), col(N), window(N)
+{
+	for (int i = 0; i < N; i++)
+		window[i] = 0.5f - 0.5f * (float)cos(2.0 * M_PI * (i + 0.5) / N);
+}
+
+// Subpixel offset of the peak of the phase correlation, which is close to a sinc function rather than a parabola.
+static inline float subpixel_peak(float l, float c, float r)
+{
+	if (r > l && r > 0.0f)
+		return std::min(r / (r + c), 0.5f);
+	if (l > 0.0f)
+		return -std::min(l / (l + c), 0.5f);
+	return 0.0f;
+}
+
+bool global_shift::estimate(const uint8_t *gray, int width, int height, float &dx, float &dy)
+{
+	if (width < N || height < N)
+		return false;
+
+	// Area average to N x N, then remove the mean and apply the window.
+	float sum = 0.0f;
+	for (int y = 0; y < N; y++) {
+		const int y0 = y * height / N, y1 = (y + 1) * height / N;
+		for (int x = 0; x < N; x++) {
+			const int x0 = x * width / N, x1 = (x + 1) * width / N;
+			int acc = 0;
+			for (int yy = y0; yy < y1; yy++) {
+				const uint8_t *line = gray + (size_t)yy * width;
+				for (int xx = x0; xx < x1; xx++)
+					acc += line[xx];
+			}
+			const float v = (float)acc / ((x1 - x0) * (y1 - y0));
+			cur_f[y * N + x] = kcf_complex(v, 0.0f);
+			sum += v;
+		}
+	}
+	const float mean = sum / (N * N);
+	for (int y = 0; y < N; y++) {
+		for (int x = 0; x < N; x++)
+			cur_f[y * N + x] = (cur_f[y * N + x].real() - mean) * window[x] * window[y];
+	}
+
+	const kcf_fft_plan &plan = kcf_fft_plan::get(N);
+	plan.fft2(cur_f.data(), col.data(), false);
+
+	if (!has_prev) {
+		prev_f.swap(cur_f);
+		has_prev = true;
+		return false;
+	}
+
+	// Normalized cross-power spectrum; `prev_f` becomes the correlation surface and `cur_f` is kept for the next.
+	for (int i = 0; i < N * N; i++) {
+		const kcf_complex r = cur_f[i] * std::conj(prev_f[i]);
+		const float a = std::abs(r);
+		prev_f[i] = a > 1e-6f ? r / a : kcf_complex(0.0f, 0.0f);
+	}
+	plan.fft2(prev_f.data(), col.data(), true);
+
+	int peak = 0;
+	for (int i = 1; i < N * N; i++) {
+		if (prev_f[i].real() > prev_f[peak].real())
+			peak = i;
+	}
+	const int px = peak % N, py = peak / N;
+	const float c = prev_f[peak].real();
+	auto at = [this](int x, int y) { return prev_f[((y + N) % N) * N + (x + N) % N].real(); };
+	const float sx = subpixel_peak(at(px - 1, py), c, at(px + 1, py));
+	const float sy = subpixel_peak(at(px, py - 1), c, at(px, py + 1));
+
+	prev_f.swap(cur_f);
+
+	if (c < PEAK_MIN)
+		return false;
+
+	dx = ((px >= N / 2 ? px - N : px) + sx) / N;
+	dy = ((py >= N / 2 ? py - N : py) + sy) / N;
+	return true;
+}
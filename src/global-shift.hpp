@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "kcf-core.hpp"
+
+#define GLOBAL_SHIFT_N 64
+
+/* Estimates the translation of the whole image between consecutive frames by phase correlation.
+ * The frame is downscaled to GLOBAL_SHIFT_N x GLOBAL_SHIFT_N so that the cost does not depend on the resolution.
+ * The shift can be estimated up to a half of the width and the height.
+ */
+class global_shift {
+	std::vector<kcf_complex> prev_f; // spectrum of the previous frame
+	std::vector<kcf_complex> cur_f;
+	std::vector<kcf_complex> col;
+	std::vector<float> window;
+	bool has_prev = false;
+
+public:
+	global_shift();
+
+	// Returns true and sets the shift of the content in the ratio to the width and the height.
+	// Returns false for the first frame or if the correlation is too weak such as a flat image.
+	bool estimate(const uint8_t *gray, int width, int height, float &dx, float &dy);
+	void reset() { has_prev = false; }
+};
@@ -1,4 +1,5 @@
 #include <obs-module.h>
+#include <graphics/vec2.h>
 #include "plugin-macros.generated.h"
 #include "helper.hpp"
 
@@ -88,6 +89,25 @@ pointf_s landmark_center(const std::vector<pointf_s> &landmark)
 	return ret;
 }
 
+void draw_sprite_crop(float width, float height, float x0, float y0, float x1, float y1)
+{
+	gs_render_start(false);
+	gs_vertex2f(0.0f, 0.0f);
+	gs_vertex2f(width, 0.0f);
+	gs_vertex2f(0.0f, height);
+	gs_vertex2f(width, height);
+	struct vec2 tv;
+	vec2_set(&tv, x0, y0);
+	gs_texcoord2v(&tv, 0);
+	vec2_set(&tv, x1, y0);
+	gs_texcoord2v(&tv, 0);
+	vec2_set(&tv, x0, y1);
+	gs_texcoord2v(&tv, 0);
+	vec2_set(&tv, x1, y1);
+	gs_texcoord2v(&tv, 0);
+	gs_render_stop(GS_TRISTRIP);
+}
+
 void draw_landmark(const std::vector<pointf_s> &landmark)
 {
 	if (landmark.size() < 2)
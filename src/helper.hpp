@@ -131,6 +131,18 @@ static inline float sqf(float x)
 	return x * x;
 }
 
+static inline rect_s upsize_rect(rect_s r, const rectf_s &upsize)
+{
+	// upsize is given as {left, top, right, bottom}
+	int w = r.x1 - r.x0;
+	int h = r.y1 - r.y0;
+	r.x0 -= w * upsize.x0;
+	r.x1 += w * upsize.x1;
+	r.y0 -= h * upsize.y0;
+	r.y1 += h * upsize.y1;
+	return r;
+}
+
 static inline rectf_s f3_to_rectf(const f3 &u, float w, float h)
 {
 	const float srwh = sqrtf(w * h);
@@ -146,6 +158,7 @@ static inline rectf_s f3_to_rectf(const f3 &u, float w, float h)
 
 void draw_rect_upsize(rect_s r, float upsize_l = 0.0f, float upsize_r = 0.0f, float upsize_t = 0.0f,
 		      float upsize_b = 0.0f);
+void draw_sprite_crop(float width, float height, float x0, float y0, float x1, float y1);
 void draw_landmark(const std::vector<pointf_s> &landmark);
 float landmark_area(const std::vector<pointf_s> &landmark);
 pointf_s landmark_center(const std::vector<pointf_s> &landmark);
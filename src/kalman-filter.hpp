@@ -0,0 +1,46 @@
+#pragma once
+
+/* Constant-velocity Kalman filter for one coordinate.
+ * The time is counted in ticks (video frames).
+ */
+struct kalman_cv_s
+{
+	float x, v;          // position and velocity
+	float p00, p01, p11; // covariance
+
+	void reset(float z, float r, float r_v)
+	{
+		x = z;
+		v = 0.0f;
+		p00 = r;
+		p01 = 0.0f;
+		p11 = r_v;
+	}
+
+	// Advance the state by `dt` ticks with the acceleration noise `q`.
+	void predict(float dt, float q)
+	{
+		x += v * dt;
+		p00 += dt * (2.0f * p01 + dt * p11) + q * dt * dt * dt * (1.0f / 3.0f);
+		p01 += dt * p11 + q * dt * dt * 0.5f;
+		p11 += q * dt;
+	}
+
+	// Correct the state with the measurement `z` that was taken `d` ticks before the current state.
+	void correct(float z, float d, float r)
+	{
+		const float a = p00 - d * p01;
+		const float b = p01 - d * p11;
+		const float s = a - d * b + r;
+		if (s <= 0.0f)
+			return;
+		const float k0 = a / s;
+		const float k1 = b / s;
+		const float y = z - (x - d * v);
+		x += k0 * y;
+		v += k1 * y;
+		p00 -= k0 * a;
+		p01 -= k0 * b;
+		p11 -= k1 * b;
+	}
+};
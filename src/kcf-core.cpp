@@ -0,0 +1,468 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "kcf-core.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KCF_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PADDING 2.5f
+#define OUTPUT_SIGMA_FACTOR 0.1f
+#define LAMBDA 1e-4f
+#define SCALE_STEP 1.05f
+#define SCALE_PENALTY 0.95f
+#define MIN_SIZE 8.0f
+
+kcf_fft_plan::kcf_fft_plan(int n_) : n(n_), bitrev(n_), twiddle(n_ / 2)
+{
+	int log2n = 0;
+	while ((1 << log2n) < n)
+		log2n++;
+
+	for (int i = 0; i < n; i++) {
+		int r = 0;
+		for (int b = 0; b < log2n; b++)
+			if (i & (1 << b))
+				r |= 1 << (log2n - 1 - b);
+		bitrev[i] = r;
+	}
+
+	for (int k = 0; k < n / 2; k++) {
+		const double a = -2.0 * M_PI * k / n;
+		twiddle[k] = kcf_complex((float)cos(a), (float)sin(a));
+	}
+}
+
+const kcf_fft_plan &kcf_fft_plan::get(int n)
+{
+	static const kcf_fft_plan plan32(32);
+	static const kcf_fft_plan plan64(64);
+	return n <= 32 ? plan32 : plan64;
+}
+
+void kcf_fft_plan::fft1(kcf_complex *a, bool inverse) const
+{
+	for (int i = 0; i < n; i++) {
+		const int j = bitrev[i];
+		if (i < j)
+			std::swap(a[i], a[j]);
+	}
+
+	for (int len = 2, tstep = n / 2; len <= n; len <<= 1, tstep >>= 1) {
+		const int half = len >> 1;
+		for (int i = 0; i < n; i += len) {
+			for (int k = 0; k < half; k++) {
+				const kcf_complex w = twiddle[k * tstep];
+				const float wr = w.real();
+				const float wi = inverse ? -w.imag() : w.imag();
+				const kcf_complex u = a[i + k];
+				const kcf_complex v = a[i + k + half];
+				const float vr = v.real() * wr - v.imag() * wi;
+				const float vi = v.real() * wi + v.imag() * wr;
+				a[i + k] = kcf_complex(u.real() + vr, u.imag() + vi);
+				a[i + k + half] = kcf_complex(u.real() - vr, u.imag() - vi);
+			}
+		}
+	}
+}
+
+void kcf_fft_plan::fft2(kcf_complex *data, kcf_complex *col, bool inverse) const
+{
+	for (int y = 0; y < n; y++)
+		fft1(data + y * n, inverse);
+
+	for (int x = 0; x < n; x++) {
+		for (int y = 0; y < n; y++)
+			col[y] = data[y * n + x];
+		fft1(col, inverse);
+		for (int y = 0; y < n; y++)
+			data[y * n + x] = col[y];
+	}
+
+	if (inverse) {
+		const float s = 1.0f / (n * n);
+		for (int i = 0; i < n * n; i++)
+			data[i] *= s;
+	}
+}
+
+// dst += a * conj(b)
+static inline void cmul_conj_acc(kcf_complex *dst, const kcf_complex *a, const kcf_complex *b, int n)
+{
+	int i = 0;
+#ifdef KCF_USE_SSE2
+	const __m128 sign = _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+	for (; i + 2 <= n; i += 2) {
+		const __m128 va = _mm_loadu_ps((const float *)(a + i));
+		const __m128 vb = _mm_loadu_ps((const float *)(b + i));
+		const __m128 br = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+		const __m128 bi = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+		const __m128 as = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+		const __m128 t1 = _mm_mul_ps(va, br);
+		const __m128 t2 = _mm_xor_ps(_mm_mul_ps(as, bi), sign);
+		const __m128 vd = _mm_loadu_ps((const float *)(dst + i));
+		_mm_storeu_ps((float *)(dst + i), _mm_add_ps(vd, _mm_add_ps(t1, t2)));
+	}
+#endif
+	for (; i < n; i++) {
+		const float ar = a[i].real(), ai = a[i].imag();
+		const float br = b[i].real(), bi = b[i].imag();
+		dst[i] += kcf_complex(ar * br + ai * bi, ai * br - ar * bi);
+	}
+}
+
+// dst = a * b
+static inline void cmul(kcf_complex *dst, const kcf_complex *a, const kcf_complex *b, int n)
+{
+	int i = 0;
+#ifdef KCF_USE_SSE2
+	const __m128 sign = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+	for (; i + 2 <= n; i += 2) {
+		const __m128 va = _mm_loadu_ps((const float *)(a + i));
+		const __m128 vb = _mm_loadu_ps((const float *)(b + i));
+		const __m128 br = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+		const __m128 bi = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+		const __m128 as = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+		const __m128 t1 = _mm_mul_ps(va, br);
+		const __m128 t2 = _mm_xor_ps(_mm_mul_ps(as, bi), sign);
+		_mm_storeu_ps((float *)(dst + i), _mm_add_ps(t1, t2));
+	}
+#endif
+	for (; i < n; i++) {
+		const float ar = a[i].real(), ai = a[i].imag();
+		const float br = b[i].real(), bi = b[i].imag();
+		dst[i] = kcf_complex(ar * br - ai * bi, ai * br + ar * bi);
+	}
+}
+
+// returns sum |a|^2
+static inline float sum_norm(const kcf_complex *a, int n)
+{
+	const float *f = (const float *)a;
+	const int nf = n * 2;
+	int i = 0;
+	float ret = 0.0f;
+#ifdef KCF_USE_SSE2
+	__m128 acc = _mm_setzero_ps();
+	for (; i + 4 <= nf; i += 4) {
+		const __m128 v = _mm_loadu_ps(f + i);
+		acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+	}
+	alignas(16) float s[4];
+	_mm_store_ps(s, acc);
+	ret = s[0] + s[1] + s[2] + s[3];
+#endif
+	for (; i < nf; i++)
+		ret += f[i] * f[i];
+	return ret;
+}
+
+struct alignas(32) kcf_core_private_s
+{
+	enum kcf_feature_e feature;
+	const kcf_fft_plan *plan;
+	int n, channels, cell, patch_size;
+	float sigma_k, interp;
+
+	float hann[KCF_MAX_N * KCF_MAX_N];
+	kcf_complex yf[KCF_MAX_N * KCF_MAX_N];
+
+	// work buffers
+	int xi[KCF_MAX_N * 4 + 2];
+	float xw[KCF_MAX_N * 4 + 2];
+	float patch[KCF_MAX_PATCH];
+	float feat[KCF_MAX_ELEMENTS];
+	kcf_complex zf[KCF_MAX_ELEMENTS];
+	kcf_complex kf[KCF_MAX_N * KCF_MAX_N];
+	kcf_complex tmp[KCF_MAX_N * KCF_MAX_N];
+	kcf_complex col[KCF_MAX_N];
+	float response[KCF_MAX_N * KCF_MAX_N];
+
+	void sample_patch(const kcf_image_s &img, float cx, float cy, float sx, float sy);
+	void extract_features(const kcf_image_s &img, float cx, float cy, float w, float h);
+	void gaussian_correlation(const kcf_complex *xf, const kcf_complex *yf);
+	float detect(const kcf_model_s &m, const kcf_box_s &b, const kcf_image_s &img, float scale, float &dx,
+		     float &dy, float &psr);
+	void train(kcf_model_s &m, const kcf_box_s &b, const kcf_image_s &img, bool first);
+};
+
+kcf_core::kcf_core(enum kcf_feature_e feature)
+{
+	p = new kcf_core_private_s;
+	p->feature = feature;
+	switch (feature) {
+	case kcf_feature_hog:
+		p->n = 32;
+		p->channels = KCF_HOG_BINS;
+		p->cell = 4;
+		p->patch_size = p->n * p->cell + 2;
+		p->sigma_k = 0.5f;
+		p->interp = 0.02f;
+		break;
+	case kcf_feature_gray:
+	default:
+		p->feature = kcf_feature_gray;
+		p->n = 64;
+		p->channels = 1;
+		p->cell = 1;
+		p->patch_size = p->n;
+		p->sigma_k = 0.2f;
+		p->interp = 0.075f;
+		break;
+	}
+	p->plan = &kcf_fft_plan::get(p->n);
+
+	const int n = p->n;
+	for (int y = 0; y < n; y++) {
+		const float hy = 0.5f * (1.0f - cosf(2.0f * (float)M_PI * y / (n - 1)));
+		for (int x = 0; x < n; x++) {
+			const float hx = 0.5f * (1.0f - cosf(2.0f * (float)M_PI * x / (n - 1)));
+			p->hann[y * n + x] = hx * hy;
+		}
+	}
+
+	// Gaussian-shaped label whose peak is at the origin.
+	const float sigma = n / PADDING * OUTPUT_SIGMA_FACTOR;
+	for (int y = 0; y < n; y++) {
+		const int dy = y < n / 2 ? y : y - n;
+		for (int x = 0; x < n; x++) {
+			const int dx = x < n / 2 ? x : x - n;
+			p->yf[y * n + x] = kcf_complex(expf(-0.5f * (dx * dx + dy * dy) / (sigma * sigma)), 0.0f);
+		}
+	}
+	p->plan->fft2(p->yf, p->col, false);
+}
+
+kcf_core::~kcf_core()
+{
+	delete p;
+}
+
+enum kcf_feature_e kcf_core::get_feature() const
+{
+	return p->feature;
+}
+
+void kcf_core_private_s::sample_patch(const kcf_image_s &img, float cx, float cy, float sx, float sy)
+{
+	const int s = patch_size;
+	const float xmax = img.width - 1.001f;
+	const float ymax = img.height - 1.001f;
+
+	for (int j = 0; j < s; j++) {
+		const float x = std::clamp(cx + (j - (s - 1) * 0.5f) * sx, 0.0f, xmax);
+		xi[j] = (int)x;
+		xw[j] = x - xi[j];
+	}
+
+	for (int i = 0; i < s; i++) {
+		const float y = std::clamp(cy + (i - (s - 1) * 0.5f) * sy, 0.0f, ymax);
+		const int iy = (int)y;
+		const float fy = y - iy;
+		const uint8_t *l0 = img.data + (size_t)img.linesize * iy;
+		const uint8_t *l1 = l0 + img.linesize;
+		float *dst = patch + s * i;
+		for (int j = 0; j < s; j++) {
+			const int x0 = xi[j];
+			const float fx = xw[j];
+			const float v0 = l0[x0] + (l0[x0 + 1] - l0[x0]) * fx;
+			const float v1 = l1[x0] + (l1[x0 + 1] - l1[x0]) * fx;
+			dst[j] = v0 + (v1 - v0) * fy;
+		}
+	}
+}
+
+void kcf_core_private_s::extract_features(const kcf_image_s &img, float cx, float cy, float w, float h)
+{
+	const int nn = n * n;
+	const float sx = w * PADDING / (n * cell);
+	const float sy = h * PADDING / (n * cell);
+	sample_patch(img, cx, cy, sx, sy);
+
+	if (feature == kcf_feature_gray) {
+		for (int i = 0; i < nn; i++)
+			feat[i] = (patch[i] * (1.0f / 255.0f) - 0.5f) * hann[i];
+		return;
+	}
+
+	// Unsigned gradient orientation histogram for each cell.
+	static const float ori[KCF_HOG_BINS][2] = {
+		{1.0000f, 0.0000f}, {0.9397f, 0.3420f},  {0.7660f, 0.6428f},  {0.5000f, 0.8660f},  {0.1736f, 0.9848f},
+		{-0.1736f, 0.9848f}, {-0.5000f, 0.8660f}, {-0.7660f, 0.6428f}, {-0.9397f, 0.3420f},
+	};
+	memset(feat, 0, sizeof(float) * nn * channels);
+	const int s = patch_size;
+	for (int y = 1; y < s - 1; y++) {
+		const float *l = patch + s * y;
+		float *fc = feat + ((y - 1) / cell) * n;
+		for (int x = 1; x < s - 1; x++) {
+			const float gx = l[x + 1] - l[x - 1];
+			const float gy = l[x + s] - l[x - s];
+			int best = 0;
+			float best_dot = 0.0f;
+			for (int b = 0; b < KCF_HOG_BINS; b++) {
+				const float d = fabsf(gx * ori[b][0] + gy * ori[b][1]);
+				if (d > best_dot) {
+					best_dot = d;
+					best = b;
+				}
+			}
+			fc[best * nn + (x - 1) / cell] += sqrtf(gx * gx + gy * gy);
+		}
+	}
+
+	for (int i = 0; i < nn; i++) {
+		float sum = 1e-4f;
+		for (int b = 0; b < channels; b++)
+			sum += feat[b * nn + i] * feat[b * nn + i];
+		const float k = hann[i] / sqrtf(sum);
+		for (int b = 0; b < channels; b++)
+			feat[b * nn + i] *= k;
+	}
+}
+
+// kf = fft2(exp(-|x - y|^2 / sigma^2 / numel)) for all cyclic shifts of y
+void kcf_core_private_s::gaussian_correlation(const kcf_complex *xf, const kcf_complex *yf)
+{
+	const int nn = n * n;
+	const float xx = sum_norm(xf, nn * channels) / nn;
+	const float yy = xf == yf ? xx : sum_norm(yf, nn * channels) / nn;
+
+	std::fill(tmp, tmp + nn, kcf_complex(0.0f, 0.0f));
+	for (int c = 0; c < channels; c++)
+		cmul_conj_acc(tmp, xf + c * nn, yf + c * nn, nn);
+	plan->fft2(tmp, col, true);
+
+	const float k = 1.0f / (nn * channels);
+	const float s = -1.0f / (sigma_k * sigma_k);
+	for (int i = 0; i < nn; i++) {
+		const float d = std::max((xx + yy - 2.0f * tmp[i].real()) * k, 0.0f);
+		kf[i] = kcf_complex(expf(d * s), 0.0f);
+	}
+	plan->fft2(kf, col, false);
+}
+
+static inline void features_to_freq(kcf_complex *dst, const float *src, int channels, int nn, const kcf_fft_plan &plan,
+				    kcf_complex *col)
+{
+	for (int c = 0; c < channels; c++) {
+		kcf_complex *d = dst + c * nn;
+		const float *s = src + c * nn;
+		for (int i = 0; i < nn; i++)
+			d[i] = kcf_complex(s[i], 0.0f);
+		plan.fft2(d, col, false);
+	}
+}
+
+float kcf_core_private_s::detect(const kcf_model_s &m, const kcf_box_s &b, const kcf_image_s &img, float scale,
+				 float &dx, float &dy, float &psr)
+{
+	const int nn = n * n;
+	extract_features(img, b.cx, b.cy, b.w * scale, b.h * scale);
+	features_to_freq(zf, feat, channels, nn, *plan, col);
+	gaussian_correlation(zf, m.xf);
+	cmul(tmp, m.alphaf, kf, nn);
+	plan->fft2(tmp, col, true);
+
+	int i_max = 0;
+	float sum = 0.0f, sum2 = 0.0f;
+	for (int i = 0; i < nn; i++) {
+		const float r = tmp[i].real();
+		response[i] = r;
+		sum += r;
+		sum2 += r * r;
+		if (r > response[i_max])
+			i_max = i;
+	}
+	const float peak = response[i_max];
+	const float mean = sum / nn;
+	const float sd = sqrtf(std::max(sum2 / nn - mean * mean, 1e-12f));
+	psr = (peak - mean) / sd;
+
+	const int px = i_max % n;
+	const int py = i_max / n;
+	auto subpixel = [](float l, float c, float r) {
+		const float d = l - 2.0f * c + r;
+		return d < 0.0f ? 0.5f * (l - r) / d : 0.0f;
+	};
+	float fx = px + subpixel(response[py * n + (px + n - 1) % n], peak, response[py * n + (px + 1) % n]);
+	float fy = py + subpixel(response[((py + n - 1) % n) * n + px], peak, response[((py + 1) % n) * n + px]);
+	if (fx > n / 2)
+		fx -= n;
+	if (fy > n / 2)
+		fy -= n;
+
+	dx = fx * b.w * scale * PADDING / n;
+	dy = fy * b.h * scale * PADDING / n;
+	return peak;
+}
+
+void kcf_core_private_s::train(kcf_model_s &m, const kcf_box_s &b, const kcf_image_s &img, bool first)
+{
+	const int nn = n * n;
+	extract_features(img, b.cx, b.cy, b.w, b.h);
+	features_to_freq(zf, feat, channels, nn, *plan, col);
+	gaussian_correlation(zf, zf);
+
+	for (int i = 0; i < nn; i++) {
+		const float kr = kf[i].real() + LAMBDA, ki = kf[i].imag();
+		const float yr = yf[i].real(), yi = yf[i].imag();
+		const float d = 1.0f / (kr * kr + ki * ki);
+		tmp[i] = kcf_complex((yr * kr + yi * ki) * d, (yi * kr - yr * ki) * d);
+	}
+
+	if (first) {
+		std::copy(zf, zf + nn * channels, m.xf);
+		std::copy(tmp, tmp + nn, m.alphaf);
+		return;
+	}
+
+	const float k1 = interp, k0 = 1.0f - interp;
+	for (int i = 0; i < nn * channels; i++)
+		m.xf[i] = m.xf[i] * k0 + zf[i] * k1;
+	for (int i = 0; i < nn; i++)
+		m.alphaf[i] = m.alphaf[i] * k0 + tmp[i] * k1;
+}
+
+void kcf_core::init(kcf_model_s &m, kcf_box_s &b, const kcf_image_s &img, float x0, float y0, float x1, float y1)
+{
+	b.cx = (x0 + x1) * 0.5f;
+	b.cy = (y0 + y1) * 0.5f;
+	b.w = std::max(x1 - x0, MIN_SIZE);
+	b.h = std::max(y1 - y0, MIN_SIZE);
+	p->train(m, b, img, true);
+}
+
+float kcf_core::update(kcf_model_s &m, kcf_box_s &b, const kcf_image_s &img)
+{
+	static const float scales[] = {1.0f, 1.0f / SCALE_STEP, SCALE_STEP};
+
+	float best = -1e9f, best_dx = 0.0f, best_dy = 0.0f, best_psr = 0.0f, best_scale = 1.0f;
+	for (float s : scales) {
+		float dx, dy, psr;
+		float peak = p->detect(m, b, img, s, dx, dy, psr);
+		if (s != 1.0f)
+			peak *= SCALE_PENALTY;
+		if (peak > best) {
+			best = peak;
+			best_dx = dx;
+			best_dy = dy;
+			best_psr = psr;
+			best_scale = s;
+		}
+	}
+
+	b.cx = std::clamp(b.cx + best_dx, 0.0f, (float)img.width);
+	b.cy = std::clamp(b.cy + best_dy, 0.0f, (float)img.height);
+	b.w = std::clamp(b.w * best_scale, MIN_SIZE, (float)img.width);
+	b.h = std::clamp(b.h * best_scale, MIN_SIZE, (float)img.height);
+	p->train(m, b, img, false);
+
+	return best_psr;
+}
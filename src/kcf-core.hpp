@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <complex>
+#include <memory>
+#include <vector>
+
+/* Kernelized correlation filter (KCF) with a Gaussian kernel.
+ *
+ * The filter size is fixed for each feature type so that FFT plans, the window, the label, and all work buffers
+ * are prepared once and reused for every frame and for every target.
+ */
+
+typedef std::complex<float> kcf_complex;
+
+enum kcf_feature_e {
+	kcf_feature_gray = 0,
+	kcf_feature_hog = 1,
+};
+
+#define KCF_MAX_N 64
+#define KCF_HOG_BINS 9
+#define KCF_MAX_ELEMENTS (32 * 32 * KCF_HOG_BINS)
+#define KCF_MAX_PATCH ((32 * 4 + 2) * (32 * 4 + 2))
+
+struct kcf_image_s
+{
+	const uint8_t *data; // 8-bit grayscale
+	int width, height, linesize;
+};
+
+struct kcf_fft_plan
+{
+	int n;
+	std::vector<int> bitrev;
+	std::vector<kcf_complex> twiddle;
+
+	static const kcf_fft_plan &get(int n);
+
+	void fft2(kcf_complex *data, kcf_complex *col, bool inverse) const;
+
+private:
+	kcf_fft_plan(int n);
+	void fft1(kcf_complex *a, bool inverse) const;
+};
+
+struct alignas(32) kcf_model_s
+{
+	kcf_complex xf[KCF_MAX_ELEMENTS];          // model features in the frequency domain
+	kcf_complex alphaf[KCF_MAX_N * KCF_MAX_N]; // model coefficients in the frequency domain
+};
+
+struct kcf_box_s
+{
+	float cx, cy, w, h; // location and size in the image pixel
+};
+
+class kcf_core {
+	struct kcf_core_private_s *p;
+
+public:
+	kcf_core(enum kcf_feature_e feature);
+	~kcf_core();
+
+	enum kcf_feature_e get_feature() const;
+
+	void init(kcf_model_s &m, kcf_box_s &b, const kcf_image_s &img, float x0, float y0, float x1, float y1);
+
+	// Returns peak-to-sidelobe ratio of the response.
+	float update(kcf_model_s &m, kcf_box_s &b, const kcf_image_s &img);
+};
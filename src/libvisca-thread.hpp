@@ -1,24 +1,19 @@
 #pragma once
 
 #include <util/threading.h>
-// #include "libvisca.h"
 #include "ptz-backend.hpp"
+#include "visca-queue.hpp"
 
+/* VISCA over TCP
+ * The requests from the video thread are coalesced to the latest value in `queue`.
+ * The queue is sent by `visca_tcp_connection`, which is shared by the cameras on the same endpoint.
+ */
 class libvisca_thread : public ptz_backend {
 	pthread_mutex_t mutex;
-	struct _VISCA_interface *iface;
-	struct _VISCA_camera *camera;
-	struct obs_data *data;
-	volatile bool data_changed;
-	volatile bool preset_changed;
-	volatile long pan_rsvd, tilt_rsvd, zoom_rsvd;
-	volatile int preset_rsvd;
-	volatile long zoom_got;
+	visca_queue queue;
+	class visca_tcp_connection *connection; // protected by `mutex`
 
-	static void *thread_main(void *);
-	void thread_connect();
-	void thread_loop();
-	float raw2zoomfactor(int);
+	void disconnect();
 
 public:
 	libvisca_thread();
@@ -26,18 +21,16 @@ public:
 
 	void set_config(struct obs_data *data) override; // and attempt to connect
 
-	void set_pantilt_speed(int pan, int tilt) override
+	void set_pantilt_speed(int pan, int tilt) override { queue.set_pantilt_speed(pan, tilt); }
+	void set_zoom_speed(int zoom) override { queue.set_zoom_speed(zoom); }
+	void set_ptz_state(const struct ptz_state_s &st) override { queue.set_speed(st.pan, st.tilt, st.zoom); }
+	void recall_preset(int preset) override { queue.recall_preset(preset); }
+	float get_zoom() override;
+	bool get_position(struct ptz_position_s &pos) override;
+	bool get_pantilt_sent(int &pan, int &tilt, uint64_t &ns) override
 	{
-		os_atomic_set_long(&pan_rsvd, pan);
-		os_atomic_set_long(&tilt_rsvd, tilt);
+		return queue.get_pantilt_sent(pan, tilt, ns);
 	}
-	void set_zoom_speed(int zoom) override { os_atomic_set_long(&zoom_rsvd, zoom); }
-	void recall_preset(int preset) override
-	{
-		preset_rsvd = preset;
-		os_atomic_set_bool(&preset_changed, true);
-	}
-	float get_zoom() override { return raw2zoomfactor(os_atomic_load_long(&zoom_got)); }
 
 	inline static bool check_data(obs_data_t *data)
 	{
@@ -14,6 +14,7 @@ OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
 void register_face_tracker_filter(bool hide_filter, bool hide_source);
 void register_face_tracker_ptz(bool hide_ptz);
 void register_face_tracker_monitor(bool hide_monitor);
+void register_face_tracker_ptz_sim(bool hide_ptz);
 
 bool obs_module_load(void)
 {
@@ -42,6 +43,7 @@ bool obs_module_load(void)
 	register_face_tracker_filter(!show_filter, !show_source);
 	register_face_tracker_ptz(!show_ptz);
 	register_face_tracker_monitor(!show_monitor);
+	register_face_tracker_ptz_sim(!show_ptz);
 
 #ifdef WITH_DOCK
 	config_set_default_bool(cfg, CONFIG_SECTION_NAME, "LoadDock", true);
@@ -0,0 +1,243 @@
+#include <obs-module.h>
+#include <cstdio>
+#include <cstring>
+#include "plugin-macros.generated.h"
+#include "net-socket.hpp"
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else // _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif // _WIN32
+
+#ifdef _WIN32
+static bool net_init()
+{
+	static bool initialized = false;
+	if (!initialized) {
+		WSADATA wsa;
+		initialized = WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+	}
+	return initialized;
+}
+
+static inline bool would_block()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+static inline void set_nonblocking(net_socket_t s)
+{
+	u_long mode = 1;
+	ioctlsocket(s, FIONBIO, &mode);
+}
+#else // _WIN32
+static inline bool net_init()
+{
+	return true;
+}
+
+static inline bool would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static inline void set_nonblocking(net_socket_t s)
+{
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+#endif // _WIN32
+
+static net_socket_t net_connect(const char *address, int port, int socktype)
+{
+	if (!net_init() || !address)
+		return NET_INVALID_SOCKET;
+
+	char service[16];
+	snprintf(service, sizeof(service), "%d", port);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = socktype;
+	struct addrinfo *res = NULL;
+	if (getaddrinfo(address, service, &hints, &res) != 0 || !res)
+		return NET_INVALID_SOCKET;
+
+	net_socket_t s = NET_INVALID_SOCKET;
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (s == NET_INVALID_SOCKET)
+			continue;
+		if (connect(s, ai->ai_addr, (int)ai->ai_addrlen) == 0)
+			break;
+		net_close(s);
+		s = NET_INVALID_SOCKET;
+	}
+	freeaddrinfo(res);
+
+	return s;
+}
+
+net_socket_t net_connect_tcp(const char *address, int port)
+{
+	net_socket_t s = net_connect(address, port, SOCK_STREAM);
+	if (s == NET_INVALID_SOCKET)
+		return s;
+
+	// The commands are small and latency sensitive.
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+	set_nonblocking(s);
+	return s;
+}
+
+net_socket_t net_connect_udp(const char *address, int port)
+{
+	// The datagrams from other peers are discarded since the socket is connected.
+	net_socket_t s = net_connect(address, port, SOCK_DGRAM);
+	if (s == NET_INVALID_SOCKET)
+		return s;
+
+	set_nonblocking(s);
+	return s;
+}
+
+void net_close(net_socket_t s)
+{
+	if (s == NET_INVALID_SOCKET)
+		return;
+#ifdef _WIN32
+	closesocket(s);
+#else
+	close(s);
+#endif
+}
+
+int net_send(net_socket_t s, const void *data, size_t size)
+{
+	int ret = (int)send(s, (const char *)data, (int)size, 0);
+	if (ret < 0)
+		return would_block() ? 0 : -1;
+	return ret;
+}
+
+int net_recv(net_socket_t s, void *data, size_t size)
+{
+	int ret = (int)recv(s, (char *)data, (int)size, 0);
+	if (ret < 0)
+		return would_block() ? 0 : -1;
+	if (ret == 0)
+		return -1; // closed by the peer
+	return ret;
+}
+
+bool net_wait_readable(net_socket_t s, int timeout_ms)
+{
+#ifdef _WIN32
+	// `FD_SET` on Windows takes a socket handle, not an index, so `select` has no limit of the value.
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(s, &fds);
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	return select((int)s + 1, &fds, NULL, NULL, &tv) > 0;
+#else // _WIN32
+	// `FD_SET` is undefined for a descriptor at or above `FD_SETSIZE`, which OBS can easily reach.
+	struct pollfd pfd;
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, timeout_ms) > 0;
+#endif // _WIN32
+}
+
+net_socket_t net_create_waker()
+{
+	if (!net_init())
+		return NET_INVALID_SOCKET;
+
+	net_socket_t s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s == NET_INVALID_SOCKET)
+		return s;
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t len = sizeof(addr);
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    getsockname(s, (struct sockaddr *)&addr, &len) != 0 ||
+	    connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		net_close(s);
+		return NET_INVALID_SOCKET;
+	}
+
+	set_nonblocking(s);
+	return s;
+}
+
+void net_wake(net_socket_t waker)
+{
+	if (waker == NET_INVALID_SOCKET)
+		return;
+	// If the buffer is full, the waiting thread has not consumed the earlier ones yet.
+	const char c = 0;
+	send(waker, &c, 1, 0);
+}
+
+bool net_wait(net_socket_t s, net_socket_t waker, int timeout_ms)
+{
+	bool readable = false, woken = false;
+#ifdef _WIN32
+	fd_set fds;
+	FD_ZERO(&fds);
+	if (s != NET_INVALID_SOCKET)
+		FD_SET(s, &fds);
+	if (waker != NET_INVALID_SOCKET)
+		FD_SET(waker, &fds);
+	if (fds.fd_count == 0) {
+		// `select` fails without any socket.
+		Sleep(timeout_ms);
+		return false;
+	}
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	if (select(0, &fds, NULL, NULL, &tv) > 0) {
+		readable = s != NET_INVALID_SOCKET && FD_ISSET(s, &fds);
+		woken = waker != NET_INVALID_SOCKET && FD_ISSET(waker, &fds);
+	}
+#else // _WIN32
+	// A negative descriptor is ignored by `poll`.
+	struct pollfd pfd[2];
+	pfd[0].fd = s;
+	pfd[1].fd = waker;
+	for (struct pollfd &p : pfd) {
+		p.events = POLLIN;
+		p.revents = 0;
+	}
+	if (poll(pfd, 2, timeout_ms) > 0) {
+		readable = pfd[0].revents != 0;
+		woken = pfd[1].revents != 0;
+	}
+#endif // _WIN32
+
+	if (woken) {
+		char buf[64];
+		while (recv(waker, buf, sizeof(buf), 0) > 0)
+			;
+	}
+	return readable;
+}
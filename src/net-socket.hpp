@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET net_socket_t;
+#define NET_INVALID_SOCKET INVALID_SOCKET
+#else
+typedef int net_socket_t;
+#define NET_INVALID_SOCKET (-1)
+#endif
+
+/* Thin wrapper of the BSD and Windows sockets.
+ * All sockets returned by these functions are non-blocking.
+ */
+
+// Connects to `address:port`. Returns NET_INVALID_SOCKET on failure.
+net_socket_t net_connect_tcp(const char *address, int port);
+
+// Creates a UDP socket connected to `address:port`. Returns NET_INVALID_SOCKET on failure.
+net_socket_t net_connect_udp(const char *address, int port);
+
+void net_close(net_socket_t s);
+
+// Returns the number of bytes sent, 0 if the socket is not ready, or -1 on error.
+int net_send(net_socket_t s, const void *data, size_t size);
+
+// Returns the number of bytes received, 0 if no data is available, or -1 on error or if the peer has closed.
+int net_recv(net_socket_t s, void *data, size_t size);
+
+// Waits until the socket becomes readable or `timeout_ms` elapses. Returns true if readable.
+bool net_wait_readable(net_socket_t s, int timeout_ms);
+
+/* Creates a UDP socket on the loopback connected to itself, which becomes readable by `net_wake`.
+ * A thread waiting for a socket by `net_wait` can be woken up by another thread through it.
+ */
+net_socket_t net_create_waker();
+
+void net_wake(net_socket_t waker);
+
+/* Waits until `s` becomes readable, `net_wake` is called for `waker`, or `timeout_ms` elapses.
+ * Either socket can be NET_INVALID_SOCKET. The wake-ups are consumed. Returns true if `s` is readable.
+ */
+bool net_wait(net_socket_t s, net_socket_t waker, int timeout_ms);
@@ -1,24 +1,136 @@
 #include <obs-module.h>
 #include <util/platform.h>
 #include <algorithm>
+#include <vector>
 #include "plugin-macros.generated.h"
 #include "obsptz-backend.hpp"
 #include "helper.hpp"
 
 #define debug(...) blog(LOG_INFO, __VA_ARGS__)
 
-#define SAME_CNT_TH 4
+// The unchanged state is sent again a few times in case the camera missed it.
+#define REPEAT_CNT 2
+#define REPEAT_INTERVAL_NS 200000000
+
+/* Rate limit
+ * Each device has a token bucket. A command takes one token and the tokens are refilled at the rate of the device.
+ * PTZ Controls queues the commands and returns before the camera processes them, so there is no signal of how fast
+ * the camera can take the commands. The rate is given by the property `Max command rate`.
+ */
+#define BUCKET_SIZE 2.0f
+#define RATE_DEFAULT 20.0f // commands per second, used if the property is not given
+#define RATE_MIN 1.0f
+#define PRESET_HOLD_S 0.5f // time for the camera to start moving to the preset
+#define STATS_INTERVAL_NS 10000000000ULL
 #define PTZ_MAX_X 0x18
 #define PTZ_MAX_Y 0x14
 #define PTZ_MAX_Z 0x07
 
+struct obsptz_device_s
+{
+	int device_id;
+	int ref;
+
+	float rate; // commands per second, set by the backend configured last
+	float tokens;
+	uint64_t refill_ns;
+
+	// statistics
+	uint64_t stats_ns;
+	int n_sent;
+	int n_dropped;
+};
+
+static pthread_mutex_t devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<obsptz_device_s *> devices;
+
+static obsptz_device_s *device_acquire(int device_id)
+{
+	pthread_mutex_lock(&devices_mutex);
+	obsptz_device_s *d = nullptr;
+	for (obsptz_device_s *x : devices) {
+		if (x->device_id == device_id) {
+			d = x;
+			break;
+		}
+	}
+	if (!d) {
+		d = new obsptz_device_s();
+		d->device_id = device_id;
+		d->rate = RATE_DEFAULT;
+		d->tokens = BUCKET_SIZE;
+		devices.push_back(d);
+	}
+	d->ref++;
+	pthread_mutex_unlock(&devices_mutex);
+	return d;
+}
+
+static void device_release(obsptz_device_s *d)
+{
+	if (!d)
+		return;
+	pthread_mutex_lock(&devices_mutex);
+	if (--d->ref == 0) {
+		devices.erase(std::find(devices.begin(), devices.end(), d));
+		delete d;
+	}
+	pthread_mutex_unlock(&devices_mutex);
+}
+
+// Called with `devices_mutex` locked
+static void device_refill(obsptz_device_s *d, uint64_t ns)
+{
+	if (d->refill_ns && ns > d->refill_ns)
+		d->tokens = std::min(d->tokens + (ns - d->refill_ns) * 1e-9f * d->rate, BUCKET_SIZE);
+	d->refill_ns = ns;
+}
+
+static void device_sent(obsptz_device_s *d, float tokens, uint64_t ns)
+{
+	pthread_mutex_lock(&devices_mutex);
+	device_refill(d, ns);
+	d->tokens -= tokens;
+	d->n_sent++;
+
+	if (!d->stats_ns) {
+		d->stats_ns = ns;
+	} else if (ns - d->stats_ns >= STATS_INTERVAL_NS) {
+		blog(LOG_DEBUG, "obsptz device %d: %.1f commands/s of %.1f/s, %d dropped", d->device_id,
+		     d->n_sent * 1e9f / (ns - d->stats_ns), d->rate, d->n_dropped);
+		d->stats_ns = ns;
+		d->n_sent = d->n_dropped = 0;
+	}
+	pthread_mutex_unlock(&devices_mutex);
+}
+
+static void device_dropped(obsptz_device_s *d)
+{
+	pthread_mutex_lock(&devices_mutex);
+	d->n_dropped++;
+	pthread_mutex_unlock(&devices_mutex);
+}
+
 obsptz_backend::obsptz_backend() {}
 
-obsptz_backend::~obsptz_backend() {}
+obsptz_backend::~obsptz_backend()
+{
+	device_release(device);
+}
 
 void obsptz_backend::set_config(struct obs_data *data)
 {
-	device_id = (int)obs_data_get_int(data, "device_id");
+	const int id = (int)obs_data_get_int(data, "device_id");
+	if (!device || id != device_id) {
+		device_release(device);
+		device = device_acquire(id);
+	}
+	device_id = id;
+
+	const double rate = obs_data_get_double(data, "rate");
+	pthread_mutex_lock(&devices_mutex);
+	device->rate = rate > 0.0 ? std::max((float)rate, RATE_MIN) : RATE_DEFAULT;
+	pthread_mutex_unlock(&devices_mutex);
 
 	ptz_max_x = obs_data_get_int(data, "max_x");
 	ptz_max_y = obs_data_get_int(data, "max_y");
@@ -27,14 +139,35 @@ void obsptz_backend::set_config(struct obs_data *data)
 
 bool obsptz_backend::can_send()
 {
-	if (!available_ns)
-		return true;
+	if (!device)
+		return false;
 
-	uint64_t ns = os_gettime_ns();
-	return ns >= available_ns;
+	pthread_mutex_lock(&devices_mutex);
+	device_refill(device, os_gettime_ns());
+	const bool ret = device->tokens >= 1.0f;
+	pthread_mutex_unlock(&devices_mutex);
+	return ret;
 }
 
-void obsptz_backend::tick() {}
+uint64_t obsptz_backend::get_send_ns()
+{
+	if (!device)
+		return 0;
+
+	pthread_mutex_lock(&devices_mutex);
+	const uint64_t ns = os_gettime_ns();
+	device_refill(device, ns);
+	uint64_t ret = 0;
+	if (device->tokens < 1.0f)
+		ret = ns + (uint64_t)((1.0f - device->tokens) / device->rate * 1e9f);
+	pthread_mutex_unlock(&devices_mutex);
+	return ret;
+}
+
+void obsptz_backend::tick()
+{
+	flush();
+}
 
 proc_handler_t *obsptz_backend::get_ptz_ph()
 {
@@ -52,61 +185,96 @@ proc_handler_t *obsptz_backend::get_ptz_ph()
 	return ptz_ph;
 }
 
-void obsptz_backend::set_pantilt_speed(int pan, int tilt)
+// Calls the procedure of PTZ Controls and takes `tokens` from the bucket of the device.
+void obsptz_backend::call(proc_handler_t *ph, const char *name, calldata_t *cd, float tokens)
 {
-	pan = std::clamp(pan, -ptz_max_x, ptz_max_x);
-	tilt = std::clamp(tilt, -ptz_max_y, ptz_max_y);
-
-	if (pan == prev_pan && tilt == prev_tilt) {
-		if (same_pantilt_cnt > SAME_CNT_TH)
-			return;
-		same_pantilt_cnt++;
-	} else {
-		same_pantilt_cnt = 0;
-	}
+	proc_handler_call(ph, name, cd);
+	const uint64_t ns = os_gettime_ns();
+	if (device)
+		device_sent(device, tokens, ns);
+	sent_ns = ns;
+}
 
+/* Sends the requested speeds in one call of `ptz_move_continuous`.
+ * Only the axes specified by `pantilt` and `zoom` are included so that the other axes are kept.
+ */
+void obsptz_backend::move_continuous(bool pantilt, bool zoom)
+{
 	CALLDATA_FIXED_DECL(cd, 128);
 	calldata_set_int(&cd, "device_id", device_id);
-	calldata_set_float(&cd, "pan", pan / 24.0f);
-	calldata_set_float(&cd, "tilt", -tilt / 20.0f);
+	if (pantilt) {
+		calldata_set_float(&cd, "pan", pan_req / 24.0f);
+		calldata_set_float(&cd, "tilt", -tilt_req / 20.0f);
+	}
 	proc_handler_t *ph = get_ptz_ph();
-	if (ph)
-		proc_handler_call(ph, "ptz_move_continuous", &cd);
-	else {
-		// compatibility
+	if (ph) {
+		if (zoom)
+			calldata_set_float(&cd, "zoom", -zoom_req / 7.0f);
+		call(ph, "ptz_move_continuous", &cd, 1.0f);
+	} else if (pantilt) {
+		// compatibility, zoom is not available
 		ph = obs_get_proc_handler();
-		proc_handler_call(ph, "ptz_pantilt", &cd);
+		call(ph, "ptz_pantilt", &cd, 1.0f);
 	}
-	uint64_t ns = os_gettime_ns();
-	available_ns = std::max(available_ns, ns) + (60 * 1000 * 1000);
-	prev_pan = pan;
-	prev_tilt = tilt;
+
+	if (pantilt) {
+		pan_sent = pan_req;
+		tilt_sent = tilt_req;
+		pantilt_sent_ns = sent_ns;
+	}
+	if (zoom)
+		zoom_sent = zoom_req;
 }
 
-void obsptz_backend::set_zoom_speed(int zoom)
+void obsptz_backend::flush()
 {
-	zoom = std::clamp(zoom, -ptz_max_z, ptz_max_z);
+	if (!state_requested || !can_send())
+		return;
 
-	if (zoom == prev_zoom) {
-		if (same_zoom_cnt > SAME_CNT_TH)
-			return;
-		same_zoom_cnt++;
+	bool pantilt = pan_req != pan_sent || tilt_req != tilt_sent;
+	bool zoom = zoom_req != zoom_sent;
+	if (pantilt || zoom) {
+		repeat_cnt = 0;
 	} else {
-		same_zoom_cnt = 0;
+		if (repeat_cnt >= REPEAT_CNT || os_gettime_ns() < sent_ns + REPEAT_INTERVAL_NS)
+			return;
+		repeat_cnt++;
+		pantilt = zoom = true;
 	}
 
-	proc_handler_t *ph = get_ptz_ph();
-	if (!ph)
-		return;
+	move_continuous(pantilt, zoom);
+}
 
-	CALLDATA_FIXED_DECL(cd, 128);
-	calldata_set_int(&cd, "device_id", device_id);
-	calldata_set_float(&cd, "zoom", -zoom / 7.0f);
-	proc_handler_call(ph, "ptz_move_continuous", &cd);
+void obsptz_backend::set_ptz_state(const struct ptz_state_s &state)
+{
+	const int pan_prev = pan_req, tilt_prev = tilt_req, zoom_prev = zoom_req;
+	const bool pending = pan_req != pan_sent || tilt_req != tilt_sent || zoom_req != zoom_sent;
+
+	pan_req = std::clamp(state.pan, -ptz_max_x, ptz_max_x);
+	tilt_req = std::clamp(state.tilt, -ptz_max_y, ptz_max_y);
+	zoom_req = std::clamp(state.zoom, -ptz_max_z, ptz_max_z);
+	state_requested = true;
+
+	// A request replaced before being sent is counted as a drop.
+	if (device && pending && (pan_req != pan_prev || tilt_req != tilt_prev || zoom_req != zoom_prev))
+		device_dropped(device);
+
+	flush();
+}
+
+void obsptz_backend::set_pantilt_speed(int pan, int tilt)
+{
+	pan_req = std::clamp(pan, -ptz_max_x, ptz_max_x);
+	tilt_req = std::clamp(tilt, -ptz_max_y, ptz_max_y);
+	repeat_cnt = 0;
+	move_continuous(true, false);
+}
 
-	uint64_t ns = os_gettime_ns();
-	available_ns = std::max(available_ns, ns) + (60 * 1000 * 1000);
-	prev_zoom = zoom;
+void obsptz_backend::set_zoom_speed(int zoom)
+{
+	zoom_req = std::clamp(zoom, -ptz_max_z, ptz_max_z);
+	repeat_cnt = 0;
+	move_continuous(false, true);
 }
 
 void obsptz_backend::recall_preset(int preset)
@@ -118,18 +286,32 @@ void obsptz_backend::recall_preset(int preset)
 	CALLDATA_FIXED_DECL(cd, 128);
 	calldata_set_int(&cd, "device_id", device_id);
 	calldata_set_int(&cd, "preset_id", preset);
-	proc_handler_call(ph, "ptz_preset_recall", &cd);
-
-	uint64_t ns = os_gettime_ns();
-	available_ns = std::max(available_ns, ns) + (500 * 1000 * 1000);
+	// Hold the following commands while the camera starts moving to the preset.
+	float tokens = 1.0f;
+	if (device) {
+		pthread_mutex_lock(&devices_mutex);
+		tokens = std::max(device->tokens, 1.0f) - 1.0f + PRESET_HOLD_S * device->rate;
+		pthread_mutex_unlock(&devices_mutex);
+	}
+	call(ph, "ptz_preset_recall", &cd, tokens);
 }
 
 float obsptz_backend::get_zoom()
 {
-	// TODO: implement
+	/* PTZ Controls does not provide any procedure to inquire the position. Returns the wide end so that the gains
+	 * are not scaled. `get_position` is not overridden for the same reason.
+	 */
 	return 1.0f;
 }
 
+bool obsptz_backend::get_pantilt_sent(int &pan, int &tilt, uint64_t &ns)
+{
+	pan = pan_sent;
+	tilt = tilt_sent;
+	ns = pantilt_sent_ns;
+	return pantilt_sent_ns != 0;
+}
+
 bool obsptz_backend::ptz_type_modified(obs_properties_t *pp, obs_data_t *)
 {
 	if (obs_properties_get(pp, "ptz.obsptz.device_id"))
@@ -140,6 +322,9 @@ bool obsptz_backend::ptz_type_modified(obs_properties_t *pp, obs_data_t *)
 	obs_properties_add_int_slider(pp, "ptz.obsptz.max_x", "Max control (pan)", 0, PTZ_MAX_X, 1);
 	obs_properties_add_int_slider(pp, "ptz.obsptz.max_y", "Max control (tilt)", 0, PTZ_MAX_Y, 1);
 	obs_properties_add_int_slider(pp, "ptz.obsptz.max_z", "Max control (zoom)", 0, PTZ_MAX_Z, 1);
+	obs_property_t *prop = obs_properties_add_float(pp, "ptz.obsptz.rate", obs_module_text("Max command rate"),
+							RATE_MIN, 60.0, 1.0);
+	obs_property_float_set_suffix(prop, " /s");
 
 	return true;
 }
@@ -2,16 +2,23 @@
 #include "ptz-backend.hpp"
 
 class obsptz_backend : public ptz_backend {
-	uint64_t available_ns = 0;
 	int device_id = -1;
+	struct obsptz_device_s *device = nullptr; // rate limit shared with the other backends for the same device
 	int ptz_max_x = 0, ptz_max_y = 0, ptz_max_z = 0;
 	proc_handler_t *ptz_ph = NULL;
 	proc_handler_t *get_ptz_ph();
-	int prev_pan = 0;
-	int prev_tilt = 0;
-	int prev_zoom = 0;
-	int same_pantilt_cnt = 0;
-	int same_zoom_cnt = 0;
+
+	// The latest request and the last values sent. Accessed only by the video thread.
+	int pan_req = 0, tilt_req = 0, zoom_req = 0;
+	bool state_requested = false;
+	int pan_sent = 0, tilt_sent = 0, zoom_sent = 0;
+	uint64_t sent_ns = 0;
+	uint64_t pantilt_sent_ns = 0;
+	int repeat_cnt = 0;
+
+	void call(proc_handler_t *ph, const char *name, calldata_t *cd, float tokens);
+	void move_continuous(bool pantilt, bool zoom);
+	void flush();
 
 public:
 	obsptz_backend();
@@ -19,11 +26,14 @@ public:
 
 	void set_config(struct obs_data *data) override;
 	bool can_send() override;
+	uint64_t get_send_ns() override;
 	void tick() override;
 	void set_pantilt_speed(int pan, int tilt) override;
 	void set_zoom_speed(int zoom) override;
+	void set_ptz_state(const struct ptz_state_s &state) override;
 	void recall_preset(int preset) override;
 	float get_zoom() override;
+	bool get_pantilt_sent(int &pan, int &tilt, uint64_t &ns) override;
 
 	static bool ptz_type_modified(obs_properties_t *group_output, obs_data_t *settings);
 };
@@ -2,6 +2,21 @@
 
 #include <util/threading.h>
 
+struct ptz_position_s
+{
+	int pan, tilt;       // raw position in the unit of the camera
+	float zoom;          // zoom factor, 1 at the wide end
+	uint64_t pantilt_ns; // time when pan and tilt were measured, 0 if not available
+	uint64_t zoom_ns;    // time when zoom was measured, 0 if not available
+};
+
+// Speeds of all axes requested in one tick
+struct ptz_state_s
+{
+	int pan, tilt, zoom;                         // speed code
+	float pan_linear, tilt_linear, zoom_linear; // control value before the conversion to the speed code
+};
+
 class ptz_backend {
 	volatile long ref;
 
@@ -15,17 +30,42 @@ public:
 	virtual void set_config(struct obs_data *data) = 0;
 
 	virtual bool can_send() { return true; }
+	// Returns the earliest time when a new speed can be sent. Returns 0 if it can be sent now.
+	virtual uint64_t get_send_ns() { return 0; }
 	virtual void tick() {}
 	virtual void set_pantilt_speed(int pan, int tilt) = 0;
 	virtual void set_zoom_speed(int zoom) = 0;
+
+	/* Requests the speeds of all axes. Called every tick even if nothing has changed.
+	 * The backend decides how to batch, coalesce, and skip the repeated values. Unlike `set_pantilt_speed` and
+	 * `set_zoom_speed`, the caller does not need to check `can_send`.
+	 */
+	virtual void set_ptz_state(const struct ptz_state_s &state)
+	{
+		set_pantilt_speed(state.pan, state.tilt);
+		set_zoom_speed(state.zoom);
+	}
+
 	virtual void recall_preset(int preset) = 0;
 	virtual float get_zoom() = 0;
 
-	virtual void set_pantiltzoom_speed(float pan, float tilt, float zoom)
+	// Returns the latest measured position. Returns false if the backend cannot inquire the position.
+	virtual bool get_position(struct ptz_position_s &pos)
+	{
+		(void)pos;
+		return false;
+	}
+
+	/* Returns the pan and tilt speeds last sent to the camera and the time they were sent.
+	 * They can differ from the requested ones while the backend holds or coalesces the requests.
+	 * Returns false if the backend cannot tell.
+	 */
+	virtual bool get_pantilt_sent(int &pan, int &tilt, uint64_t &ns)
 	{
 		(void)pan;
 		(void)tilt;
-		(void)zoom;
+		(void)ns;
+		return false;
 	}
 
 	inline static bool check_data(obs_data_t *) { return true; }
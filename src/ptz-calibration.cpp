@@ -0,0 +1,96 @@
+#include <obs-module.h>
+#include <cmath>
+#include <algorithm>
+#include "plugin-macros.generated.h"
+#include "ptz-calibration.hpp"
+#include "ptz-speed-table.hpp"
+
+#define debug(...) // blog(LOG_INFO, __VA_ARGS__)
+
+#define STOP_NS 300000000
+#define ACCEL_NS 400000000
+#define MEASURE_NS 600000000
+
+enum phase_e {
+	phase_stop,
+	phase_forward_accel,
+	phase_forward_measure,
+	phase_backward_accel,
+	phase_backward_measure,
+	n_phases,
+};
+
+static const uint64_t phase_ns[n_phases] = {STOP_NS, ACCEL_NS, MEASURE_NS, ACCEL_NS, MEASURE_NS};
+
+ptz_calibration::ptz_calibration(int n_pan, int n_tilt)
+{
+	axis = 0;
+	code = 1;
+	phase = phase_stop;
+	phase_start_ns = 0;
+	n_codes[0] = n_pan;
+	n_codes[1] = n_tilt;
+	shift_sum[0] = shift_sum[1] = 0.0;
+	if (n_pan <= 0)
+		axis = 1;
+}
+
+void ptz_calibration::next_phase(uint64_t ns)
+{
+	phase_start_ns = ns;
+	if (++phase < n_phases)
+		return;
+
+	// Forward and backward move in the opposite directions. The difference cancels the drift of the scene.
+	const double v = std::abs(shift_sum[0] - shift_sum[1]) * 0.5 / (MEASURE_NS * 1e-9);
+	auto &vv = velocities[axis];
+	vv.push_back(std::max((float)v * PTZ_SPEED_UNIT, vv.empty() ? 0.0f : vv.back()));
+	blog(LOG_INFO, "ptz_calibration: %s speed %d: %.3f", axis ? "tilt" : "pan", code, vv.back());
+
+	shift_sum[0] = shift_sum[1] = 0.0;
+	phase = phase_stop;
+	if (++code > n_codes[axis]) {
+		code = 1;
+		axis++;
+		if (axis == 1 && n_codes[1] <= 0)
+			axis++;
+	}
+}
+
+bool ptz_calibration::tick(uint64_t ns, float shift_x, float shift_y, float zoom, int &pan, int &tilt)
+{
+	if (!phase_start_ns)
+		phase_start_ns = ns;
+
+	if (axis > 1)
+		return false;
+
+	// The image moves faster when zoomed in. The table is defined at the widest zoom.
+	const float shift = (axis ? shift_y : shift_x) / std::max(zoom, 1.0f);
+	if (phase == phase_forward_measure)
+		shift_sum[0] += shift;
+	else if (phase == phase_backward_measure)
+		shift_sum[1] += shift;
+
+	if (ns - phase_start_ns >= phase_ns[phase])
+		next_phase(ns);
+
+	if (axis > 1)
+		return false;
+
+	int u = 0;
+	if (phase == phase_forward_accel || phase == phase_forward_measure)
+		u = code;
+	else if (phase == phase_backward_accel || phase == phase_backward_measure)
+		u = -code;
+	pan = axis == 0 ? u : 0;
+	tilt = axis == 1 ? u : 0;
+	return true;
+}
+
+int ptz_calibration::progress() const
+{
+	const int total = n_codes[0] + n_codes[1];
+	const int done = (int)(velocities[0].size() + velocities[1].size());
+	return total > 0 ? done * 100 / total : 100;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/* Measures the velocity of each pan and tilt speed code from the motion of the image.
+ * For each code, the camera moves forward and backward and the motion is averaged excluding the time to accelerate.
+ * Called only from the video thread.
+ */
+class ptz_calibration {
+	int axis; // 0 for pan, 1 for tilt
+	int code;
+	int phase;
+	uint64_t phase_start_ns;
+	int n_codes[2];
+	double shift_sum[2]; // shift during the measuring phases, forward and backward
+	std::vector<float> velocities[2];
+
+	void next_phase(uint64_t ns);
+
+public:
+	ptz_calibration(int n_pan, int n_tilt);
+
+	/* Advances the calibration with the shift of the image since the last call in the unit of the square root
+	 * of the image area, and the current zoom factor.
+	 * Returns false when finished. Otherwise sets the speed codes to send.
+	 */
+	bool tick(uint64_t ns, float shift_x, float shift_y, float zoom, int &pan, int &tilt);
+
+	int progress() const; // in percent
+
+	// Control values in PTZ_SPEED_UNIT for the codes from 1
+	const std::vector<float> &pan_velocities() const { return velocities[0]; }
+	const std::vector<float> &tilt_velocities() const { return velocities[1]; }
+};
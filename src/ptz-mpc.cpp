@@ -0,0 +1,199 @@
+#include <obs-module.h>
+#include <cmath>
+#include <algorithm>
+#include "plugin-macros.generated.h"
+#include "helper.hpp"
+#include "ptz-mpc.hpp"
+#include "ptz-speed-table.hpp"
+
+#define debug(...) // blog(LOG_INFO, __VA_ARGS__)
+
+// identification
+#define ID_INTERVAL_NS 200000000
+#define DELAY_STEP_NS 50000000
+#define N_DELAYS 13 // up to 600 ms
+#define DELAY_INDEX_DEFAULT 4
+#define FORGET_TIME 20.0f
+#define GAIN_NOMINAL (1.0f / PTZ_SPEED_UNIT)
+#define GAIN_PRIOR_WEIGHT 100.0f // equivalent to a few samples of the control value 5
+#define EXCITATION_MIN 400.0f
+#define HISTORY_NS 2000000000
+
+// prediction
+#define STEP_NS 100000000
+#define N_STEPS 20
+#define BLOCK_STEPS 3
+#define SWITCH_COST 1e-3f
+#define EFFORT_COST 1e-4f
+
+ptz_mpc::ptz_mpc(const char *name_)
+{
+	name = name_;
+	reset();
+	delay_index_logged = DELAY_INDEX_DEFAULT;
+	gain_logged = GAIN_NOMINAL;
+}
+
+void ptz_mpc::reset()
+{
+	history.clear();
+	for (int j = 0; j < N_DELAYS; j++)
+		sxx[j] = sxy[j] = 0.0f;
+	syy = 0.0f;
+	id_last_ns = 0;
+	id_last_err = 0.0f;
+	id_last_valid = false;
+	delay_index = DELAY_INDEX_DEFAULT;
+	gain = GAIN_NOMINAL;
+}
+
+float ptz_mpc::average_command(uint64_t from, uint64_t to) const
+{
+	double sum = 0.0;
+	float v = 0.0f;
+	uint64_t t = from;
+	for (const command_s &c : history) {
+		if (c.ns >= to)
+			break;
+		if (c.ns > t) {
+			sum += (double)v * (c.ns - t);
+			t = c.ns;
+		}
+		v = c.v;
+	}
+	sum += (double)v * (to - t);
+	return (float)(sum / (to - from));
+}
+
+void ptz_mpc::identify(uint64_t ns, float err, float zoom)
+{
+	const uint64_t interval = ns - id_last_ns;
+	const float y = -(err - id_last_err) / (interval * 1e-9f) * zoom;
+	const float forget = expf(interval * -1e-9f / FORGET_TIME);
+
+	syy = syy * forget + y * y;
+	for (int j = 0; j < N_DELAYS; j++) {
+		const uint64_t d = (uint64_t)j * DELAY_STEP_NS;
+		const float x = average_command(id_last_ns - d, ns - d);
+		sxx[j] = sxx[j] * forget + x * x;
+		sxy[j] = sxy[j] * forget + x * y;
+	}
+
+	// Ridge regression toward the nominal gain so that the gain stays sane without enough motion.
+	float r_best = INFINITY;
+	for (int j0 = 0; j0 < N_DELAYS; j0++) {
+		// Start from the current one so that a tie keeps it.
+		const int j = (j0 + delay_index) % N_DELAYS;
+		if (sxx[j] < EXCITATION_MIN && j != delay_index)
+			continue;
+		const float g = std::clamp((sxy[j] + GAIN_NOMINAL * GAIN_PRIOR_WEIGHT) / (sxx[j] + GAIN_PRIOR_WEIGHT),
+					   GAIN_NOMINAL * 0.25f, GAIN_NOMINAL * 4.0f);
+		const float r = syy - 2.0f * g * sxy[j] + g * g * sxx[j] + sqf(g - GAIN_NOMINAL) * GAIN_PRIOR_WEIGHT;
+		if (r < r_best) {
+			r_best = r;
+			delay_index = j;
+			gain = g;
+		}
+	}
+
+	if (delay_index != delay_index_logged || std::abs(gain - gain_logged) > gain_logged * 0.2f) {
+		blog(LOG_INFO, "ptz_mpc %s: dead time %d ms, gain %.2f", name, dead_time_ms(), gain_ratio());
+		delay_index_logged = delay_index;
+		gain_logged = gain;
+	}
+}
+
+int ptz_mpc::control(uint64_t ns, float err, bool valid, float zoom, float deadband, const ptz_speed_table &table,
+		     uint64_t send_ns)
+{
+	zoom = std::max(zoom, 1.0f);
+
+	if (!valid) {
+		id_last_valid = false;
+	} else if (!id_last_valid) {
+		id_last_ns = ns;
+		id_last_err = err;
+		id_last_valid = true;
+	} else if (ns - id_last_ns >= ID_INTERVAL_NS) {
+		identify(ns, err, zoom);
+		id_last_ns = ns;
+		id_last_err = err;
+	}
+
+	while (history.size() > 1 && history[1].ns + HISTORY_NS < ns)
+		history.pop_front();
+
+	int code = 0;
+	if (valid) {
+		const uint64_t d = (uint64_t)delay_index * DELAY_STEP_NS;
+		const float h = STEP_NS * 1e-9f;
+		const float k = gain / zoom * h;
+
+		/* Motion already committed by the commands sent within the dead time.
+		 * The step `i` uses the command sent at `ns + i * STEP_NS - d`.
+		 * The last code sent stays until the backend can send again; after that, the codes to be chosen are
+		 * used.
+		 */
+		float e_committed = err;
+		int i_plan = 0;
+		for (; i_plan < N_STEPS; i_plan++) {
+			const uint64_t t = ns + (uint64_t)i_plan * STEP_NS;
+			if (t >= std::max(ns, send_ns) + d)
+				break;
+			e_committed -= k * average_command(t - d, t + STEP_NS - d);
+		}
+
+		const int n = table.max_code();
+		const float v_sent = history.empty() ? 0.0f : history.back().v;
+		float cost_best = INFINITY;
+		for (int a = -n; a <= n; a++) {
+			const float va = k * table.velocity(a);
+			float e = e_committed;
+			float cost_a = (table.velocity(a) != v_sent ? SWITCH_COST : 0.0f) + EFFORT_COST * sqf(va / h);
+			int i = i_plan;
+			for (; i < N_STEPS && i < i_plan + BLOCK_STEPS; i++) {
+				e -= va;
+				cost_a += sqf(std::max(std::abs(e) - deadband, 0.0f));
+			}
+			if (cost_a >= cost_best)
+				continue;
+
+			for (int b = -n; b <= n; b++) {
+				const float vb = k * table.velocity(b);
+				float cost = cost_a + (b != a ? SWITCH_COST * 0.5f : 0.0f);
+				cost += EFFORT_COST * sqf(vb / h) * 0.5f;
+				float eb = e;
+				for (int j = i; j < N_STEPS && cost < cost_best; j++) {
+					eb -= vb;
+					cost += sqf(std::max(std::abs(eb) - deadband, 0.0f));
+				}
+				if (cost < cost_best) {
+					cost_best = cost;
+					code = a;
+				}
+			}
+		}
+	}
+
+	debug("ptz_mpc %s: err=%f code=%d", name, err, code);
+	return code;
+}
+
+void ptz_mpc::sent(uint64_t ns, int code, const ptz_speed_table &table)
+{
+	const float v = table.velocity(code);
+	// Only the changes are kept; a repeated or an older report does not change the command in effect.
+	if (!history.empty() && (history.back().v == v || ns <= history.back().ns))
+		return;
+	history.push_back({ns, v});
+}
+
+int ptz_mpc::dead_time_ms() const
+{
+	return delay_index * (DELAY_STEP_NS / 1000000);
+}
+
+float ptz_mpc::gain_ratio() const
+{
+	return gain / GAIN_NOMINAL;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+/* Model predictive controller for one axis of pan or tilt.
+ * The camera is modeled as a dead time followed by an integrator; the image moves by
+ * `gain * (control value of the speed code) / zoom` per second after `dead time`.
+ * Both the dead time and the gain are identified online from the commanded speed codes and the observed error.
+ * Each tick, the speed codes are chosen by predicting the error over the horizon for every pair of codes.
+ *
+ * The error is in the ratio to the square root of the image area. A positive speed code decreases the error.
+ * Called only from the video thread.
+ */
+class ptz_mpc {
+	struct command_s
+	{
+		uint64_t ns;
+		float v; // control value of the speed code
+	};
+	std::deque<command_s> history;
+
+	// least-squares sums for each candidate of the dead time
+	float sxx[16], sxy[16], syy;
+	uint64_t id_last_ns;
+	float id_last_err;
+	bool id_last_valid;
+
+	int delay_index;
+	float gain;
+	int delay_index_logged;
+	float gain_logged;
+
+	const char *name;
+
+	float average_command(uint64_t from, uint64_t to) const;
+	void identify(uint64_t ns, float err, float zoom);
+
+public:
+	ptz_mpc(const char *name);
+	void reset();
+
+	/* Feeds the error observed in this tick and returns the speed code to send.
+	 * `valid` should be false while the face is not found, then the camera is stopped.
+	 * `send_ns` is the earliest time the backend can send the code, 0 if it can send now.
+	 */
+	int control(uint64_t ns, float err, bool valid, float zoom, float deadband, const class ptz_speed_table &table,
+		    uint64_t send_ns);
+
+	/* Records the speed code sent to the camera at `ns`. Called after the backend has sent, or held, the code
+	 * returned by `control` so that the prediction and the identification use only the commands actually sent.
+	 */
+	void sent(uint64_t ns, int code, const class ptz_speed_table &table);
+
+	int dead_time_ms() const;
+	float gain_ratio() const; // identified gain relative to the nominal one
+};
@@ -0,0 +1,308 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <algorithm>
+#include "plugin-macros.generated.h"
+#include "helper.hpp"
+#include "ptz-sim.hpp"
+
+/* PTZ Simulator
+ * Crops another source as if a PTZ camera looks at the scene. The `Simulator` PTZ type of `Face Tracker PTZ` moves
+ * the view through `ptz_sim`, so that the tracking can be tested and benchmarked without a camera.
+ *
+ * The view is read back and output as an asynchronous frame like a camera does, since `Face Tracker PTZ` is an
+ * asynchronous filter and cannot be added to a synchronous source.
+ */
+
+struct ptz_sim_source
+{
+	obs_source_t *context;
+	char *source_name;
+	obs_weak_source_t *source_ref;
+	uint32_t width, height;
+	float fov; // ratio of the scene width covered at the widest zoom
+
+	char *sim_name;
+	ptz_sim *sim;
+	gs_texrender_t *texrender;
+	gs_texrender_t *texrender_view;
+	gs_stagesurf_t *stagesurf;
+};
+
+static const char *ptzsim_get_name(void *)
+{
+	return obs_module_text("PTZ Simulator");
+}
+
+static void ptzsim_update(void *data, obs_data_t *settings)
+{
+	auto *s = (struct ptz_sim_source *)data;
+
+	const char *name = obs_data_get_string(settings, "name");
+	const char *source_name = obs_data_get_string(settings, "source_name");
+
+	if (!s->sim_name || strcmp(name, s->sim_name)) {
+		// The backend looks up the new name in the next call.
+		if (s->sim)
+			s->sim->release();
+		s->sim = new ptz_sim(name);
+		bfree(s->sim_name);
+		s->sim_name = bstrdup(name);
+	}
+
+	if (!s->source_name || strcmp(source_name, s->source_name)) {
+		bfree(s->source_name);
+		s->source_name = bstrdup(source_name);
+		obs_weak_source_release(s->source_ref);
+		s->source_ref = NULL;
+	}
+
+	s->width = (uint32_t)obs_data_get_int(settings, "width");
+	s->height = (uint32_t)obs_data_get_int(settings, "height");
+	s->fov = (float)obs_data_get_double(settings, "fov") * 1e-2f;
+
+	ptz_sim::config_s cfg;
+	cfg.latency_ns = (uint64_t)obs_data_get_int(settings, "latency_ms") * 1000000;
+	cfg.pantilt_rate = (float)obs_data_get_double(settings, "pantilt_rate") * 1e-2f;
+	cfg.zoom_rate = (float)obs_data_get_double(settings, "zoom_rate");
+	cfg.zoom_max = (float)obs_data_get_double(settings, "zoom_max");
+	cfg.speed_levels = (int)obs_data_get_int(settings, "speed_levels");
+	cfg.pan_speed_max = (int)obs_data_get_int(settings, "pan_speed_max");
+	cfg.tilt_speed_max = (int)obs_data_get_int(settings, "tilt_speed_max");
+	cfg.zoom_speed_max = (int)obs_data_get_int(settings, "zoom_speed_max");
+	cfg.command_rate_max = (float)obs_data_get_double(settings, "command_rate_max");
+	cfg.script = (int)obs_data_get_int(settings, "script");
+	cfg.script_amplitude = (float)obs_data_get_double(settings, "script_amplitude") * 1e-2f;
+	cfg.script_period = (float)obs_data_get_double(settings, "script_period");
+	s->sim->set_config(cfg);
+}
+
+static void *ptzsim_create(obs_data_t *settings, obs_source_t *context)
+{
+	auto *s = (struct ptz_sim_source *)bzalloc(sizeof(struct ptz_sim_source));
+	s->context = context;
+
+	// The frames are already late by the read back; don't buffer them further.
+	obs_source_set_async_unbuffered(context, true);
+
+	obs_source_update(context, settings);
+
+	return s;
+}
+
+static void ptzsim_destroy(void *data)
+{
+	auto *s = (struct ptz_sim_source *)data;
+
+	obs_enter_graphics();
+	gs_texrender_destroy(s->texrender);
+	gs_texrender_destroy(s->texrender_view);
+	gs_stagesurface_destroy(s->stagesurf);
+	obs_leave_graphics();
+
+	if (s->sim)
+		s->sim->release();
+	obs_weak_source_release(s->source_ref);
+	bfree(s->source_name);
+	bfree(s->sim_name);
+	bfree(s);
+}
+
+static obs_properties_t *ptzsim_properties(void *)
+{
+	obs_properties_t *props = obs_properties_create();
+	obs_property_t *p;
+
+	obs_properties_add_text(props, "name", obs_module_text("Simulator name"), OBS_TEXT_DEFAULT);
+	obs_properties_add_text(props, "source_name", obs_module_text("Source name"), OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "width", obs_module_text("Width"), 16, 8192, 1);
+	obs_properties_add_int(props, "height", obs_module_text("Height"), 16, 8192, 1);
+	p = obs_properties_add_float(props, "fov", obs_module_text("Field of view at wide end"), 5.0, 100.0, 1.0);
+	obs_property_float_set_suffix(p, "%");
+
+	{
+		obs_properties_t *pp = obs_properties_create();
+		p = obs_properties_add_int(pp, "latency_ms", obs_module_text("Latency"), 0, 2000, 10);
+		obs_property_int_set_suffix(p, " ms");
+		p = obs_properties_add_float(pp, "pantilt_rate", obs_module_text("Pan and tilt rate per speed step"),
+					     0.01, 10.0, 0.01);
+		obs_property_float_set_suffix(p, "%/s");
+		obs_properties_add_float(pp, "zoom_rate", obs_module_text("Zoom rate per speed step"), 0.01, 2.0, 0.01);
+		obs_properties_add_float(pp, "zoom_max", obs_module_text("Max zoom"), 1.0, 30.0, 0.1);
+		obs_properties_add_int(pp, "pan_speed_max", obs_module_text("Max speed (pan)"), 1, 127, 1);
+		obs_properties_add_int(pp, "tilt_speed_max", obs_module_text("Max speed (tilt)"), 1, 127, 1);
+		obs_properties_add_int(pp, "zoom_speed_max", obs_module_text("Max speed (zoom)"), 1, 15, 1);
+		obs_properties_add_int(pp, "speed_levels", obs_module_text("Speed levels"), 0, 127, 1);
+		p = obs_properties_add_float(pp, "command_rate_max", obs_module_text("Max command rate"), 0.0, 100.0,
+					     1.0);
+		obs_property_float_set_suffix(p, " Hz");
+		obs_properties_add_group(props, "actuator", obs_module_text("Actuator"), OBS_GROUP_NORMAL, pp);
+	}
+
+	{
+		obs_properties_t *pp = obs_properties_create();
+		p = obs_properties_add_list(pp, "script", obs_module_text("Scene motion"), OBS_COMBO_TYPE_LIST,
+					    OBS_COMBO_FORMAT_INT);
+		obs_property_list_add_int(p, obs_module_text("None"), 0);
+		obs_property_list_add_int(p, obs_module_text("Step"), 1);
+		obs_property_list_add_int(p, obs_module_text("Sine"), 2);
+		p = obs_properties_add_float(pp, "script_amplitude", obs_module_text("Amplitude"), 0.0, 50.0, 0.5);
+		obs_property_float_set_suffix(p, "%");
+		p = obs_properties_add_float(pp, "script_period", obs_module_text("Period"), 0.5, 60.0, 0.5);
+		obs_property_float_set_suffix(p, " s");
+		obs_properties_add_group(props, "script_group", obs_module_text("Script"), OBS_GROUP_NORMAL, pp);
+	}
+
+	return props;
+}
+
+static void ptzsim_get_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_string(settings, "name", "ptz-sim");
+	obs_data_set_default_int(settings, "width", 1280);
+	obs_data_set_default_int(settings, "height", 720);
+	obs_data_set_default_double(settings, "fov", 50.0);
+	obs_data_set_default_int(settings, "latency_ms", 100);
+	obs_data_set_default_double(settings, "pantilt_rate", 1.0);
+	obs_data_set_default_double(settings, "zoom_rate", 0.1);
+	obs_data_set_default_double(settings, "zoom_max", 10.0);
+	obs_data_set_default_int(settings, "pan_speed_max", 0x18);
+	obs_data_set_default_int(settings, "tilt_speed_max", 0x14);
+	obs_data_set_default_int(settings, "zoom_speed_max", 0x07);
+	obs_data_set_default_int(settings, "speed_levels", 0);
+	obs_data_set_default_double(settings, "command_rate_max", 0.0);
+	obs_data_set_default_int(settings, "script", 0);
+	obs_data_set_default_double(settings, "script_amplitude", 10.0);
+	obs_data_set_default_double(settings, "script_period", 4.0);
+}
+
+// Renders the view into `texrender_view`. Called in the graphics context.
+static bool render_view(struct ptz_sim_source *s)
+{
+	obs_source_t *src = obs_weak_source_get_source(s->source_ref);
+	if (!src)
+		return false;
+
+	const uint32_t cx = obs_source_get_width(src);
+	const uint32_t cy = obs_source_get_height(src);
+	if (!cx || !cy || !s->width || !s->height) {
+		obs_source_release(src);
+		return false;
+	}
+
+	if (!s->texrender)
+		s->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+	gs_texrender_reset(s->texrender);
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+	if (gs_texrender_begin(s->texrender, cx, cy)) {
+		struct vec4 clear_color;
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+		obs_source_video_render(src);
+		gs_texrender_end(s->texrender);
+	}
+	gs_blend_state_pop();
+	obs_source_release(src);
+
+	gs_texture_t *tex = gs_texrender_get_texture(s->texrender);
+	if (!tex)
+		return false;
+
+	// The view in the ratio to the scene size.
+	double x, y, zoom;
+	s->sim->get_view(x, y, zoom);
+	const double w = std::min(s->fov / zoom, 1.0);
+	const double h = std::min(w * cx * s->height / (s->width * cy), 1.0);
+	const double x0 = std::clamp(0.5 + x - w * 0.5, 0.0, 1.0 - w);
+	const double y0 = std::clamp(0.5 + y - h * 0.5, 0.0, 1.0 - h);
+
+	if (!s->texrender_view)
+		s->texrender_view = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+	gs_texrender_reset(s->texrender_view);
+	bool rendered = false;
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+	if (gs_texrender_begin(s->texrender_view, s->width, s->height)) {
+		gs_ortho(0.0f, (float)s->width, 0.0f, (float)s->height, -100.0f, 100.0f);
+		gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+		gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), tex);
+		while (gs_effect_loop(effect, "Draw"))
+			draw_sprite_crop((float)s->width, (float)s->height, (float)x0, (float)y0, (float)(x0 + w),
+					 (float)(y0 + h));
+		gs_texrender_end(s->texrender_view);
+		rendered = true;
+	}
+	gs_blend_state_pop();
+	return rendered;
+}
+
+static void output_view(struct ptz_sim_source *s, uint64_t ns)
+{
+	obs_enter_graphics();
+
+	if (!render_view(s)) {
+		obs_leave_graphics();
+		return;
+	}
+
+	if (!s->stagesurf || gs_stagesurface_get_width(s->stagesurf) != s->width ||
+	    gs_stagesurface_get_height(s->stagesurf) != s->height) {
+		gs_stagesurface_destroy(s->stagesurf);
+		s->stagesurf = gs_stagesurface_create(s->width, s->height, GS_BGRA);
+	}
+
+	// Mapped right after staging; the stall is acceptable for a test source and adds no frame of latency.
+	gs_stage_texture(s->stagesurf, gs_texrender_get_texture(s->texrender_view));
+	uint8_t *video_data;
+	uint32_t video_linesize;
+	if (gs_stagesurface_map(s->stagesurf, &video_data, &video_linesize)) {
+		struct obs_source_frame frame = {};
+		frame.data[0] = video_data;
+		frame.linesize[0] = video_linesize;
+		frame.width = s->width;
+		frame.height = s->height;
+		frame.format = VIDEO_FORMAT_BGRA;
+		frame.full_range = true;
+		frame.timestamp = ns;
+		obs_source_output_video(s->context, &frame);
+		gs_stagesurface_unmap(s->stagesurf);
+	}
+
+	obs_leave_graphics();
+}
+
+static void ptzsim_tick(void *data, float)
+{
+	auto *s = (struct ptz_sim_source *)data;
+
+	if (!s->source_ref && s->source_name && *s->source_name) {
+		obs_source_t *src = obs_get_source_by_name(s->source_name);
+		s->source_ref = obs_source_get_weak_source(src);
+		obs_source_release(src);
+	}
+
+	const uint64_t ns = os_gettime_ns();
+	s->sim->advance(ns);
+
+	if (obs_source_showing(s->context))
+		output_view(s, ns);
+}
+
+extern "C" void register_face_tracker_ptz_sim(bool hide_ptz)
+{
+	struct obs_source_info info = {};
+	info.id = "face_tracker_ptz_sim";
+	info.type = OBS_SOURCE_TYPE_INPUT;
+	info.output_flags = OBS_SOURCE_ASYNC_VIDEO;
+	if (hide_ptz)
+		info.output_flags |= OBS_SOURCE_CAP_DISABLED;
+	info.get_name = ptzsim_get_name;
+	info.create = ptzsim_create;
+	info.destroy = ptzsim_destroy;
+	info.update = ptzsim_update;
+	info.get_properties = ptzsim_properties;
+	info.get_defaults = ptzsim_get_defaults;
+	info.video_tick = ptzsim_tick;
+	obs_register_source(&info);
+}
@@ -0,0 +1,323 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include "plugin-macros.generated.h"
+#include "ptz-sim.hpp"
+
+#define debug(...) // blog(LOG_INFO, __VA_ARGS__)
+
+#define SETTLE_TOLERANCE 0.05
+#define PAN_MAX 0.5
+#define TILT_MAX 0.5
+
+enum command_type_e {
+	command_pantilt,
+	command_zoom,
+	command_preset,
+};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<ptz_sim *> registry;
+
+ptz_sim::ptz_sim(const char *name_)
+{
+	ref = 1;
+	name = bstrdup(name_);
+	pthread_mutex_init(&mutex, 0);
+	memset(&cfg, 0, sizeof(cfg));
+	pantilt_held = zoom_held = false;
+	pan_held = tilt_held = zoom_held_speed = 0;
+	command_next_ns = 0;
+	ns = os_gettime_ns();
+	pan = tilt = log_zoom = 0.0;
+	pan_speed = tilt_speed = zoom_speed = 0;
+	target_x = target_y = 0.0;
+	period_start_ns = ns;
+	step_from = step_to = 0.0;
+	settle_ns = 0;
+	overshoot = 0.0;
+	err_sq_sum = 0.0;
+	err_cnt = 0;
+	n_commands = 0;
+	memset(&last_report, 0, sizeof(last_report));
+
+	pthread_mutex_lock(&registry_mutex);
+	registry.push_back(this);
+	pthread_mutex_unlock(&registry_mutex);
+}
+
+ptz_sim::~ptz_sim()
+{
+	bfree(name);
+	pthread_mutex_destroy(&mutex);
+}
+
+void ptz_sim::release()
+{
+	pthread_mutex_lock(&registry_mutex);
+	const bool last = os_atomic_dec_long(&ref) == 0;
+	if (last)
+		registry.erase(std::find(registry.begin(), registry.end(), this));
+	pthread_mutex_unlock(&registry_mutex);
+
+	if (last)
+		delete this;
+}
+
+ptz_sim *ptz_sim::find(const char *name)
+{
+	if (!name)
+		return nullptr;
+
+	ptz_sim *ret = nullptr;
+	pthread_mutex_lock(&registry_mutex);
+	for (ptz_sim *s : registry) {
+		if (strcmp(s->name, name) == 0) {
+			ret = s;
+			ret->add_ref();
+			break;
+		}
+	}
+	pthread_mutex_unlock(&registry_mutex);
+	return ret;
+}
+
+void ptz_sim::set_config(const config_s &cfg_)
+{
+	pthread_mutex_lock(&mutex);
+	const bool script_changed = cfg.script != cfg_.script || cfg.script_amplitude != cfg_.script_amplitude ||
+				    cfg.script_period != cfg_.script_period;
+	cfg = cfg_;
+	if (script_changed) {
+		target_x = target_y = 0.0;
+		step_from = step_to = 0.0;
+		period_start_ns = ns;
+		settle_ns = 0;
+		overshoot = err_sq_sum = 0.0;
+		err_cnt = n_commands = 0;
+		memset(&last_report, 0, sizeof(last_report));
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+int ptz_sim::quantize(int speed, int speed_max) const
+{
+	if (speed_max <= 0)
+		return speed;
+	const int sign = speed < 0 ? -1 : 1;
+	int a = std::min(speed * sign, speed_max);
+	if (cfg.speed_levels > 0 && cfg.speed_levels < speed_max) {
+		const int level = (a * cfg.speed_levels + speed_max / 2) / speed_max;
+		a = (level * speed_max + cfg.speed_levels / 2) / cfg.speed_levels;
+	}
+	return a * sign;
+}
+
+void ptz_sim::accept_pantilt(int pan_, int tilt_, uint64_t now)
+{
+	commands.push_back({now + cfg.latency_ns, command_pantilt, quantize(pan_, cfg.pan_speed_max),
+			    quantize(tilt_, cfg.tilt_speed_max)});
+	n_commands++;
+	pantilt_held = false;
+	if (cfg.command_rate_max > 0.0f)
+		command_next_ns = now + (uint64_t)(1e9f / cfg.command_rate_max);
+}
+
+void ptz_sim::accept_zoom(int zoom, uint64_t now)
+{
+	commands.push_back({now + cfg.latency_ns, command_zoom, quantize(zoom, cfg.zoom_speed_max), 0});
+	n_commands++;
+	zoom_held = false;
+	if (cfg.command_rate_max > 0.0f)
+		command_next_ns = now + (uint64_t)(1e9f / cfg.command_rate_max);
+}
+
+void ptz_sim::set_pantilt_speed(int pan_, int tilt_, uint64_t now)
+{
+	pthread_mutex_lock(&mutex);
+	if (now < command_next_ns) {
+		// The camera would reject or delay the command. Keep the latest one.
+		pantilt_held = true;
+		pan_held = pan_;
+		tilt_held = tilt_;
+	} else {
+		accept_pantilt(pan_, tilt_, now);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void ptz_sim::set_zoom_speed(int zoom, uint64_t now)
+{
+	pthread_mutex_lock(&mutex);
+	if (now < command_next_ns) {
+		zoom_held = true;
+		zoom_held_speed = zoom;
+	} else {
+		accept_zoom(zoom, now);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void ptz_sim::recall_preset(uint64_t now)
+{
+	pthread_mutex_lock(&mutex);
+	commands.push_back({now + cfg.latency_ns, command_preset, 0, 0});
+	n_commands++;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ptz_sim::get_position(struct ptz_position_s &pos, uint64_t now)
+{
+	pthread_mutex_lock(&mutex);
+	integrate(now);
+	pos.pan = (int)lround(pan * PTZ_SIM_POSITION_SCALE);
+	pos.tilt = (int)lround(tilt * PTZ_SIM_POSITION_SCALE);
+	pos.zoom = (float)exp(log_zoom);
+	pos.pantilt_ns = pos.zoom_ns = ns;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ptz_sim::integrate(uint64_t to)
+{
+	for (;;) {
+		uint64_t t = to;
+		const bool apply = !commands.empty() && commands.front().ns <= to;
+		if (apply)
+			t = commands.front().ns;
+
+		if (t > ns) {
+			const double dt = (t - ns) * 1e-9;
+			pan = std::clamp(pan + pan_speed * cfg.pantilt_rate * dt, -PAN_MAX, PAN_MAX);
+			tilt = std::clamp(tilt + tilt_speed * cfg.pantilt_rate * dt, -TILT_MAX, TILT_MAX);
+			// Positive zoom speed moves to wide.
+			log_zoom = std::clamp(log_zoom - zoom_speed * cfg.zoom_rate * dt, 0.0,
+					      (double)logf(std::max(cfg.zoom_max, 1.0f)));
+			ns = t;
+		}
+
+		if (!apply)
+			break;
+
+		const command_s c = commands.front();
+		commands.pop_front();
+		switch (c.type) {
+		case command_pantilt:
+			pan_speed = c.a;
+			// Negative tilt speed moves up.
+			tilt_speed = c.b;
+			break;
+		case command_zoom:
+			zoom_speed = c.a;
+			break;
+		case command_preset:
+			pan = tilt = log_zoom = 0.0;
+			pan_speed = tilt_speed = zoom_speed = 0;
+			break;
+		}
+	}
+}
+
+void ptz_sim::update_script(uint64_t now)
+{
+	const uint64_t period_ns = (uint64_t)(std::max(cfg.script_period, 0.1f) * 1e9f);
+
+	if (cfg.script == 1) {
+		const double err = pan - target_x;
+		const double step = step_to - step_from;
+		if (step != 0.0) {
+			if (std::abs(err) > std::abs(step) * SETTLE_TOLERANCE)
+				settle_ns = now;
+			overshoot = std::max(overshoot, err * (step > 0.0 ? 1.0 : -1.0) / std::abs(step));
+		}
+	} else if (cfg.script == 2) {
+		const double t = (now - period_start_ns) * 1e-9 / cfg.script_period;
+		target_x = cfg.script_amplitude * sin(2.0 * M_PI * t);
+		const double err = pan - target_x;
+		err_sq_sum += err * err;
+		err_cnt++;
+	}
+
+	if (now - period_start_ns < period_ns)
+		return;
+
+	if (cfg.script)
+		report(now);
+
+	period_start_ns = now;
+	settle_ns = now;
+	overshoot = err_sq_sum = 0.0;
+	err_cnt = n_commands = 0;
+	if (cfg.script == 1) {
+		// Move the scene alternately so that the face moves by the amplitude.
+		step_from = target_x;
+		step_to = target_x == 0.0 ? cfg.script_amplitude : 0.0;
+		target_x = step_to;
+	} else {
+		target_x = 0.0;
+	}
+}
+
+void ptz_sim::report(uint64_t now)
+{
+	const double period = (now - period_start_ns) * 1e-9;
+	report_s &r = last_report;
+	r.n_periods++;
+	r.script = cfg.script;
+	r.step = cfg.script == 1 ? step_to - step_from : 0.0;
+	r.settled = settle_ns + 1000000 < now;
+	r.settle_s = (settle_ns - period_start_ns) * 1e-9;
+	r.overshoot = overshoot;
+	r.rms_error = err_cnt > 0 ? sqrt(err_sq_sum / err_cnt) : 0.0;
+	r.command_rate = n_commands / period;
+
+	if (cfg.script == 1 && step_to != step_from) {
+		if (!r.settled) {
+			blog(LOG_INFO, "ptz-sim %s: step %+.3f not settled in %.2f s, %.1f commands/s", name,
+			     step_to - step_from, period, n_commands / period);
+		} else {
+			blog(LOG_INFO, "ptz-sim %s: step %+.3f settled in %.3f s, overshoot %.1f%%, %.1f commands/s",
+			     name, step_to - step_from, (settle_ns - period_start_ns) * 1e-9, overshoot * 100.0,
+			     n_commands / period);
+		}
+	} else if (cfg.script == 2 && err_cnt > 0) {
+		blog(LOG_INFO, "ptz-sim %s: sine amplitude %.3f, RMS error %.4f, %.1f commands/s", name,
+		     cfg.script_amplitude, sqrt(err_sq_sum / err_cnt), n_commands / period);
+	}
+}
+
+void ptz_sim::advance(uint64_t now)
+{
+	pthread_mutex_lock(&mutex);
+
+	if (now >= command_next_ns) {
+		if (pantilt_held)
+			accept_pantilt(pan_held, tilt_held, now);
+		else if (zoom_held)
+			accept_zoom(zoom_held_speed, now);
+	}
+
+	integrate(now);
+	update_script(now);
+
+	pthread_mutex_unlock(&mutex);
+}
+
+void ptz_sim::get_view(double &x, double &y, double &zoom)
+{
+	pthread_mutex_lock(&mutex);
+	x = pan - target_x;
+	y = tilt - target_y;
+	zoom = exp(log_zoom);
+	pthread_mutex_unlock(&mutex);
+}
+
+void ptz_sim::get_report(report_s &report)
+{
+	pthread_mutex_lock(&mutex);
+	report = last_report;
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <deque>
+#include <util/threading.h>
+#include "ptz-backend.hpp"
+
+#define PTZ_SIM_POSITION_SCALE 10000 // pan and tilt are reported in 1/10000 of the input width and height
+
+/* Simulated PTZ head shared by the simulator source and the simulator backend.
+ * The source owns the instance and registers it by name. The backend looks it up by the same name.
+ * The speed commands from the backend take effect after `latency_ns`. The position is integrated in `advance`.
+ *
+ * Pan and tilt are the offset of the view center from the input center, in the ratio to the input size.
+ * Zoom is the magnification; 1 is the widest.
+ */
+class ptz_sim {
+	volatile long ref;
+	char *name;
+
+public:
+	struct config_s
+	{
+		uint64_t latency_ns;
+		float pantilt_rate; // offset per second per speed step
+		float zoom_rate;    // log of magnification per second per speed step
+		float zoom_max;
+		int speed_levels;   // 0 to pass the speed as is
+		int pan_speed_max, tilt_speed_max, zoom_speed_max;
+		float command_rate_max; // commands per second, 0 for unlimited
+
+		// scripted motion of the scene to measure the response
+		int script; // 0: none, 1: step, 2: sine
+		float script_amplitude;
+		float script_period;
+	};
+
+	// Response measured in the last period of the script
+	struct report_s
+	{
+		int n_periods;       // number of periods completed since the script was set
+		int script;
+		double step;         // size of the step, 0 for the sine
+		bool settled;
+		double settle_s;     // time to settle into the tolerance after the step
+		double overshoot;    // in the ratio to the step
+		double rms_error;    // for the sine
+		double command_rate; // commands per second
+	};
+
+private:
+	pthread_mutex_t mutex;
+	config_s cfg;
+
+	struct command_s
+	{
+		uint64_t ns; // time to take effect
+		int type;
+		int a, b;
+	};
+	std::deque<command_s> commands;
+
+	// requests held by the rate limit
+	bool pantilt_held, zoom_held;
+	int pan_held, tilt_held, zoom_held_speed;
+	uint64_t command_next_ns;
+
+	uint64_t ns;
+	double pan, tilt, log_zoom;
+	int pan_speed, tilt_speed, zoom_speed;
+	double target_x, target_y;
+
+	// response to the script
+	uint64_t period_start_ns;
+	double step_from, step_to;
+	uint64_t settle_ns; // last time the error was out of the tolerance
+	double overshoot;
+	double err_sq_sum;
+	int err_cnt;
+	int n_commands;
+	report_s last_report;
+
+	int quantize(int speed, int speed_max) const;
+	void accept_pantilt(int pan, int tilt, uint64_t now);
+	void accept_zoom(int zoom, uint64_t now);
+	void integrate(uint64_t to);
+	void update_script(uint64_t now);
+	void report(uint64_t now);
+
+public:
+	ptz_sim(const char *name);
+	~ptz_sim();
+	void add_ref() { os_atomic_inc_long(&ref); }
+	void release();
+
+	void set_config(const config_s &cfg);
+
+	/* Called from the simulator backend. `now` is the time the command arrives at the camera, usually
+	 * `os_gettime_ns()`. An offline benchmark can run the simulator faster than real time by its own clock.
+	 */
+	void set_pantilt_speed(int pan, int tilt, uint64_t now);
+	void set_zoom_speed(int zoom, uint64_t now);
+	void recall_preset(uint64_t now);
+	void get_position(struct ptz_position_s &pos, uint64_t now);
+
+	// Called from the simulator source
+	void advance(uint64_t now);
+	void get_view(double &x, double &y, double &zoom); // view center relative to the scene, and magnification
+	void get_report(report_s &report);
+
+	static ptz_sim *find(const char *name); // returns with a reference
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/* Speed table to convert the linear control value to the speed code of the camera.
+ * `thresholds[k]` is the lowest control value for the speed code `k + 1`. The thresholds are positive and strictly
+ * increasing so that the control value 0 stops the camera.
+ * The control value is in the unit of PTZ_SPEED_UNIT, which is the velocity at the widest zoom.
+ */
+
+/* Control value for the velocity of the square root of the image area per second at the widest zoom.
+ * The built-in tables below are the former hard-coded conversion, which had no unit. The unit is chosen so that the
+ * top pan code of the table, about 120, is 2.4 per second; with the horizontal field of view of 60 degrees at the
+ * wide end, the square root of a 16:9 image spans 45 degrees and the top code pans at about 100 degrees per second,
+ * the usual max speed of VISCA cameras. `Calibrate speed` replaces the tables by the velocities measured in this
+ * unit, after which the unit only sets the scale of the gains.
+ */
+#define PTZ_SPEED_UNIT 50.0f
+
+// Built-in speed tables in PTZ_SPEED_UNIT, used until the speed is calibrated.
+static const float pan_thresholds_default[] = {
+	0.50f, 1.25f, 1.85f, 2.30f, 2.50f, 2.70f, 2.90f, 3.10f, 3.30f, 3.60f, 4.15f, 5.25f,
+	7.50f, 12.0f, 17.0f, 22.0f, 28.5f, 35.0f, 41.5f, 51.5f, 66.5f, 81.5f, 96.5f, 112.5f,
+};
+
+static const float tilt_thresholds_default[] = {
+	0.50f, 1.25f, 1.85f, 2.30f, 4.15f, 5.35f, 7.00f, 9.00f, 11.0f,
+	13.5f, 16.5f, 20.5f, 26.5f, 34.5f, 43.5f, 53.5f, 64.0f, 74.5f,
+};
+
+class ptz_speed_table {
+	std::vector<float> thresholds;
+
+public:
+	void set(const float *t, int n) { thresholds.assign(t, t + n); }
+
+	int max_code() const { return (int)thresholds.size(); }
+
+	int lookup(float x) const
+	{
+		if (x < 0.0f)
+			return -lookup(-x);
+		if (thresholds.empty() || x < thresholds[0])
+			return 0;
+		return (int)(std::upper_bound(thresholds.begin(), thresholds.end(), x) - thresholds.begin());
+	}
+
+	// Returns the representative control value of the speed code, which is the inverse of `set_velocities`.
+	float velocity(int code) const
+	{
+		if (code < 0)
+			return -velocity(-code);
+		const int n = (int)thresholds.size();
+		if (code == 0 || n == 0)
+			return 0.0f;
+		if (code > n)
+			code = n;
+		if (code < n)
+			return (thresholds[code - 1] + thresholds[code]) * 0.5f;
+		const float lo = n > 1 ? thresholds[n - 2] : 0.0f;
+		return thresholds[n - 1] + (thresholds[n - 1] - lo) * 0.5f;
+	}
+
+	// Returns true if the control values are positive and strictly increasing.
+	static bool is_increasing(const std::vector<float> &v)
+	{
+		for (size_t k = 0; k < v.size(); k++) {
+			if (!(v[k] > (k > 0 ? v[k - 1] : 0.0f)))
+				return false;
+		}
+		return !v.empty();
+	}
+
+	/* Builds the thresholds from the measured control values of each speed code, starting from the code 1.
+	 * Returns false and keeps the table unless the values are positive and strictly increasing.
+	 */
+	bool set_velocities(const std::vector<float> &v)
+	{
+		if (!is_increasing(v))
+			return false;
+		thresholds.resize(v.size());
+		for (size_t k = 0; k < v.size(); k++) {
+			const float lo = k > 0 ? v[k - 1] : 0.0f;
+			thresholds[k] = (lo + v[k]) * 0.5f;
+		}
+		return true;
+	}
+
+	/* Parses the thresholds separated by spaces or commas.
+	 * Returns false if the string is empty or malformed, or if the thresholds are not positive and strictly
+	 * increasing.
+	 */
+	bool parse(const char *str)
+	{
+		std::vector<float> t;
+		while (str && *str) {
+			char *end;
+			const float x = strtof(str, &end);
+			if (end == str) {
+				if (*str != ' ' && *str != ',')
+					return false;
+				str++;
+				continue;
+			}
+			if (!(x > (t.empty() ? 0.0f : t.back())))
+				return false;
+			t.push_back(x);
+			str = end;
+		}
+		if (t.empty())
+			return false;
+		thresholds.swap(t);
+		return true;
+	}
+
+	std::string to_string() const { return to_string(thresholds); }
+
+	static std::string to_string(const std::vector<float> &v)
+	{
+		std::string ret;
+		char buf[32];
+		for (float x : v) {
+			snprintf(buf, sizeof(buf), ret.empty() ? "%.3g" : " %.3g", x);
+			ret += buf;
+		}
+		return ret;
+	}
+};
@@ -0,0 +1,112 @@
+#include <cstdlib>
+#include <cstring>
+#include "scene-change.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_CHANGE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define N SCENE_CHANGE_TILES
+#define TILE_TH 4          // mean absolute difference of a changed tile
+#define CUT_HIST_TH 0.35f  // histogram distance of a scene cut, 0 for the same and 1 for disjoint histograms
+#define CUT_TILES (N * N * 3 / 4)
+
+// returns sum |a - b|
+static inline uint32_t sad_row(const uint8_t *a, const uint8_t *b, int n)
+{
+	int i = 0;
+	uint32_t ret = 0;
+#ifdef SCENE_CHANGE_USE_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		const __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+	}
+	ret = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+	for (; i < n; i++)
+		ret += (uint32_t)abs(a[i] - b[i]);
+	return ret;
+}
+
+uint64_t scene_change::changed_tiles(const uint32_t *sad_tiles, int width, int height, int &n_changed) const
+{
+	uint64_t mask = 0;
+	n_changed = 0;
+	for (int ty = 0; ty < N; ty++) {
+		const int h = (ty + 1) * height / N - ty * height / N;
+		for (int tx = 0; tx < N; tx++) {
+			const int w = (tx + 1) * width / N - tx * width / N;
+			if (sad_tiles[ty * N + tx] > (uint32_t)(TILE_TH * w * h)) {
+				mask |= (uint64_t)1 << (ty * N + tx);
+				n_changed++;
+			}
+		}
+	}
+	return mask;
+}
+
+scene_change::result_e scene_change::update(const uint8_t *gray, int width, int height,
+					     uint64_t mask[SCENE_CHANGE_REFS])
+{
+	for (int i = 0; i < SCENE_CHANGE_REFS; i++)
+		mask[i] = ~(uint64_t)0;
+	if (width < N || height < N)
+		return result_first;
+
+	// frames to compare with, the previous one first
+	const uint8_t *base[1 + SCENE_CHANGE_REFS];
+	for (int i = 0; i < 1 + SCENE_CHANGE_REFS; i++) {
+		const frame_s &f = i == 0 ? prev : ref[i - 1];
+		base[i] = f.width == width && f.height == height ? f.gray.data() : NULL;
+	}
+
+	memset(hist, 0, sizeof(hist));
+	memset(sad, 0, sizeof(sad));
+	for (int y = 0; y < height; y++) {
+		const uint8_t *line = gray + (size_t)width * y;
+		for (int x = 0; x < width; x++)
+			hist[line[x] * SCENE_CHANGE_BINS / 256]++;
+		for (int i = 0; i < 1 + SCENE_CHANGE_REFS; i++) {
+			if (!base[i])
+				continue;
+			const uint8_t *line_base = base[i] + (size_t)width * y;
+			uint32_t *sad_line = sad[i] + y * N / height * N;
+			for (int tx = 0; tx < N; tx++) {
+				const int x0 = tx * width / N, x1 = (tx + 1) * width / N;
+				sad_line[tx] += sad_row(line + x0, line_base + x0, x1 - x0);
+			}
+		}
+	}
+
+	for (int i = 0; i < SCENE_CHANGE_REFS; i++) {
+		int n;
+		if (base[1 + i])
+			mask[i] = changed_tiles(sad[1 + i], width, height, n);
+	}
+
+	result_e ret = result_first;
+	if (base[0]) {
+		int n_changed;
+		changed_tiles(sad[0], width, height, n_changed);
+
+		uint32_t dist = 0;
+		for (int i = 0; i < SCENE_CHANGE_BINS; i++)
+			dist += (uint32_t)abs((int)hist[i] - (int)hist_prev[i]);
+
+		if (n_changed >= CUT_TILES && dist > CUT_HIST_TH * 2.0f * width * height)
+			ret = result_cut;
+		else if (n_changed)
+			ret = result_changed;
+		else
+			ret = result_static;
+	}
+
+	prev.gray.assign(gray, gray + (size_t)width * height);
+	prev.width = width;
+	prev.height = height;
+	memcpy(hist_prev, hist, sizeof(hist));
+	return ret;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// The frame is divided into SCENE_CHANGE_TILES x SCENE_CHANGE_TILES tiles, one bit for each in the mask.
+#define SCENE_CHANGE_TILES 8
+#define SCENE_CHANGE_BINS 32
+#define SCENE_CHANGE_REFS 2
+
+/* Cheap change detector on the downscaled luma.
+ * Each frame is compared with the previously given one by the mean absolute difference in each tile and by the
+ * luma histogram. A scene cut is a frame whose histogram is far from the previous one and most tiles changed, which
+ * distinguishes a cut from a camera motion that keeps the histogram.
+ * The changed tiles are found against the reference frames set by the caller, so that a slow change is accumulated
+ * until the caller processes the frame again.
+ */
+class scene_change {
+	struct frame_s
+	{
+		std::vector<uint8_t> gray;
+		int width = 0, height = 0;
+	};
+	frame_s prev;
+	frame_s ref[SCENE_CHANGE_REFS];
+	uint32_t hist_prev[SCENE_CHANGE_BINS];
+	uint32_t hist[SCENE_CHANGE_BINS];
+	uint32_t sad[1 + SCENE_CHANGE_REFS][SCENE_CHANGE_TILES * SCENE_CHANGE_TILES]; // previous frame, references
+
+	uint64_t changed_tiles(const uint32_t *sad, int width, int height, int &n_changed) const;
+
+public:
+	enum result_e {
+		result_first,   // nothing to compare
+		result_static,  // no tile changed
+		result_changed, // some tiles changed
+		result_cut,     // the scene was switched
+	};
+
+	/* Compares the frame with the previous one to find a scene cut, and with each reference frame.
+	 * `mask[i]` returns the tiles changed since the frame set by `set_reference(i)`, or all tiles if not set.
+	 * The bit `ty * SCENE_CHANGE_TILES + tx` is set if the tile at `tx`, `ty` changed.
+	 */
+	result_e update(const uint8_t *gray, int width, int height, uint64_t mask[SCENE_CHANGE_REFS]);
+
+	// Makes the frame given last to `update` the reference `i`.
+	void set_reference(int i) { ref[i] = prev; }
+
+	void reset()
+	{
+		prev.width = prev.height = 0;
+		for (frame_s &r : ref)
+			r.width = r.height = 0;
+	}
+};
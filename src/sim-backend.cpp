@@ -0,0 +1,122 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include "plugin-macros.generated.h"
+#include "sim-backend.hpp"
+#include "ptz-sim.hpp"
+
+sim_backend::sim_backend()
+{
+	pthread_mutex_init(&mutex, 0);
+}
+
+sim_backend::~sim_backend()
+{
+	bfree(name);
+	pthread_mutex_destroy(&mutex);
+}
+
+void sim_backend::set_config(struct obs_data *data)
+{
+	pthread_mutex_lock(&mutex);
+	bfree(name);
+	name = bstrdup(obs_data_get_string(data, "name"));
+	pthread_mutex_unlock(&mutex);
+}
+
+ptz_sim *sim_backend::find_sim()
+{
+	pthread_mutex_lock(&mutex);
+	ptz_sim *sim = ptz_sim::find(name);
+	pthread_mutex_unlock(&mutex);
+	return sim;
+}
+
+void sim_backend::set_pantilt_speed(int pan, int tilt)
+{
+	ptz_sim *sim = find_sim();
+	if (!sim)
+		return;
+	pantilt_sent_ns = os_gettime_ns();
+	sim->set_pantilt_speed(pan, tilt, pantilt_sent_ns);
+	pan_sent = pan;
+	tilt_sent = tilt;
+	sim->release();
+}
+
+void sim_backend::set_zoom_speed(int zoom)
+{
+	ptz_sim *sim = find_sim();
+	if (!sim)
+		return;
+	sim->set_zoom_speed(zoom, os_gettime_ns());
+	zoom_sent = zoom;
+	sim->release();
+}
+
+void sim_backend::set_ptz_state(const struct ptz_state_s &state)
+{
+	ptz_sim *sim = find_sim();
+	if (!sim)
+		return;
+
+	// Like a VISCA camera, pan-tilt and zoom are separate commands; send only the changed ones.
+	const bool renewed = sim != sent_sim;
+	const uint64_t now = os_gettime_ns();
+	if (renewed || state.pan != pan_sent || state.tilt != tilt_sent) {
+		sim->set_pantilt_speed(state.pan, state.tilt, now);
+		pantilt_sent_ns = now;
+	}
+	if (renewed || state.zoom != zoom_sent)
+		sim->set_zoom_speed(state.zoom, now);
+
+	sent_sim = sim;
+	pan_sent = state.pan;
+	tilt_sent = state.tilt;
+	zoom_sent = state.zoom;
+	sim->release();
+}
+
+void sim_backend::recall_preset(int preset)
+{
+	(void)preset;
+	ptz_sim *sim = find_sim();
+	if (!sim)
+		return;
+	sim->recall_preset(os_gettime_ns());
+	sim->release();
+}
+
+float sim_backend::get_zoom()
+{
+	struct ptz_position_s pos;
+	if (!get_position(pos))
+		return 1.0f;
+	return pos.zoom;
+}
+
+bool sim_backend::get_position(struct ptz_position_s &pos)
+{
+	ptz_sim *sim = find_sim();
+	if (!sim)
+		return false;
+	sim->get_position(pos, os_gettime_ns());
+	sim->release();
+	return true;
+}
+
+bool sim_backend::get_pantilt_sent(int &pan, int &tilt, uint64_t &ns)
+{
+	pan = pan_sent;
+	tilt = tilt_sent;
+	ns = pantilt_sent_ns;
+	return pantilt_sent_ns != 0;
+}
+
+bool sim_backend::ptz_type_modified(obs_properties_t *pp, obs_data_t *)
+{
+	if (obs_properties_get(pp, "ptz.simulator.name"))
+		return false;
+
+	obs_properties_add_text(pp, "ptz.simulator.name", obs_module_text("Simulator name"), OBS_TEXT_DEFAULT);
+	return true;
+}
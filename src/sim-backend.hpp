@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ptz-backend.hpp"
+
+/* Sends the commands to the simulator source `PTZ Simulator` found by its name.
+ * The name is looked up for each call so that the source can be created and removed at any time.
+ */
+class sim_backend : public ptz_backend {
+	pthread_mutex_t mutex;
+	char *name = nullptr;
+
+	// last speeds given to `sent_sim`, accessed only by the video thread
+	const class ptz_sim *sent_sim = nullptr;
+	int pan_sent = 0, tilt_sent = 0, zoom_sent = 0;
+	uint64_t pantilt_sent_ns = 0;
+
+	class ptz_sim *find_sim();
+
+public:
+	sim_backend();
+	~sim_backend() override;
+
+	void set_config(struct obs_data *data) override;
+	void set_pantilt_speed(int pan, int tilt) override;
+	void set_zoom_speed(int zoom) override;
+	void set_ptz_state(const struct ptz_state_s &state) override;
+	void recall_preset(int preset) override;
+	float get_zoom() override;
+	bool get_position(struct ptz_position_s &pos) override;
+	bool get_pantilt_sent(int &pan, int &tilt, uint64_t &ns) override;
+
+	static bool ptz_type_modified(obs_properties_t *group_output, obs_data_t *settings);
+};
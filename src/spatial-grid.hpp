@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include "helper.hpp"
+
+/* Hashed uniform grid to find rectangles that might overlap with a given rectangle.
+ * The buffers are kept across `reset` so that no allocation happens once enough capacity is reserved.
+ */
+class spatial_grid {
+	int cell;
+	std::vector<int> head;  // first entry for each bucket, -1 if empty
+	std::vector<int> next;  // next entry in the same bucket
+	std::vector<int> index; // index of the rectangle for each entry
+	std::vector<int> stamp; // last query that returned the rectangle
+	int query_cnt = 0;
+
+	static inline int floor_div(int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+
+	inline int bucket(int cx, int cy) const
+	{
+		return (int)(((unsigned)cx * 73856093u ^ (unsigned)cy * 19349663u) & (head.size() - 1));
+	}
+
+	template<typename F> inline void for_cells(const rect_s &r, F f) const
+	{
+		const int cx0 = floor_div(r.x0, cell), cx1 = floor_div(r.x1, cell);
+		const int cy0 = floor_div(r.y0, cell), cy1 = floor_div(r.y1, cell);
+		for (int cy = cy0; cy <= cy1; cy++)
+			for (int cx = cx0; cx <= cx1; cx++)
+				f(bucket(cx, cy));
+	}
+
+public:
+	spatial_grid() : cell(1), head(256, -1) {}
+
+	// Clears the grid. `cell_size` should be similar to the size of the rectangles.
+	void reset(int cell_size)
+	{
+		cell = cell_size > 1 ? cell_size : 1;
+		std::fill(head.begin(), head.end(), -1);
+		next.clear();
+		index.clear();
+	}
+
+	void insert(int ix, const rect_s &r)
+	{
+		for_cells(r, [&](int b) {
+			next.push_back(head[b]);
+			index.push_back(ix);
+			head[b] = (int)index.size() - 1;
+		});
+		if ((int)stamp.size() <= ix)
+			stamp.resize(ix + 1, 0);
+	}
+
+	// Calls `f(ix)` once for each rectangle that shares a cell with `r`.
+	template<typename F> void query(const rect_s &r, F f)
+	{
+		const int q = ++query_cnt;
+		for_cells(r, [&](int b) {
+			for (int e = head[b]; e >= 0; e = next[e]) {
+				const int ix = index[e];
+				if (stamp[ix] == q)
+					continue;
+				stamp[ix] = q;
+				f(ix);
+			}
+		});
+	}
+};
@@ -2,6 +2,7 @@
 #include <util/platform.h>
 #include <util/threading.h>
 #include <util/bmem.h>
+#include <cstring>
 #include <dlib/array2d/array2d_kernel.h>
 #include "plugin-macros.generated.h"
 #include "texture-object.h"
@@ -20,6 +21,8 @@ texture_object::texture_object()
 {
 	data = new texture_object_private_s;
 	data->obs_frame = NULL;
+	origin = pointf_s{0.0f, 0.0f};
+	motion = pointf_s{0.0f, 0.0f};
 }
 
 texture_object::~texture_object()
@@ -58,6 +61,46 @@ static void obsframe2dlib_rgbx(dlib::matrix<dlib::rgb_pixel> &img, const struct
 	}
 }
 
+static void obsframe2gray(uint8_t *img, int nc, int nr, const struct obs_source_frame *frame, int scale, int ir,
+			  int ig, int ib, int size)
+{
+	const int inc = size * scale;
+	for (int i = 0; i < nr; i++) {
+		const uint8_t *line = frame->data[0] + frame->linesize[0] * scale * i;
+		uint8_t *dst = img + nc * i;
+		for (int j = 0, js = 0; j < nc; j++, js += inc)
+			dst[j] = (uint8_t)((line[js + ir] * 77 + line[js + ig] * 150 + line[js + ib] * 29) >> 8);
+	}
+}
+
+static void obsframe2dlib_y800(dlib::matrix<dlib::rgb_pixel> &img, const struct obs_source_frame *frame, int scale)
+{
+	const int nr = img.nr();
+	const int nc = img.nc();
+	for (int i = 0; i < nr; i++) {
+		const uint8_t *line = frame->data[0] + frame->linesize[0] * scale * i;
+		for (int j = 0, js = 0; j < nc; j++, js += scale) {
+			img(i, j).red = line[js];
+			img(i, j).green = line[js];
+			img(i, j).blue = line[js];
+		}
+	}
+}
+
+static void y800_to_gray(uint8_t *img, int nc, int nr, const struct obs_source_frame *frame, int scale)
+{
+	for (int i = 0; i < nr; i++) {
+		const uint8_t *line = frame->data[0] + frame->linesize[0] * scale * i;
+		uint8_t *dst = img + nc * i;
+		if (scale == 1) {
+			memcpy(dst, line, nc);
+			continue;
+		}
+		for (int j = 0, js = 0; j < nc; j++, js += scale)
+			dst[j] = line[js];
+	}
+}
+
 static bool need_allocate_frame(const struct obs_source_frame *dst, const struct obs_source_frame *src)
 {
 	if (!dst)
@@ -104,6 +147,9 @@ bool texture_object::get_dlib_rgb_image(dlib::matrix<dlib::rgb_pixel> &img) cons
 	case VIDEO_FORMAT_RGBA:
 		obsframe2dlib_rgbx(img, frame, scale);
 		break;
+	case VIDEO_FORMAT_Y800:
+		obsframe2dlib_y800(img, frame, scale);
+		break;
 	default:
 		if (TEST_FORMAT(frame->format))
 			blog(LOG_ERROR, "Frame format %d has to be RGB", (int)frame->format);
@@ -112,3 +158,98 @@ bool texture_object::get_dlib_rgb_image(dlib::matrix<dlib::rgb_pixel> &img) cons
 
 	return true;
 }
+
+bool texture_object::get_gray_image(std::vector<uint8_t> &img, int &width, int &height, int step) const
+{
+	if (!data->obs_frame)
+		return false;
+
+	const auto *frame = data->obs_frame;
+	const int scale = data->scale * step;
+	width = frame->width / scale;
+	height = frame->height / scale;
+	img.resize((size_t)width * height);
+	switch (frame->format) {
+	case VIDEO_FORMAT_BGRX:
+	case VIDEO_FORMAT_BGRA:
+		obsframe2gray(img.data(), width, height, frame, scale, 2, 1, 0, 4);
+		break;
+	case VIDEO_FORMAT_BGR3:
+		obsframe2gray(img.data(), width, height, frame, scale, 2, 1, 0, 3);
+		break;
+	case VIDEO_FORMAT_RGBA:
+		obsframe2gray(img.data(), width, height, frame, scale, 0, 1, 2, 4);
+		break;
+	case VIDEO_FORMAT_Y800:
+		y800_to_gray(img.data(), width, height, frame, scale);
+		break;
+	default:
+		if (TEST_FORMAT(frame->format))
+			blog(LOG_ERROR, "Frame format %d has to be RGB", (int)frame->format);
+		SET_FORMAT(frame->format);
+		return false;
+	}
+
+	return true;
+}
+
+bool texture_object::get_dlib_gray_image(dlib::matrix<unsigned char> &img) const
+{
+	int width, height;
+	std::vector<uint8_t> gray;
+	if (data->obs_frame && data->obs_frame->format == VIDEO_FORMAT_Y800) {
+		const auto *frame = data->obs_frame;
+		const int scale = data->scale;
+		img.set_size(frame->height / scale, frame->width / scale);
+		for (long i = 0; i < img.nr(); i++) {
+			const uint8_t *line = frame->data[0] + frame->linesize[0] * scale * i;
+			for (long j = 0; j < img.nc(); j++)
+				img(i, j) = line[j * scale];
+		}
+		return true;
+	}
+
+	if (!get_gray_image(gray, width, height))
+		return false;
+	img.set_size(height, width);
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++)
+			img(i, j) = gray[(size_t)width * i + j];
+	}
+	return true;
+}
+
+bool texture_object::is_gray() const
+{
+	return data->obs_frame && data->obs_frame->format == VIDEO_FORMAT_Y800;
+}
+
+const texture_object &texture_object::finest(dlib::rectangle &r) const
+{
+	const float x0 = r.left() * scale + origin.x;
+	const float y0 = r.top() * scale + origin.y;
+	const float x1 = r.right() * scale + origin.x;
+	const float y1 = r.bottom() * scale + origin.y;
+
+	const texture_object *ret = this;
+	auto consider = [&](const texture_object *roi) {
+		const struct obs_source_frame *frame = roi ? roi->data->obs_frame : NULL;
+		if (!frame || roi->scale >= ret->scale)
+			return;
+		const float w = (float)(frame->width / roi->data->scale) * roi->scale;
+		const float h = (float)(frame->height / roi->data->scale) * roi->scale;
+		if (x0 < roi->origin.x || y0 < roi->origin.y || x1 > roi->origin.x + w || y1 > roi->origin.y + h)
+			return;
+		ret = roi;
+	};
+	for (const auto &roi : rois)
+		consider(roi.get());
+	consider(native.get());
+
+	if (ret != this) {
+		const float k = 1.0f / ret->scale;
+		r = dlib::rectangle((long)((x0 - ret->origin.x) * k), (long)((y0 - ret->origin.y) * k),
+				    (long)((x1 - ret->origin.x) * k), (long)((y1 - ret->origin.y) * k));
+	}
+	return *ret;
+}
@@ -2,8 +2,11 @@
 #include <obs-module.h>
 #include <util/threading.h>
 #include <vector>
+#include <memory>
 #include <dlib/array2d/array2d_kernel.h>
+#include <dlib/geometry/rectangle.h>
 #include "plugin-macros.generated.h"
+#include "helper.hpp"
 
 class texture_object {
 	struct texture_object_private_s *data;
@@ -14,8 +17,43 @@ public:
 
 	void set_texture_obsframe(const struct obs_source_frame *frame, int scale);
 	bool get_dlib_rgb_image(dlib::matrix<dlib::rgb_pixel> &img) const;
+	bool get_dlib_gray_image(dlib::matrix<unsigned char> &img) const;
+	// Takes every `step` pixels in both directions.
+	bool get_gray_image(std::vector<uint8_t> &img, int &width, int &height, int step = 1) const;
+	bool is_gray() const; // the frame has only luma, such as read back from the GPU in VIDEO_FORMAT_Y800
+
+	/* Returns the image with the finest resolution covering `r`, which is one of `rois`, `native`, or this object.
+	 * `r` is given in the pixels of this object and converted to the pixels of the returned object.
+	 */
+	const texture_object &finest(dlib::rectangle &r) const;
 
 public:
 	int tick;
 	float scale;
+	pointf_s origin; // position of the top-left pixel in the source pixels, non-zero for a region of interest
+	pointf_s motion; // accumulated motion of the camera image in the source pixels, zero if not estimated
+
+	// Other levels of the pyramid read back in the same frame. Each has its own `scale` and `origin`.
+	std::shared_ptr<texture_object> coarse; // lower resolution for the detector, null if not read back
+	std::shared_ptr<texture_object> native; // whole frame at the native resolution for the tiled detection
+	std::vector<std::shared_ptr<texture_object>> rois; // native resolution around the faces for the landmarks
 };
+
+/* Calls `f` with the image in the native format of the texture; grayscale if `is_gray`, otherwise RGB.
+ * dlib's detectors, trackers, and shape predictors accept both so that a grayscale frame is not expanded to RGB.
+ */
+template<typename F>
+static inline bool with_dlib_image(const texture_object &tex, dlib::matrix<dlib::rgb_pixel> &rgb,
+				   dlib::matrix<unsigned char> &gray, F f)
+{
+	if (tex.is_gray()) {
+		if (!tex.get_dlib_gray_image(gray))
+			return false;
+		f(gray);
+	} else {
+		if (!tex.get_dlib_rgb_image(rgb))
+			return false;
+		f(rgb);
+	}
+	return true;
+}
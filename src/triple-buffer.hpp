@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+
+/* Lock-free triple buffer to pass the latest data from one producer thread to one consumer thread.
+ * The producer fills `back()` and calls `publish()`. The consumer calls `acquire()` and reads `front()`.
+ * Neither side waits for the other. Data that is published twice before the consumer acquires it is dropped.
+ */
+template<typename T> class triple_buffer {
+	T buf[3];
+	std::atomic<int> middle; // index of the middle buffer, `fresh` is set if it has not been acquired
+	int back_ix = 0;
+	int front_ix = 1;
+
+	static const int fresh = 4;
+
+public:
+	triple_buffer() : middle(2) {}
+
+	T &back() { return buf[back_ix]; }
+	T &front() { return buf[front_ix]; }
+
+	void publish() { back_ix = middle.exchange(back_ix | fresh, std::memory_order_acq_rel) & 3; }
+
+	// Returns true if `front()` has been replaced by newly published data.
+	bool acquire()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & fresh))
+			return false;
+		front_ix = middle.exchange(front_ix, std::memory_order_acq_rel) & 3;
+		return true;
+	}
+};
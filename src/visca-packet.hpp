@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+/* Encoder and decoder of the VISCA packets used by the PTZ backends.
+ * The camera address is 1 to 7. A reply from the camera at address `a` starts with `0x80 + (a << 4)`.
+ */
+
+#define VISCA_PACKET_MAX 16
+
+struct visca_packet_s
+{
+	uint8_t data[VISCA_PACKET_MAX];
+	int size;
+};
+
+static inline void visca_packet_set(visca_packet_s &p, std::initializer_list<uint8_t> bytes)
+{
+	p.size = 0;
+	for (uint8_t b : bytes)
+		p.data[p.size++] = b;
+}
+
+static inline uint8_t visca_header(int address)
+{
+	return (uint8_t)(0x80 | (address & 7));
+}
+
+static inline void visca_if_clear(visca_packet_s &p, int address)
+{
+	visca_packet_set(p, {visca_header(address), 0x01, 0x00, 0x01, 0xFF});
+}
+
+// Negative `pan` moves left, negative `tilt` moves up.
+static inline void visca_pantilt_drive(visca_packet_s &p, int address, int pan, int tilt)
+{
+	int pan_a = pan < 0 ? -pan : pan;
+	int tilt_a = tilt < 0 ? -tilt : tilt;
+	if (pan_a > 127)
+		pan_a = 127;
+	if (tilt_a > 127)
+		tilt_a = 127;
+	const uint8_t dir_pan = pan < 0 ? 0x01 : pan > 0 ? 0x02 : 0x03;
+	const uint8_t dir_tilt = tilt < 0 ? 0x01 : tilt > 0 ? 0x02 : 0x03;
+	visca_packet_set(p, {visca_header(address), 0x01, 0x06, 0x01, (uint8_t)pan_a, (uint8_t)tilt_a, dir_pan,
+			     dir_tilt, 0xFF});
+}
+
+// Positive `zoom` moves to wide, negative `zoom` moves to tele.
+static inline void visca_zoom_drive(visca_packet_s &p, int address, int zoom)
+{
+	int zoom_a = zoom < 0 ? -zoom : zoom;
+	if (zoom_a > 7)
+		zoom_a = 7;
+	const uint8_t cmd = zoom > 0 ? (uint8_t)(0x30 | zoom_a) : zoom < 0 ? (uint8_t)(0x20 | zoom_a) : 0x00;
+	visca_packet_set(p, {visca_header(address), 0x01, 0x04, 0x07, cmd, 0xFF});
+}
+
+static inline void visca_memory_recall(visca_packet_s &p, int address, int preset)
+{
+	visca_packet_set(p, {visca_header(address), 0x01, 0x04, 0x3F, 0x02, (uint8_t)(preset & 0x7F), 0xFF});
+}
+
+static inline void visca_zoom_inquiry(visca_packet_s &p, int address)
+{
+	visca_packet_set(p, {visca_header(address), 0x09, 0x04, 0x47, 0xFF});
+}
+
+static inline void visca_pantilt_inquiry(visca_packet_s &p, int address)
+{
+	visca_packet_set(p, {visca_header(address), 0x09, 0x06, 0x12, 0xFF});
+}
+
+/* VISCA over IP
+ * Each UDP datagram has an 8-byte header of the payload type, the payload length, and the sequence number, all in
+ * big endian. The control message RESET resets the sequence number in the camera.
+ */
+#define VISCAIP_HEADER_SIZE 8
+#define VISCAIP_TYPE_COMMAND 0x0100
+#define VISCAIP_TYPE_INQUIRY 0x0110
+#define VISCAIP_TYPE_REPLY 0x0111
+#define VISCAIP_TYPE_CONTROL 0x0200
+#define VISCAIP_TYPE_CONTROL_REPLY 0x0201
+
+static inline void viscaip_header(uint8_t *buf, int type, int size, uint32_t seq)
+{
+	buf[0] = (uint8_t)(type >> 8);
+	buf[1] = (uint8_t)type;
+	buf[2] = (uint8_t)(size >> 8);
+	buf[3] = (uint8_t)size;
+	buf[4] = (uint8_t)(seq >> 24);
+	buf[5] = (uint8_t)(seq >> 16);
+	buf[6] = (uint8_t)(seq >> 8);
+	buf[7] = (uint8_t)seq;
+}
+
+// Returns false if `buf` does not start with a valid header.
+static inline bool viscaip_parse_header(const uint8_t *buf, int n, int &type, int &size, uint32_t &seq)
+{
+	if (n < VISCAIP_HEADER_SIZE)
+		return false;
+	type = (buf[0] << 8) | buf[1];
+	size = (buf[2] << 8) | buf[3];
+	seq = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
+	return size <= n - VISCAIP_HEADER_SIZE;
+}
+
+enum visca_reply_type_e {
+	visca_reply_ack,
+	visca_reply_completion,
+	visca_reply_error,
+	visca_reply_unknown,
+};
+
+struct visca_reply_s
+{
+	enum visca_reply_type_e type;
+	int socket;           // socket number in the camera
+	const uint8_t *data;  // whole packet including the header and the terminator
+	int size;
+};
+
+// Returns the value of `n` nibbles starting at `data`, as returned by the position inquiries.
+static inline int visca_nibbles(const uint8_t *data, int n)
+{
+	int v = 0;
+	for (int i = 0; i < n; i++)
+		v = (v << 4) | (data[i] & 0x0F);
+	return v;
+}
+
+// Same as `visca_nibbles` but the value is signed.
+static inline int visca_nibbles_signed(const uint8_t *data, int n)
+{
+	const int v = visca_nibbles(data, n);
+	const int sign = 1 << (n * 4 - 1);
+	return (v ^ sign) - sign;
+}
+
+// Parses the reply to the pan-tilt position inquiry. Cameras return 4 or 5 nibbles for each axis.
+static inline bool visca_parse_pantilt(const visca_reply_s &r, int &pan, int &tilt)
+{
+	const int n = r.size - 3;
+	if (n < 8 || n > 10)
+		return false;
+	const int n_pan = (n + 1) / 2;
+	pan = visca_nibbles_signed(r.data + 2, n_pan);
+	tilt = visca_nibbles_signed(r.data + 2 + n_pan, n - n_pan);
+	return true;
+}
+
+/* Splits a byte stream into the reply packets.
+ * Bytes are appended by `feed` and the packets are taken by `next` until it returns false.
+ */
+class visca_reply_parser {
+	uint8_t buf[256];
+	int size = 0;
+	int head = 0;
+
+public:
+	void reset() { size = head = 0; }
+
+	// Returns a pointer to append at most `n` bytes and call `commit` with the number of bytes appended.
+	uint8_t *prepare(int &n)
+	{
+		if (head > 0) {
+			memmove(buf, buf + head, size - head);
+			size -= head;
+			head = 0;
+		}
+		if (size == (int)sizeof(buf))
+			size = 0; // No terminator in the buffer, drop the garbage.
+		n = (int)sizeof(buf) - size;
+		return buf + size;
+	}
+	void commit(int n) { size += n; }
+
+	void feed(const uint8_t *data, int n)
+	{
+		while (n > 0) {
+			int m;
+			uint8_t *dst = prepare(m);
+			if (m > n)
+				m = n;
+			memcpy(dst, data, m);
+			commit(m);
+			data += m;
+			n -= m;
+		}
+	}
+
+	bool next(visca_reply_s &r)
+	{
+		for (int i = head; i < size; i++) {
+			if (buf[i] != 0xFF)
+				continue;
+			r.data = buf + head;
+			r.size = i + 1 - head;
+			head = i + 1;
+			r.socket = r.size >= 2 ? r.data[1] & 0x0F : 0;
+			const uint8_t t = r.size >= 2 ? r.data[1] & 0xF0 : 0;
+			if ((r.data[0] & 0x8F) != 0x80)
+				r.type = visca_reply_unknown;
+			else if (t == 0x40)
+				r.type = visca_reply_ack;
+			else if (t == 0x50)
+				r.type = visca_reply_completion;
+			else if (t == 0x60)
+				r.type = visca_reply_error;
+			else
+				r.type = visca_reply_unknown;
+			return true;
+		}
+		return false;
+	}
+};
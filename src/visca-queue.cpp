@@ -0,0 +1,316 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include "plugin-macros.generated.h"
+#include "visca-queue.hpp"
+
+#define debug(...) // blog(LOG_INFO, __VA_ARGS__)
+
+#define ZOOM_INQUIRY_INTERVAL_NS 50000000
+#define ZOOM_INQUIRY_AFTER_STOP_NS 500000000
+
+#define LATENCY_REPORT_CNT 300
+
+#define INQUIRY_PANTILT 1
+#define INQUIRY_ZOOM 2
+
+visca_queue::visca_queue(os_event_t *event_)
+{
+	pthread_mutex_init(&mutex, 0);
+	event = event_;
+	waker = NET_INVALID_SOCKET;
+	pan_req = tilt_req = zoom_req = preset_req = 0;
+	pantilt_pending = zoom_pending = preset_pending = false;
+	pantilt_req_ns = zoom_req_ns = preset_req_ns = 0;
+	query_interval_ns = 0;
+	memset(&position, 0, sizeof(position));
+	position.zoom = 1.0f;
+	pan_wire = tilt_wire = 0;
+	pantilt_wire_ns = 0;
+
+	prefer_zoom = false;
+	inquiry_last = false;
+	inquiry_due = 0;
+	zoom_inquiry_ns = zoom_stop_ns = query_next_ns = 0;
+	latency_ns_sum = latency_ns_max = 0;
+	latency_cnt = 0;
+	resend();
+}
+
+visca_queue::~visca_queue()
+{
+	pthread_mutex_destroy(&mutex);
+}
+
+inline bool visca_queue::request_pantilt(int pan, int tilt, uint64_t ns)
+{
+	if (pan == pan_req && tilt == tilt_req)
+		return false;
+	if (!pantilt_pending)
+		pantilt_req_ns = ns;
+	pantilt_pending = true;
+	pan_req = pan;
+	tilt_req = tilt;
+	return true;
+}
+
+inline bool visca_queue::request_zoom(int zoom, uint64_t ns)
+{
+	if (zoom == zoom_req)
+		return false;
+	if (!zoom_pending)
+		zoom_req_ns = ns;
+	zoom_pending = true;
+	zoom_req = zoom;
+	return true;
+}
+
+void visca_queue::set_event(os_event_t *event_)
+{
+	pthread_mutex_lock(&mutex);
+	event = event_;
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_queue::set_waker(net_socket_t waker_)
+{
+	pthread_mutex_lock(&mutex);
+	waker = waker_;
+	pthread_mutex_unlock(&mutex);
+}
+
+// Called with `mutex` locked
+inline void visca_queue::notify()
+{
+	if (event)
+		os_event_signal(event);
+	net_wake(waker);
+}
+
+void visca_queue::set_pantilt_speed(int pan, int tilt)
+{
+	const uint64_t ns = os_gettime_ns();
+	pthread_mutex_lock(&mutex);
+	bool changed = request_pantilt(pan, tilt, ns);
+	if (changed)
+		notify();
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_queue::set_zoom_speed(int zoom)
+{
+	const uint64_t ns = os_gettime_ns();
+	pthread_mutex_lock(&mutex);
+	bool changed = request_zoom(zoom, ns);
+	if (changed)
+		notify();
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_queue::set_speed(int pan, int tilt, int zoom)
+{
+	const uint64_t ns = os_gettime_ns();
+	pthread_mutex_lock(&mutex);
+	bool changed = request_pantilt(pan, tilt, ns);
+	changed |= request_zoom(zoom, ns);
+	if (changed)
+		notify();
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_queue::recall_preset(int preset)
+{
+	pthread_mutex_lock(&mutex);
+	preset_req = preset;
+	if (!preset_pending)
+		preset_req_ns = os_gettime_ns();
+	preset_pending = true;
+	notify();
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_queue::set_query_rate(float hz)
+{
+	pthread_mutex_lock(&mutex);
+	query_interval_ns = hz > 0.0f ? (uint64_t)(1e9f / hz) : 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_queue::get_position(struct ptz_position_s &pos)
+{
+	pthread_mutex_lock(&mutex);
+	pos = position;
+	pthread_mutex_unlock(&mutex);
+}
+
+bool visca_queue::get_pantilt_sent(int &pan, int &tilt, uint64_t &ns)
+{
+	pthread_mutex_lock(&mutex);
+	pan = pan_wire;
+	tilt = tilt_wire;
+	ns = pantilt_wire_ns;
+	pthread_mutex_unlock(&mutex);
+	return ns != 0;
+}
+
+void visca_queue::resend()
+{
+	pan_sent = tilt_sent = zoom_sent = INT_MIN;
+}
+
+inline bool visca_queue::zoom_moving(uint64_t ns) const
+{
+	// Inquire the zoom position while zooming and for a while after stopping.
+	return zoom_sent != 0 || ns - zoom_stop_ns < ZOOM_INQUIRY_AFTER_STOP_NS;
+}
+
+bool visca_queue::next(visca_command_s &cmd, uint64_t ns)
+{
+	cmd.type = visca_cmd_none;
+	cmd.req_ns = 0;
+
+	if (zoom_moving(ns) && ns >= zoom_inquiry_ns) {
+		inquiry_due |= INQUIRY_ZOOM;
+		zoom_inquiry_ns = ns + ZOOM_INQUIRY_INTERVAL_NS;
+	}
+
+	pthread_mutex_lock(&mutex);
+	if (query_interval_ns && ns >= query_next_ns) {
+		inquiry_due |= INQUIRY_PANTILT | INQUIRY_ZOOM;
+		query_next_ns = std::max(query_next_ns + query_interval_ns, ns);
+	}
+	const bool pantilt_changed = pan_req != pan_sent || tilt_req != tilt_sent;
+	const bool zoom_changed = zoom_req != zoom_sent;
+	// An inquiry takes every other slot so that neither the inquiries nor the motion commands starve.
+	const bool inquiry_first = inquiry_due && (!inquiry_last || (!pantilt_changed && !zoom_changed));
+	if (preset_pending) {
+		visca_memory_recall(cmd.packet, address, preset_req);
+		debug("visca_queue::next recall preset=%d", preset_req);
+		cmd.type = visca_cmd_preset;
+		cmd.req_ns = preset_req_ns;
+		cmd.preset = preset_req;
+		preset_pending = false;
+	} else if (inquiry_first) {
+		cmd.type = inquiry_due & INQUIRY_PANTILT ? visca_cmd_inquiry_pantilt : visca_cmd_inquiry_zoom;
+	} else if (pantilt_changed && (!zoom_changed || !prefer_zoom)) {
+		visca_pantilt_drive(cmd.packet, address, pan_req, tilt_req);
+		debug("visca_queue::next pan=%d tilt=%d", pan_req, tilt_req);
+		cmd.type = visca_cmd_pantilt;
+		cmd.req_ns = pantilt_pending ? pantilt_req_ns : ns;
+		cmd.pan = pan_req;
+		cmd.tilt = tilt_req;
+		pan_sent = pan_req;
+		tilt_sent = tilt_req;
+		prefer_zoom = true;
+	} else if (zoom_changed) {
+		visca_zoom_drive(cmd.packet, address, zoom_req);
+		debug("visca_queue::next zoom=%d", zoom_req);
+		cmd.type = visca_cmd_zoom;
+		cmd.req_ns = zoom_pending ? zoom_req_ns : ns;
+		zoom_sent = zoom_req;
+		if (zoom_sent == 0)
+			zoom_stop_ns = ns;
+		prefer_zoom = false;
+	}
+	if (pan_sent == pan_req && tilt_sent == tilt_req)
+		pantilt_pending = false;
+	if (zoom_sent == zoom_req)
+		zoom_pending = false;
+	pthread_mutex_unlock(&mutex);
+
+	if (cmd.type == visca_cmd_inquiry_pantilt) {
+		visca_pantilt_inquiry(cmd.packet, address);
+		inquiry_due &= ~INQUIRY_PANTILT;
+	} else if (cmd.type == visca_cmd_inquiry_zoom) {
+		visca_zoom_inquiry(cmd.packet, address);
+		inquiry_due &= ~INQUIRY_ZOOM;
+	}
+
+	if (cmd.type == visca_cmd_none)
+		return false;
+	inquiry_last = cmd.type == visca_cmd_inquiry_pantilt || cmd.type == visca_cmd_inquiry_zoom;
+	return true;
+}
+
+void visca_queue::unsent(const visca_command_s &cmd)
+{
+	// A preset is not restored by `resend`, which only sends the latest speeds again.
+	if (cmd.type == visca_cmd_preset) {
+		pthread_mutex_lock(&mutex);
+		if (!preset_pending) {
+			preset_req = cmd.preset;
+			preset_req_ns = cmd.req_ns;
+			preset_pending = true;
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+	resend();
+}
+
+void visca_queue::sent(const visca_command_s &cmd, uint64_t ns)
+{
+	if (cmd.type == visca_cmd_pantilt) {
+		pthread_mutex_lock(&mutex);
+		pan_wire = cmd.pan;
+		tilt_wire = cmd.tilt;
+		pantilt_wire_ns = ns;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	if (!cmd.req_ns)
+		return;
+
+	const uint64_t dt = ns - cmd.req_ns;
+	latency_ns_sum += dt;
+	if (dt > latency_ns_max)
+		latency_ns_max = dt;
+	if (++latency_cnt >= LATENCY_REPORT_CNT) {
+		blog(LOG_DEBUG, "VISCA camera %d: %.3f ms in average, %.3f ms at max from request to send", address,
+		     latency_ns_sum * 1e-6 / latency_cnt, latency_ns_max * 1e-6);
+		latency_ns_sum = latency_ns_max = 0;
+		latency_cnt = 0;
+	}
+}
+
+uint64_t visca_queue::next_inquiry_ns(uint64_t ns)
+{
+	uint64_t ret = UINT64_MAX;
+	if (zoom_moving(ns))
+		ret = zoom_inquiry_ns;
+	pthread_mutex_lock(&mutex);
+	if (query_interval_ns)
+		ret = std::min(ret, query_next_ns);
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+void visca_queue::received_inquiry(enum visca_command_e type, const visca_reply_s &r, uint64_t ns)
+{
+	if (type == visca_cmd_inquiry_zoom && r.size == 7) {
+		const int zoom = visca_nibbles(r.data + 2, 4);
+		debug("visca_queue: got zoom=%d", zoom);
+		pthread_mutex_lock(&mutex);
+		position.zoom = raw2zoomfactor(zoom);
+		position.zoom_ns = ns;
+		pthread_mutex_unlock(&mutex);
+	} else if (type == visca_cmd_inquiry_pantilt) {
+		int pan, tilt;
+		if (!visca_parse_pantilt(r, pan, tilt))
+			return;
+		debug("visca_queue: got pan=%d tilt=%d", pan, tilt);
+		pthread_mutex_lock(&mutex);
+		position.pan = pan;
+		position.tilt = tilt;
+		position.pantilt_ns = ns;
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+float visca_queue::raw2zoomfactor(int zoom)
+{
+	// TODO: configurable
+	return expf((float)zoom * (logf(20.0f) / 16384.f));
+}
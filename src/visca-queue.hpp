@@ -0,0 +1,89 @@
+#pragma once
+
+#include <util/threading.h>
+#include "net-socket.hpp"
+#include "ptz-backend.hpp"
+#include "visca-packet.hpp"
+
+enum visca_command_e {
+	visca_cmd_none = 0,
+	visca_cmd_pantilt,
+	visca_cmd_zoom,
+	visca_cmd_preset,
+	visca_cmd_inquiry_pantilt,
+	visca_cmd_inquiry_zoom,
+};
+
+struct visca_command_s
+{
+	enum visca_command_e type;
+	visca_packet_s packet;
+	uint64_t req_ns; // time of the oldest request coalesced into this command, 0 for inquiries
+	int pan, tilt;   // speeds of `visca_cmd_pantilt`
+	int preset;      // preset of `visca_cmd_preset`
+};
+
+/* Requests to a VISCA camera and the order to send them.
+ * The video thread stores the requests and signals `event` owned by the sending thread, which can be replaced by
+ * `set_event` when the queue moves to another sending thread. A sending thread waiting for a socket sets `waker`
+ * instead. Speed requests are coalesced
+ * so that only the latest value is sent. Position inquiries are interleaved with the motion commands.
+ */
+class visca_queue {
+	pthread_mutex_t mutex;
+	os_event_t *event;  // protected by `mutex`
+	net_socket_t waker; // protected by `mutex`
+
+	// requests, protected by `mutex`
+	int pan_req, tilt_req, zoom_req, preset_req;
+	bool pantilt_pending, zoom_pending, preset_pending;
+	uint64_t pantilt_req_ns, zoom_req_ns, preset_req_ns; // time of the oldest request not sent yet
+	uint64_t query_interval_ns;                          // 0 to disable the periodic inquiry
+	struct ptz_position_s position;
+	int pan_wire, tilt_wire; // pan and tilt speeds last written to the camera
+	uint64_t pantilt_wire_ns;
+
+	// scheduler, accessed only by the sending thread
+	int pan_sent, tilt_sent, zoom_sent;
+	bool prefer_zoom;
+	bool inquiry_last;
+	int inquiry_due;
+	uint64_t zoom_inquiry_ns;
+	uint64_t zoom_stop_ns;
+	uint64_t query_next_ns;
+	uint64_t latency_ns_sum; // statistics of the time from the request to the wire
+	uint64_t latency_ns_max;
+	int latency_cnt;
+
+	inline bool zoom_moving(uint64_t ns) const;
+	inline bool request_pantilt(int pan, int tilt, uint64_t ns);
+	inline bool request_zoom(int zoom, uint64_t ns);
+	inline void notify();
+
+public:
+	int address = 1;
+
+	visca_queue(os_event_t *event);
+	~visca_queue();
+	void set_event(os_event_t *event);  // NULL while no thread is sending
+	void set_waker(net_socket_t waker); // NET_INVALID_SOCKET while no thread is sending
+
+	// Called from the video thread
+	void set_pantilt_speed(int pan, int tilt);
+	void set_zoom_speed(int zoom);
+	void set_speed(int pan, int tilt, int zoom); // both in one lock and one wake-up
+	void recall_preset(int preset);
+	void set_query_rate(float hz);
+	void get_position(struct ptz_position_s &pos);
+	bool get_pantilt_sent(int &pan, int &tilt, uint64_t &ns);
+
+	// Called from the sending thread
+	bool next(visca_command_s &cmd, uint64_t ns);
+	void sent(const visca_command_s &cmd, uint64_t ns); // to measure the latency
+	void unsent(const visca_command_s &cmd);            // `cmd` from `next` could not be sent
+	void resend(); // the latest values will be sent again, such as after reconnecting or an error
+	void received_inquiry(enum visca_command_e type, const visca_reply_s &r, uint64_t ns);
+	uint64_t next_inquiry_ns(uint64_t ns); // time to call `next` even without any request
+
+	static float raw2zoomfactor(int);
+};
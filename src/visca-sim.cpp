@@ -0,0 +1,543 @@
+/* VISCA camera simulator
+ * Listens on TCP and on UDP (VISCA over IP) and speaks the subset of VISCA used by the plugin.
+ * The commanded speeds are integrated to a virtual head position so that the inquiries return a moving position.
+ * Every command is recorded with the time it was received.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <csignal>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include "visca-packet.hpp"
+
+#define PAN_MAX 2448
+#define TILT_MAX 1200
+#define ZOOM_MAX 16384
+#define N_SOCKETS 2
+#define STATS_INTERVAL_NS 5000000000ULL
+
+struct config_s
+{
+	int tcp_port = 1259;
+	int udp_port = 52381;
+	uint64_t ack_delay_ns = 2000000;
+	uint64_t completion_delay_ns = 1000000;
+	uint64_t motion_latency_ns = 50000000;
+	double pan_rate = 60.0;   // units per second per speed step
+	double tilt_rate = 60.0;  // units per second per speed step
+	double zoom_rate = 700.0; // units per second per speed step
+	double drop = 0.0;        // ratio of UDP datagrams to drop
+	FILE *log = NULL;
+};
+
+static config_s cfg;
+static volatile sig_atomic_t quit = 0;
+
+static uint64_t now_ns()
+{
+	using namespace std::chrono;
+	static const steady_clock::time_point t0 = steady_clock::now();
+	return (uint64_t)duration_cast<nanoseconds>(steady_clock::now() - t0).count();
+}
+
+// Where to send the replies. TCP clients are identified by `fd`, UDP clients by the address.
+struct peer_s
+{
+	int fd;
+	bool udp;
+	sockaddr_storage addr;
+	socklen_t addrlen;
+};
+
+struct client_s
+{
+	peer_s peer;
+	visca_reply_parser parser;
+	int busy[N_SOCKETS];
+};
+
+struct reply_s
+{
+	uint64_t ns;
+	peer_s peer;
+	uint32_t seq;
+	int type;
+	visca_packet_s packet;
+	int *release_socket; // socket to release when this reply is sent
+	bool inquiry_zoom, inquiry_pantilt;
+};
+
+struct motion_s
+{
+	uint64_t ns;
+	enum { speed_pantilt, speed_zoom, preset } kind;
+	int a, b;
+};
+
+struct head_s
+{
+	double pan = 0.0, tilt = 0.0, zoom = 0.0;
+	int pan_speed = 0, tilt_speed = 0, zoom_speed = 0;
+	uint64_t ns = 0;
+	double presets[128][3] = {};
+
+	void advance(uint64_t to)
+	{
+		if (to <= ns)
+			return;
+		const double dt = (to - ns) * 1e-9;
+		pan = std::clamp(pan + pan_speed * cfg.pan_rate * dt, (double)-PAN_MAX, (double)PAN_MAX);
+		tilt = std::clamp(tilt + tilt_speed * cfg.tilt_rate * dt, (double)-TILT_MAX, (double)TILT_MAX);
+		zoom = std::clamp(zoom + zoom_speed * cfg.zoom_rate * dt, 0.0, (double)ZOOM_MAX);
+		ns = to;
+	}
+};
+
+struct stats_s
+{
+	uint64_t start_ns = 0;
+	int n_pantilt = 0, n_zoom = 0, n_preset = 0, n_inquiry = 0, n_other = 0;
+	int n_dropped = 0, n_buffer_full = 0;
+	uint64_t gap_ns_max = 0; // longest interval between two commands
+	uint64_t last_ns = 0;
+};
+
+static std::vector<client_s *> clients;
+static std::deque<reply_s> replies;       // sorted by `ns`
+static std::deque<motion_s> motions;      // sorted by `ns`
+static head_s head;
+static stats_s stats;
+
+static void schedule_reply(const reply_s &r)
+{
+	auto it = std::upper_bound(replies.begin(), replies.end(), r.ns,
+				   [](uint64_t ns, const reply_s &x) { return ns < x.ns; });
+	replies.insert(it, r);
+}
+
+static void schedule_motion(const motion_s &m)
+{
+	auto it = std::upper_bound(motions.begin(), motions.end(), m.ns,
+				   [](uint64_t ns, const motion_s &x) { return ns < x.ns; });
+	motions.insert(it, m);
+}
+
+static void apply_motions(uint64_t ns)
+{
+	while (!motions.empty() && motions.front().ns <= ns) {
+		const motion_s m = motions.front();
+		motions.pop_front();
+		head.advance(m.ns);
+		switch (m.kind) {
+		case motion_s::speed_pantilt:
+			head.pan_speed = m.a;
+			head.tilt_speed = m.b;
+			break;
+		case motion_s::speed_zoom:
+			head.zoom_speed = m.a;
+			break;
+		case motion_s::preset:
+			head.pan = head.presets[m.a][0];
+			head.tilt = head.presets[m.a][1];
+			head.zoom = head.presets[m.a][2];
+			head.pan_speed = head.tilt_speed = head.zoom_speed = 0;
+			break;
+		}
+	}
+	head.advance(ns);
+}
+
+static void put_nibbles(uint8_t *dst, int v, int n)
+{
+	for (int i = n - 1; i >= 0; i--, v >>= 4)
+		dst[i] = (uint8_t)(v & 0x0F);
+}
+
+static void send_reply(reply_s &r)
+{
+	if (r.inquiry_zoom) {
+		r.packet.data[0] = 0x90;
+		r.packet.data[1] = 0x50;
+		put_nibbles(r.packet.data + 2, (int)head.zoom, 4);
+		r.packet.data[6] = 0xFF;
+		r.packet.size = 7;
+	} else if (r.inquiry_pantilt) {
+		r.packet.data[0] = 0x90;
+		r.packet.data[1] = 0x50;
+		put_nibbles(r.packet.data + 2, (int)lround(head.pan), 4);
+		put_nibbles(r.packet.data + 6, (int)lround(head.tilt), 4);
+		r.packet.data[10] = 0xFF;
+		r.packet.size = 11;
+	}
+
+	if (r.release_socket)
+		*r.release_socket = 0;
+
+	if (r.peer.udp) {
+		uint8_t buf[VISCAIP_HEADER_SIZE + VISCA_PACKET_MAX];
+		viscaip_header(buf, r.type, r.packet.size, r.seq);
+		memcpy(buf + VISCAIP_HEADER_SIZE, r.packet.data, r.packet.size);
+		sendto(r.peer.fd, buf, VISCAIP_HEADER_SIZE + r.packet.size, 0, (sockaddr *)&r.peer.addr,
+		       r.peer.addrlen);
+	} else {
+		if (send(r.peer.fd, r.packet.data, r.packet.size, MSG_NOSIGNAL) < 0)
+			perror("send");
+	}
+}
+
+static void log_command(const peer_s &peer, uint32_t seq, const char *kind, const uint8_t *data, int size, uint64_t ns)
+{
+	if (!cfg.log)
+		return;
+	fprintf(cfg.log, "%.6f\t%s\t", ns * 1e-9, peer.udp ? "udp" : "tcp");
+	if (peer.udp)
+		fprintf(cfg.log, "%u", seq);
+	else
+		fprintf(cfg.log, "-");
+	fprintf(cfg.log, "\t%s\t", kind);
+	for (int i = 0; i < size; i++)
+		fprintf(cfg.log, "%02x", data[i]);
+	fprintf(cfg.log, "\n");
+}
+
+static int allocate_socket(int *busy)
+{
+	for (int i = 0; i < N_SOCKETS; i++) {
+		if (!busy[i]) {
+			busy[i] = 1;
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void handle_command(const peer_s &peer, int *busy, uint32_t seq, const uint8_t *p, int n, uint64_t ns)
+{
+	reply_s r;
+	memset(&r, 0, sizeof(r));
+	r.peer = peer;
+	r.seq = seq;
+	r.type = VISCAIP_TYPE_REPLY;
+
+	const char *kind = "unknown";
+	bool command = false;
+	if (n == 9 && p[1] == 0x01 && p[2] == 0x06 && p[3] == 0x01) {
+		kind = "pantilt";
+		command = true;
+		stats.n_pantilt++;
+		const int pan = p[6] == 0x01 ? -p[4] : p[6] == 0x02 ? p[4] : 0;
+		const int tilt = p[7] == 0x01 ? p[5] : p[7] == 0x02 ? -p[5] : 0;
+		schedule_motion({ns + cfg.motion_latency_ns, motion_s::speed_pantilt, pan, tilt});
+	} else if (n == 6 && p[1] == 0x01 && p[2] == 0x04 && p[3] == 0x07) {
+		kind = "zoom";
+		command = true;
+		stats.n_zoom++;
+		// Tele increases the zoom position.
+		const int z = p[4];
+		int zoom = 0;
+		if (z == 0x02)
+			zoom = 3;
+		else if (z == 0x03)
+			zoom = -3;
+		else if ((z & 0xF0) == 0x20)
+			zoom = (z & 7) + 1;
+		else if ((z & 0xF0) == 0x30)
+			zoom = -((z & 7) + 1);
+		schedule_motion({ns + cfg.motion_latency_ns, motion_s::speed_zoom, zoom, 0});
+	} else if (n == 7 && p[1] == 0x01 && p[2] == 0x04 && p[3] == 0x3F) {
+		kind = "preset";
+		command = true;
+		stats.n_preset++;
+		const int preset = p[5] & 0x7F;
+		if (p[4] == 0x01) {
+			head.presets[preset][0] = head.pan;
+			head.presets[preset][1] = head.tilt;
+			head.presets[preset][2] = head.zoom;
+		} else if (p[4] == 0x02) {
+			schedule_motion({ns + cfg.motion_latency_ns, motion_s::preset, preset, 0});
+		}
+	} else if (n == 5 && p[1] == 0x01 && p[2] == 0x00 && p[3] == 0x01) {
+		kind = "if_clear";
+		stats.n_other++;
+		r.ns = ns + cfg.ack_delay_ns;
+		visca_packet_set(r.packet, {0x90, 0x50, 0xFF});
+		schedule_reply(r);
+	} else if (n == 5 && p[1] == 0x09 && p[2] == 0x04 && p[3] == 0x47) {
+		kind = "inquiry_zoom";
+		stats.n_inquiry++;
+		r.ns = ns + cfg.ack_delay_ns;
+		r.inquiry_zoom = true;
+		schedule_reply(r);
+	} else if (n == 5 && p[1] == 0x09 && p[2] == 0x06 && p[3] == 0x12) {
+		kind = "inquiry_pantilt";
+		stats.n_inquiry++;
+		r.ns = ns + cfg.ack_delay_ns;
+		r.inquiry_pantilt = true;
+		schedule_reply(r);
+	} else {
+		stats.n_other++;
+		r.ns = ns + cfg.ack_delay_ns;
+		visca_packet_set(r.packet, {0x90, 0x60, 0x02, 0xFF}); // syntax error
+		schedule_reply(r);
+	}
+
+	log_command(peer, seq, kind, p, n, ns);
+
+	if (stats.last_ns && ns - stats.last_ns > stats.gap_ns_max)
+		stats.gap_ns_max = ns - stats.last_ns;
+	stats.last_ns = ns;
+
+	if (!command)
+		return;
+
+	const int s = allocate_socket(busy);
+	if (s < 0) {
+		stats.n_buffer_full++;
+		r.ns = ns + cfg.ack_delay_ns;
+		visca_packet_set(r.packet, {0x90, 0x60, 0x03, 0xFF});
+		schedule_reply(r);
+		return;
+	}
+	r.ns = ns + cfg.ack_delay_ns;
+	visca_packet_set(r.packet, {0x90, (uint8_t)(0x41 + s), 0xFF});
+	schedule_reply(r);
+	r.ns += cfg.completion_delay_ns;
+	r.release_socket = busy + s;
+	visca_packet_set(r.packet, {0x90, (uint8_t)(0x51 + s), 0xFF});
+	schedule_reply(r);
+}
+
+static void receive_tcp(client_s *c)
+{
+	int n;
+	uint8_t *buf = c->parser.prepare(n);
+	n = (int)recv(c->peer.fd, buf, n, 0);
+	if (n <= 0) {
+		fprintf(stderr, "visca-sim: TCP client closed\n");
+		// Drop the replies to the closed client.
+		replies.erase(std::remove_if(replies.begin(), replies.end(),
+					     [c](const reply_s &r) { return !r.peer.udp && r.peer.fd == c->peer.fd; }),
+			      replies.end());
+		close(c->peer.fd);
+		clients.erase(std::find(clients.begin(), clients.end(), c));
+		delete c;
+		return;
+	}
+	c->parser.commit(n);
+
+	const uint64_t ns = now_ns();
+	apply_motions(ns);
+	visca_reply_s r;
+	while (c->parser.next(r))
+		handle_command(c->peer, c->busy, 0, r.data, r.size, ns);
+}
+
+static void receive_udp(int fd)
+{
+	static int busy[N_SOCKETS];
+	uint8_t buf[256];
+	peer_s peer;
+	peer.fd = fd;
+	peer.udp = true;
+	peer.addrlen = sizeof(peer.addr);
+	int n = (int)recvfrom(fd, buf, sizeof(buf), 0, (sockaddr *)&peer.addr, &peer.addrlen);
+	if (n <= 0)
+		return;
+
+	const uint64_t ns = now_ns();
+	if (cfg.drop > 0.0 && rand() < cfg.drop * RAND_MAX) {
+		stats.n_dropped++;
+		return;
+	}
+
+	int type, size;
+	uint32_t seq;
+	if (!viscaip_parse_header(buf, n, type, size, seq))
+		return;
+	const uint8_t *payload = buf + VISCAIP_HEADER_SIZE;
+
+	if (type == VISCAIP_TYPE_CONTROL) {
+		log_command(peer, seq, "control", payload, size, ns);
+		reply_s r;
+		memset(&r, 0, sizeof(r));
+		r.ns = ns;
+		r.peer = peer;
+		r.seq = seq;
+		r.type = VISCAIP_TYPE_CONTROL_REPLY;
+		visca_packet_set(r.packet, {0x01});
+		memset(busy, 0, sizeof(busy));
+		schedule_reply(r);
+		return;
+	}
+
+	apply_motions(ns);
+	handle_command(peer, busy, seq, payload, size, ns);
+}
+
+static int listen_socket(int type, int port)
+{
+	int fd = socket(AF_INET, type, 0);
+	if (fd < 0)
+		return -1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((uint16_t)port);
+	if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || (type == SOCK_STREAM && listen(fd, 4) < 0)) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void print_stats(uint64_t ns)
+{
+	const double dt = (ns - stats.start_ns) * 1e-9;
+	if (dt <= 0.0)
+		return;
+	fprintf(stderr,
+		"visca-sim: %.1f s: pantilt %.1f/s zoom %.1f/s preset %d inquiry %.1f/s other %d, "
+		"dropped %d, buffer full %d, max gap %.1f ms, pan %.0f tilt %.0f zoom %.0f\n",
+		dt, stats.n_pantilt / dt, stats.n_zoom / dt, stats.n_preset, stats.n_inquiry / dt, stats.n_other,
+		stats.n_dropped, stats.n_buffer_full, stats.gap_ns_max * 1e-6, head.pan, head.tilt, head.zoom);
+	stats = stats_s();
+	stats.start_ns = ns;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -t port     TCP port, 0 to disable (default 1259)\n"
+		"  -u port     UDP port for VISCA over IP, 0 to disable (default 52381)\n"
+		"  -a ms       delay of the acknowledgement and the inquiry reply (default 2)\n"
+		"  -c ms       delay from the acknowledgement to the completion (default 1)\n"
+		"  -m ms       latency from the command to the motion (default 50)\n"
+		"  -d ratio    ratio of UDP datagrams to drop (default 0)\n"
+		"  -l file     record every command to the file, '-' for stdout\n",
+		name);
+}
+
+static void on_signal(int)
+{
+	quit = 1;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "t:u:a:c:m:d:l:h")) != -1) {
+		switch (opt) {
+		case 't':
+			cfg.tcp_port = atoi(optarg);
+			break;
+		case 'u':
+			cfg.udp_port = atoi(optarg);
+			break;
+		case 'a':
+			cfg.ack_delay_ns = (uint64_t)(atof(optarg) * 1e6);
+			break;
+		case 'c':
+			cfg.completion_delay_ns = (uint64_t)(atof(optarg) * 1e6);
+			break;
+		case 'm':
+			cfg.motion_latency_ns = (uint64_t)(atof(optarg) * 1e6);
+			break;
+		case 'd':
+			cfg.drop = atof(optarg);
+			break;
+		case 'l':
+			cfg.log = strcmp(optarg, "-") == 0 ? stdout : fopen(optarg, "w");
+			if (!cfg.log) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	const int tcp_fd = cfg.tcp_port > 0 ? listen_socket(SOCK_STREAM, cfg.tcp_port) : -1;
+	const int udp_fd = cfg.udp_port > 0 ? listen_socket(SOCK_DGRAM, cfg.udp_port) : -1;
+	if (tcp_fd < 0 && udp_fd < 0)
+		return 1;
+	fprintf(stderr, "visca-sim: listening on TCP %d, UDP %d\n", cfg.tcp_port, cfg.udp_port);
+
+	stats.start_ns = now_ns();
+	while (!quit) {
+		std::vector<pollfd> fds;
+		if (tcp_fd >= 0)
+			fds.push_back({tcp_fd, POLLIN, 0});
+		if (udp_fd >= 0)
+			fds.push_back({udp_fd, POLLIN, 0});
+		for (client_s *c : clients)
+			fds.push_back({c->peer.fd, POLLIN, 0});
+
+		uint64_t ns = now_ns();
+		int timeout_ms = 100;
+		if (!replies.empty())
+			timeout_ms = replies.front().ns > ns ? (int)((replies.front().ns - ns) / 1000000) : 0;
+		poll(fds.data(), fds.size(), timeout_ms);
+
+		for (const pollfd &p : fds) {
+			if (!(p.revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (p.fd == tcp_fd) {
+				int fd = accept(tcp_fd, NULL, NULL);
+				if (fd < 0)
+					continue;
+				int one = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				auto *c = new client_s();
+				c->peer.fd = fd;
+				c->peer.udp = false;
+				clients.push_back(c);
+				fprintf(stderr, "visca-sim: TCP client connected\n");
+			} else if (p.fd == udp_fd) {
+				receive_udp(udp_fd);
+			} else {
+				auto it = std::find_if(clients.begin(), clients.end(),
+						       [&p](client_s *c) { return c->peer.fd == p.fd; });
+				if (it != clients.end())
+					receive_tcp(*it);
+			}
+		}
+
+		ns = now_ns();
+		while (!replies.empty() && replies.front().ns <= ns) {
+			reply_s r = replies.front();
+			replies.pop_front();
+			apply_motions(r.ns);
+			send_reply(r);
+		}
+		apply_motions(ns);
+
+		if (ns - stats.start_ns > STATS_INTERVAL_NS)
+			print_stats(ns);
+	}
+
+	print_stats(now_ns());
+	if (cfg.log && cfg.log != stdout)
+		fclose(cfg.log);
+	return 0;
+}
@@ -0,0 +1,343 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "plugin-macros.generated.h"
+#include "visca-tcp-connection.hpp"
+
+#define debug(...) // blog(LOG_INFO, __VA_ARGS__)
+
+#define TH_FAIL 4
+#define ACK_TIMEOUT_NS 500000000
+#define MAX_OUTSTANDING 2
+#define RECONNECT_WAIT_MS 50
+#define BUSY_WAIT_MS 50 // while a camera is waiting for the reply, the timeout is checked at this interval
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<visca_tcp_connection *> registry;
+
+visca_tcp_connection::visca_tcp_connection(const char *host_, int port_)
+{
+	ref = 1;
+	users = 1;
+	host = bstrdup(host_);
+	port = port_;
+	waker = net_create_waker();
+	if (waker == NET_INVALID_SOCKET)
+		blog(LOG_ERROR, "visca_tcp_connection: failed to create a socket to wake up the thread");
+	stopping = false;
+	pthread_mutex_init(&mutex, 0);
+	next_camera = 0;
+	sock = NET_INVALID_SOCKET;
+
+	add_ref(); // release inside thread_main
+	pthread_t thread;
+	pthread_create(&thread, NULL, visca_tcp_connection::thread_main, (void *)this);
+	pthread_detach(thread);
+}
+
+visca_tcp_connection::~visca_tcp_connection()
+{
+	net_close(sock);
+	net_close(waker);
+	pthread_mutex_destroy(&mutex);
+	bfree(host);
+}
+
+void visca_tcp_connection::release()
+{
+	if (os_atomic_dec_long(&ref) == 0)
+		delete this;
+}
+
+visca_tcp_connection *visca_tcp_connection::acquire(const char *host, int port)
+{
+	pthread_mutex_lock(&registry_mutex);
+	visca_tcp_connection *ret = nullptr;
+	for (visca_tcp_connection *c : registry) {
+		if (c->is_endpoint(host, port)) {
+			ret = c;
+			ret->users++;
+			ret->add_ref();
+			break;
+		}
+	}
+	if (!ret) {
+		ret = new visca_tcp_connection(host, port);
+		registry.push_back(ret);
+	}
+	pthread_mutex_unlock(&registry_mutex);
+	return ret;
+}
+
+void visca_tcp_connection::release_user()
+{
+	pthread_mutex_lock(&registry_mutex);
+	if (--users == 0) {
+		registry.erase(std::find(registry.begin(), registry.end(), this));
+		os_atomic_set_bool(&stopping, true);
+		net_wake(waker);
+	}
+	pthread_mutex_unlock(&registry_mutex);
+	release();
+}
+
+bool visca_tcp_connection::is_endpoint(const char *host_, int port_) const
+{
+	return port == port_ && strcmp(host, host_) == 0;
+}
+
+void visca_tcp_connection::add_camera(visca_queue *queue)
+{
+	pthread_mutex_lock(&mutex);
+	if (find_camera(queue->address))
+		blog(LOG_WARNING, "VISCA camera address %d is used twice on %s:%d", queue->address, host, port);
+	camera_s cam;
+	cam.queue = queue;
+	reset_camera(cam);
+	cameras.push_back(cam);
+	queue->set_waker(waker);
+	pthread_mutex_unlock(&mutex);
+
+	net_wake(waker);
+}
+
+void visca_tcp_connection::remove_camera(visca_queue *queue)
+{
+	pthread_mutex_lock(&mutex);
+	for (auto it = cameras.begin(); it != cameras.end(); it++) {
+		if (it->queue == queue) {
+			cameras.erase(it);
+			break;
+		}
+	}
+	queue->set_waker(NET_INVALID_SOCKET);
+	pthread_mutex_unlock(&mutex);
+}
+
+void visca_tcp_connection::reset_camera(camera_s &cam)
+{
+	cam.cleared = false;
+	cam.n_outstanding = 0;
+	cam.waiting_ack = false;
+	cam.inquiry_sent = visca_cmd_none;
+	cam.sent_ns = 0;
+	cam.n_fail = 0;
+}
+
+visca_tcp_connection::camera_s *visca_tcp_connection::find_camera(int address)
+{
+	for (camera_s &cam : cameras) {
+		if (cam.queue->address == address)
+			return &cam;
+	}
+	return nullptr;
+}
+
+bool visca_tcp_connection::thread_connect()
+{
+	debug("visca_tcp_connection::thread_connect connecting to address=%s port=%d...", host, port);
+	net_socket_t sock_new = net_connect_tcp(host, port);
+	if (sock_new == NET_INVALID_SOCKET) {
+		blog(LOG_ERROR, "failed to connect %s:%d", host, port);
+		return false;
+	}
+	debug("visca_tcp_connection::thread_connect connected.");
+
+	net_close(sock);
+	sock = sock_new;
+	parser.reset();
+
+	// IF_Clear is sent to each camera before its first command.
+	pthread_mutex_lock(&mutex);
+	for (camera_s &cam : cameras)
+		reset_camera(cam);
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void *visca_tcp_connection::thread_main(void *data)
+{
+	auto *conn = (visca_tcp_connection *)data;
+
+	// add_ref() was called just before creating this thread.
+
+	os_set_thread_name("visca-tcp");
+	conn->thread_loop();
+
+	conn->release();
+
+	return NULL;
+}
+
+bool visca_tcp_connection::send_packet(camera_s &cam, const visca_packet_s &p)
+{
+	int ret = net_send(sock, p.data, p.size);
+	if (ret != p.size) {
+		// The packet is small enough to be written at once unless the connection is broken.
+		blog(LOG_ERROR, "visca_tcp_connection: failed to send a packet to %s:%d", host, port);
+		net_close(sock);
+		sock = NET_INVALID_SOCKET;
+		return false;
+	}
+
+	cam.sent_ns = os_gettime_ns();
+	cam.waiting_ack = true;
+	cam.n_outstanding++;
+	return true;
+}
+
+// Returns false if the connection is lost. Called with `mutex` locked.
+bool visca_tcp_connection::receive_replies()
+{
+	for (;;) {
+		int n;
+		uint8_t *buf = parser.prepare(n);
+		n = net_recv(sock, buf, n);
+		if (n < 0) {
+			blog(LOG_ERROR, "visca_tcp_connection: connection to %s:%d closed", host, port);
+			net_close(sock);
+			sock = NET_INVALID_SOCKET;
+			return false;
+		}
+		if (n == 0)
+			break;
+		parser.commit(n);
+	}
+
+	visca_reply_s r;
+	while (parser.next(r)) {
+		camera_s *cam = find_camera((r.data[0] >> 4) & 7);
+		if (!cam)
+			continue;
+
+		switch (r.type) {
+		case visca_reply_ack:
+			cam->waiting_ack = false;
+			cam->n_fail = 0;
+			break;
+		case visca_reply_completion:
+			cam->waiting_ack = false;
+			cam->n_fail = 0;
+			if (cam->n_outstanding > 0)
+				cam->n_outstanding--;
+			if (r.size > 3) {
+				// The measurement is assumed to be taken in the middle of the round trip.
+				const uint64_t ns = cam->sent_ns + (os_gettime_ns() - cam->sent_ns) / 2;
+				cam->queue->received_inquiry(cam->inquiry_sent, r, ns);
+				cam->inquiry_sent = visca_cmd_none;
+			}
+			break;
+		case visca_reply_error:
+			cam->waiting_ack = false;
+			cam->inquiry_sent = visca_cmd_none;
+			if (cam->n_outstanding > 0)
+				cam->n_outstanding--;
+			blog(LOG_INFO, "visca_tcp_connection: error %02x from the camera %d",
+			     r.size >= 3 ? r.data[2] : 0, cam->queue->address);
+			// Send the latest values again.
+			cam->n_fail++;
+			cam->queue->resend();
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+void visca_tcp_connection::thread_loop()
+{
+	while (!os_atomic_load_bool(&stopping)) {
+		if (sock == NET_INVALID_SOCKET && !thread_connect()) {
+			net_wait(NET_INVALID_SOCKET, waker, RECONNECT_WAIT_MS);
+			continue;
+		}
+
+		pthread_mutex_lock(&mutex);
+
+		if (!receive_replies()) {
+			pthread_mutex_unlock(&mutex);
+			continue;
+		}
+
+		uint64_t ns = os_gettime_ns();
+		bool all_failing = !cameras.empty();
+		for (camera_s &cam : cameras) {
+			if (cam.waiting_ack && ns - cam.sent_ns > ACK_TIMEOUT_NS) {
+				blog(LOG_INFO, "visca_tcp_connection: no reply from the camera %d", cam.queue->address);
+				cam.waiting_ack = false;
+				cam.inquiry_sent = visca_cmd_none;
+				cam.n_outstanding = 0;
+				cam.n_fail++;
+				cam.queue->resend();
+				if (cam.n_fail > TH_FAIL)
+					cam.cleared = false;
+			}
+			all_failing = all_failing && cam.n_fail > TH_FAIL;
+		}
+		if (all_failing) {
+			// None of the cameras is replying, the bridge might be stuck.
+			net_close(sock);
+			sock = NET_INVALID_SOCKET;
+			pthread_mutex_unlock(&mutex);
+			continue;
+		}
+
+		bool sent = false;
+		bool busy = false;
+		uint64_t next_ns = UINT64_MAX;
+		for (size_t k = 0; k < cameras.size() && !sent && sock != NET_INVALID_SOCKET; k++) {
+			const size_t i = (next_camera + k) % cameras.size();
+			camera_s &cam = cameras[i];
+			if (cam.waiting_ack || cam.n_outstanding >= MAX_OUTSTANDING) {
+				// The camera is not ready for the next command.
+				busy = true;
+				continue;
+			}
+
+			if (!cam.cleared) {
+				debug("visca_tcp_connection: sending IF_Clear to the camera %d...", cam.queue->address);
+				visca_packet_s p;
+				visca_if_clear(p, cam.queue->address);
+				sent = send_packet(cam, p);
+				cam.cleared = true;
+				cam.queue->resend();
+			} else {
+				visca_command_s cmd;
+				if (cam.queue->next(cmd, ns)) {
+					sent = send_packet(cam, cmd.packet);
+					if (sent) {
+						cam.queue->sent(cmd, cam.sent_ns);
+						if (cmd.type == visca_cmd_inquiry_pantilt ||
+						    cmd.type == visca_cmd_inquiry_zoom)
+							cam.inquiry_sent = cmd.type;
+					} else {
+						cam.queue->unsent(cmd);
+					}
+				} else {
+					next_ns = std::min(next_ns, cam.queue->next_inquiry_ns(ns));
+				}
+			}
+
+			if (sent)
+				next_camera = i + 1;
+		}
+
+		pthread_mutex_unlock(&mutex);
+
+		if (sent || sock == NET_INVALID_SOCKET)
+			continue;
+
+		// Wake up by a reply or by a request to any camera, whichever comes first.
+		if (busy) {
+			net_wait(sock, waker, BUSY_WAIT_MS);
+			continue;
+		}
+
+		const uint64_t wait_ns = std::min<uint64_t>(next_ns > ns ? next_ns - ns : 0, 50000000);
+		net_wait(sock, waker, (int)(wait_ns / 1000000 + 1));
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <util/threading.h>
+#include "net-socket.hpp"
+#include "visca-queue.hpp"
+
+/* TCP connection to a VISCA endpoint, shared by the cameras behind it.
+ * Cameras daisy-chained behind an IP-to-serial bridge are distinguished by the address of each `visca_queue`.
+ * One connection is made for each endpoint and `acquire` returns the existing one for the same endpoint.
+ *
+ * The thread takes the commands from the queues in round-robin order. Each camera waits for its own
+ * acknowledgement, so a camera not replying does not block the others. The replies are routed by the address in the
+ * header.
+ */
+class visca_tcp_connection {
+	volatile long ref;
+	int users; // protected by the registry mutex
+	char *host;
+	int port;
+	net_socket_t waker; // wakes up the thread waiting for `sock`
+	volatile bool stopping;
+
+	struct camera_s
+	{
+		visca_queue *queue;
+		bool cleared;                      // IF_Clear has been sent since the connection was made
+		int n_outstanding;                 // commands sent but not completed
+		bool waiting_ack;                  // the last command is not acknowledged yet
+		enum visca_command_e inquiry_sent; // inquiry waiting for the reply
+		uint64_t sent_ns;                  // time when the last command was sent
+		int n_fail;
+	};
+
+	pthread_mutex_t mutex; // protects `cameras`, held by the thread while accessing the queues
+	std::vector<camera_s> cameras;
+	size_t next_camera; // round-robin position, accessed only by the thread
+
+	// accessed only by the thread
+	net_socket_t sock;
+	visca_reply_parser parser;
+
+	visca_tcp_connection(const char *host, int port);
+	~visca_tcp_connection();
+	void add_ref() { os_atomic_inc_long(&ref); }
+	void release();
+
+	static void *thread_main(void *);
+	bool thread_connect();
+	void thread_loop();
+	bool send_packet(camera_s &cam, const visca_packet_s &p);
+	bool receive_replies();
+	camera_s *find_camera(int address);
+	void reset_camera(camera_s &cam);
+
+public:
+	static visca_tcp_connection *acquire(const char *host, int port);
+	void release_user();
+
+	bool is_endpoint(const char *host, int port) const;
+
+	// The queue should stay alive until `remove_camera` returns.
+	void add_camera(visca_queue *queue);
+	void remove_camera(visca_queue *queue);
+};
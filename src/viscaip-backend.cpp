@@ -0,0 +1,383 @@
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <algorithm>
+#include <cstring>
+#include "plugin-macros.generated.h"
+#include "viscaip-backend.hpp"
+
+#define debug(...) // blog(LOG_INFO, __VA_ARGS__)
+
+#define TH_FAIL 4
+#define CAMERA_ADDRESS 1
+#define MAX_UNACKED 2
+#define MAX_RETRY 3
+#define ACK_TIMEOUT_NS 100000000
+#define COMPLETION_TIMEOUT_NS 5000000000ULL
+
+static os_event_t *new_event()
+{
+	os_event_t *event;
+	os_event_init(&event, OS_EVENT_TYPE_AUTO);
+	return event;
+}
+
+static inline bool is_inquiry(enum visca_command_e cmd)
+{
+	return cmd == visca_cmd_inquiry_pantilt || cmd == visca_cmd_inquiry_zoom;
+}
+
+viscaip_backend::viscaip_backend() : event(new_event()), queue(event)
+{
+	debug("viscaip_backend::viscaip_backend");
+	data = NULL;
+	data_changed = false;
+	queue.address = CAMERA_ADDRESS;
+	sock = NET_INVALID_SOCKET;
+	memset(slots, 0, sizeof(slots));
+	seq_next = 0;
+	resetting = false;
+	reset_ns = 0;
+	reset_retry = 0;
+	n_fail = 0;
+	pthread_mutex_init(&mutex, 0);
+
+	add_ref(); // release inside thread_main
+	pthread_t thread;
+	pthread_create(&thread, NULL, viscaip_backend::thread_main, (void *)this);
+	pthread_detach(thread);
+}
+
+viscaip_backend::~viscaip_backend()
+{
+	net_close(sock);
+	if (data)
+		obs_data_release(data);
+	os_event_destroy(event);
+	pthread_mutex_destroy(&mutex);
+}
+
+void viscaip_backend::thread_connect()
+{
+	pthread_mutex_lock(&mutex);
+	char *address = bstrdup(obs_data_get_string(data, "address"));
+	int port = (int)obs_data_get_int(data, "port");
+	os_atomic_set_bool(&data_changed, false);
+	pthread_mutex_unlock(&mutex);
+
+	debug("viscaip_backend::thread_connect address=%s port=%d", address, port);
+	net_socket_t sock_new = net_connect_udp(address, port);
+	if (sock_new == NET_INVALID_SOCKET) {
+		blog(LOG_ERROR, "failed to resolve %s:%d", address, port);
+		os_atomic_set_bool(&data_changed, true); // retry
+		bfree(address);
+		return;
+	}
+	bfree(address);
+
+	net_close(sock);
+	sock = sock_new;
+	send_reset();
+}
+
+void *viscaip_backend::thread_main(void *data)
+{
+	auto *visca = (viscaip_backend *)data;
+
+	// add_ref() was called just before creating this thread.
+
+	os_set_thread_name("viscaip");
+	visca->thread_loop();
+
+	visca->release();
+
+	return NULL;
+}
+
+void viscaip_backend::send_reset()
+{
+	// Messages sent before the reset will not be replied with the new sequence numbers.
+	memset(slots, 0, sizeof(slots));
+	queue.resend();
+
+	uint8_t buf[VISCAIP_HEADER_SIZE + 1];
+	viscaip_header(buf, VISCAIP_TYPE_CONTROL, 1, 0);
+	buf[VISCAIP_HEADER_SIZE] = 0x01;
+	debug("viscaip_backend::send_reset");
+	if (net_send(sock, buf, sizeof(buf)) != (int)sizeof(buf))
+		blog(LOG_ERROR, "viscaip_backend: failed to send RESET");
+	resetting = true;
+	reset_ns = os_gettime_ns();
+	reset_retry = 0;
+	seq_next = 1;
+}
+
+bool viscaip_backend::send_message(message_s &m)
+{
+	if (net_send(sock, m.data, m.size) != m.size) {
+		blog(LOG_ERROR, "viscaip_backend: failed to send a packet");
+		return false;
+	}
+	m.sent_ns = os_gettime_ns();
+	return true;
+}
+
+bool viscaip_backend::send_command(const visca_command_s &cmd)
+{
+	message_s *m = free_slot();
+	if (!m)
+		return false;
+
+	const int type = is_inquiry(cmd.type) ? VISCAIP_TYPE_INQUIRY : VISCAIP_TYPE_COMMAND;
+	m->cmd = cmd.type;
+	m->seq = seq_next++;
+	m->acked = false;
+	m->retry = 0;
+	viscaip_header(m->data, type, cmd.packet.size, m->seq);
+	memcpy(m->data + VISCAIP_HEADER_SIZE, cmd.packet.data, cmd.packet.size);
+	m->size = VISCAIP_HEADER_SIZE + cmd.packet.size;
+	if (!send_message(*m))
+		return false;
+	m->used = true;
+	return true;
+}
+
+void viscaip_backend::receive_replies()
+{
+	uint8_t buf[256];
+	for (;;) {
+		int n = net_recv(sock, buf, sizeof(buf));
+		if (n == 0)
+			break;
+		if (n < 0) {
+			// Such as ICMP port unreachable. The socket is still usable.
+			n_fail++;
+			break;
+		}
+
+		int type, size;
+		uint32_t seq;
+		if (!viscaip_parse_header(buf, n, type, size, seq))
+			continue;
+		const uint8_t *payload = buf + VISCAIP_HEADER_SIZE;
+
+		if (type == VISCAIP_TYPE_CONTROL_REPLY) {
+			if (size >= 2 && payload[0] == 0x0F) {
+				blog(LOG_INFO, "viscaip_backend: control error %02x from the camera", payload[1]);
+				send_reset();
+			} else if (resetting) {
+				debug("viscaip_backend: RESET acknowledged");
+				resetting = false;
+			}
+		} else if (type == VISCAIP_TYPE_REPLY) {
+			handle_reply(seq, payload, size);
+		}
+	}
+}
+
+void viscaip_backend::handle_reply(uint32_t seq, const uint8_t *payload, int size)
+{
+	message_s *m = NULL;
+	for (auto &s : slots) {
+		if (s.used && s.seq == seq)
+			m = &s;
+	}
+	if (!m)
+		return; // late reply to a message already dropped
+
+	visca_reply_s r;
+	parser.reset();
+	parser.feed(payload, size);
+	if (!parser.next(r))
+		return;
+
+	switch (r.type) {
+	case visca_reply_ack:
+		m->acked = true;
+		break;
+	case visca_reply_completion:
+		if (is_inquiry(m->cmd)) {
+			// The measurement is assumed to be taken in the middle of the round trip.
+			const uint64_t ns = m->sent_ns + (os_gettime_ns() - m->sent_ns) / 2;
+			queue.received_inquiry(m->cmd, r, ns);
+		}
+		m->used = false;
+		n_fail = 0;
+		break;
+	case visca_reply_error:
+		blog(LOG_INFO, "viscaip_backend: error %02x from the camera", r.size >= 3 ? r.data[2] : 0);
+		m->used = false;
+		n_fail++;
+		queue.resend();
+		break;
+	default:
+		break;
+	}
+}
+
+void viscaip_backend::check_timeout(uint64_t ns)
+{
+	if (resetting) {
+		if (ns - reset_ns <= ACK_TIMEOUT_NS)
+			return;
+		if (reset_retry < MAX_RETRY) {
+			const int retry = reset_retry + 1;
+			send_reset();
+			reset_retry = retry;
+		} else {
+			// Some cameras do not reply to RESET. Start sending the commands anyway.
+			blog(LOG_INFO, "viscaip_backend: no reply to RESET");
+			resetting = false;
+		}
+		return;
+	}
+
+	for (auto &m : slots) {
+		if (!m.used)
+			continue;
+		if (m.acked) {
+			if (ns - m.sent_ns > COMPLETION_TIMEOUT_NS)
+				m.used = false;
+			continue;
+		}
+		if (ns - m.sent_ns <= ACK_TIMEOUT_NS)
+			continue;
+
+		n_fail++;
+		if (m.cmd == visca_cmd_pantilt || m.cmd == visca_cmd_zoom) {
+			// The speed might have been changed since. Send the latest one with a new sequence number.
+			debug("viscaip_backend: seq=%u lost, sending the latest speed", m.seq);
+			m.used = false;
+			queue.resend();
+		} else if (m.retry < MAX_RETRY) {
+			debug("viscaip_backend: seq=%u lost, retransmitting", m.seq);
+			m.retry++;
+			send_message(m);
+		} else {
+			blog(LOG_INFO, "viscaip_backend: no reply from the camera");
+			m.used = false;
+		}
+	}
+}
+
+int viscaip_backend::count_unacked() const
+{
+	int n = 0;
+	for (auto &m : slots) {
+		if (m.used && !m.acked)
+			n++;
+	}
+	return n;
+}
+
+bool viscaip_backend::has_outstanding() const
+{
+	for (auto &m : slots) {
+		if (m.used)
+			return true;
+	}
+	return false;
+}
+
+viscaip_backend::message_s *viscaip_backend::free_slot()
+{
+	for (auto &m : slots) {
+		if (!m.used)
+			return &m;
+	}
+	return NULL;
+}
+
+void viscaip_backend::thread_loop()
+{
+	while (get_ref() > 1) {
+		if (os_atomic_load_bool(&data_changed) || n_fail > TH_FAIL) {
+			if (n_fail > TH_FAIL)
+				blog(LOG_INFO, "viscaip_backend: resetting after %d failures", n_fail);
+			thread_connect();
+			n_fail = 0;
+		}
+		if (sock == NET_INVALID_SOCKET) {
+			os_event_timedwait(event, 50);
+			continue;
+		}
+
+		receive_replies();
+
+		uint64_t ns = os_gettime_ns();
+		check_timeout(ns);
+
+		if (resetting || count_unacked() >= MAX_UNACKED || !free_slot()) {
+			net_wait_readable(sock, 10);
+			continue;
+		}
+
+		visca_command_s cmd;
+		if (queue.next(cmd, ns)) {
+			if (send_command(cmd)) {
+				queue.sent(cmd, os_gettime_ns());
+			} else {
+				queue.unsent(cmd);
+				n_fail++;
+			}
+			continue;
+		}
+
+		// Wake up shortly to receive the replies while any message is outstanding.
+		const uint64_t next_ns = queue.next_inquiry_ns(ns);
+		const uint64_t wait_max = has_outstanding() ? 2000000 : 50000000;
+		const uint64_t wait_ns = std::min<uint64_t>(next_ns > ns ? next_ns - ns : 0, wait_max);
+		os_event_timedwait(event, (unsigned long)(wait_ns / 1000000 + 1));
+	}
+}
+
+void viscaip_backend::set_config(struct obs_data *data_)
+{
+	pthread_mutex_lock(&mutex);
+
+	obs_data_addref(data_);
+	if (data) {
+		obs_data_release(data);
+		const char *address_old = obs_data_get_string(data, "address");
+		int port_old = (int)obs_data_get_int(data, "port");
+		const char *address_new = obs_data_get_string(data_, "address");
+		int port_new = (int)obs_data_get_int(data_, "port");
+		if (strcmp(address_old, address_new))
+			os_atomic_set_bool(&data_changed, true);
+		if (port_old != port_new)
+			os_atomic_set_bool(&data_changed, true);
+	} else
+		os_atomic_set_bool(&data_changed, true);
+	data = data_;
+
+	queue.set_query_rate((float)obs_data_get_double(data, "query_rate"));
+
+	pthread_mutex_unlock(&mutex);
+}
+
+float viscaip_backend::get_zoom()
+{
+	struct ptz_position_s pos;
+	queue.get_position(pos);
+	return pos.zoom;
+}
+
+bool viscaip_backend::get_position(struct ptz_position_s &pos)
+{
+	queue.get_position(pos);
+	return true;
+}
+
+bool viscaip_backend::ptz_type_modified(obs_properties_t *pp, obs_data_t *settings)
+{
+	(void)settings;
+	if (obs_properties_get(pp, "ptz.visca-over-ip.address"))
+		return false;
+
+	obs_properties_add_text(pp, "ptz.visca-over-ip.address", obs_module_text("IP address"), OBS_TEXT_DEFAULT);
+	obs_properties_add_int(pp, "ptz.visca-over-ip.port", obs_module_text("Port"), 1, 65535, 1);
+	obs_property_t *prop = obs_properties_add_float(pp, "ptz.visca-over-ip.query_rate",
+							obs_module_text("Position inquiry rate"), 0.0, 30.0, 1.0);
+	obs_property_float_set_suffix(prop, " Hz");
+	return true;
+}
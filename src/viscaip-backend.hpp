@@ -0,0 +1,83 @@
+#pragma once
+
+#include <util/threading.h>
+#include "ptz-backend.hpp"
+#include "net-socket.hpp"
+#include "visca-queue.hpp"
+
+#define VISCAIP_SLOTS 4
+
+/* VISCA over IP (UDP)
+ * Each message has a sequence number so that the replies are matched to the messages.
+ * Up to 2 messages are sent without waiting for the acknowledgement.
+ * A lost speed command is not retransmitted; the latest speed is sent with a new sequence number instead.
+ */
+class viscaip_backend : public ptz_backend {
+	pthread_mutex_t mutex;
+	os_event_t *event;
+	struct obs_data *data;
+	volatile bool data_changed;
+	visca_queue queue;
+
+	struct message_s
+	{
+		bool used;
+		bool acked;
+		enum visca_command_e cmd;
+		uint32_t seq;
+		uint8_t data[VISCAIP_HEADER_SIZE + VISCA_PACKET_MAX];
+		int size;
+		uint64_t sent_ns; // time of the last transmission
+		int retry;
+	};
+
+	// connection, accessed only by the thread
+	net_socket_t sock;
+	visca_reply_parser parser;
+	struct message_s slots[VISCAIP_SLOTS];
+	uint32_t seq_next;
+	bool resetting; // waiting for the reply to RESET
+	uint64_t reset_ns;
+	int reset_retry;
+	int n_fail;
+
+	static void *thread_main(void *);
+	void thread_connect();
+	void thread_loop();
+	void send_reset();
+	bool send_message(message_s &m);
+	bool send_command(const visca_command_s &cmd);
+	void receive_replies();
+	void handle_reply(uint32_t seq, const uint8_t *payload, int size);
+	void check_timeout(uint64_t ns);
+	int count_unacked() const;
+	bool has_outstanding() const;
+	message_s *free_slot();
+
+public:
+	viscaip_backend();
+	~viscaip_backend() override;
+
+	void set_config(struct obs_data *data) override; // and attempt to connect
+
+	void set_pantilt_speed(int pan, int tilt) override { queue.set_pantilt_speed(pan, tilt); }
+	void set_zoom_speed(int zoom) override { queue.set_zoom_speed(zoom); }
+	void set_ptz_state(const struct ptz_state_s &st) override { queue.set_speed(st.pan, st.tilt, st.zoom); }
+	void recall_preset(int preset) override { queue.recall_preset(preset); }
+	float get_zoom() override;
+	bool get_position(struct ptz_position_s &pos) override;
+	bool get_pantilt_sent(int &pan, int &tilt, uint64_t &ns) override
+	{
+		return queue.get_pantilt_sent(pan, tilt, ns);
+	}
+
+	inline static bool check_data(obs_data_t *data)
+	{
+		if (!obs_data_get_string(data, "address"))
+			return false;
+		if (obs_data_get_int(data, "port") <= 0)
+			return false;
+		return true;
+	}
+	static bool ptz_type_modified(obs_properties_t *group_output, obs_data_t *settings);
+};
@@ -0,0 +1,190 @@
+/* Measures how the crowd mode scales from 1 to 100 synthetic faces.
+ *
+ * Usage: bench-crowd
+ *
+ * For each number of faces, the faces are placed on a 1920x1080 frame and moved by a few pixels in each frame.
+ * - KCF: time to update all faces with one `kcf_core` in one thread, and with the updates limited to 8 faces in
+ *   each frame as `Faces to track in each frame` does.
+ * - Overlap: time of the overlap queries made by `attenuate_tracker` and `remove_duplicated_tracker` after each
+ *   detection, with `spatial_grid` and with the pairwise loops they replaced.
+ */
+
+#include <obs-module.h>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "helper.hpp"
+#include "spatial-grid.hpp"
+#include "kcf-core.hpp"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define N_FRAMES 30
+#define MAX_UPDATES 8
+#define N_QUERY_REPEAT 200
+
+static uint32_t rnd_state = 1;
+
+static inline float rnd()
+{
+	rnd_state = rnd_state * 1664525u + 1013904223u;
+	return (rnd_state >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline double elapsed_ms(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Places `n` faces on a jittered grid.
+static void place_faces(std::vector<rect_s> &faces, int n)
+{
+	const int cols = (int)ceilf(sqrtf(n * (float)WIDTH / HEIGHT));
+	const int rows = (n + cols - 1) / cols;
+	const int cw = WIDTH / cols, ch = HEIGHT / rows;
+	const int size = std::min(std::min(cw, ch) * 2 / 3, 160);
+	faces.clear();
+	for (int i = 0; i < n; i++) {
+		const int x = (i % cols) * cw + (cw - size) / 2 + (int)((rnd() - 0.5f) * (cw - size) * 0.5f);
+		const int y = (i / cols) * ch + (ch - size) / 2 + (int)((rnd() - 0.5f) * (ch - size) * 0.5f);
+		faces.push_back(rect_s{x, y, x + size, y + size, 1.0f});
+	}
+}
+
+static void render(std::vector<uint8_t> &img, const std::vector<rect_s> &faces, int dx, int dy)
+{
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++)
+			img[y * WIDTH + x] = (uint8_t)(100 + 30 * sinf(x * 0.02f) * cosf(y * 0.03f) + rnd() * 10);
+	}
+	for (const rect_s &f : faces) {
+		const int w = f.x1 - f.x0;
+		for (int y = std::max(f.y0 + dy, 0); y < std::min(f.y1 + dy, HEIGHT); y++) {
+			for (int x = std::max(f.x0 + dx, 0); x < std::min(f.x1 + dx, WIDTH); x++) {
+				const float u = (float)(x - f.x0 - dx) / w - 0.5f, v = (float)(y - f.y0 - dy) / w - 0.5f;
+				if (u * u + v * v > 0.25f)
+					continue;
+				const bool eye = std::abs(std::abs(u) - 0.18f) < 0.06f && std::abs(v + 0.12f) < 0.05f;
+				img[y * WIDTH + x] = (uint8_t)(eye ? 60 : 180 + 40 * v);
+			}
+		}
+	}
+}
+
+static double bench_kcf(const std::vector<rect_s> &faces, int max_updates)
+{
+	std::vector<uint8_t> img(WIDTH * HEIGHT);
+	render(img, faces, 0, 0);
+	const kcf_image_s kimg = {img.data(), WIDTH, HEIGHT, WIDTH};
+
+	kcf_core core(kcf_feature_gray);
+	std::vector<kcf_model_s *> models(faces.size());
+	std::vector<kcf_box_s> boxes(faces.size());
+	for (size_t i = 0; i < faces.size(); i++) {
+		models[i] = new kcf_model_s;
+		core.init(*models[i], boxes[i], kimg, faces[i].x0, faces[i].y0, faces[i].x1, faces[i].y1);
+	}
+
+	double ms = 0.0;
+	size_t next = 0;
+	for (int k = 1; k <= N_FRAMES; k++) {
+		render(img, faces, k * 2, k);
+		const auto t0 = std::chrono::steady_clock::now();
+		// The faces not updated for the longest time come first, which is round robin here.
+		const size_t n = std::min(faces.size(), (size_t)max_updates);
+		for (size_t j = 0; j < n; j++) {
+			const size_t i = (next + j) % faces.size();
+			core.update(*models[i], boxes[i], kimg);
+		}
+		next = (next + n) % faces.size();
+		ms += elapsed_ms(t0);
+	}
+
+	for (kcf_model_s *m : models)
+		delete m;
+	return ms / N_FRAMES;
+}
+
+static inline int rect_size_max(const rect_s &r)
+{
+	return std::max(r.x1 - r.x0, r.y1 - r.y0);
+}
+
+// Same queries as `attenuate_tracker` and `remove_duplicated_tracker`; returns a checksum.
+static long overlap_grid(spatial_grid &grid, const std::vector<rect_s> &trackers, const std::vector<rect_s> &dets)
+{
+	long sum = 0;
+	int size_max = 1;
+	for (const rect_s &r : dets)
+		size_max = std::max(size_max, rect_size_max(r));
+	for (const rect_s &r : trackers)
+		size_max = std::max(size_max, rect_size_max(r));
+
+	grid.reset(size_max);
+	for (size_t j = 0; j < dets.size(); j++)
+		grid.insert((int)j, dets[j]);
+	for (const rect_s &t : trackers)
+		grid.query(t, [&](int j) { sum += common_area(dets[j], t); });
+
+	grid.reset(size_max);
+	for (size_t i = 0; i < trackers.size(); i++)
+		grid.insert((int)i, trackers[i]);
+	for (size_t i = 0; i < trackers.size(); i++) {
+		grid.query(trackers[i], [&](int j) {
+			if ((size_t)j > i)
+				sum += common_area(trackers[i], trackers[j]);
+		});
+	}
+	return sum;
+}
+
+static long overlap_pairwise(const std::vector<rect_s> &trackers, const std::vector<rect_s> &dets)
+{
+	long sum = 0;
+	for (const rect_s &t : trackers) {
+		for (const rect_s &d : dets)
+			sum += common_area(d, t);
+	}
+	for (size_t i = 0; i < trackers.size(); i++) {
+		for (size_t j = i + 1; j < trackers.size(); j++)
+			sum += common_area(trackers[i], trackers[j]);
+	}
+	return sum;
+}
+
+int main()
+{
+	static const int counts[] = {1, 2, 5, 10, 20, 50, 100};
+
+	printf("%6s %14s %14s %14s %14s\n", "faces", "KCF all ms", "KCF 8 ms", "grid us", "pairwise us");
+	std::vector<rect_s> faces, dets;
+	spatial_grid grid;
+	for (int n : counts) {
+		place_faces(faces, n);
+		dets = faces;
+		for (rect_s &d : dets) {
+			d.x0 += 3;
+			d.x1 += 3;
+		}
+
+		const double kcf_all = bench_kcf(faces, n);
+		const double kcf_capped = bench_kcf(faces, MAX_UPDATES);
+
+		long check_grid = 0, check_pairwise = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (int k = 0; k < N_QUERY_REPEAT; k++)
+			check_grid += overlap_grid(grid, faces, dets);
+		const double us_grid = elapsed_ms(t0) * 1e3 / N_QUERY_REPEAT;
+		t0 = std::chrono::steady_clock::now();
+		for (int k = 0; k < N_QUERY_REPEAT; k++)
+			check_pairwise += overlap_pairwise(faces, dets);
+		const double us_pairwise = elapsed_ms(t0) * 1e3 / N_QUERY_REPEAT;
+		if (check_grid != check_pairwise)
+			fprintf(stderr, "Error: the grid missed an overlap with %d faces\n", n);
+
+		printf("%6d %14.2f %14.2f %14.2f %14.2f\n", n, kcf_all, kcf_capped, us_grid, us_pairwise);
+	}
+	return 0;
+}
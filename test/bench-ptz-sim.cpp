@@ -0,0 +1,239 @@
+/* Measures the step and sine responses of the PTZ control on `ptz_sim` without OBS.
+ *
+ * Usage: bench-ptz-sim
+ *
+ * The loop of `Face Tracker PTZ` with `PTZ Type` set to `Simulator` is closed in a simulated time at 30 frames per
+ * second. The face is at the center of the scene and `Scene motion` of the simulator moves the scene; the error is
+ * taken from the view of the simulator a few frames earlier, as the face is located on a past frame.
+ * The settling time into 5% of the step, the overshoot, and the RMS error of the sine are those logged by the
+ * simulator source.
+ *
+ * - PID: `tick_filter` for pan with the default settings and the built-in speed table.
+ * - MPC: `ptz_mpc` with the built-in speed table, given the codes actually sent as `record_mpc_sent` does.
+ *
+ * Each controller runs with the latencies of the camera of 0, 100, and 300 ms. The last case limits the commands
+ * to 5 per second in the backend, which holds the latest request as `obsptz_backend` does.
+ * Each case runs with the built-in speed table and with the table that `Calibrate speed` would measure on the
+ * simulator, whose speed is linear to the speed code unlike the built-in table.
+ */
+
+#include <obs-module.h>
+#include <util/base.h>
+#include <util/platform.h>
+#include <cstdio>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "helper.hpp"
+#include "ptz-sim.hpp"
+#include "ptz-mpc.hpp"
+#include "ptz-speed-table.hpp"
+
+#define FPS 30
+#define WIDTH 1280
+#define HEIGHT 720
+#define FOV 0.5 // ratio of the scene width at the wide end, default of the simulator source
+#define MEASURE_DELAY 2 // frames between the capture and the error given to the control
+#define N_PERIODS 8
+
+// default settings of `Face Tracker PTZ`
+#define KP_DB 50.0f
+#define KI 0.3f
+#define TD 0.42f
+#define TDLPF 2.0f
+#define GAIN_FPS 30.0f // PTZ_GAIN_FPS
+
+enum controller_e {
+	controller_pid,
+	controller_mpc,
+};
+
+static const char *controller_names[] = {"PID", "MPC"};
+
+enum table_e {
+	table_builtin,
+	table_calibrated,
+};
+
+static const char *table_names[] = {"built-in", "calibrated"};
+
+struct scenario_s
+{
+	int latency_ms;
+	float backend_rate; // commands per second, 0 for unlimited
+};
+
+struct result_s
+{
+	int n_steps = 0, n_settled = 0;
+	double settle_sum = 0.0, settle_max = 0.0;
+	double overshoot_sum = 0.0, overshoot_max = 0.0;
+	double step_rate_sum = 0.0;
+	int n_sine = 0;
+	double rms_sum = 0.0, sine_rate_sum = 0.0;
+};
+
+// Same as `tick_filter` for one axis while the face is found; the dead band and the nonlinear band are 0.
+class pid_axis {
+	float filter_int = 0.0f, filter_lpf = 0.0f;
+	bool found_last = false;
+
+public:
+	int control(float e, float second, float srwh, float zoom, const ptz_speed_table &table)
+	{
+		float e_int = e;
+		if (filter_int < 0.0f && e > 0.0f)
+			e_int = std::min(e, -filter_int / (second * KI));
+		else if (filter_int > 0.0f && e < 0.0f)
+			e_int = std::max(e, -filter_int / (second * KI));
+
+		const float lpf_prev = filter_lpf;
+		filter_int += e_int * KI * second;
+		filter_lpf = (filter_lpf * TDLPF + e * second) / (TDLPF + second);
+		float uf = 0.0f;
+		if (found_last)
+			uf = (e + filter_int) * second + (filter_lpf - lpf_prev) * TD;
+		found_last = true;
+
+		const float kp = (float)from_dB(KP_DB) / srwh / std::max(zoom, 1.0f);
+		return table.lookup(uf * kp / (second * GAIN_FPS));
+	}
+};
+
+static void log_quiet(int, const char *, va_list, void *) {}
+
+static void run(result_s &res, enum controller_e controller, enum table_e table_type, int script,
+		const scenario_s &sc)
+{
+	ptz_sim *sim = new ptz_sim("bench");
+	uint64_t now = os_gettime_ns(); // the simulator starts its clock at the construction
+
+	ptz_sim::config_s cfg = {};
+	cfg.latency_ns = (uint64_t)sc.latency_ms * 1000000;
+	cfg.pantilt_rate = 0.01f;
+	cfg.zoom_rate = 0.1f;
+	cfg.zoom_max = 10.0f;
+	cfg.pan_speed_max = 0x18;
+	cfg.tilt_speed_max = 0x14;
+	cfg.zoom_speed_max = 0x07;
+	cfg.script = script;
+	cfg.script_amplitude = 0.1f;
+	cfg.script_period = 4.0f;
+	sim->set_config(cfg);
+
+	ptz_speed_table table;
+	if (table_type == table_builtin) {
+		table.set(pan_thresholds_default, sizeof(pan_thresholds_default) / sizeof(float));
+	} else {
+		// The view moves by `pantilt_rate / FOV` of its width per second for each speed code.
+		std::vector<float> v;
+		for (int c = 1; c <= cfg.pan_speed_max; c++)
+			v.push_back(c * cfg.pantilt_rate / FOV * WIDTH / sqrtf((float)WIDTH * HEIGHT) * PTZ_SPEED_UNIT);
+		table.set_velocities(v);
+	}
+	pid_axis pid;
+	ptz_mpc mpc("bench");
+
+	const float second = 1.0f / FPS;
+	const float srwh = sqrtf((float)WIDTH * HEIGHT);
+	std::deque<float> errors;
+	int sent = 0, n_periods = 0;
+	uint64_t sent_ns = 0;
+	const int n_ticks = (int)(N_PERIODS * cfg.script_period * FPS) + FPS / 2;
+	for (int k = 0; k < n_ticks; k++) {
+		now += 1000000000 / FPS;
+		sim->advance(now);
+
+		// The face at the scene center seen in the view, in pixels.
+		double x, y, zoom;
+		sim->get_view(x, y, zoom);
+		errors.push_back((float)(-x / (FOV / zoom) * WIDTH));
+		if (errors.size() <= MEASURE_DELAY)
+			continue;
+		const float e = errors.front();
+		errors.pop_front();
+
+		const uint64_t send_ns = sc.backend_rate > 0.0f ? sent_ns + (uint64_t)(1e9f / sc.backend_rate) : 0;
+		int code = 0;
+		switch (controller) {
+		case controller_pid:
+			code = pid.control(e, second, srwh, (float)zoom, table);
+			break;
+		case controller_mpc:
+			code = mpc.control(now, e / srwh, true, (float)zoom, 0.0f, table, send_ns);
+			break;
+		}
+
+		// Only the changed speed is sent as `sim_backend` does, and no faster than the backend rate.
+		if (code != sent && now >= send_ns) {
+			sim->set_pantilt_speed(code, 0, now);
+			sent = code;
+			sent_ns = now;
+		}
+		if (controller == controller_mpc)
+			mpc.sent(sent_ns, sent, table);
+
+		ptz_sim::report_s r;
+		sim->get_report(r);
+		if (r.n_periods == n_periods)
+			continue;
+		n_periods = r.n_periods;
+		if (r.script == 1 && r.step != 0.0) {
+			res.n_steps++;
+			if (r.settled) {
+				res.n_settled++;
+				res.settle_sum += r.settle_s;
+				res.settle_max = std::max(res.settle_max, r.settle_s);
+			}
+			res.overshoot_sum += r.overshoot;
+			res.overshoot_max = std::max(res.overshoot_max, r.overshoot);
+			res.step_rate_sum += r.command_rate;
+		} else if (r.script == 2 && n_periods > 1) {
+			// The first period includes the start from the rest.
+			res.n_sine++;
+			res.rms_sum += r.rms_error / cfg.script_amplitude;
+			res.sine_rate_sum += r.command_rate;
+		}
+	}
+
+	sim->release();
+}
+
+int main()
+{
+	static const scenario_s scenarios[] = {{0, 0.0f}, {100, 0.0f}, {300, 0.0f}, {100, 5.0f}};
+	static const enum controller_e controllers[] = {controller_pid, controller_mpc};
+	static const enum table_e tables[] = {table_builtin, table_calibrated};
+
+	base_set_log_handler(log_quiet, NULL);
+
+	printf("step %.0f%% of the scene width every 4 s, sine %.0f%% in 4 s; view %.0f%% of the scene, %d fps\n",
+	       10.0, 10.0, FOV * 100.0, FPS);
+	printf("%-6s %-10s %8s %8s %8s %10s %10s %10s %10s %8s %10s %8s\n", "", "table", "latency", "backend",
+	       "settled", "settle avg", "settle max", "overshoot", "overs max", "cmd/s", "sine RMS", "cmd/s");
+	for (enum controller_e c : controllers) {
+		for (enum table_e t : tables) {
+			for (const scenario_s &sc : scenarios) {
+				result_s res;
+				run(res, c, t, 1, sc);
+				run(res, c, t, 2, sc);
+				char settled[16], backend[16];
+				snprintf(settled, sizeof(settled), "%d/%d", res.n_settled, res.n_steps);
+				if (sc.backend_rate > 0.0f)
+					snprintf(backend, sizeof(backend), "%.0f/s", sc.backend_rate);
+				else
+					snprintf(backend, sizeof(backend), "-");
+				printf("%-6s %-10s %6d ms %8s %8s %8.2f s %8.2f s %9.1f%% %9.1f%% %8.1f "
+				       "%9.1f%% %8.1f\n",
+				       controller_names[c], table_names[t], sc.latency_ms, backend, settled,
+				       res.n_settled ? res.settle_sum / res.n_settled : NAN, res.settle_max,
+				       res.overshoot_sum / std::max(res.n_steps, 1) * 100.0, res.overshoot_max * 100.0,
+				       res.step_rate_sum / std::max(res.n_steps, 1),
+				       res.rms_sum / std::max(res.n_sine, 1) * 100.0,
+				       res.sine_rate_sum / std::max(res.n_sine, 1));
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,226 @@
+/* Compares the per-update cost and the drift of the KCF tracker and the correlation tracker of dlib.
+ *
+ * Usage: bench-tracker [clip.tsv]
+ *
+ * Without an argument, a synthetic clip is generated; a textured face moves over a textured background with noise.
+ * A recorded clip is given as a TSV file whose lines are `frame.pgm cx cy w h`, the binary PGM frame and the ground
+ * truth of the face in its pixels. The trackers start from the ground truth of the first frame.
+ *
+ * The drift is the distance between the centers of the tracked box and the ground truth.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "kcf-core.hpp"
+
+#include <dlib/image_processing/correlation_tracker.h>
+
+struct frame_s
+{
+	dlib::matrix<unsigned char> img;
+	float cx, cy, w, h; // ground truth
+};
+
+struct result_s
+{
+	const char *name;
+	double ms_sum = 0.0, ms_max = 0.0;
+	double err_sum = 0.0, err_max = 0.0, err_last = 0.0;
+	int n = 0;
+	int n_lost = 0; // frames whose drift exceeds half of the face width
+};
+
+static uint32_t rnd_state = 1;
+
+static inline float rnd()
+{
+	rnd_state = rnd_state * 1664525u + 1013904223u;
+	return (rnd_state >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline unsigned char clip_u8(float v)
+{
+	return (unsigned char)std::clamp(v, 0.0f, 255.0f);
+}
+
+static inline float sq_dist(float u, float v, float u0, float v0)
+{
+	return (u - u0) * (u - u0) + (v - v0) * (v - v0);
+}
+
+static void make_synthetic(std::vector<frame_s> &frames)
+{
+	const int width = 640, height = 360, n_frames = 600;
+	const float w = 80.0f, h = 96.0f;
+
+	dlib::matrix<unsigned char> bg(height, width);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++)
+			bg(y, x) = clip_u8(110.0f + 40.0f * sinf(x * 0.031f) * cosf(y * 0.047f) +
+					   25.0f * sinf((x + y) * 0.013f) + 20.0f * rnd());
+	}
+
+	// face texture, brighter skin with darker eyes and mouth
+	dlib::matrix<float> face((long)h, (long)w);
+	for (int y = 0; y < (int)h; y++) {
+		for (int x = 0; x < (int)w; x++) {
+			const float u = x / w - 0.5f, v = y / h - 0.5f;
+			float f = 180.0f + 30.0f * v + 10.0f * rnd();
+			if (sq_dist(u, v, -0.18f, -0.12f) < 0.004f || sq_dist(u, v, 0.18f, -0.12f) < 0.004f)
+				f = 60.0f;
+			if (std::abs(u) < 0.15f && std::abs(v - 0.22f) < 0.03f)
+				f = 90.0f;
+			face(y, x) = f;
+		}
+	}
+
+	frames.resize(n_frames);
+	for (int i = 0; i < n_frames; i++) {
+		frame_s &fr = frames[i];
+		fr.cx = width * 0.5f + 180.0f * sinf(i * 2.0f * (float)M_PI / 240.0f);
+		fr.cy = height * 0.5f + 60.0f * sinf(i * 2.0f * (float)M_PI / 170.0f);
+		fr.w = w;
+		fr.h = h;
+		fr.img = bg;
+		const int x0 = (int)(fr.cx - w * 0.5f), y0 = (int)(fr.cy - h * 0.5f);
+		for (int y = 0; y < (int)h; y++) {
+			for (int x = 0; x < (int)w; x++) {
+				const float u = x / w - 0.5f, v = y / h - 0.5f;
+				if (u * u + v * v > 0.25f)
+					continue;
+				fr.img(y0 + y, x0 + x) = clip_u8(face(y, x));
+			}
+		}
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++)
+				fr.img(y, x) = clip_u8(fr.img(y, x) + (rnd() - 0.5f) * 16.0f);
+		}
+	}
+}
+
+static bool read_pgm(const char *path, dlib::matrix<unsigned char> &img)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	int width, height, maxval;
+	bool ok = fscanf(fp, "P5 %d %d %d", &width, &height, &maxval) == 3 && maxval == 255 && fgetc(fp) != EOF;
+	if (ok) {
+		img.set_size(height, width);
+		std::vector<unsigned char> line(width);
+		for (int y = 0; y < height && ok; y++) {
+			ok = fread(line.data(), 1, width, fp) == (size_t)width;
+			for (int x = 0; x < width && ok; x++)
+				img(y, x) = line[x];
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+static bool read_clip(const char *list, std::vector<frame_s> &frames)
+{
+	FILE *fp = fopen(list, "r");
+	if (!fp)
+		return false;
+	char path[1024];
+	frame_s fr;
+	bool ok = true;
+	while (ok && fscanf(fp, "%1023s %f %f %f %f", path, &fr.cx, &fr.cy, &fr.w, &fr.h) == 5) {
+		ok = read_pgm(path, fr.img);
+		if (!ok)
+			fprintf(stderr, "Error: cannot read '%s'\n", path);
+		frames.push_back(fr);
+	}
+	fclose(fp);
+	return ok && frames.size() > 1;
+}
+
+template<typename F> static void run(result_s &r, const std::vector<frame_s> &frames, F update)
+{
+	for (size_t i = 1; i < frames.size(); i++) {
+		const frame_s &fr = frames[i];
+		float cx, cy;
+		const auto t0 = std::chrono::steady_clock::now();
+		update(fr, cx, cy);
+		const auto t1 = std::chrono::steady_clock::now();
+		const double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+		const double err = std::hypot(cx - fr.cx, cy - fr.cy);
+		r.ms_sum += ms;
+		r.ms_max = std::max(r.ms_max, ms);
+		r.err_sum += err;
+		r.err_max = std::max(r.err_max, err);
+		r.err_last = err;
+		r.n++;
+		if (err > fr.w * 0.5f)
+			r.n_lost++;
+	}
+}
+
+static void run_kcf(result_s &r, const std::vector<frame_s> &frames, enum kcf_feature_e feature)
+{
+	kcf_core core(feature);
+	auto *m = new kcf_model_s;
+	kcf_box_s b;
+	auto to_kcf = [](const frame_s &fr) {
+		return kcf_image_s{&fr.img(0, 0), (int)fr.img.nc(), (int)fr.img.nr(), (int)fr.img.nc()};
+	};
+	const frame_s &f0 = frames[0];
+	core.init(*m, b, to_kcf(f0), f0.cx - f0.w * 0.5f, f0.cy - f0.h * 0.5f, f0.cx + f0.w * 0.5f,
+		  f0.cy + f0.h * 0.5f);
+	run(r, frames, [&](const frame_s &fr, float &cx, float &cy) {
+		core.update(*m, b, to_kcf(fr));
+		cx = b.cx;
+		cy = b.cy;
+	});
+	delete m;
+}
+
+static void run_dlib(result_s &r, const std::vector<frame_s> &frames)
+{
+	dlib::correlation_tracker tracker;
+	const frame_s &f0 = frames[0];
+	tracker.start_track(f0.img, dlib::drectangle(f0.cx - f0.w * 0.5f, f0.cy - f0.h * 0.5f, f0.cx + f0.w * 0.5f,
+						     f0.cy + f0.h * 0.5f));
+	run(r, frames, [&](const frame_s &fr, float &cx, float &cy) {
+		tracker.update(fr.img);
+		const dlib::drectangle p = tracker.get_position();
+		cx = (float)(p.left() + p.right()) * 0.5f;
+		cy = (float)(p.top() + p.bottom()) * 0.5f;
+	});
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<frame_s> frames;
+	if (argc > 1) {
+		if (!read_clip(argv[1], frames)) {
+			fprintf(stderr, "Error: cannot read the clip '%s'\n", argv[1]);
+			return 1;
+		}
+	} else {
+		make_synthetic(frames);
+	}
+
+	result_s results[] = {{"KCF, grayscale"}, {"KCF, HOG"}, {"Correlation tracker, dlib"}};
+	run_kcf(results[0], frames, kcf_feature_gray);
+	run_kcf(results[1], frames, kcf_feature_hog);
+	run_dlib(results[2], frames);
+
+	printf("%d frames %dx%d, face %.0fx%.0f\n", (int)frames.size(), (int)frames[0].img.nc(),
+	       (int)frames[0].img.nr(), frames[0].w, frames[0].h);
+	printf("%-26s %10s %10s %10s %10s %10s %8s\n", "tracker", "ms/update", "ms max", "drift avg", "drift max",
+	       "drift last", "lost");
+	for (const result_s &r : results) {
+		printf("%-26s %10.3f %10.3f %10.2f %10.2f %10.2f %7.1f%%\n", r.name, r.ms_sum / r.n, r.ms_max,
+		       r.err_sum / r.n, r.err_max, r.err_last, r.n_lost * 100.0 / r.n);
+	}
+	return 0;
+}
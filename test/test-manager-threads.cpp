@@ -0,0 +1,159 @@
+/* Stress test of `face_tracker_manager` with `post_render` and `tick` on two threads.
+ *
+ * The video thread renders synthetic faces moving on a grayscale frame and calls `post_render` as the PTZ filter
+ * does from its video callback. The tick thread calls `tick` and reads the results as the PTZ filter does from its
+ * tick callback. The detector is replaced by one that returns the true location of the faces so that the trackers
+ * are created and retired without any model file.
+ *
+ * Build with `-fsanitize=thread` to check the data races between the two threads, the detector thread, and the
+ * tracker threads. The test fails if no tracker becomes available or if a result is out of the frame.
+ */
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "plugin-macros.generated.h"
+#include "face-tracker-manager.hpp"
+#include "face-detector-base.h"
+#include "texture-object.h"
+
+OBS_DECLARE_MODULE()
+OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
+
+#define WIDTH 640
+#define HEIGHT 360
+#define N_FACES 6
+#define FACE_SIZE 64
+#define N_FRAMES 600
+
+static rect_s face_rect(int i, int tick)
+{
+	const float t = tick * 0.02f + i;
+	const int cx = (int)(WIDTH * (0.15f + 0.7f * (i + 0.5f) / N_FACES) + 20.0f * sinf(t));
+	const int cy = (int)(HEIGHT * 0.5f + 60.0f * cosf(t * 0.7f));
+	return rect_s{cx - FACE_SIZE / 2, cy - FACE_SIZE / 2, cx + FACE_SIZE / 2, cy + FACE_SIZE / 2, 1.0f};
+}
+
+// Returns the true location of the faces at the tick of the texture.
+class fake_detector : public face_detector_base {
+	std::shared_ptr<texture_object> tex;
+	std::vector<rect_s> rects;
+
+	void detect_main() override
+	{
+		if (!tex)
+			return;
+		rects.clear();
+		for (int i = 0; i < N_FACES; i++)
+			rects.push_back(face_rect(i, tex->tick));
+		tex.reset();
+	}
+
+public:
+	void set_texture(std::shared_ptr<texture_object> &t, int, int, int, int) override { tex = t; }
+	void get_faces(std::vector<rect_s> &r) override { r = rects; }
+};
+
+class stress_manager : public face_tracker_manager {
+	std::vector<uint8_t> img;
+	std::shared_ptr<texture_object> cvtex;
+
+public:
+	stress_manager() : img(WIDTH * HEIGHT) {}
+
+	// Renders the frame of the current tick, as the filter does at the beginning of its video callback.
+	void render()
+	{
+		const int tick = tick_cnt.load(std::memory_order_relaxed);
+		for (int y = 0; y < HEIGHT; y++) {
+			for (int x = 0; x < WIDTH; x++)
+				img[y * WIDTH + x] = (uint8_t)(110 + 40 * sinf(x * 0.05f) * cosf(y * 0.07f));
+		}
+		for (int i = 0; i < N_FACES; i++) {
+			const rect_s r = face_rect(i, tick);
+			for (int y = std::max(r.y0, 0); y < std::min(r.y1, HEIGHT); y++) {
+				for (int x = std::max(r.x0, 0); x < std::min(r.x1, WIDTH); x++) {
+					const int u = x - r.x0, v = y - r.y0;
+					img[y * WIDTH + x] = (uint8_t)((u / 8 + v / 8 + i) % 2 ? 220 : 30);
+				}
+			}
+		}
+
+		struct obs_source_frame frame = {};
+		frame.data[0] = img.data();
+		frame.linesize[0] = WIDTH;
+		frame.width = WIDTH;
+		frame.height = HEIGHT;
+		frame.format = VIDEO_FORMAT_Y800;
+		cvtex = std::make_shared<texture_object>();
+		cvtex->set_texture_obsframe(&frame, 1);
+		cvtex->tick = tick;
+		cvtex->scale = 1.0f;
+		cvtex->origin = pointf_s{0.0f, 0.0f};
+		cvtex->motion = pointf_s{0.0f, 0.0f};
+	}
+
+protected:
+	std::shared_ptr<texture_object> get_cvtex() override { return cvtex; }
+};
+
+static int run(bool crowd_mode)
+{
+	stress_manager ftm;
+	ftm.scale = 1.0f;
+	ftm.tracker_engine = face_tracker_manager::tracker_kcf_gray;
+	ftm.crowd_mode = crowd_mode;
+	ftm.crowd_max_updates = 4;
+	ftm.motion_prediction = true;
+	ftm.detect = new fake_detector();
+	ftm.detect->start();
+
+	std::atomic<bool> done(false);
+	int n_error = 0, n_available = 0, n_ticks = 0;
+
+	std::thread tick_thread([&]() {
+		while (!done.load(std::memory_order_acquire)) {
+			ftm.tick(0.1f);
+			n_ticks++;
+			for (const auto &t : ftm.tracker_rects) {
+				const rect_s &r = t.rect;
+				if (r.x1 < -WIDTH || r.x0 > WIDTH * 2 || r.y1 < -HEIGHT || r.y0 > HEIGHT * 2) {
+					if (n_error++ < 10)
+						fprintf(stderr, "Error: tracker out of the frame %d %d %d %d\n", r.x0, r.y0,
+							r.x1, r.y1);
+				}
+			}
+			if (!ftm.tracker_rects.empty())
+				n_available++;
+			if (n_ticks % 200 == 0)
+				ftm.reset_requested = true;
+			os_sleep_ms(2);
+		}
+	});
+
+	for (int i = 0; i < N_FRAMES; i++) {
+		ftm.render();
+		ftm.post_render();
+		os_sleep_ms(1);
+	}
+	done.store(true, std::memory_order_release);
+	tick_thread.join();
+
+	printf("crowd_mode=%d: %d ticks, trackers available in %d ticks, %d error(s)\n", crowd_mode, n_ticks,
+	       n_available, n_error);
+	if (n_available == 0) {
+		fprintf(stderr, "Error: no tracker became available\n");
+		n_error++;
+	}
+	return n_error;
+}
+
+int main()
+{
+	int n_error = run(false);
+	n_error += run(true);
+	return n_error ? 1 : 0;
+}
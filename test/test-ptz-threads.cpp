@@ -0,0 +1,144 @@
+/* Stress test of `Face Tracker PTZ` with the video thread, the graphics thread, and the analysis thread.
+ *
+ * The video thread calls `filter_video` with synthetic frames in BGRA, NV12, and I420 as an async source does, and
+ * the filter hands them off to its analysis thread. The graphics thread calls `video_tick` and, from time to time,
+ * `update` with the detector, the tracker, the scale, and the landmark detection changed, as OBS Studio applies the
+ * deferred update of a video source before its tick. The PTZ type is `dummy`.
+ *
+ * Build with `-fsanitize=thread` to check the data races between the threads. The test fails if no frame is
+ * analyzed or if the size of the analyzed frame is not given to the tick.
+ */
+
+#include "face-tracker-ptz.cpp"
+#include <atomic>
+#include <thread>
+
+OBS_DECLARE_MODULE()
+OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
+
+#define WIDTH 640
+#define HEIGHT 360
+#define N_FRAMES 600
+#define UPDATE_INTERVAL 20 // ticks between the updates
+
+static const char *parent_get_name(void *)
+{
+	return "test-ptz-threads parent";
+}
+
+static void *parent_create(obs_data_t *, obs_source_t *context)
+{
+	return context;
+}
+
+static void parent_destroy(void *) {}
+
+static void fill_frame(struct obs_source_frame *frame, int k)
+{
+	const int x0 = k * 3 % (WIDTH - 64), y0 = HEIGHT / 2 - 32;
+	for (uint32_t y = 0; y < HEIGHT; y++) {
+		for (uint32_t x = 0; x < WIDTH; x++) {
+			const bool face = (int)x >= x0 && (int)x < x0 + 64 && (int)y >= y0 && (int)y < y0 + 64;
+			const uint8_t v = face ? (uint8_t)((x / 8 + y / 8) % 2 ? 220 : 30) : (uint8_t)(x + y);
+			switch (frame->format) {
+			case VIDEO_FORMAT_BGRA:
+				memset(frame->data[0] + frame->linesize[0] * y + x * 4, v, 4);
+				break;
+			default:
+				frame->data[0][frame->linesize[0] * y + x] = v;
+			}
+		}
+	}
+	if (frame->format == VIDEO_FORMAT_NV12) {
+		for (uint32_t y = 0; y < HEIGHT / 2; y++)
+			memset(frame->data[1] + frame->linesize[1] * y, 128, WIDTH);
+	} else if (frame->format == VIDEO_FORMAT_I420) {
+		for (uint32_t y = 0; y < HEIGHT / 2; y++) {
+			memset(frame->data[1] + frame->linesize[1] * y, 128, WIDTH / 2);
+			memset(frame->data[2] + frame->linesize[2] * y, 128, WIDTH / 2);
+		}
+	}
+}
+
+int main()
+{
+	if (!obs_startup("en-US", NULL, NULL)) {
+		fprintf(stderr, "Error: obs_startup failed\n");
+		return 1;
+	}
+
+	struct obs_source_info parent_info = {};
+	parent_info.id = "test_ptz_threads_parent";
+	parent_info.type = OBS_SOURCE_TYPE_INPUT;
+	parent_info.output_flags = OBS_SOURCE_ASYNC_VIDEO;
+	parent_info.get_name = parent_get_name;
+	parent_info.create = parent_create;
+	parent_info.destroy = parent_destroy;
+	obs_register_source(&parent_info);
+	register_face_tracker_ptz(false);
+
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_string(settings, "ptz-type", "dummy");
+	obs_data_set_double(settings, "analysis_rate", 120.0);
+	obs_source_t *parent = obs_source_create_private("test_ptz_threads_parent", "parent", NULL);
+	obs_source_t *filter = obs_source_create_private("face_tracker_ptz", "ptz", settings);
+	obs_source_filter_add(parent, filter);
+	auto *s = (struct face_tracker_ptz *)obs_obj_get_data(filter);
+
+	// The update given at the creation is deferred to the first tick.
+	obs_data_t *filter_settings = obs_source_get_settings(filter);
+	ftptz_update(s, filter_settings);
+
+	std::atomic<bool> done(false);
+	std::thread video_thread([&]() {
+		static const enum video_format formats[] = {VIDEO_FORMAT_BGRA, VIDEO_FORMAT_NV12, VIDEO_FORMAT_I420};
+		for (int k = 0; k < N_FRAMES; k++) {
+			struct obs_source_frame *frame = obs_source_frame_create(formats[k / 50 % 3], WIDTH, HEIGHT);
+			fill_frame(frame, k);
+			frame->timestamp = os_gettime_ns();
+			ftptz_filter_video(s, frame);
+			obs_source_frame_destroy(frame);
+			os_sleep_ms(3);
+		}
+		done.store(true, std::memory_order_release);
+	});
+
+	int n_ticks = 0, n_analyzed = 0, n_error = 0;
+	while (!done.load(std::memory_order_acquire)) {
+		if (++n_ticks % UPDATE_INTERVAL == 0) {
+			const int k = n_ticks / UPDATE_INTERVAL;
+			obs_data_set_int(filter_settings, "detector_engine", k % 3);
+			obs_data_set_int(filter_settings, "tracker_engine", k / 3 % 3);
+			obs_data_set_double(filter_settings, "scale", 1 + k % 3);
+			obs_data_set_bool(filter_settings, "landmark_detection", k % 2);
+			ftptz_update(s, filter_settings);
+		}
+
+		const bool rendered = os_atomic_load_bool(&s->rendered);
+		ftptz_tick(s, 1.0f / 60.0f);
+		if (rendered) {
+			n_analyzed++;
+			if (s->known_width != WIDTH || s->known_height != HEIGHT) {
+				if (n_error++ < 10)
+					fprintf(stderr, "Error: the tick took the size %ux%u\n", s->known_width,
+						s->known_height);
+			}
+		}
+		os_sleep_ms(2);
+	}
+	video_thread.join();
+
+	printf("%d ticks, %d with analyzed frames, %d error(s)\n", n_ticks, n_analyzed, n_error);
+	if (n_analyzed == 0) {
+		fprintf(stderr, "Error: no frame was analyzed\n");
+		n_error++;
+	}
+
+	obs_data_release(filter_settings);
+	obs_data_release(settings);
+	obs_source_filter_remove(parent, filter);
+	obs_source_release(filter);
+	obs_source_release(parent);
+	obs_shutdown();
+	return n_error ? 1 : 0;
+}
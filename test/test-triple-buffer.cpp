@@ -0,0 +1,64 @@
+/* Stress test of `triple_buffer` with one producer and one consumer.
+ *
+ * The producer fills a vector with its sequence number and publishes it as `publish_snapshot` does.
+ * The consumer checks that each acquired buffer is complete and that the sequence numbers never go back.
+ * Build with `-fsanitize=thread` to check the data races.
+ */
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "triple-buffer.hpp"
+
+#define N_PUBLISH 200000
+
+struct data_s
+{
+	int seq = -1;
+	std::vector<int> v;
+};
+
+int main()
+{
+	triple_buffer<data_s> tb;
+	std::atomic<bool> done(false);
+	int n_error = 0, n_acquired = 0;
+
+	std::thread consumer([&]() {
+		int last = -1;
+		for (;;) {
+			// `done` is read before `acquire` so that the last data is always acquired.
+			const bool finished = done.load(std::memory_order_acquire);
+			if (tb.acquire()) {
+				const data_s &d = tb.front();
+				bool ok = d.seq > last && (int)d.v.size() == d.seq % 17 + 1;
+				for (int x : d.v)
+					ok = ok && x == d.seq;
+				if (!ok && n_error++ < 10)
+					fprintf(stderr, "Error: seq=%d last=%d size=%d\n", d.seq, last, (int)d.v.size());
+				last = d.seq;
+				n_acquired++;
+			} else if (finished) {
+				if (last != N_PUBLISH - 1) {
+					fprintf(stderr, "Error: the last data %d was not acquired\n", last);
+					n_error++;
+				}
+				break;
+			}
+		}
+	});
+
+	for (int seq = 0; seq < N_PUBLISH; seq++) {
+		data_s &d = tb.back();
+		d.seq = seq;
+		d.v.assign(seq % 17 + 1, seq);
+		tb.publish();
+		if (seq % 16 == 0)
+			std::this_thread::yield();
+	}
+	done.store(true, std::memory_order_release);
+	consumer.join();
+
+	printf("%d published, %d acquired, %d error(s)\n", N_PUBLISH, n_acquired, n_error);
+	return n_error ? 1 : 0;
+}